@@ -17,6 +17,14 @@
 #define MAX_REGEX_PATTERNS 8
 #define ERROR_BUFFER_SIZE 512
 
+// Prints each match reported by the library.
+static int
+print_match(const frec_match_t *pmatch, size_t nmatch, void *arg)
+{
+    printf("%ld (%ld %ld)\n", pmatch->pattern_id, pmatch->soffset, pmatch->eoffset);
+    return 0;
+}
+
 int
 main(int argc, char *argv[])
 {
@@ -88,34 +96,18 @@ main(int argc, char *argv[])
         errx(2, "Invalid file buffer from file: %s", *argv);
     }
 
-    // Execute regex matching.
-    ssize_t start = 0;
-    while (start < st.st_size) {
-        // Only match on the remaining part.
-        char *text_offset = &buffer[start];
-        ssize_t text_len = st.st_size - start;
-
-        frec_match_t pmatch;
-
-        ret = frec_mregnexec(&preg, text_offset, text_len, 1, &pmatch, eflags);
+    // Execute regex matching on the whole buffer at once.
+    frec_match_t pmatch;
+    ret = frec_mregnexec_all(&preg, buffer, st.st_size, 1, &pmatch, eflags,
+        print_match, NULL);
 
-        // If no more matches were found, break.
-        if (ret == REG_NOMATCH) {
-            break;
-        }
-
-        // On any other error, print the error then exit.
-        if (ret != 0) {
-            char buffer[ERROR_BUFFER_SIZE + 1];
-
-            frec_mregerror(ret, &preg, NULL, buffer, ERROR_BUFFER_SIZE);
-            errx(2, "%s", buffer);
-        }
+    // On any error other than no match, print the error then exit.
+    if (ret != 0 && ret != REG_NOMATCH) {
+        char buffer[ERROR_BUFFER_SIZE + 1];
 
-        // Otherwise we print the matches.
-        printf("%ld (%ld %ld)\n", pmatch.pattern_id, start + pmatch.soffset, start + pmatch.eoffset);
-        start += pmatch.eoffset;
+        frec_mregerror(ret, &preg, NULL, buffer, ERROR_BUFFER_SIZE);
+        errx(2, "%s", buffer);
     }
 
-    return !(ret > 0);
+    return (ret == 0) ? 0 : 1;
 }
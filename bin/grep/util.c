@@ -259,6 +259,42 @@ procfile(const char *fn)
 
 #define iswword(x)	(iswalnum((x)) || (x) == L'_')
 
+/* Matches of the line being processed by procline(). */
+struct linematches {
+	struct str	*l;
+	frec_match_t	 matches[MAX_LINE_MATCHES];
+	int		 m;
+};
+
+/*
+ * Called for each match found in a line.  Saves the match and returns
+ * non-zero when further matches are not needed.
+ */
+static int
+collectmatch(const frec_match_t *pmatch, size_t nmatch, void *arg)
+{
+	struct linematches *lm = arg;
+
+	(void)nmatch;
+
+	/*
+	 * Check for full match.  There is already a match so
+	 * if it fails it will not succeed later either.
+	 */
+	if (xflag)
+		if (pmatch->soffset != 0 ||
+		    (size_t)pmatch->eoffset != lm->l->len)
+			return (1);
+
+	if (lm->m < MAX_LINE_MATCHES)
+		lm->matches[lm->m++] = *pmatch;
+
+	/* matches - skip further patterns */
+	if ((color == NULL && !oflag) || qflag || lflag || vflag)
+		return (1);
+	return (0);
+}
+
 /*
  * Processes a line comparing it with the specified patterns.  Each pattern
  * is looped to be compared along with the full string, saving each and every
@@ -269,53 +305,27 @@ procfile(const char *fn)
 static int
 procline(struct str *l, int nottext)
 {
-	frec_match_t matches[MAX_LINE_MATCHES];
+	struct linematches lm;
 	frec_match_t pmatch;
-	size_t st = 0;
-	int c = 0, m = 0, r = 0;
-
-	/* Loop to process the whole line */
-	while (st < l->len) {
-		//pmatch.soffset = st;
-		//pmatch.eoffset = l->len;
-        pmatch.soffset = 0;
-        pmatch.eoffset = l->len - st;
-        r = frec_mregnexec(&preg, l->dat + st, l->len - st, 1, &pmatch, eflags);
-		//r = frec_mregexec(&preg, l->dat, 1, &pmatch, eflags);
-		st = (cflags & REG_NOSUB) ? (size_t)l->len :
-		    (size_t)pmatch.soffset;
-		if (r == REG_NOMATCH)
-			continue;
-		else if (r != REG_OK) {
-			frec_mregerror(r, &preg, NULL, re_error, RE_ERROR_BUF);
-			errx(2, "%s", re_error);
-		}
-
-		/*
-		 * Check for full match.  There is already a match so
-		 * if it fails it will not succeed later either.
-		 */
-		if (xflag)
-			if (pmatch.soffset != 0 ||
-			    (size_t)pmatch.eoffset != l->len)
-			   break;
-
-		/* If reached here, we have a match. */
-		if (m == 0)
-			c++;
-		if (m < MAX_LINE_MATCHES)
-			matches[m++] = pmatch;
-
-		/* matches - skip further patterns */
-		if ((color == NULL && !oflag) || qflag || lflag)
-			break;
-
-		if (vflag) {
-			c = !c;
-			break;
-		}
+	int c = 0, r = 0;
+
+	lm.l = l;
+	lm.m = 0;
+	pmatch.soffset = 0;
+	pmatch.eoffset = l->len;
+
+	/* Collect the matches of the whole line in one call */
+	r = frec_mregnexec_all(&preg, l->dat, l->len, 1, &pmatch, eflags,
+	    collectmatch, &lm);
+	if (r != REG_OK && r != REG_NOMATCH) {
+		frec_mregerror(r, &preg, NULL, re_error, RE_ERROR_BUF);
+		errx(2, "%s", re_error);
 	}
 
+	/* If reached here with a stored match, we have a match. */
+	if (lm.m > 0)
+		c = vflag ? 0 : 1;
+
 	/* Count the matches if we have a match limit */
 	if (mflag)
 		mcount -= c;
@@ -335,9 +345,9 @@ procline(struct str *l, int nottext)
 				printqueue();
 			}
 			linesqueued = 0;
-			printline(l, ':', matches, m);
+			printline(l, ':', lm.matches, lm.m);
 		} else {
-			printline(l, '-', matches, m);
+			printline(l, '-', lm.matches, lm.m);
 			tail--;
 		}
 	}
@@ -10,4 +10,9 @@ typedef struct frec_match_t {
 	size_t pattern_id; /* The index of the pattern that was matched. */
 } frec_match_t;
 
+/* Callback of the match iteration functions. Receives the nmatch submatches
+ * of the current match (at least one), and the arg pointer that was given to
+ * the iteration function. A non-zero return value stops the iteration. */
+typedef int (*frec_match_cb)(const frec_match_t *pmatch, size_t nmatch, void *arg);
+
 #endif
@@ -2,25 +2,50 @@
 #define LIBFREC_TYPES_H 1
 
 #include <tre/regex.h>
+#include <pthread.h>
 #include <stdbool.h>
+#include <stdint.h>
+
+#include "frec-match.h"
 
 typedef struct bm_comp bm_comp;
 typedef struct heur heur;
 typedef struct wm_comp wm_comp;
+typedef struct ac_comp ac_comp;
+typedef struct teddy_comp teddy_comp;
+typedef struct dfa_comp dfa_comp;
+typedef struct dfa_context dfa_context;
+typedef struct frec_version frec_version;
 
 typedef struct frec_t {
-    regex_t original;           /* Compiled automaton data used by TRE. */
+    regex_t original;           /* Compiled automaton data used by TRE. For
+                                 * literal patterns, it is only compiled when
+                                 * first needed. */
     bm_comp *boyer_moore;       /* Compiled Boyer-Moore search data. */
     heur *heuristic;            /* Compiled FREC heuristic data. */
+    dfa_comp *dfa;              /* Lazy DFA used instead of TRE, or NULL. */
     int cflags;                 /* Input compilation flags. */
     bool is_literal;            /* Whether or not the pattern is literal. */
 
+    void *source;               /* XXX (private) Copy of the pattern. */
+    size_t source_len;          /* XXX (private) Length of the pattern. */
+    bool source_wide;           /* XXX (private) Whether it is wide. */
+    int source_cflags;          /* XXX (private) The flags it was given. */
+    bool is_borrowed;           /* XXX (private) Whether the source points
+                                 * into a serialized blob. */
+    bool has_original;          /* XXX (private) Whether original is
+                                 * compiled yet. */
+    bool is_removed;            /* XXX (private) Whether the pattern was
+                                 * removed from its set. */
+
     const char *re_endp;        /* Optionally marks the end of the pattern. */
 	const wchar_t *re_wendp;    /* Optionally marks the end of the pattern. */
 } frec_t;
 
 typedef struct mfrec_t {
     wm_comp *wu_manber;	/* Wu-Manber common compiled structure. */
+    ac_comp *aho_corasick;	/* Aho-Corasick common compiled structure. */
+    teddy_comp *teddy;	/* Teddy common compiled structure. */
 	frec_t *patterns;	/* Separate compiled structure for each pattern. */
 	ssize_t count;	    /* Number of patterns. */
     int cflags;		    /* Input compilation flags. */
@@ -28,6 +53,67 @@ typedef struct mfrec_t {
 
 	int type;		    /* XXX (private) Matching type */
 	ssize_t err;		/* XXX (private) Which pattern failed */
+	uint32_t *ids;		/* XXX (private) Pattern of each literal of the
+				 * engine, or NULL if they are the same. */
+	ssize_t removed;	/* XXX (private) Number of removed patterns. */
+	ssize_t capacity;	/* XXX (private) Room for patterns. */
+	ssize_t reach;		/* XXX (private) How far a match may start
+				 * before the literal found in it. */
+	bool reach_lines;	/* XXX (private) Whether some matches are only
+				 * bounded by their line instead. */
+	uint32_t *by_literal;	/* XXX (private) Patterns of the engine,
+				 * ordered by their literal. */
+	bool literal_ties;	/* XXX (private) Whether a literal is the
+				 * prefix of another one. */
 } mfrec_t;
 
+typedef struct frec_scratch_t {
+    regmatch_t *pmatch;	    /* XXX (private) Submatches of the original matcher. */
+    size_t pmatch_len;	    /* XXX (private) Capacity of pmatch. */
+    frec_match_t *matches;	/* XXX (private) A match for each pattern. */
+    size_t matches_len;	    /* XXX (private) Capacity of matches. */
+    frec_match_t *next;	    /* XXX (private) Next match of each pattern. */
+    size_t next_len;	    /* XXX (private) Capacity of next. */
+    dfa_context **dfa;	    /* XXX (private) Hash table of the lazy DFAs. */
+    size_t dfa_len;	        /* XXX (private) Capacity of dfa. */
+    size_t dfa_count;	    /* XXX (private) Number of lazy DFAs. */
+} frec_scratch_t;
+
+typedef struct frec_stream_t {
+    const frec_t *single;	/* The pattern matched in the stream, or NULL. */
+    const mfrec_t *multi;	/* The patterns matched in the stream, or NULL. */
+    frec_match_cb cb;	/* Called with each match. */
+    void *arg;		    /* Passed to cb. */
+    int eflags;		    /* Execution flags. */
+
+    int mode;		    /* XXX (private) How much text is kept. */
+    ssize_t max_length;	/* XXX (private) Longest possible match. */
+    char *carry;	    /* XXX (private) Text kept from previous chunks. */
+    ssize_t carry_len;	/* XXX (private) Length of the kept text. */
+    ssize_t carry_cap;	/* XXX (private) Capacity of the carry buffer. */
+    ssize_t carry_base;	/* XXX (private) Stream offset of the kept text. */
+    bool carry_bol;	    /* XXX (private) Whether the kept text starts a line. */
+    ssize_t length;	    /* XXX (private) Length of the stream so far. */
+    bool ends_lf;	    /* XXX (private) Whether the last byte was a line feed. */
+    ssize_t resume;	    /* XXX (private) Where the next search starts. */
+    bool found;		    /* XXX (private) Whether any match was reported. */
+    bool stopped;	    /* XXX (private) Whether the callback stopped us. */
+} frec_stream_t;
+
+typedef struct frec_handle_t {
+    frec_version *current;	/* XXX (private) The published version. */
+    frec_version *retired;	/* XXX (private) Replaced versions that may
+				 * still be in use. */
+    uint64_t epoch;	    /* XXX (private) Number of versions published. */
+    struct frec_reader_t *readers;	/* XXX (private) Registered readers. */
+    pthread_mutex_t lock;	/* XXX (private) Held by writers. */
+} frec_handle_t;
+
+typedef struct frec_reader_t {
+    frec_handle_t *handle;	/* The handle the reader is registered with. */
+
+    uint64_t epoch;	    /* XXX (private) The epoch it pinned, or 0. */
+    struct frec_reader_t *next;	/* XXX (private) Next registered reader. */
+} frec_reader_t;
+
 #endif
@@ -7,6 +7,21 @@
 #include "frec-match.h"
 #include "frec-types.h"
 
+/* Thread safety. The execution functions (matching, iteration, counting and
+ * streaming) never modify a compiled frec_t or mfrec_t, so one compiled
+ * pattern or pattern set can be shared by any number of threads at the same
+ * time. The mutable state of matching is kept in a frec_scratch_t instead,
+ * see below. (The automaton of the original matcher, which literal patterns
+ * rarely need, is compiled on first use, but only by one of the threads.)
+ * The following must not happen concurrently:
+ *  - compiling, editing or freeing a struct, and any other use of the same
+ *    struct,
+ *  - two calls that use the same frec_scratch_t or frec_stream_t.
+ * frec_train_byte_freq doesn't wait for the compilations that are running,
+ * each of them keeps using the frequency model it started with.
+ * To replace a pattern set while other threads are matching with it, use a
+ * frec_handle_t, see below. */
+
 /* Early declaration of the structs used internally for state management. */
 struct frec_t;
 struct mfrec_t;
@@ -29,16 +44,160 @@ int frec_mregncomp(struct mfrec_t *preg, size_t k, const char **patterns, size_t
 int frec_mregwcomp(struct mfrec_t *preg, size_t k, const wchar_t **patterns, int cflags);
 int frec_mregwncomp(struct mfrec_t *preg, size_t k, const wchar_t **patterns, size_t *lens, int cflags);
 
+/* Multi-pattern editing functions. A pattern is compiled with the flags of
+ * the set and added with the next id, which is stored in id. Removing a
+ * pattern keeps the ids of the others, and its id is never reused. Edits of
+ * literal sets only update the tables they affect, unless they change the
+ * strategy of the set (like adding a literal shorter than the others to a
+ * Wu-Manber set, or a pattern without a literal); these compile the
+ * multi-pattern tables of the set again. Every few edits the tables are
+ * rebuilt to stay efficient. On failure the set is left as it was. */
+int frec_madd(struct mfrec_t *preg, const char *pattern, size_t *id);
+int frec_mnadd(struct mfrec_t *preg, const char *pattern, size_t len, size_t *id);
+int frec_mwadd(struct mfrec_t *preg, const wchar_t *pattern, size_t *id);
+int frec_mwnadd(struct mfrec_t *preg, const wchar_t *pattern, size_t len, size_t *id);
+int frec_mremove(struct mfrec_t *preg, size_t id);
+
 /* Multi-pattern execution functions. */
 int frec_mregexec(const struct mfrec_t *preg, const char *text, size_t nmatch, struct frec_match_t *pmatch, int eflags);
 int frec_mregnexec(const struct mfrec_t *preg, const char *text, size_t len, size_t nmatch, struct frec_match_t *pmatch, int eflags);
 int frec_mregwexec(const struct mfrec_t *preg, const wchar_t *text, size_t nmatch, struct frec_match_t *pmatch, int eflags);
 int frec_mregwnexec(const struct mfrec_t *preg, const wchar_t *text, size_t len, size_t nmatch, struct frec_match_t *pmatch, int eflags);
 
+/* Scratch space functions. The execution functions need temporary storage
+ * when the original matcher is used, or when several non-literal patterns
+ * are matched, and the scratch space also holds the DFAs that are built
+ * lazily for non-literal patterns. The functions below without the _r suffix
+ * use a default scratch space of the calling thread, which is freed when the
+ * thread exits. The _r variants use the given scratch space instead, which
+ * must not be used by multiple calls at the same time. It grows to fit the
+ * largest nmatch and pattern set it was used with, and is reused afterwards,
+ * so that matching doesn't allocate memory in the long run. */
+int frec_scratch_init(struct frec_scratch_t *scratch);
+void frec_scratch_free(struct frec_scratch_t *scratch);
+
+int frec_regexec_r(const struct frec_t *preg, const char *text, size_t nmatch, struct frec_match_t *pmatch, int eflags, struct frec_scratch_t *scratch);
+int frec_regnexec_r(const struct frec_t *preg, const char *text, size_t len, size_t nmatch, struct frec_match_t *pmatch, int eflags, struct frec_scratch_t *scratch);
+int frec_regwexec_r(const struct frec_t *preg, const wchar_t *text, size_t nmatch, struct frec_match_t *pmatch, int eflags, struct frec_scratch_t *scratch);
+int frec_regwnexec_r(const struct frec_t *preg, const wchar_t *text, size_t len, size_t nmatch, struct frec_match_t *pmatch, int eflags, struct frec_scratch_t *scratch);
+int frec_mregexec_r(const struct mfrec_t *preg, const char *text, size_t nmatch, struct frec_match_t *pmatch, int eflags, struct frec_scratch_t *scratch);
+int frec_mregnexec_r(const struct mfrec_t *preg, const char *text, size_t len, size_t nmatch, struct frec_match_t *pmatch, int eflags, struct frec_scratch_t *scratch);
+int frec_mregwexec_r(const struct mfrec_t *preg, const wchar_t *text, size_t nmatch, struct frec_match_t *pmatch, int eflags, struct frec_scratch_t *scratch);
+int frec_mregwnexec_r(const struct mfrec_t *preg, const wchar_t *text, size_t len, size_t nmatch, struct frec_match_t *pmatch, int eflags, struct frec_scratch_t *scratch);
+
+/* Match iteration functions. Call cb for every successive, non-overlapping
+ * match in the text, until the end of the text or until cb returns non-zero.
+ * The pmatch array of nmatch elements is used to store the submatches of the
+ * current match. Returns REG_OK if any match was found, REG_NOMATCH if none
+ * were found. With REG_NOSUB, only the first match is reported. */
+int frec_regexec_all(const struct frec_t *preg, const char *text, size_t nmatch, struct frec_match_t *pmatch, int eflags, frec_match_cb cb, void *arg);
+int frec_regnexec_all(const struct frec_t *preg, const char *text, size_t len, size_t nmatch, struct frec_match_t *pmatch, int eflags, frec_match_cb cb, void *arg);
+int frec_regwexec_all(const struct frec_t *preg, const wchar_t *text, size_t nmatch, struct frec_match_t *pmatch, int eflags, frec_match_cb cb, void *arg);
+int frec_regwnexec_all(const struct frec_t *preg, const wchar_t *text, size_t len, size_t nmatch, struct frec_match_t *pmatch, int eflags, frec_match_cb cb, void *arg);
+int frec_mregexec_all(const struct mfrec_t *preg, const char *text, size_t nmatch, struct frec_match_t *pmatch, int eflags, frec_match_cb cb, void *arg);
+int frec_mregnexec_all(const struct mfrec_t *preg, const char *text, size_t len, size_t nmatch, struct frec_match_t *pmatch, int eflags, frec_match_cb cb, void *arg);
+int frec_mregwexec_all(const struct mfrec_t *preg, const wchar_t *text, size_t nmatch, struct frec_match_t *pmatch, int eflags, frec_match_cb cb, void *arg);
+int frec_mregwnexec_all(const struct mfrec_t *preg, const wchar_t *text, size_t len, size_t nmatch, struct frec_match_t *pmatch, int eflags, frec_match_cb cb, void *arg);
+
+/* Counting functions. Store the number of non-overlapping matches in the text
+ * in count with FREC_COUNT_MATCHES, or the number of lines that contain a
+ * match with FREC_COUNT_LINES. Lines are matched on their own, like in grep.
+ * Returns REG_OK, or an error code. REG_STARTEND is ignored, and with
+ * REG_NOSUB, at most one match of a non-literal pattern is counted. */
+#define FREC_COUNT_MATCHES 0
+#define FREC_COUNT_LINES 1
+
+int frec_regcount(const struct frec_t *preg, const char *text, int eflags, int mode, size_t *count);
+int frec_regncount(const struct frec_t *preg, const char *text, size_t len, int eflags, int mode, size_t *count);
+int frec_regwcount(const struct frec_t *preg, const wchar_t *text, int eflags, int mode, size_t *count);
+int frec_regwncount(const struct frec_t *preg, const wchar_t *text, size_t len, int eflags, int mode, size_t *count);
+int frec_mregcount(const struct mfrec_t *preg, const char *text, int eflags, int mode, size_t *count);
+int frec_mregncount(const struct mfrec_t *preg, const char *text, size_t len, int eflags, int mode, size_t *count);
+int frec_mregwcount(const struct mfrec_t *preg, const wchar_t *text, int eflags, int mode, size_t *count);
+int frec_mregwncount(const struct mfrec_t *preg, const wchar_t *text, size_t len, int eflags, int mode, size_t *count);
+
+/* Streaming functions. Find the matches of a pattern in a stream of narrow
+ * text that is given in chunks of any size. cb is called for each successive,
+ * non-overlapping match with offsets counted from the start of the stream.
+ * Only as much text is kept between the chunks as a match could still need:
+ * the length of the longest possible match, the current line, or (if neither
+ * is known) the whole stream. Feeding returns REG_OK or an error code. Closing
+ * reports the matches at the end of the stream and frees the kept text, then
+ * returns REG_OK if any match was found, REG_NOMATCH if none were found. */
+int frec_stream_open(struct frec_stream_t *stream, const struct frec_t *preg, int eflags, frec_match_cb cb, void *arg);
+int frec_mstream_open(struct frec_stream_t *stream, const struct mfrec_t *preg, int eflags, frec_match_cb cb, void *arg);
+int frec_stream_feed(struct frec_stream_t *stream, const char *chunk, size_t len);
+int frec_stream_close(struct frec_stream_t *stream);
+
+/* Serialization functions. Store a compiled pattern or pattern set in a
+ * single blob, allocated with malloc, that the caller frees. The blob holds no
+ * addresses, so it can be written to a file and mapped into memory later, even
+ * read-only. It can only be loaded by the same library version on a platform
+ * with the same byte order and type sizes, otherwise loading fails with
+ * REG_BADPAT, like it does for damaged blobs. Loading references the tables in
+ * the blob instead of copying them, so the blob must be aligned to 8 bytes and
+ * must outlive the loaded struct, which is freed with frec_regfree or
+ * frec_mregfree as usual. The automata of the original matcher are compiled
+ * again when loading (or when first needed, for literal patterns). Wide
+ * patterns, and the multi-pattern tables of edited sets, are compiled again
+ * as a whole. */
+int frec_serialize(const struct frec_t *preg, void **blob, size_t *len);
+int frec_mserialize(const struct mfrec_t *preg, void **blob, size_t *len);
+int frec_deserialize(struct frec_t *preg, const void *blob, size_t len);
+int frec_mdeserialize(struct mfrec_t *preg, const void *blob, size_t len);
+
 /* Multi-pattern error reporting function. */
 size_t frec_regerror(int errcode, const struct frec_t *preg, char *errbuf, size_t errbuf_size);
 size_t frec_mregerror(int errcode, const struct mfrec_t *preg, int *errpatn, char *errbuf, size_t errbuf_size);
 
+/* Hot swap functions. A handle holds the current version of a pattern set,
+ * which writers can replace at any time without stopping the threads that
+ * match with it. Init and publish take over the given compiled set: it must
+ * not be used or freed by the caller afterwards. Each reading thread
+ * registers its own reader, then pins the current version for each batch of
+ * matching and unpins it afterwards. Pinning and unpinning never block, and a
+ * pinned version stays valid until it is unpinned, even if a newer one was
+ * published meanwhile. The replaced versions are freed once no reader has
+ * them pinned: whenever a version is published, or when reclaim is called,
+ * which returns how many replaced versions are still in use. A reader must
+ * not pin twice without unpinning first, and must be unpinned before it is
+ * freed. The handle is freed after all of its readers. Publishing and
+ * registering readers are serialized by a lock, only the readers are
+ * lock-free. */
+int frec_handle_init(struct frec_handle_t *handle, struct mfrec_t *preg);
+int frec_handle_publish(struct frec_handle_t *handle, struct mfrec_t *preg);
+size_t frec_handle_reclaim(struct frec_handle_t *handle);
+void frec_handle_free(struct frec_handle_t *handle);
+
+int frec_reader_init(struct frec_reader_t *reader, struct frec_handle_t *handle);
+const struct mfrec_t *frec_reader_pin(struct frec_reader_t *reader);
+void frec_reader_unpin(struct frec_reader_t *reader);
+void frec_reader_free(struct frec_reader_t *reader);
+
+/* Frequency model training function. Replaces the built-in byte frequency
+ * table that is used to pick the rarest bytes of literal patterns with one
+ * computed from the given sample, along with a table of byte pairs. Only
+ * affects patterns compiled afterwards. An empty sample restores the
+ * built-in table. */
+void frec_train_byte_freq(const char *sample, size_t len);
+
+/* Literal score function, for diagnostics. Patterns are searched for by one
+ * of their literal fragments (or by one in each of their alternatives),
+ * chosen by how rarely it is expected to occur according to the frequency
+ * model above, also using byte pair frequencies if the model was trained.
+ * Stores this rarity in score: each 12 more means half as many candidates
+ * in typical texts. Returns REG_NOMATCH if the pattern isn't searched for by
+ * a literal. */
+int frec_literal_score(const struct frec_t *preg, unsigned int *score);
+
+/* Compilation thread count function. Pattern sets are compiled by this many
+ * threads: the patterns themselves, and the tables of large Wu-Manber sets.
+ * The default of 1 compiles on the calling thread only, and zero or less
+ * selects one thread for each processor. The results don't depend on it: on
+ * failure, frec_mregerror always reports the first invalid pattern. Only
+ * affects compilations started afterwards. */
+void frec_set_compile_threads(int count);
+
 /* Memory deallocation functions. */
 void frec_regfree(struct frec_t *preg);
 void frec_mregfree(struct mfrec_t *preg);
@@ -0,0 +1,525 @@
+#include <frec-config.h>
+#include <stdlib.h>
+#include <string.h>
+#include "ac-comp.h"
+#include "ac-type.h"
+
+// The states of depth one always have full transition tables. The next
+// levels get them too, as long as the number of these states is at most
+// this much (with a table of 1 KB each).
+#define AC_DENSE_STATES 4096
+
+// The patterns added after the compilation are matched by a second
+// automaton, which is compiled again with each one of them. Once there are
+// more of them than this, and more than the square root of the set, the set
+// is compiled again: this balances the two compilations. The same goes for
+// removed patterns, once there are more than half of the set plus this.
+#define AC_EDIT_SLACK 64
+
+// States with at most this many edges are searched linearly for a
+// transition, the ones with more edges with a binary search.
+#define AC_LINEAR_EDGES 8
+
+// A node of the temporary trie the automaton is built from. The children
+// of a node are stored as a linked list, except for the root, which has
+// a separate table for them.
+typedef struct ac_node {
+    uint32_t child;          // The first child of the node, or AC_NONE.
+    uint32_t sibling;        // The next child of the parent, or AC_NONE.
+    uint32_t output;         // Lowest id of the pattern ending here.
+    unsigned char c;         // The character leading to this node.
+} ac_node;
+
+typedef struct ac_trie {
+    ac_node *nodes;          // Nodes of the trie, the root is node 0.
+    uint32_t count;          // Number of nodes.
+    uint32_t root[256];      // Children of the root, or AC_NONE.
+} ac_trie;
+
+// Returns the child of the given node in the trie for character c,
+// creating it if it doesn't exist yet.
+static uint32_t
+trie_child(ac_trie *trie, uint32_t node, unsigned char c)
+{
+    uint32_t *link = (node == 0) ? &trie->root[c] : &trie->nodes[node].child;
+
+    if (node == 0) {
+        if (*link != AC_NONE) {
+            return *link;
+        }
+    } else {
+        for (uint32_t i = *link; i != AC_NONE; i = trie->nodes[i].sibling) {
+            if (trie->nodes[i].c == c) {
+                return i;
+            }
+        }
+    }
+
+    uint32_t child = trie->count++;
+    trie->nodes[child].child = AC_NONE;
+    trie->nodes[child].sibling = (node == 0) ? AC_NONE : *link;
+    trie->nodes[child].output = AC_NONE;
+    trie->nodes[child].c = c;
+
+    *link = child;
+    return child;
+}
+
+// Inserts every pattern into a new trie. The trie has room for the total
+// length of the patterns plus the root, which is always enough.
+static bool
+build_trie(ac_trie *trie, const ac_comp *comp,
+    const string *patterns, ssize_t count, size_t total)
+{
+    trie->nodes = malloc(sizeof(ac_node) * (total + 1));
+    if (trie->nodes == NULL) {
+        return false;
+    }
+
+    trie->count = 1;
+    trie->nodes[0].child = AC_NONE;
+    trie->nodes[0].sibling = AC_NONE;
+    trie->nodes[0].output = AC_NONE;
+    for (int c = 0; c < 256; c++) {
+        trie->root[c] = AC_NONE;
+    }
+
+    for (ssize_t i = 0; i < count; i++) {
+        uint32_t node = 0;
+        for (ssize_t j = 0; j < patterns[i].len; j++) {
+            unsigned char c = comp->fold[(unsigned char) patterns[i].stnd[j]];
+            node = trie_child(trie, node, c);
+        }
+
+        // Ids are increasing, so only the first one is kept.
+        if (trie->nodes[node].output == AC_NONE) {
+            trie->nodes[node].output = (uint32_t) i;
+        }
+    }
+
+    return true;
+}
+
+// Returns the target of the edge of state s for character c, or AC_NONE.
+static inline uint32_t
+find_edge(const ac_comp *comp, uint32_t s, unsigned char c)
+{
+    uint32_t start = comp->edge_start[s];
+    uint32_t end = comp->edge_start[s + 1];
+    const ac_edge *edges = comp->edges;
+
+    if (end - start <= AC_LINEAR_EDGES) {
+        for (; start < end; start++) {
+            if (edges[start].c == c) {
+                return edges[start].target;
+            }
+        }
+        return AC_NONE;
+    }
+
+    while (start < end) {
+        uint32_t mid = start + (end - start) / 2;
+        if (edges[mid].c < c) {
+            start = mid + 1;
+        } else {
+            end = mid;
+        }
+    }
+
+    if (start < comp->edge_start[s + 1] && edges[start].c == c) {
+        return edges[start].target;
+    }
+    return AC_NONE;
+}
+
+// Renumbers the states of the trie in breadth-first order, and fills the
+// edge array. The edges of each state are sorted by their character.
+static bool
+build_edges(ac_comp *comp, const ac_trie *trie)
+{
+    uint32_t n = trie->count;
+    comp->state_count = n;
+
+    comp->edge_start = malloc(sizeof(uint32_t) * (n + 1));
+    comp->edges = malloc(sizeof(ac_edge) * n);
+    comp->output = malloc(sizeof(uint32_t) * n);
+    comp->depth = malloc(sizeof(uint32_t) * n);
+    uint32_t *queue = malloc(sizeof(uint32_t) * n);
+    if (comp->edge_start == NULL || comp->edges == NULL
+        || comp->output == NULL
+        || comp->depth == NULL || queue == NULL) {
+        free(queue);
+        return false;
+    }
+
+    // The position of a node in the queue is its new state number.
+    queue[0] = 0;
+    comp->depth[0] = 0;
+    uint32_t tail = 1;
+    uint32_t edges = 0;
+
+    for (uint32_t s = 0; s < n; s++) {
+        const ac_node *node = &trie->nodes[queue[s]];
+        comp->edge_start[s] = edges;
+        comp->output[s] = node->output;
+
+        if (s == 0) {
+            for (int c = 0; c < 256; c++) {
+                if (trie->root[c] != AC_NONE) {
+                    comp->edges[edges].c = (unsigned char) c;
+                    comp->edges[edges++].target = tail;
+                    comp->depth[tail] = 1;
+                    queue[tail++] = trie->root[c];
+                }
+            }
+            continue;
+        }
+
+        // Insert the children in sorted order. Most states have only a
+        // few children, so insertion sort is fine here.
+        uint32_t first = edges;
+        for (uint32_t i = node->child; i != AC_NONE;
+             i = trie->nodes[i].sibling) {
+            unsigned char c = trie->nodes[i].c;
+            uint32_t at = edges++;
+            while (at > first && comp->edges[at - 1].c > c) {
+                comp->edges[at] = comp->edges[at - 1];
+                at--;
+            }
+            comp->edges[at].c = c;
+            comp->edges[at].target = i;
+        }
+
+        // Then assign the state numbers in this order.
+        for (uint32_t e = first; e < edges; e++) {
+            uint32_t child = comp->edges[e].target;
+            comp->edges[e].target = tail;
+            comp->depth[tail] = comp->depth[s] + 1;
+            queue[tail++] = child;
+        }
+    }
+    comp->edge_start[n] = edges;
+
+    free(queue);
+    return true;
+}
+
+// Computes the failure and dictionary links of every state, and the full
+// transition tables of the dense states.
+static bool
+build_links(ac_comp *comp)
+{
+    uint32_t n = comp->state_count;
+
+    comp->fail = malloc(sizeof(uint32_t) * n);
+    comp->dict = malloc(sizeof(uint32_t) * n);
+    if (comp->fail == NULL || comp->dict == NULL) {
+        return false;
+    }
+
+    comp->fail[0] = 0;
+    comp->dict[0] = AC_NONE;
+
+    // States are in breadth-first order, so the failure link of a state
+    // is always computed before the state itself is processed.
+    for (uint32_t s = 0; s < n; s++) {
+        for (uint32_t e = comp->edge_start[s]; e < comp->edge_start[s + 1]; e++) {
+            unsigned char c = comp->edges[e].c;
+            uint32_t t = comp->edges[e].target;
+
+            uint32_t fail = 0;
+            if (s != 0) {
+                uint32_t f = comp->fail[s];
+                uint32_t g = find_edge(comp, f, c);
+                while (g == AC_NONE && f != 0) {
+                    f = comp->fail[f];
+                    g = find_edge(comp, f, c);
+                }
+                fail = (g == AC_NONE) ? 0 : g;
+            }
+
+            comp->fail[t] = fail;
+            comp->dict[t] = (comp->output[fail] != AC_NONE)
+                ? fail : comp->dict[fail];
+        }
+    }
+
+    // Now that every link is known, mark the edges leading to outputs.
+    for (uint32_t e = 0; e < comp->edge_start[n]; e++) {
+        uint32_t t = comp->edges[e].target;
+        if (comp->output[t] != AC_NONE || comp->dict[t] != AC_NONE) {
+            comp->edges[e].target = t | AC_OUTPUT_FLAG;
+        }
+    }
+
+    // Select the dense states: whole levels of the breadth-first order.
+    uint32_t dense = 1;
+    for (uint32_t level = 1; ; level++) {
+        uint32_t end = dense;
+        while (end < n && comp->depth[end] == level) {
+            end++;
+        }
+        if (end == dense || (level > 1 && end > AC_DENSE_STATES)) {
+            break;
+        }
+        dense = end;
+    }
+
+    comp->dense_count = dense;
+    comp->dense = malloc(sizeof(uint32_t) * 256 * dense);
+    if (comp->dense == NULL) {
+        return false;
+    }
+
+    // The root stays in itself on a missing edge, the other states take
+    // the transition of their failure link instead. This is always a
+    // shallower state, so its table is already filled.
+    for (uint32_t s = 0; s < dense; s++) {
+        uint32_t *table = &comp->dense[(size_t) s * 256];
+        const uint32_t *fail = &comp->dense[(size_t) comp->fail[s] * 256];
+
+        for (int c = 0; c < 256; c++) {
+            uint32_t t = find_edge(comp, s, (unsigned char) c);
+            if (t != AC_NONE) {
+                table[c] = t;
+            } else {
+                table[c] = (s == 0) ? 0 : fail[c];
+            }
+        }
+    }
+
+    return true;
+}
+
+int
+ac_compile(ac_comp *comp, const string *patterns, ssize_t count, int cflags)
+{
+    ac_comp_init(comp, cflags);
+
+    if (count <= 0 || (uint64_t) count >= AC_NONE) {
+        return (REG_BADPAT);
+    }
+    comp->count = count;
+    comp->base_count = count;
+
+    size_t total = 0;
+    for (ssize_t i = 0; i < count; i++) {
+        // Wide patterns are not supported, and empty patterns are
+        // rejected, the same way as by Wu-Manber.
+        if (patterns[i].is_wide || patterns[i].len == 0) {
+            return (REG_BADPAT);
+        }
+
+        total += patterns[i].len;
+        if (patterns[i].len > comp->len_longest) {
+            comp->len_longest = patterns[i].len;
+        }
+    }
+
+    // State numbers are stored on 31 bits, next to the output flag.
+    if (total >= AC_STATE_MASK) {
+        return (REG_ESPACE);
+    }
+
+    ac_trie trie;
+    bool success = build_trie(&trie, comp, patterns, count, total);
+    if (!success) {
+        return (REG_ESPACE);
+    }
+
+    success = build_edges(comp, &trie);
+    free(trie.nodes);
+    if (!success || !build_links(comp)) {
+        return (REG_ESPACE);
+    }
+
+    return (REG_OK);
+}
+
+// Returns the next state from state s on character c, with the
+// output flag set if the state has an output.
+static inline uint32_t
+step(const ac_comp *comp, uint32_t s, unsigned char c)
+{
+    while (s >= comp->dense_count) {
+        uint32_t t = find_edge(comp, s, c);
+        if (t != AC_NONE) {
+            return t;
+        }
+        s = comp->fail[s];
+    }
+
+    return comp->dense[(size_t) s * 256 + c];
+}
+
+// Makes room for one more added pattern.
+static bool
+grow_added(ac_comp *comp)
+{
+    if (comp->added_count < comp->added_cap) {
+        return true;
+    }
+    ssize_t cap = (comp->added_cap == 0) ? 16 : comp->added_cap * 2;
+
+    string *added = realloc(comp->added, sizeof(string) * cap);
+    if (added == NULL) {
+        return false;
+    }
+    comp->added = added;
+
+    if (comp->removed != NULL) {
+        uint8_t *removed = realloc(comp->removed, comp->base_count + cap);
+        if (removed == NULL) {
+            return false;
+        }
+        memset(&removed[comp->base_count + comp->added_cap], 0,
+            cap - comp->added_cap);
+        comp->removed = removed;
+    }
+
+    comp->added_cap = cap;
+    return true;
+}
+
+int
+ac_add(ac_comp *comp, string pattern)
+{
+    if (pattern.is_wide || pattern.len == 0
+        || (uint64_t) comp->count >= AC_NONE - 1) {
+        return (REG_BADPAT);
+    }
+    if (!grow_added(comp)
+        || !string_duplicate(&comp->added[comp->added_count], pattern)) {
+        return (REG_ESPACE);
+    }
+
+    // The automaton of the added patterns is replaced only once the new
+    // one is compiled, so a failure leaves the set as it was.
+    ac_comp *extra = malloc(sizeof(ac_comp));
+    int ret = (extra == NULL) ? REG_ESPACE
+        : ac_compile(extra, comp->added, comp->added_count + 1, comp->cflags);
+    if (ret != REG_OK) {
+        ac_comp_free(extra);
+        free(extra);
+        string_free(&comp->added[comp->added_count]);
+        return ret;
+    }
+
+    ac_comp_free(comp->extra);
+    free(comp->extra);
+    comp->extra = extra;
+
+    comp->added_count++;
+    comp->count++;
+    comp->edits++;
+    return (REG_OK);
+}
+
+int
+ac_remove(ac_comp *comp, ssize_t id)
+{
+    if (id < 0 || id >= comp->count) {
+        return (REG_BADPAT);
+    }
+
+    if (comp->removed == NULL) {
+        comp->removed = calloc(comp->base_count + comp->added_cap, 1);
+        if (comp->removed == NULL) {
+            return (REG_ESPACE);
+        }
+    }
+
+    comp->removed[id] = 1;
+    comp->edits++;
+    return (REG_OK);
+}
+
+bool
+ac_needs_rebuild(const ac_comp *comp)
+{
+    ssize_t added = comp->added_count;
+    ssize_t removed = comp->edits - added;
+    return removed > comp->base_count / 2 + AC_EDIT_SLACK
+        || (added > AC_EDIT_SLACK && added * added > comp->base_count);
+}
+
+// The leftmost match found so far, with the lowest id at that position.
+typedef struct ac_best {
+    ssize_t start;
+    uint32_t id;
+    uint32_t len;
+} ac_best;
+
+// Scans the text with the automaton, and updates the best match with the
+// ones found. The ids of the automaton start at base, and the patterns
+// marked in removed are skipped.
+static void
+scan(ac_best *best, const ac_comp *comp, string text,
+    const uint8_t *removed, uint32_t base)
+{
+    const unsigned char *chars = (const unsigned char *) text.stnd;
+    uint32_t s = 0;
+
+    // Once a match was found, we only need to continue while a pattern
+    // could still start at or before it, so the end is moved closer.
+    ssize_t end = text.len;
+    if (best->start != -1 && best->start + comp->len_longest < end) {
+        end = best->start + comp->len_longest;
+    }
+
+    for (ssize_t i = 0; i < end; i++) {
+        s = step(comp, s & AC_STATE_MASK, comp->fold[chars[i]]);
+        if (!(s & AC_OUTPUT_FLAG)) {
+            continue;
+        }
+
+        uint32_t o = s & AC_STATE_MASK;
+        o = (comp->output[o] != AC_NONE) ? o : comp->dict[o];
+        for (; o != AC_NONE; o = comp->dict[o]) {
+            ssize_t start = i + 1 - comp->depth[o];
+            uint32_t id = base + comp->output[o];
+            if (removed != NULL && removed[id]) {
+                continue;
+            }
+
+            if (best->start == -1 || start < best->start
+                || (start == best->start && id < best->id)) {
+                best->start = start;
+                best->id = id;
+                best->len = comp->depth[o];
+            }
+        }
+
+        if (best->start != -1 && best->start + comp->len_longest < end) {
+            end = best->start + comp->len_longest;
+        }
+    }
+}
+
+int
+ac_execute(frec_match_t *result, const ac_comp *comp, string text, int eflags)
+{
+    (void) eflags;
+
+    if (text.is_wide) {
+        return (REG_BADPAT);
+    }
+
+    ac_best best = {-1, AC_NONE, 0};
+    scan(&best, comp, text, comp->removed, 0);
+    if (comp->extra != NULL) {
+        scan(&best, comp->extra, text, comp->removed,
+            (uint32_t) comp->base_count);
+    }
+
+    if (best.start == -1) {
+        return (REG_NOMATCH);
+    }
+
+    if (result != NULL) {
+        result->soffset = best.start;
+        result->eoffset = best.start + best.len;
+        result->pattern_id = best.id;
+    }
+    return (REG_OK);
+}
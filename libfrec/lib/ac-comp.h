@@ -0,0 +1,44 @@
+#ifndef FREC_AC_COMP_H
+#define FREC_AC_COMP_H
+
+#include <frec-match.h>
+#include "ac-type.h"
+
+// Implements the Aho-Corasick algorithm for multiple pattern matching.
+// Unlike Wu-Manber, it doesn't depend on the length of the shortest
+// pattern: the text is always scanned in linear time, which makes it the
+// better choice for huge pattern sets, or for sets with very short patterns.
+// Only standard character patterns are supported.
+//
+// Given a pattern array with count elements, and global compilation flags,
+// fills the given comp compilation struct.
+int
+ac_compile(ac_comp *comp, const string *patterns, ssize_t count, int cflags);
+
+// Adds a pattern to the compiled set, with the next id. The added patterns
+// are kept in a second, small automaton, which is compiled again with each
+// one of them, so this takes time proportional to their total length.
+int
+ac_add(ac_comp *comp, string pattern);
+
+// Removes the pattern with the given id from the compiled set. It is only
+// marked as removed, its states stay in the automaton. Of the patterns of
+// an automaton with the same text, only the lowest id is ever reported, so
+// if that one is removed but the others aren't, the set has to be compiled
+// again instead.
+int
+ac_remove(ac_comp *comp, ssize_t id);
+
+// Returns whether the set was edited so much since it was compiled that
+// it should be compiled again.
+bool
+ac_needs_rebuild(const ac_comp *comp);
+
+// Finds the leftmost match in the given text. If multiple patterns match
+// at the same position, the one with the lowest id is reported. The literals
+// have no anchors, so eflags is unused, it is only taken to match the other
+// engines.
+int
+ac_execute(frec_match_t *result, const ac_comp *comp, string text, int eflags);
+
+#endif //FREC_AC_COMP_H
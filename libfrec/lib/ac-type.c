@@ -0,0 +1,65 @@
+#include <frec-config.h>
+#include <ctype.h>
+#include <malloc.h>
+#include "ac-type.h"
+
+void
+ac_comp_init(ac_comp *comp, int cflags)
+{
+    comp->state_count = 0;
+    comp->dense_count = 0;
+    comp->dense = NULL;
+
+    comp->edge_start = NULL;
+    comp->edges = NULL;
+
+    comp->fail = NULL;
+    comp->output = NULL;
+    comp->dict = NULL;
+    comp->depth = NULL;
+
+    comp->count = 0;
+    comp->len_longest = 0;
+
+    comp->extra = NULL;
+    comp->added = NULL;
+    comp->added_count = 0;
+    comp->added_cap = 0;
+    comp->removed = NULL;
+    comp->base_count = 0;
+    comp->edits = 0;
+
+    comp->cflags = cflags;
+    comp->borrowed = false;
+
+    for (int c = 0; c < 256; c++) {
+        comp->fold[c] = (cflags & REG_ICASE) ? (unsigned char) tolower(c) : c;
+    }
+}
+
+void
+ac_comp_free(ac_comp *comp)
+{
+    if (comp == NULL) {
+        return;
+    }
+
+    if (!comp->borrowed) {
+        free(comp->dense);
+        free(comp->edge_start);
+        free(comp->edges);
+        free(comp->fail);
+        free(comp->output);
+        free(comp->dict);
+        free(comp->depth);
+    }
+
+    // The edits are never part of a blob.
+    ac_comp_free(comp->extra);
+    free(comp->extra);
+    for (ssize_t i = 0; i < comp->added_count; i++) {
+        string_free(&comp->added[i]);
+    }
+    free(comp->added);
+    free(comp->removed);
+}
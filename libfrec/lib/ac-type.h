@@ -0,0 +1,72 @@
+#ifndef FREC_AC_TYPE_H
+#define FREC_AC_TYPE_H
+
+#include <stdint.h>
+#include <sys/types.h>
+#include "string-type.h"
+
+// An edge of the automaton: its target, and the character leading there.
+// These are stored together, so that a lookup touches only one cache line.
+typedef struct ac_edge {
+    uint32_t target;
+    unsigned char c;
+} ac_edge;
+
+// Marks a missing state or pattern id.
+#define AC_NONE UINT32_MAX
+
+// Transitions into states that have an output (directly, or through their
+// dictionary link) are marked with this bit, so that the outputs only
+// have to be looked up for these states.
+#define AC_OUTPUT_FLAG 0x80000000u
+#define AC_STATE_MASK 0x7fffffffu
+
+// The Aho-Corasick automaton. States are numbered in breadth-first order,
+// so the root (state 0) and the states of depth one come first: these, and
+// the next few levels of a small automaton (states 1 to dense_count - 1),
+// have a full transition table with 256 entries each. Deeper states only store their own edges, sorted by
+// character, and fall back on their failure links. The targets of the
+// transitions and the targets of the edges carry the AC_OUTPUT_FLAG bit.
+typedef struct ac_comp {
+    uint32_t state_count;    // Number of states.
+    uint32_t dense_count;    // Number of states with full transition tables.
+    uint32_t *dense;         // The full transition tables of these states.
+
+    uint32_t *edge_start;    // Start of the edges of each state in the
+                             // edge array, followed by the edge count.
+    ac_edge *edges;          // The edges of the deeper states.
+
+    uint32_t *fail;          // Failure link of each state.
+    uint32_t *output;        // Lowest id of the pattern ending in each
+                             // state, or AC_NONE.
+    uint32_t *dict;          // Nearest state along the failure links that
+                             // has an output, or AC_NONE.
+    uint32_t *depth;         // Depth of each state.
+
+    ssize_t count;           // Number of patterns.
+    ssize_t len_longest;     // Length of the longest pattern.
+    unsigned char fold[256]; // Character mapping applied to the patterns
+                             // and the text (case folding with REG_ICASE).
+
+    struct ac_comp *extra;   // The automaton of the patterns added after
+                             // the compilation, or NULL. Their ids start
+                             // at base_count.
+    string *added;           // These patterns.
+    ssize_t added_count;     // Number of these patterns.
+    ssize_t added_cap;       // Room for patterns in the array.
+    uint8_t *removed;        // Whether each pattern was removed, or NULL.
+    ssize_t base_count;      // Number of patterns compiled at once.
+    ssize_t edits;           // Number of patterns added and removed since.
+
+    int cflags;              // Compilation flags.
+    bool borrowed;           // The tables point into a serialized blob,
+                             // and are not freed.
+} ac_comp;
+
+void
+ac_comp_init(ac_comp *comp, int cflags);
+
+void
+ac_comp_free(ac_comp *comp);
+
+#endif //FREC_AC_TYPE_H
@@ -34,6 +34,7 @@
 
 #include "bm.h"
 #include "bm-type.h"
+#include "byte-freq.h"
 #include "regex-parser.h"
 
 // Utility function. Asserts that str[at] equals stnd or wide in the correct
@@ -66,7 +67,7 @@ fill_badc_shifts_stnd(bm_comp *comp)
 	// NB: the last character is skipped, because no jump occurs when the
     // current character of the text is the same as the last pattern char.
 	for (size_t i = 0; i < len - 1; i++) {
-		char c = pattern[i];
+		u_char c = pattern[i];
 
 		// Ignore case if necessary.
 		if (comp->is_icase_set) {
@@ -80,6 +81,39 @@ fill_badc_shifts_stnd(bm_comp *comp)
 	return (REG_OK);
 }
 
+// Ranks the characters of the pattern using the byte frequency model, and
+// stores the offsets of the two rarest ones in the given compilation struct.
+// Standard character version, the search is anchored on these characters.
+static void
+find_rare_offsets(bm_comp *comp)
+{
+	u_char *pattern = (u_char *) comp->pattern.stnd;
+	ssize_t len = comp->pattern.len;
+
+	unsigned int best_score[2] = { UINT_MAX, UINT_MAX };
+	ssize_t *best = comp->rare_offsets;
+	best[0] = len - 1;
+	best[1] = 0;
+
+	// Later characters win ties, so that equally rare characters keep the
+	// usual last-then-first anchoring of the search.
+	for (ssize_t i = 0; i < len; i++) {
+		unsigned int score = (comp->is_icase_set)
+			? byte_freq_icase(pattern[i])
+			: byte_freq(pattern[i]);
+
+		if (score <= best_score[0]) {
+			best_score[1] = best_score[0];
+			best[1] = best[0];
+			best_score[0] = score;
+			best[0] = i;
+		} else if (score <= best_score[1]) {
+			best_score[1] = score;
+			best[1] = i;
+		}
+	}
+}
+
 // Fills the bad character shift table in the given compilation struct.
 // Wide character version.
 static int
@@ -109,7 +143,7 @@ fill_badc_shifts_wide(bm_comp *comp)
 		}
 
 		// Set the shift value to their distance from the end of the word.
-		ssize_t value = len - 1 - i;
+		unsigned int value = len - 1 - i;
 		int res = hashtable_put(table, &c, &value);
 		if (res == HASH_FAIL || res == HASH_FULL) {
 			return (REG_ESPACE);
@@ -193,30 +227,32 @@ fill_good_shifts(bm_comp *comp)
 {
 	// The pattern to use is the original pattern.
 	string *pattern = &comp->pattern;
+	string lowered;
 
 	// Unless the case needs to be ignored.
 	if (comp->is_icase_set) {
         // In which case we duplicate the string
-        bool success = string_duplicate(pattern, comp->pattern);
+        bool success = string_duplicate(&lowered, comp->pattern);
 		if (!success) {
 			return (REG_ESPACE);
 		}
 
         // And convert every character into lowercase.
-		for (int i = 0; i < pattern->len; i++) {
-            if (pattern->is_wide) {
-                pattern->wide[i] = (wchar_t) towlower(pattern->wide[i]);
+		for (int i = 0; i < lowered.len; i++) {
+            if (lowered.is_wide) {
+                lowered.wide[i] = (wchar_t) towlower(lowered.wide[i]);
             } else {
-                pattern->stnd[i] = (char) tolower((u_char) pattern->stnd[i]);
+                lowered.stnd[i] = (char) tolower((u_char) lowered.stnd[i]);
             }
 		}
+		pattern = &lowered;
 	}
 
     // Initialize good_shifts attribute.
     comp->good_shifts = malloc(sizeof(unsigned int) * pattern->len);
     if (comp->good_shifts == NULL) {
         if (comp->is_icase_set) {
-            string_free(pattern);
+            string_free(&lowered);
         }
         return (REG_ESPACE);
     }
@@ -224,9 +260,9 @@ fill_good_shifts(bm_comp *comp)
 	// Calculate good shifts into the newly created table.
 	int res = calculate_good_shifts(comp->good_shifts, pattern);
 
-	// If the case was ignored or an error occurred, the copy is freed.
-	if (comp->is_icase_set || res != REG_OK) {
-		string_free(pattern);
+	// If the case was ignored, the copy is freed.
+	if (comp->is_icase_set) {
+		string_free(&lowered);
 	}
 
 	return res;
@@ -256,6 +292,10 @@ compile_literal(bm_comp *comp, string patt, int cflags)
         return (REG_ESPACE);
     }
 
+    if (!comp->pattern.is_wide) {
+        find_rare_offsets(comp);
+    }
+
     int ret = (comp->pattern.is_wide)
         ? fill_badc_shifts_wide(comp)
         : fill_badc_shifts_stnd(comp);
@@ -285,14 +325,14 @@ bm_compile_literal(bm_comp *comp, string patt, int cflags)
 static int
 strip_specials(string str, string *out_str, int in_flags, bm_comp *comp)
 {
-	ssize_t len = str.len;
-
 	// If the first character is ^, set the given flag and continue.
 	if (string_has_char_at(str, 0, '^', L'^')) {
 		comp->has_bol_anchor = true;
         string_offset(&str, 1);
 	}
 
+	ssize_t len = str.len;
+
 	// If the last character is a $ with special meaning, do the same.
 	if (
         (len >= 1 && string_has_char_at(str, len - 1, '$', L'$'))
@@ -300,6 +340,7 @@ strip_specials(string str, string *out_str, int in_flags, bm_comp *comp)
 	) {
 		comp->has_eol_anchor = true;
 		str.len--;
+		len--;
 	}
 
 	regex_parser parser;
@@ -358,6 +399,14 @@ bm_compile_full(bm_comp *comp, string patt, int cflags)
 		return ret;
 	}
 
+    // An anchored empty pattern (e.g. '^$') doesn't match everything, and
+    // is left for the original matcher.
+    if (clean_pattern.len == 0
+        && (comp->has_bol_anchor || comp->has_eol_anchor)) {
+        string_free(&clean_pattern);
+        return (REG_BADPAT);
+    }
+
 	// Execute literal preprocessing.
 	ret = compile_literal(comp, clean_pattern, cflags);
 
@@ -24,12 +24,29 @@
  * SUCH DAMAGE.
  */
 
+#include <ctype.h>
 #include <frec-config.h>
 #include <string-type.h>
 #include <string.h>
 
 #include "bm.h"
 
+// Vectorized candidate scanning is available for standard character texts.
+// SSE2 is part of the x86-64 baseline, AVX2 is selected at load time.
+#if defined(__SSE2__)
+    #include <emmintrin.h>
+    #define BM_HAVE_SSE2 1
+#endif
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+    #include <immintrin.h>
+    #define BM_HAVE_AVX2 1
+#endif
+
+// Patterns up to this length are searched with the candidate scanner, longer
+// ones with Turbo-BM, whose shifts then skip more than a vector block.
+#define BM_VECTOR_MAX_LEN 32
+
 // Utility functions.
 static ssize_t max(ssize_t a, ssize_t b) { return (a > b) ? a : b; }
 static ssize_t min(ssize_t a, ssize_t b) { return (a < b) ? a : b; }
@@ -90,14 +107,14 @@ exec_turbo_bm(
             // candidate may not be correct.
             bool can_return = true;
             if (comp->has_bol_anchor) {
-                can_return &= ((srch_pos == 0)
-                    || string_has_newline_at(text, srch_pos - 1));
+                can_return &= ((srch_pos == 0) || (comp->is_nline_set
+                    && string_has_newline_at(text, srch_pos - 1)));
             }
 
             if (comp->has_eol_anchor) {
                 ssize_t end = srch_pos + patt.len;
-                can_return &= ((end == text.len)
-                    || string_has_newline_at(text, end));
+                can_return &= ((end == text.len) || (comp->is_nline_set
+                    && string_has_newline_at(text, end)));
             }
 
             // Only return if the above checks succeeded.
@@ -123,18 +140,14 @@ exec_turbo_bm(
 
             if (text.is_wide) {
                 wchar_t key = text.wide[srch_pos + i];
-                int ret = hashtable_get(comp->bad_shifts_wide, &key, &value);
+                const unsigned int *stored =
+                    hashtable_get(comp->bad_shifts_wide, &key);
                 // If the char is not present in the hash, this shift value
                 // equals the length of the pattern.
-                if (ret != HASH_OK) {
-                    value = patt.len;
-                }
+                value = (stored != NULL) ? *stored : patt.len;
             } else {
-                char key = text.stnd[srch_pos + i];
-                // If the key is invalid (< 0), no pattern can match with it.
-                value = (key < 0)
-                    ? patt.len
-                    : comp->bad_shifts_stnd[key];
+                u_char key = text.stnd[srch_pos + i];
+                value = comp->bad_shifts_stnd[key];
             }
 
             ssize_t bad_shift = value - v;
@@ -158,16 +171,258 @@ exec_turbo_bm(
     return (REG_NOMATCH);
 }
 
-int
-bm_execute(frec_match_t *result, const bm_comp *comp, string text, int eflags)
+// Asserts that the whole pattern (and its anchors) matches the standard
+// character text at pos. Used to verify the candidates of the vector scanner.
+static bool
+verify_candidate_stnd(const bm_comp *comp, string text, ssize_t pos)
+{
+    const char *patt = comp->pattern.stnd;
+    const char *curr = &text.stnd[pos];
+    ssize_t len = comp->pattern.len;
+
+    if (comp->is_icase_set) {
+        for (ssize_t i = 0; i < len; i++) {
+            if (tolower((u_char) curr[i]) != tolower((u_char) patt[i])) {
+                return false;
+            }
+        }
+    } else if (memcmp(curr, patt, len) != 0) {
+        return false;
+    }
+
+    // Anchors match at line breaks only if REG_NEWLINE was set.
+    if (comp->has_bol_anchor && pos != 0
+        && !(comp->is_nline_set && text.stnd[pos - 1] == '\n')) {
+        return false;
+    }
+
+    ssize_t end = pos + len;
+    if (comp->has_eol_anchor && end != text.len
+        && !(comp->is_nline_set && text.stnd[end] == '\n')) {
+        return false;
+    }
+
+    return true;
+}
+
+// Returns the pattern character at the given position, in lowercase if the
+// case of the text should be ignored.
+static u_char
+pattern_char_at(const bm_comp *comp, ssize_t at)
+{
+    u_char c = comp->pattern.stnd[at];
+    return (comp->is_icase_set) ? (u_char) tolower(c) : c;
+}
+
+// Scalar version of the candidate scanner. Tests the two rarest pattern
+// characters at every position from pos, and verifies the candidates.
+// Outside of case insensitive mode, memchr is used to jump between the
+// occurrences of the rarest character.
+// Returns the position of the first match, or -1 if there was none.
+static ssize_t
+scan_candidates_scalar(const bm_comp *comp, string text, ssize_t pos)
+{
+    ssize_t off_a = comp->rare_offsets[0];
+    ssize_t off_b = comp->rare_offsets[1];
+    u_char rare_a = pattern_char_at(comp, off_a);
+    u_char rare_b = pattern_char_at(comp, off_b);
+
+    // The last position where the pattern may start.
+    ssize_t limit = text.len - comp->pattern.len;
+
+    while (pos <= limit) {
+        if (!comp->is_icase_set) {
+            const char *from = &text.stnd[pos + off_a];
+            const char *found = memchr(from, rare_a, limit - pos + 1);
+            if (found == NULL) {
+                return -1;
+            }
+            pos += found - from;
+        }
+
+        u_char a = text.stnd[pos + off_a];
+        u_char b = text.stnd[pos + off_b];
+
+        if (comp->is_icase_set) {
+            a = tolower(a);
+            b = tolower(b);
+        }
+
+        if (a == rare_a && b == rare_b
+            && verify_candidate_stnd(comp, text, pos)) {
+            return pos;
+        }
+        pos++;
+    }
+
+    return -1;
+}
+
+#ifdef BM_HAVE_SSE2
+// SSE2 version of the candidate scanner. Compares the two rarest pattern
+// characters at 16 positions per step. Only advances *pos while a whole block
+// can be loaded, the remainder is left for a narrower scanner.
+static ssize_t
+scan_candidates_sse2(const bm_comp *comp, string text, ssize_t *pos)
+{
+    ssize_t last = comp->pattern.len - 1;
+    ssize_t off_a = comp->rare_offsets[0];
+    ssize_t off_b = comp->rare_offsets[1];
+    u_char rare_a = pattern_char_at(comp, off_a);
+    u_char rare_b = pattern_char_at(comp, off_b);
+
+    // In case insensitive mode, both the lower and upper case are compared.
+    __m128i a_lo = _mm_set1_epi8((char) rare_a);
+    __m128i a_up = _mm_set1_epi8((char) toupper(rare_a));
+    __m128i b_lo = _mm_set1_epi8((char) rare_b);
+    __m128i b_up = _mm_set1_epi8((char) toupper(rare_b));
+
+    ssize_t i = *pos;
+    for (; i + last + 16 <= text.len; i += 16) {
+        __m128i a = _mm_loadu_si128((const __m128i *) &text.stnd[i + off_a]);
+        __m128i b = _mm_loadu_si128((const __m128i *) &text.stnd[i + off_b]);
+
+        __m128i eq_a = _mm_cmpeq_epi8(a, a_lo);
+        __m128i eq_b = _mm_cmpeq_epi8(b, b_lo);
+        if (comp->is_icase_set) {
+            eq_a = _mm_or_si128(eq_a, _mm_cmpeq_epi8(a, a_up));
+            eq_b = _mm_or_si128(eq_b, _mm_cmpeq_epi8(b, b_up));
+        }
+
+        unsigned int mask = _mm_movemask_epi8(_mm_and_si128(eq_a, eq_b));
+        while (mask != 0) {
+            ssize_t cand = i + __builtin_ctz(mask);
+            if (verify_candidate_stnd(comp, text, cand)) {
+                *pos = cand;
+                return cand;
+            }
+            mask &= mask - 1;
+        }
+    }
+
+    *pos = i;
+    return -1;
+}
+#endif
+
+#ifdef BM_HAVE_AVX2
+// AVX2 version of the candidate scanner, 32 positions per step.
+// See scan_candidates_sse2 for more information.
+__attribute__((target("avx2")))
+static ssize_t
+scan_candidates_avx2(const bm_comp *comp, string text, ssize_t *pos)
+{
+    ssize_t last = comp->pattern.len - 1;
+    ssize_t off_a = comp->rare_offsets[0];
+    ssize_t off_b = comp->rare_offsets[1];
+    u_char rare_a = pattern_char_at(comp, off_a);
+    u_char rare_b = pattern_char_at(comp, off_b);
+
+    __m256i a_lo = _mm256_set1_epi8((char) rare_a);
+    __m256i a_up = _mm256_set1_epi8((char) toupper(rare_a));
+    __m256i b_lo = _mm256_set1_epi8((char) rare_b);
+    __m256i b_up = _mm256_set1_epi8((char) toupper(rare_b));
+
+    ssize_t i = *pos;
+    for (; i + last + 32 <= text.len; i += 32) {
+        __m256i a = _mm256_loadu_si256((const __m256i *) &text.stnd[i + off_a]);
+        __m256i b = _mm256_loadu_si256((const __m256i *) &text.stnd[i + off_b]);
+
+        __m256i eq_a = _mm256_cmpeq_epi8(a, a_lo);
+        __m256i eq_b = _mm256_cmpeq_epi8(b, b_lo);
+        if (comp->is_icase_set) {
+            eq_a = _mm256_or_si256(eq_a, _mm256_cmpeq_epi8(a, a_up));
+            eq_b = _mm256_or_si256(eq_b, _mm256_cmpeq_epi8(b, b_up));
+        }
+
+        unsigned int mask =
+            (unsigned int) _mm256_movemask_epi8(_mm256_and_si256(eq_a, eq_b));
+        while (mask != 0) {
+            ssize_t cand = i + __builtin_ctz(mask);
+            if (verify_candidate_stnd(comp, text, cand)) {
+                *pos = cand;
+                return cand;
+            }
+            mask &= mask - 1;
+        }
+    }
+
+    *pos = i;
+    return -1;
+}
+#endif
+
+// A block scanner advances *pos while whole blocks can be loaded, and returns
+// the first verified candidate, or -1 if there was none in these blocks.
+typedef ssize_t (*block_scanner)(const bm_comp *comp, string text, ssize_t *pos);
+
+// The widest block scanner supported by the CPU. Defaults to SSE2, and is
+// resolved once at load time if AVX2 is available as well.
+#if defined(BM_HAVE_SSE2)
+static block_scanner scan_blocks = scan_candidates_sse2;
+#else
+static block_scanner scan_blocks = NULL;
+#endif
+
+#ifdef BM_HAVE_AVX2
+__attribute__((constructor))
+static void
+resolve_block_scanner(void)
 {
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        scan_blocks = scan_candidates_avx2;
+    }
+}
+#endif
+
+// Executes the vectorized candidate search on the given standard character
+// text. Instead of the Boyer-Moore shifts, every position is tested for the
+// two rarest pattern characters in bulk (see find_rare_offsets), and only
+// positions where both of them are present are verified.
+static int
+exec_vector_bm(
+    frec_match_t *result, const bm_comp *comp, string text, bool store_matches
+) {
+    ssize_t pos = 0;
+    ssize_t found = -1;
+
+    if (scan_blocks != NULL) {
+        found = scan_blocks(comp, text, &pos);
+    }
+#ifdef BM_HAVE_SSE2
+    // The tail that is too short for an AVX2 block may still fit SSE2 ones.
+    if (found < 0 && scan_blocks != scan_candidates_sse2) {
+        found = scan_candidates_sse2(comp, text, &pos);
+    }
+#endif
+    if (found < 0) {
+        found = scan_candidates_scalar(comp, text, pos);
+    }
+
+    if (found < 0) {
+        return (REG_NOMATCH);
+    }
+
+    if (store_matches) {
+        result->soffset = found;
+        result->eoffset = found + comp->pattern.len;
+    }
+    return (REG_OK);
+}
+
+// The common implementation of bm_execute and bm_execute_offsets.
+static int
+execute(
+    frec_match_t *result, const bm_comp *comp, string text, int eflags,
+    bool store_matches
+) {
     // Entry condition: the comp was created with the same char type as text.
     if (comp->pattern.is_wide != text.is_wide) {
         return (REG_BADPAT);
     }
 
     // Set bool fields.
-    bool store_matches = !comp->is_nosub_set && result != NULL;
     bool no_bol_anchor = eflags & REG_NOTBOL;
     bool no_eol_anchor = eflags & REG_NOTEOL;
 
@@ -180,13 +435,32 @@ bm_execute(frec_match_t *result, const bm_comp *comp, string text, int eflags)
         return (REG_OK);
     }
 
-    // If BOL and EOL can't match the start and end of the text, we won't
-    // accept any matches that are at the very beginning or the very end.
+    // If BOL and EOL can't match the start and end of the text, anchored
+    // matches can only be found after the first and before the last line
+    // break, and only if REG_NEWLINE was set.
+    ssize_t skipped = 0;
     if (comp->has_bol_anchor && no_bol_anchor) {
-        string_offset(&text, 1);
+        ssize_t lf = 0;
+        while (lf < text.len && !string_has_newline_at(text, lf)) {
+            lf++;
+        }
+        if (!comp->is_nline_set || lf == text.len) {
+            return (REG_NOMATCH);
+        }
+
+        string_offset(&text, lf + 1);
+        skipped = lf + 1;
     }
     if (comp->has_eol_anchor && no_eol_anchor) {
-        text.len--;
+        ssize_t lf = text.len - 1;
+        while (lf >= 0 && !string_has_newline_at(text, lf)) {
+            lf--;
+        }
+        if (!comp->is_nline_set || lf < 0) {
+            return (REG_NOMATCH);
+        }
+
+        text.len = lf;
     }
 
     // If the original pattern is longer than the text, return.
@@ -194,6 +468,34 @@ bm_execute(frec_match_t *result, const bm_comp *comp, string text, int eflags)
         return (REG_NOMATCH);
     }
 
-    // Execute BM algorithm.
-    return exec_turbo_bm(result, comp, text, store_matches);
+    // Short patterns in standard character texts are scanned with the
+    // vectorized matcher, as their Boyer-Moore shifts are short as well.
+    // Long patterns and wide texts use the Turbo Boyer-Moore algorithm,
+    // except when the case is ignored, which only the former supports.
+    bool vector = !text.is_wide && (comp->pattern.len <= BM_VECTOR_MAX_LEN
+        || comp->is_icase_set);
+    int ret = (vector)
+        ? exec_vector_bm(result, comp, text, store_matches)
+        : exec_turbo_bm(result, comp, text, store_matches);
+
+    // Offsets are relative to the text we were given.
+    if (ret == REG_OK && store_matches) {
+        result->soffset += skipped;
+        result->eoffset += skipped;
+    }
+    return ret;
+}
+
+int
+bm_execute(frec_match_t *result, const bm_comp *comp, string text, int eflags)
+{
+    bool store_matches = !comp->is_nosub_set && result != NULL;
+    return execute(result, comp, text, eflags, store_matches);
+}
+
+int
+bm_execute_offsets(
+    frec_match_t *result, const bm_comp *comp, string text, int eflags
+) {
+    return execute(result, comp, text, eflags, true);
 }
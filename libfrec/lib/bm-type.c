@@ -10,6 +10,9 @@ bm_comp_init(bm_comp *comp, int cflags)
 
     comp->bad_shifts_wide = NULL;
 
+    comp->rare_offsets[0] = 0;
+    comp->rare_offsets[1] = 0;
+
     comp->has_bol_anchor = false;
     comp->has_eol_anchor = false;
     comp->has_glob_match = false;
@@ -17,6 +20,7 @@ bm_comp_init(bm_comp *comp, int cflags)
     comp->is_icase_set = cflags & REG_ICASE;
     comp->is_nosub_set = cflags & REG_NOSUB;
     comp->is_nline_set = cflags & REG_NEWLINE;
+    comp->is_borrowed = false;
 }
 
 void
@@ -24,7 +28,15 @@ bm_comp_free(bm_comp *comp)
 {
     if (comp != NULL) {
         string_free(&comp->pattern);
-        free(comp->good_shifts);
+        if (!comp->is_borrowed) {
+            free(comp->good_shifts);
+        }
         hashtable_free(comp->bad_shifts_wide);
+
+        // Freeing the struct twice must be harmless, as the compilation
+        // functions already free it on failure.
+        string_init(&comp->pattern);
+        comp->good_shifts = NULL;
+        comp->bad_shifts_wide = NULL;
     }
 }
@@ -15,6 +15,9 @@ typedef struct bm_comp {
     unsigned int bad_shifts_stnd[UCHAR_MAX + 1]; // The Boyer-Moore bad shifts
     hashtable *bad_shifts_wide;                  // table, separate versions.
 
+    ssize_t rare_offsets[2]; // Offsets of the two rarest pattern characters,
+                             // the rarest one first. Standard strings only.
+
     bool has_bol_anchor; // The pattern starts with a ^ anchor.
     bool has_eol_anchor; // The pattern ends with a $ anchor.
     bool has_glob_match; // The pattern matches anything.
@@ -22,6 +25,8 @@ typedef struct bm_comp {
     bool is_icase_set; // Ignore text case when matching. Set by REG_ICASE.
     bool is_nosub_set; // Do not save result when matching. Set by REG_NOSUB.
     bool is_nline_set; // Handle newlines differently. Set by REG_NEWLINE.
+    bool is_borrowed;  // The tables point into a serialized blob, and are
+                       // not freed.
 } bm_comp;
 
 // Initialize the given compilation struct. Must point to valid memory.
@@ -24,4 +24,10 @@ bm_compile_full(bm_comp *comp, string patt, int cflags);
 int
 bm_execute(frec_match_t *result, const bm_comp *comp, string text, int eflags);
 
+// Same as bm_execute, but always stores the match in result, even if
+// is_nosub_set was set in comp. The result pointer can't be NULL.
+int
+bm_execute_offsets(
+    frec_match_t *result, const bm_comp *comp, string text, int eflags);
+
 #endif // FREC_BM_H
@@ -0,0 +1,330 @@
+#include <ctype.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <frec.h>
+
+#include "byte-freq.h"
+
+// Built-in frequency scores, derived from a mix of English prose, C sources
+// and system logs in equal parts.
+static const unsigned char builtin_freq[256] = {
+      0,   0,   0,   0,   0,   0,   0,   0,   0, 154, 188,   0,  19, 146,   0,   0,  // 0x00
+      0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,  // 0x10
+    215,  91, 123, 144,  63, 107, 119, 115, 168, 167, 167, 151, 162, 187, 190, 190,  // 0x20
+    186, 189, 188, 169, 174, 169, 170, 163, 153, 147, 180, 146, 144, 129, 144,  69,  // 0x30
+    110, 158, 143, 160, 150, 165, 147, 143, 133, 160, 114, 133, 160, 148, 160, 159,  // 0x40
+    158, 110, 159, 172, 162, 146, 132, 124, 136, 126,  94, 114, 115, 114,  96, 189,  // 0x50
+    103, 199, 186, 192, 193, 206, 178, 179, 179, 200, 128, 169, 195, 185, 197, 196,  // 0x60
+    192, 136, 193, 200, 203, 187, 167, 154, 162, 168, 135, 120,  99, 120, 111,   0,  // 0x70
+     20,   1,  16,  18,  12,   1,  51,   0,   1,   1,   0,   0,   0,   1,   0,   0,  // 0x80
+      1,   0,  50,   1,   1,   0,   1,   1,   0,   2,   1,   1,   1,   1,   1,   2,  // 0x90
+      1,  17,   1,   1,  27,   1,   0,   1,   1,  47,   0,   1,   0,  19,   0,   0,  // 0xa0
+      1,  43,   4,  22,   1,   1,  30,   0,   1,   0,   1,   1,  14,  14,   1,   1,  // 0xb0
+      0,   0,  43,  68,   1,  32,   0,   0,   0,   0,   0,   0,   1,   0,   0,  16,  // 0xc0
+      7,   1,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,  // 0xd0
+      0,   0,  52,   0,   1,   1,   1,   0,   0,   0,   0,   0,   0,   0,   0,   0,  // 0xe0
+      0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,  // 0xf0
+};
+
+// A trained frequency model. Models are never modified once they are in
+// use, frec_train_byte_freq builds a new one and replaces the old one.
+typedef struct freq_model {
+    unsigned char freq[256];
+    // The frequency table of byte pairs, indexed by the first and the
+    // second byte of the pair. There is no built-in one.
+    unsigned char pair_freq[256][256];
+    bool has_pairs;
+    // The references to the model: one while it is in use, and one for
+    // each thread that pinned it. Freed when the last one is dropped.
+    unsigned int refs;
+} freq_model;
+
+// The trained model in use, or NULL for the built-in table. The lock is only
+// held while the model is replaced, or while a reference to it is taken.
+static freq_model *current_model = NULL;
+static pthread_mutex_t model_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// The model pinned by the calling thread, and the number of its pins.
+static __thread freq_model *pinned_model = NULL;
+static __thread unsigned int pin_count = 0;
+
+// Returns log2(x) * 16 for x >= 1, using binary digit extraction
+// (so that we don't have to depend on the math library).
+static unsigned int
+log2_x16(double x)
+{
+    unsigned int result = 0;
+
+    while (x >= 2.0) {
+        x /= 2.0;
+        result += 16;
+    }
+
+    for (unsigned int bit = 8; bit > 0; bit /= 2) {
+        x *= x;
+        if (x >= 2.0) {
+            x /= 2.0;
+            result += bit;
+        }
+    }
+
+    return result;
+}
+
+// Drops a reference to the model, and frees it if it was the last one.
+static void
+release_model(freq_model *model)
+{
+    if (model != NULL
+        && __atomic_sub_fetch(&model->refs, 1, __ATOMIC_ACQ_REL) == 0) {
+        free(model);
+    }
+}
+
+const struct freq_model *
+byte_freq_pin(void)
+{
+    if (pin_count++ == 0) {
+        pthread_mutex_lock(&model_lock);
+        pinned_model = current_model;
+        if (pinned_model != NULL) {
+            __atomic_add_fetch(&pinned_model->refs, 1, __ATOMIC_RELAXED);
+        }
+        pthread_mutex_unlock(&model_lock);
+    }
+    return pinned_model;
+}
+
+void
+byte_freq_pin_model(const struct freq_model *model)
+{
+    if (pin_count++ == 0) {
+        // The thread that pinned it first holds a reference until we are done.
+        pinned_model = (freq_model *) model;
+        if (pinned_model != NULL) {
+            __atomic_add_fetch(&pinned_model->refs, 1, __ATOMIC_RELAXED);
+        }
+    }
+}
+
+void
+byte_freq_unpin(void)
+{
+    if (--pin_count == 0) {
+        release_model(pinned_model);
+        pinned_model = NULL;
+    }
+}
+
+// Puts the model in use. The old one is freed once no thread has it pinned.
+static void
+publish_model(freq_model *model)
+{
+    if (model != NULL) {
+        model->refs = 1;
+    }
+
+    pthread_mutex_lock(&model_lock);
+    freq_model *old = current_model;
+    current_model = model;
+    pthread_mutex_unlock(&model_lock);
+    release_model(old);
+}
+
+unsigned char
+byte_freq(unsigned char c)
+{
+    const freq_model *model = byte_freq_pin();
+    unsigned char freq = (model != NULL) ? model->freq[c] : builtin_freq[c];
+    byte_freq_unpin();
+    return freq;
+}
+
+// The sum of two occurrence rates, approximated on the log scale.
+static unsigned char
+freq_sum(unsigned char a, unsigned char b)
+{
+    unsigned char high = (a > b) ? a : b;
+    unsigned char low = (a > b) ? b : a;
+    unsigned int sum = high + ((high - low < 12) ? 12 - (high - low) : 0);
+
+    return (sum > UCHAR_MAX) ? UCHAR_MAX : (unsigned char) sum;
+}
+
+unsigned char
+byte_freq_icase(unsigned char c)
+{
+    byte_freq_pin();
+    unsigned char lower = byte_freq((unsigned char) tolower(c));
+    unsigned char upper = byte_freq((unsigned char) toupper(c));
+    byte_freq_unpin();
+
+    // Characters without case variants are only counted once.
+    return (tolower(c) == toupper(c)) ? lower : freq_sum(lower, upper);
+}
+
+// Returns the rarity of a single byte.
+static unsigned int
+byte_rarity(unsigned char c, bool icase)
+{
+    return UCHAR_MAX - ((icase) ? byte_freq_icase(c) : byte_freq(c));
+}
+
+// The implementation of byte_pair_rarity, with the model pinned.
+static unsigned int
+pair_rarity(const freq_model *model, unsigned char a, unsigned char b,
+    bool icase)
+{
+    if (model == NULL || !model->has_pairs) {
+        return byte_rarity(a, icase) + byte_rarity(b, icase);
+    }
+
+    const unsigned char (*pair_freq)[256] = model->pair_freq;
+    if (!icase) {
+        return UCHAR_MAX - pair_freq[a][b];
+    }
+
+    // Every case variant of the pair matches in case insensitive mode.
+    unsigned char first[2] = {(unsigned char) tolower(a), (unsigned char) toupper(a)};
+    unsigned char second[2] = {(unsigned char) tolower(b), (unsigned char) toupper(b)};
+    int first_count = (first[0] == first[1]) ? 1 : 2;
+    int second_count = (second[0] == second[1]) ? 1 : 2;
+
+    unsigned char freq = pair_freq[first[0]][second[0]];
+    for (int i = 0; i < first_count; i++) {
+        for (int j = 0; j < second_count; j++) {
+            if (i != 0 || j != 0) {
+                freq = freq_sum(freq, pair_freq[first[i]][second[j]]);
+            }
+        }
+    }
+
+    return UCHAR_MAX - freq;
+}
+
+unsigned int
+byte_pair_rarity(unsigned char a, unsigned char b, bool icase)
+{
+    const freq_model *model = byte_freq_pin();
+    unsigned int rarity = pair_rarity(model, a, b, icase);
+    byte_freq_unpin();
+    return rarity;
+}
+
+// Returns the character of the literal at the given position, or -1 if it
+// is outside of the byte range.
+static int
+literal_byte_at(string literal, ssize_t i)
+{
+    if (!literal.is_wide) {
+        return (unsigned char) literal.stnd[i];
+    }
+    return (literal.wide[i] >= 0 && literal.wide[i] <= UCHAR_MAX)
+        ? (int) literal.wide[i]
+        : -1;
+}
+
+unsigned int
+literal_rarity(string literal, bool icase)
+{
+    unsigned int rarity = 0;
+    int prev = -1;
+
+    // Every character is scored with the same model.
+    byte_freq_pin();
+    for (ssize_t i = 0; i < literal.len; i++) {
+        int curr = literal_byte_at(literal, i);
+
+        if (curr == -1) {
+            rarity += UCHAR_MAX;
+        } else if (prev == -1) {
+            rarity += byte_rarity(curr, icase);
+        } else {
+            // The rarity of the character following the previous one. The
+            // two tables are approximations, so this may come out negative.
+            unsigned int pair = byte_pair_rarity(prev, curr, icase);
+            unsigned int first = byte_rarity(prev, icase);
+            rarity += (pair > first) ? pair - first : 0;
+        }
+
+        prev = curr;
+    }
+    byte_freq_unpin();
+
+    return rarity;
+}
+
+// Fills the pair frequency table of the model from the sample, the same way
+// as the byte table. If the counts can't be allocated, the pairs are left
+// untrained.
+static void
+train_pairs(freq_model *model, const char *sample, size_t len)
+{
+    model->has_pairs = false;
+    if (len < 2) {
+        return;
+    }
+
+    size_t *counts = calloc(256 * 256, sizeof(size_t));
+    if (counts == NULL) {
+        return;
+    }
+
+    for (size_t i = 1; i < len; i++) {
+        counts[(unsigned char) sample[i - 1] * 256 + (unsigned char) sample[i]]++;
+    }
+
+    for (size_t i = 0; i < 256 * 256; i++) {
+        if (counts[i] == 0) {
+            model->pair_freq[i / 256][i % 256] = 0;
+            continue;
+        }
+
+        unsigned int decay = 3 * log2_x16((double) (len - 1) / counts[i]) / 4;
+        model->pair_freq[i / 256][i % 256] =
+            (decay >= UCHAR_MAX) ? 1 : UCHAR_MAX - decay;
+    }
+
+    free(counts);
+    model->has_pairs = true;
+}
+
+void
+frec_train_byte_freq(const char *sample, size_t len)
+{
+    // An empty sample restores the built-in table.
+    if (sample == NULL || len == 0) {
+        publish_model(NULL);
+        return;
+    }
+
+    // If the new model can't be allocated, the old one stays in use.
+    freq_model *model = malloc(sizeof(freq_model));
+    if (model == NULL) {
+        return;
+    }
+
+    size_t counts[256];
+    memset(counts, 0, sizeof(counts));
+
+    for (size_t i = 0; i < len; i++) {
+        counts[(unsigned char) sample[i]]++;
+    }
+
+    // Scale the counts the same way as the built-in table was scaled.
+    for (size_t i = 0; i < 256; i++) {
+        if (counts[i] == 0) {
+            model->freq[i] = 0;
+            continue;
+        }
+
+        unsigned int decay = 3 * log2_x16((double) len / counts[i]) / 4;
+        model->freq[i] = (decay >= UCHAR_MAX) ? 1 : UCHAR_MAX - decay;
+    }
+
+    train_pairs(model, sample, len);
+    publish_model(model);
+}
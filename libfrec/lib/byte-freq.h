@@ -0,0 +1,56 @@
+#ifndef FREC_BYTE_FREQ_H
+#define FREC_BYTE_FREQ_H
+
+#include <stdbool.h>
+#include <sys/types.h>
+#include "string-type.h"
+
+// The frequency model assigns a score to every byte value based on how
+// often it occurs in typical texts. Scores are logarithmic: a difference of
+// 12 means the byte occurs twice as often. A score of 0 marks bytes that
+// were never seen, 255 marks the most common ones.
+
+struct freq_model;
+
+// Pins the model in use to the calling thread until the matching
+// byte_freq_unpin, so that every score of a compilation comes from the same
+// model. Only a reference to it is taken: frec_train_byte_freq may replace
+// it meanwhile, and frees it once no thread has it pinned. Pins nest, and
+// every score function below pins the model for its own duration as well.
+// Returns the pinned model, for byte_freq_pin_model.
+const struct freq_model *
+byte_freq_pin(void);
+
+// Pins the given model to the calling thread, so that the threads working
+// for another one use its model. That thread must keep it pinned until they
+// are done.
+void
+byte_freq_pin_model(const struct freq_model *model);
+
+void
+byte_freq_unpin(void);
+
+// Returns the frequency score of the given byte.
+unsigned char
+byte_freq(unsigned char c);
+
+// Returns the frequency score of the given byte in case insensitive mode,
+// where both the lower and upper case variants of a letter match.
+unsigned char
+byte_freq_icase(unsigned char c);
+
+// Returns how rare the given pair of consecutive bytes is, on the same
+// logarithmic scale: each 12 more means the pair occurs half as often. A
+// rarity of 0 marks the most common pairs. Without a trained sample, the
+// two bytes are assumed to be independent.
+unsigned int
+byte_pair_rarity(unsigned char a, unsigned char b, bool icase);
+
+// Estimates how rare the occurrences of the given literal are, on the same
+// scale, from the rarity of its first character and of each character
+// following the one before it. Characters outside of the byte range are
+// considered to be the rarest ones.
+unsigned int
+literal_rarity(string literal, bool icase);
+
+#endif // FREC_BYTE_FREQ_H
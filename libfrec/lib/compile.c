@@ -25,15 +25,43 @@
  */
 
 #include <sys/types.h>
+#include <ctype.h>
+#include <pthread.h>
 #include <stdlib.h>
+#include <string.h>
 #include <string-type.h>
 #include <wchar.h>
+#include <wctype.h>
 
 #include "bm.h"
+#include "byte-freq.h"
+#include "compile.h"
+#include "dfa.h"
 #include "frec-internal.h"
+#include "ac-comp.h"
+#include "parallel.h"
 #include "regex-parser.h"
+#include "teddy-comp.h"
 #include "wm-comp.h"
 
+// Aho-Corasick is used instead of Wu-Manber if the largest possible
+// Wu-Manber shift is at most this much. For large pattern sets, where
+// most of the shifts are even smaller, the second limit is used.
+#define AC_MAX_SHIFT 2
+#define AC_MAX_SHIFT_LARGE 3
+#define AC_LARGE_SET 1000
+
+// Pattern sets are compiled in parallel if every thread gets at least this
+// many patterns. The threads claim this many patterns at a time.
+#define COMPILE_MIN_SHARE 64
+#define COMPILE_CHUNK 16
+
+// The result of the patterns that were skipped, as an earlier one failed.
+#define COMPILE_SKIPPED -1
+
+// Held while a deferred automaton of the original matcher is compiled.
+static pthread_mutex_t original_lock = PTHREAD_MUTEX_INITIALIZER;
+
 // Compiles the bm_prep field of the frec struct based on the given pattern.
 // Additional flags can be specified in the cflags field.
 static int
@@ -91,6 +119,57 @@ compile_heuristic(frec_t *frec, string pattern, int cflags)
     return ret;
 }
 
+// Compiles the dfa field of the frec struct based on the given pattern.
+// Patterns the DFA doesn't support are left to the original matcher.
+static int
+compile_dfa(frec_t *frec, string pattern, int cflags)
+{
+    frec->dfa = NULL;
+    if (pattern.is_wide) {
+        return (REG_BADPAT);
+    }
+
+    dfa_comp *comp = malloc(sizeof(dfa_comp));
+    if (comp == NULL) {
+        return (REG_ESPACE);
+    }
+
+    int ret = dfa_compile(comp, pattern, cflags);
+    if (ret == REG_OK) {
+        frec->dfa = comp;
+    } else {
+        dfa_comp_free(comp);
+        free(comp);
+    }
+
+    return ret;
+}
+
+// Keeps a copy of the pattern and of the given flags in the frec struct,
+// so that the pattern can be serialized later.
+static int
+save_source(frec_t *frec, string pattern, int cflags)
+{
+    size_t size = pattern.is_wide ? sizeof(wchar_t) : sizeof(char);
+    const void *content = pattern.is_wide
+        ? (const void *) pattern.wide : (const void *) pattern.stnd;
+
+    frec->source = malloc(size * pattern.len + 1);
+    if (frec->source == NULL) {
+        return (REG_ESPACE);
+    }
+    memcpy(frec->source, content, size * pattern.len);
+
+    frec->source_len = pattern.len;
+    frec->source_wide = pattern.is_wide;
+    frec->source_cflags = cflags;
+    frec->is_borrowed = false;
+    return (REG_OK);
+}
+
+// Decides whether the pattern is literal. This also validates the pattern:
+// any pattern that the original matcher could reject is not literal, so that
+// literal patterns can be compiled by it lazily.
 static bool
 is_pattern_literal(string pattern, int in_flags)
 {
@@ -100,6 +179,14 @@ is_pattern_literal(string pattern, int in_flags)
 
     // Traverse the pattern:
 	for (ssize_t i = 0; i < pattern.len; i++) {
+        wchar_t c = pattern.is_wide
+            ? pattern.wide[i] : (wchar_t) (u_char) pattern.stnd[i];
+
+        // An unmatched parenthesis may be an error in ERE.
+        if (parser.extended && !parser.escaped && c == L')') {
+            return false;
+        }
+
         parse_result result;
         if (pattern.is_wide) {
             result = parse_wchar(&parser, pattern.wide[i]);
@@ -119,32 +206,51 @@ is_pattern_literal(string pattern, int in_flags)
 		}
 	}
 
-    return true;
+    // A trailing escape character is an error.
+    return !parser.escaped;
 }
 
-int
-frec_compile(frec_t *frec, string pattern, int cflags)
+// Compiles a pattern, see frec_compile. The caller holds the lock of the
+// frequency model.
+static int
+compile_pattern(frec_t *frec, string pattern, int cflags)
 {
+    /* Check if pattern is literal. */
+    bool is_literal = (cflags & REG_LITERAL) || is_pattern_literal(pattern, cflags);
+    frec->is_literal = is_literal;
+    frec->is_removed = false;
+
     // Compile NFA using our regex library. If we can't optimize, we
     // can still use this original struct, and this way, we validate
-    // the pattern automatically.
-    int ret = (pattern.is_wide)
-        ? _dist_regwncomp(&frec->original, pattern.wide, pattern.len, cflags)
-        : _dist_regncomp(&frec->original, pattern.stnd, pattern.len, cflags);
+    // the pattern automatically. Literal patterns are already valid, and
+    // rarely need it, so for these, it is compiled when first needed.
+    int ret = REG_OK;
+    if (!is_literal) {
+        ret = (pattern.is_wide)
+            ? _dist_regwncomp(&frec->original, pattern.wide, pattern.len, cflags)
+            : _dist_regncomp(&frec->original, pattern.stnd, pattern.len, cflags);
+        if (ret != REG_OK) {
+            return ret;
+        }
+    }
+    frec->has_original = !is_literal;
+
+    ret = save_source(frec, pattern, cflags);
     if (ret != REG_OK) {
+        if (frec->has_original) {
+            _dist_regfree(&frec->original);
+        }
         return ret;
     }
 
-    /* Check if pattern is literal. */
-    bool is_literal = (cflags & REG_LITERAL) || is_pattern_literal(pattern, cflags);
-    frec->is_literal = is_literal;
-
     // Try and compile BM prep struct. Modify the REG_LITERAL flag if needed.
+    // Patterns that were only found to be literal may still contain escape
+    // characters, so these are compiled with the original flags.
     int flags = cflags;
     if (is_literal) {
         cflags |= REG_LITERAL;
     }
-    ret = compile_boyer_moore(frec, pattern, cflags);
+    ret = compile_boyer_moore(frec, pattern, flags);
 
     // A heuristic approach is only needed if the pattern is not literal.
     if (ret != REG_OK && !(cflags & REG_LITERAL)) {
@@ -153,14 +259,220 @@ frec_compile(frec_t *frec, string pattern, int cflags)
         frec->heuristic = NULL;
     }
 
+    // Whenever the original matcher may be needed, a DFA can replace it.
+    if (ret != REG_OK) {
+        compile_dfa(frec, pattern, cflags);
+    } else {
+        frec->dfa = NULL;
+    }
+
     // We save the compilation flags. At this point, at least
     // the library-supplied NFA compilation was successful.
     frec->cflags = cflags;
     return (REG_OK);
 }
 
+int
+frec_compile(frec_t *frec, string pattern, int cflags)
+{
+    byte_freq_pin();
+    int ret = compile_pattern(frec, pattern, cflags);
+    byte_freq_unpin();
+    return ret;
+}
+
+int
+frec_compile_original(const frec_t *frec)
+{
+    if (__atomic_load_n(&frec->has_original, __ATOMIC_ACQUIRE)) {
+        return (REG_OK);
+    }
+
+    // The struct is shared by the callers, so only one of them compiles.
+    pthread_mutex_lock(&original_lock);
+
+    int ret = REG_OK;
+    if (!frec->has_original) {
+        frec_t *lazy = (frec_t *) frec;
+        ret = (frec->source_wide)
+            ? _dist_regwncomp(&lazy->original,
+                (frec->source != NULL) ? frec->source : L"",
+                frec->source_len, frec->source_cflags)
+            : _dist_regncomp(&lazy->original,
+                (frec->source != NULL) ? frec->source : "",
+                frec->source_len, frec->source_cflags);
+        if (ret == REG_OK) {
+            __atomic_store_n(&lazy->has_original, true, __ATOMIC_RELEASE);
+        }
+    }
+
+    pthread_mutex_unlock(&original_lock);
+    return ret;
+}
+
+// The patterns of a set, compiled by several threads at once.
+typedef struct compile_job {
+    frec_t *frecs;
+    const string *patterns;
+    int *results;            // The result of each pattern.
+    ssize_t count;
+    int cflags;
+    const struct freq_model *model; // The frequency model of the set.
+
+    ssize_t next;            // The first pattern not yet claimed.
+    ssize_t failed_at;       // The first pattern found to be invalid.
+} compile_job;
+
+static void
+compile_worker(void *arg, size_t worker)
+{
+    compile_job *job = arg;
+    (void) worker;
+
+    byte_freq_pin_model(job->model);
+    while (true) {
+        ssize_t start = __atomic_fetch_add(&job->next, COMPILE_CHUNK,
+            __ATOMIC_RELAXED);
+        if (start >= job->count) {
+            break;
+        }
+
+        ssize_t end = start + COMPILE_CHUNK;
+        for (ssize_t i = start; i < end && i < job->count; i++) {
+            // Patterns after an invalid one don't matter anymore.
+            if (i > __atomic_load_n(&job->failed_at, __ATOMIC_RELAXED)) {
+                job->results[i] = COMPILE_SKIPPED;
+                continue;
+            }
+
+            int ret = compile_pattern(&job->frecs[i], job->patterns[i],
+                job->cflags);
+            job->results[i] = ret;
+
+            ssize_t failed = __atomic_load_n(&job->failed_at, __ATOMIC_RELAXED);
+            while (ret != REG_OK && i < failed
+                && !__atomic_compare_exchange_n(&job->failed_at, &failed, i,
+                    false, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+            }
+        }
+    }
+    byte_freq_unpin();
+}
+
+// Compiles each pattern of the set, on multiple threads if that was
+// requested. On error, the mfrec struct is freed, and its err field is set
+// to the first invalid pattern, regardless of the number of threads.
+// The caller has the frequency model pinned.
+static int
+compile_patterns(mfrec_t *mfrec, const string *patterns, ssize_t n,
+    int cflags)
+{
+    size_t workers = parallel_workers((size_t) n, COMPILE_MIN_SHARE);
+    int *results = (workers > 1) ? malloc(sizeof(int) * n) : NULL;
+
+    if (results == NULL) {
+        for (ssize_t i = 0; i < n; i++) {
+            int ret = compile_pattern(&mfrec->patterns[i], patterns[i], cflags);
+            // On error, we record the index of the bad pattern.
+            if (ret != REG_OK) {
+                mfrec->err = i;
+                frec_mregfree(mfrec);
+                return ret;
+            }
+        }
+        return (REG_OK);
+    }
+
+    // The workers use the model pinned by the caller.
+    compile_job job = {mfrec->patterns, patterns, results, n, cflags,
+        byte_freq_pin(), 0, n};
+    parallel_run(compile_worker, &job, workers);
+    byte_freq_unpin();
+
+    // Every pattern before the first invalid one was compiled, but some of
+    // the ones after it may have been compiled too.
+    int ret = REG_OK;
+    if (job.failed_at < n) {
+        ret = results[job.failed_at];
+        for (ssize_t i = job.failed_at + 1; i < n; i++) {
+            if (results[i] == REG_OK) {
+                frec_regfree(&mfrec->patterns[i]);
+            }
+        }
+        mfrec->err = job.failed_at;
+        frec_mregfree(mfrec);
+    }
+
+    free(results);
+    return ret;
+}
+
+// Compiles the multi-pattern literal engine of the mfrec struct from
+// the given literals, one for each pattern. Small sets of standard
+// character literals use Teddy. For larger ones, Aho-Corasick is selected
+// when the Wu-Manber shifts would be ineffective, otherwise Wu-Manber is used.
+static int
+compile_literal_set(mfrec_t *mfrec, const string *literals, ssize_t n,
+    int cflags)
+{
+    bool is_wide = literals[0].is_wide;
+
+    // Teddy only compares case insensitively if MB_CUR_MAX == 1.
+    if (!is_wide && n <= TEDDY_MAX_PATTERNS
+        && !((cflags & REG_ICASE) && MB_CUR_MAX > 1)) {
+        teddy_comp *comp = malloc(sizeof(teddy_comp));
+        if (comp == NULL) {
+            return (REG_ESPACE);
+        }
+        mfrec->teddy = comp;
+
+        return teddy_compile(comp, literals, n, cflags);
+    }
+
+    ssize_t len_shortest = literals[0].len;
+    for (ssize_t i = 1; i < n; i++) {
+        if (literals[i].len < len_shortest) {
+            len_shortest = literals[i].len;
+        }
+    }
+
+    ssize_t max_shift = wm_max_shift(n, len_shortest);
+    bool use_ac = !is_wide
+        && (max_shift <= AC_MAX_SHIFT
+            || (max_shift <= AC_MAX_SHIFT_LARGE && n >= AC_LARGE_SET));
+
+    if (use_ac) {
+        ac_comp *comp = malloc(sizeof(ac_comp));
+        if (comp == NULL) {
+            return (REG_ESPACE);
+        }
+        mfrec->aho_corasick = comp;
+
+        return ac_compile(comp, literals, n, cflags);
+    } else {
+        wm_comp *comp = malloc(sizeof(wm_comp));
+        if (comp == NULL) {
+            return (REG_ESPACE);
+        }
+        mfrec->wu_manber = comp;
+
+        return wm_compile(comp, literals, n, cflags);
+    }
+}
+
 int
 frec_mcompile(mfrec_t *mfrec, const string *patterns, ssize_t n, int cflags) {
+    mfrec->wu_manber = NULL;
+    mfrec->aho_corasick = NULL;
+    mfrec->teddy = NULL;
+    mfrec->ids = NULL;
+    mfrec->by_literal = NULL;
+    mfrec->literal_ties = false;
+    mfrec->removed = 0;
+    mfrec->capacity = n;
+    mfrec->reach = 0;
+    mfrec->reach_lines = false;
+
     mfrec->patterns = malloc(sizeof(frec_t) * n);
     if (mfrec->patterns == NULL) {
         return (REG_ESPACE);
@@ -170,97 +482,551 @@ frec_mcompile(mfrec_t *mfrec, const string *patterns, ssize_t n, int cflags) {
     mfrec->count = n;
     mfrec->cflags = cflags;
 
-    bool are_literal = true;
+    // Compile each pattern, all of them with the same frequency model.
+    byte_freq_pin();
+    int ret = compile_patterns(mfrec, patterns, n, cflags);
+    byte_freq_unpin();
+    if (ret != REG_OK) {
+        return ret;
+    }
+
+    ret = frec_mcompile_engine(mfrec);
+    if (ret != REG_OK) {
+        frec_mregfree(mfrec);
+        return ret;
+    }
+
+    return (REG_OK);
+}
+
+bool
+frec_engine_literal(const frec_t *frec, string *literal)
+{
+    if (frec->boyer_moore != NULL) {
+        string_reference(literal, frec->boyer_moore->pattern);
+    } else if (frec->heuristic != NULL) {
+        string_reference(literal, frec->heuristic->literal_comp.pattern);
+    } else {
+        return false;
+    }
+    return literal->len > 0;
+}
+
+unsigned int
+frec_literal_char(string str, ssize_t at, bool icase)
+{
+    if (str.is_wide) {
+        wint_t c = (wint_t) str.wide[at];
+        return (unsigned int) (icase ? towlower(c) : c);
+    }
+
+    unsigned char c = (unsigned char) str.stnd[at];
+    return (unsigned int) (icase ? tolower(c) : c);
+}
+
+// Orders the literals like a dictionary, so that each one precedes the
+// literals it is a prefix of.
+static int
+compare_literals(string a, string b, bool icase)
+{
+    ssize_t len = (a.len < b.len) ? a.len : b.len;
+    for (ssize_t i = 0; i < len; i++) {
+        unsigned int char_a = frec_literal_char(a, i, icase);
+        unsigned int char_b = frec_literal_char(b, i, icase);
+        if (char_a != char_b) {
+            return (char_a < char_b) ? -1 : 1;
+        }
+    }
+    return (a.len > b.len) - (a.len < b.len);
+}
+
+// Whether the first literal is a prefix of the second one. Only literals
+// like these can be found at the same position of a text.
+static bool
+is_literal_prefix(string prefix, string literal, bool icase)
+{
+    if (prefix.len > literal.len) {
+        return false;
+    }
+    for (ssize_t i = 0; i < prefix.len; i++) {
+        if (frec_literal_char(prefix, i, icase)
+            != frec_literal_char(literal, i, icase)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// A pattern of the set, while the set is ordered by the literals.
+typedef struct literal_entry {
+    string literal;
+    uint32_t id;
+    bool icase;
+} literal_entry;
+
+static int
+compare_entries(const void *a, const void *b)
+{
+    const literal_entry *entry_a = a;
+    const literal_entry *entry_b = b;
+
+    int ret = compare_literals(entry_a->literal, entry_b->literal,
+        entry_a->icase);
+    if (ret == 0) {
+        ret = (entry_a->id > entry_b->id) - (entry_a->id < entry_b->id);
+    }
+    return ret;
+}
+
+// Orders the patterns of the engine by their literal, so that every pattern
+// whose literal occurs at a position can be found, not only the one that
+// the engine reports.
+static int
+order_literals(mfrec_t *mfrec, const string *literals, ssize_t n)
+{
+    bool icase = mfrec->cflags & REG_ICASE;
+
+    literal_entry *entries = malloc(sizeof(literal_entry) * n);
+    mfrec->by_literal = malloc(sizeof(uint32_t) * mfrec->capacity);
+    if (entries == NULL || mfrec->by_literal == NULL) {
+        free(entries);
+        return (REG_ESPACE);
+    }
 
-    // Compile each pattern.
     for (ssize_t i = 0; i < n; i++) {
-        int ret = frec_compile(&mfrec->patterns[i], patterns[i], cflags);
-        // On error, we record the index of the bad pattern.
-        if (ret != REG_OK) {
-            mfrec->err = i;
-            frec_mregfree(mfrec);
-            return ret;
+        entries[i].literal = literals[i];
+        entries[i].id = (mfrec->ids != NULL) ? mfrec->ids[i] : (uint32_t) i;
+        entries[i].icase = icase;
+    }
+    qsort(entries, n, sizeof(literal_entry), compare_entries);
+
+    // If a literal is the prefix of any other one, it is also the prefix of
+    // the one after it.
+    mfrec->literal_ties = false;
+    for (ssize_t i = 0; i < n; i++) {
+        mfrec->by_literal[i] = entries[i].id;
+        if (i > 0 && is_literal_prefix(entries[i - 1].literal,
+            entries[i].literal, icase)) {
+            mfrec->literal_ties = true;
+        }
+    }
+
+    free(entries);
+    return (REG_OK);
+}
+
+// Returns where the pattern with the given literal and id is, or would be,
+// in the first n ordered patterns of the set.
+static ssize_t
+literal_index(const mfrec_t *mfrec, ssize_t n, string literal, uint32_t id)
+{
+    bool icase = mfrec->cflags & REG_ICASE;
+
+    ssize_t low = 0;
+    ssize_t high = n;
+    while (low < high) {
+        ssize_t mid = low + (high - low) / 2;
+        uint32_t mid_id = mfrec->by_literal[mid];
+
+        string mid_literal;
+        frec_engine_literal(&mfrec->patterns[mid_id], &mid_literal);
+        int ret = compare_literals(mid_literal, literal, icase);
+        if (ret < 0 || (ret == 0 && mid_id < id)) {
+            low = mid + 1;
+        } else {
+            high = mid;
         }
+    }
+    return low;
+}
+
+// Extends the reach of the set to cover the matches of the pattern, which
+// may start before the literal that the engine finds in them.
+static void
+add_reach(mfrec_t *mfrec, const frec_t *frec)
+{
+    const heur *heur = frec->heuristic;
+
+    // Literal patterns and literal prefixes start where they are found.
+    if (heur == NULL || heur->heur_type == HEUR_PREFIX) {
+        return;
+    }
+
+    if (heur->max_length == -1) {
+        mfrec->reach_lines = true;
+    } else {
+        ssize_t reach = heur->max_length - heur->literal_comp.pattern.len;
+        if (reach > mfrec->reach) {
+            mfrec->reach = reach;
+        }
+    }
+}
+
+// Frees the multi-pattern engine of the set, if it has one.
+static void
+free_engine(mfrec_t *mfrec)
+{
+    wm_comp_free(mfrec->wu_manber);
+    free(mfrec->wu_manber);
+    mfrec->wu_manber = NULL;
+
+    ac_comp_free(mfrec->aho_corasick);
+    free(mfrec->aho_corasick);
+    mfrec->aho_corasick = NULL;
+
+    teddy_comp_free(mfrec->teddy);
+    free(mfrec->teddy);
+    mfrec->teddy = NULL;
+
+    free(mfrec->ids);
+    mfrec->ids = NULL;
 
-        /* If any one of the patterns wasn't literal, set this flag to false */
-        if (!mfrec->patterns[i].is_literal) {
+    free(mfrec->by_literal);
+    mfrec->by_literal = NULL;
+    mfrec->literal_ties = false;
+}
+
+int
+frec_mcompile_engine(mfrec_t *mfrec)
+{
+    free_engine(mfrec);
+    mfrec->reach = 0;
+    mfrec->reach_lines = false;
+
+    ssize_t n = mfrec->count;
+    ssize_t live = n - mfrec->removed;
+
+    /* If any one of the patterns wasn't literal, set this flag to false */
+    bool are_literal = true;
+    for (ssize_t i = 0; i < n; i++) {
+        if (!mfrec->patterns[i].is_removed && !mfrec->patterns[i].is_literal) {
             are_literal = false;
         }
     }
 
     mfrec->are_literal = are_literal;
 
-    // If there's only one pattern, return early.
-    if (n == 1) {
+    // If there's only one pattern, return early. Without any patterns,
+    // there is nothing to speed up either.
+    if (n == 1 && live == 1) {
         mfrec->type = MHEUR_SINGLE;
         return (REG_OK);
+    } else if (live == 0) {
+        mfrec->type = MHEUR_NONE;
+        return (REG_OK);
     }
 
-    // Set the heuristic type based on the compilation flags.
-    if (cflags & REG_LITERAL || are_literal) {
-        // If the REG_LITERAL flag is set, use literal heuristics.
+    // Set the heuristic type based on the compilation flags. If the
+    // REG_LITERAL flag is set, use literal heuristics, else we'll use
+    // longest heuristics.
+    mfrec->type = (mfrec->cflags & REG_LITERAL || are_literal)
+        ? MHEUR_LITERAL
+        : MHEUR_LONGEST;
 
-        mfrec->type = MHEUR_LITERAL;
-    } else {
-        // Else we'll use longest heuristics with one exception.
-        // If there's a pattern with an empty Boyer Moore and an empty
-        // heuristic struct, we can't use any multi-pattern heuristics.
+    string *literals = malloc(sizeof(string) * live);
+    if (literals == NULL) {
+        return (REG_ESPACE);
+    }
 
-        for (ssize_t i = 0; i < n; i++) {
-            frec_t *curr = &mfrec->patterns[i];
-            bool no_heur = curr->boyer_moore == NULL && curr->heuristic == NULL;
-            if (no_heur) {
-                mfrec->type = MHEUR_NONE;
-                return (REG_OK);
-            }
+    // The engine only knows the patterns that weren't removed, so its ids
+    // have to be mapped back to the ids of the set.
+    if (live < n) {
+        mfrec->ids = malloc(sizeof(uint32_t) * mfrec->capacity);
+        if (mfrec->ids == NULL) {
+            free(literals);
+            return (REG_ESPACE);
+        }
+    }
+
+    // Reference the literal text of each pattern from the Boyer-Moore or
+    // the heuristic compilation phase. Literal patterns were stripped of
+    // their escape characters by these too.
+    // If there's a pattern without any of these, or with an empty literal,
+    // we can't use any multi-pattern heuristics.
+    ssize_t at = 0;
+    for (ssize_t i = 0; i < n; i++) {
+        frec_t *curr = &mfrec->patterns[i];
+        if (curr->is_removed) {
+            continue;
+        }
+
+        if (!frec_engine_literal(curr, &literals[at])) {
+            mfrec->type = MHEUR_NONE;
+            break;
         }
+        add_reach(mfrec, curr);
 
-        mfrec->type = MHEUR_LONGEST;
+        if (mfrec->ids != NULL) {
+            mfrec->ids[at] = (uint32_t) i;
+        }
+        at++;
     }
 
-    // If we reach this point, we'll definitely need this struct.
-    wm_comp *comp = malloc(sizeof(wm_comp));
-    if (comp == NULL) {
-        frec_mregfree(mfrec);
-        return (REG_ESPACE);
+    if (mfrec->type == MHEUR_NONE) {
+        free(literals);
+        free_engine(mfrec);
+        return (REG_OK);
     }
-    mfrec->wu_manber = comp;
 
-    // If the heuristic type was literal, we'll use the patterns as-is.
-    if (mfrec->type == MHEUR_LITERAL) {
-        int ret = wm_compile(comp, patterns, n, cflags);
-        if (ret != REG_OK) {
-            frec_mregfree(mfrec);
-            return ret;
+    // Execute compilation and free temporary arrays.
+    int ret = compile_literal_set(mfrec, literals, live, mfrec->cflags);
+    if (ret == REG_OK) {
+        ret = order_literals(mfrec, literals, live);
+    }
+    free(literals);
+
+    if (ret != REG_OK) {
+        free_engine(mfrec);
+        return ret;
+    }
+
+    return (REG_OK);
+}
+
+// Makes room for one more pattern in the arrays of the set.
+static bool
+grow_set(mfrec_t *mfrec)
+{
+    if (mfrec->count < mfrec->capacity) {
+        return true;
+    }
+    ssize_t capacity = mfrec->capacity * 2;
+
+    frec_t *patterns = realloc(mfrec->patterns, sizeof(frec_t) * capacity);
+    if (patterns == NULL) {
+        return false;
+    }
+    mfrec->patterns = patterns;
+
+    if (mfrec->ids != NULL) {
+        uint32_t *ids = realloc(mfrec->ids, sizeof(uint32_t) * capacity);
+        if (ids == NULL) {
+            return false;
         }
-    } else {
-        // Otherwise, we'll assemble the patterns from the Boyer-Moore
-        // or the heuristic compilation phase.
-        string *pat_refs = malloc(sizeof(string) * n);
-        if (pat_refs == NULL) {
-            frec_mregfree(mfrec);
-            return (REG_ESPACE);
+        mfrec->ids = ids;
+    }
+
+    if (mfrec->by_literal != NULL) {
+        uint32_t *by_literal = realloc(mfrec->by_literal,
+            sizeof(uint32_t) * capacity);
+        if (by_literal == NULL) {
+            return false;
         }
+        mfrec->by_literal = by_literal;
+    }
 
-        // Reference values from previous optimalizations.
-        for (size_t i = 0; i < n; i++) {
-            frec_t *curr = &mfrec->patterns[i];
-            if (curr->boyer_moore != NULL) {
-                string_reference(&pat_refs[i], curr->boyer_moore->pattern);
-            } else {
-                string_reference(&pat_refs[i], curr->heuristic->literal_comp.pattern);
-            }
+    mfrec->capacity = capacity;
+    return true;
+}
+
+// Returns the number of literals in the multi-pattern engine of the set,
+// including the removed ones.
+static ssize_t
+engine_count(const mfrec_t *mfrec)
+{
+    if (mfrec->teddy != NULL) {
+        return mfrec->teddy->count;
+    } else if (mfrec->aho_corasick != NULL) {
+        return mfrec->aho_corasick->count;
+    } else if (mfrec->wu_manber != NULL) {
+        return mfrec->wu_manber->count;
+    }
+    return 0;
+}
+
+// Adds a literal to the multi-pattern engine of the set, with the next
+// index. Each engine only updates the parts the literal changes.
+static int
+engine_add(mfrec_t *mfrec, string literal)
+{
+    if (mfrec->teddy != NULL) {
+        return teddy_add(mfrec->teddy, literal);
+    } else if (mfrec->aho_corasick != NULL) {
+        return ac_add(mfrec->aho_corasick, literal);
+    } else if (mfrec->wu_manber != NULL) {
+        return wm_add(mfrec->wu_manber, literal);
+    }
+    return (REG_BADPAT);
+}
+
+// Removes the literal with the given index from the multi-pattern engine
+// of the set.
+static int
+engine_remove(mfrec_t *mfrec, ssize_t index)
+{
+    if (mfrec->teddy != NULL) {
+        return teddy_remove(mfrec->teddy, index);
+    } else if (mfrec->aho_corasick != NULL) {
+        return ac_remove(mfrec->aho_corasick, index);
+    } else if (mfrec->wu_manber != NULL) {
+        return wm_remove(mfrec->wu_manber, index);
+    }
+    return (REG_BADPAT);
+}
+
+// Returns whether the multi-pattern engine of the set was edited so much
+// that it should be compiled again.
+static bool
+engine_needs_rebuild(const mfrec_t *mfrec)
+{
+    if (mfrec->teddy != NULL) {
+        return teddy_needs_rebuild(mfrec->teddy);
+    } else if (mfrec->aho_corasick != NULL) {
+        return ac_needs_rebuild(mfrec->aho_corasick);
+    } else if (mfrec->wu_manber != NULL) {
+        return wm_needs_rebuild(mfrec->wu_manber);
+    }
+    return true;
+}
+
+// Adds the last pattern of the set to its multi-pattern engine, if it
+// doesn't change the strategy of the set.
+static bool
+add_to_engine(mfrec_t *mfrec)
+{
+    frec_t *added = &mfrec->patterns[mfrec->count - 1];
+
+    string literal;
+    if (!frec_engine_literal(added, &literal)
+        || engine_add(mfrec, literal) != REG_OK) {
+        return false;
+    }
+
+    uint32_t id = (uint32_t) (mfrec->count - 1);
+    if (mfrec->ids != NULL) {
+        mfrec->ids[engine_count(mfrec) - 1] = id;
+    }
+
+    // The ordered patterns don't contain the added one yet.
+    bool icase = mfrec->cflags & REG_ICASE;
+    ssize_t live = mfrec->count - 1 - mfrec->removed;
+    ssize_t at = literal_index(mfrec, live, literal, id);
+    memmove(&mfrec->by_literal[at + 1], &mfrec->by_literal[at],
+        sizeof(uint32_t) * (live - at));
+    mfrec->by_literal[at] = id;
+
+    string other;
+    if (at > 0 && frec_engine_literal(
+            &mfrec->patterns[mfrec->by_literal[at - 1]], &other)
+        && is_literal_prefix(other, literal, icase)) {
+        mfrec->literal_ties = true;
+    }
+    if (at < live && frec_engine_literal(
+            &mfrec->patterns[mfrec->by_literal[at + 1]], &other)
+        && is_literal_prefix(literal, other, icase)) {
+        mfrec->literal_ties = true;
+    }
+    add_reach(mfrec, added);
+    if (!added->is_literal) {
+        mfrec->are_literal = false;
+        if (!(mfrec->cflags & REG_LITERAL)) {
+            mfrec->type = MHEUR_LONGEST;
         }
+    }
+    return true;
+}
 
-        // Execute compilation and free temporary arrays.
-        int ret = wm_compile(comp, pat_refs, n, cflags);
-        free(pat_refs);
+int
+frec_mcompile_add(mfrec_t *mfrec, string pattern, ssize_t *id)
+{
+    if (mfrec->count > 0 && pattern.is_wide != mfrec->patterns[0].source_wide) {
+        return (REG_BADPAT);
+    }
+    if (!grow_set(mfrec)) {
+        return (REG_ESPACE);
+    }
 
-        if (ret != REG_OK) {
-            frec_mregfree(mfrec);
-            return ret;
+    frec_t *added = &mfrec->patterns[mfrec->count];
+    int ret = frec_compile(added, pattern, mfrec->cflags);
+    if (ret != REG_OK) {
+        return ret;
+    }
+    added->is_removed = false;
+    *id = mfrec->count++;
+
+    // Most literals only change a few parts of the engine. Everything else
+    // changes the engine, or the strategy.
+    bool fast = (mfrec->type == MHEUR_LITERAL || mfrec->type == MHEUR_LONGEST)
+        && add_to_engine(mfrec);
+    if (fast && !engine_needs_rebuild(mfrec)) {
+        return (REG_OK);
+    }
+
+    // Without an engine, the set can still be matched pattern by pattern.
+    if (frec_mcompile_engine(mfrec) != REG_OK) {
+        mfrec->type = MHEUR_NONE;
+    }
+    return (REG_OK);
+}
+
+// Returns the index of the pattern in the multi-pattern engine.
+static ssize_t
+engine_index(const mfrec_t *mfrec, ssize_t id)
+{
+    if (mfrec->ids == NULL) {
+        return id;
+    }
+
+    // The ids only ever grow, so they are sorted.
+    ssize_t low = 0;
+    ssize_t high = engine_count(mfrec);
+    while (low < high) {
+        ssize_t mid = low + (high - low) / 2;
+        if (mfrec->ids[mid] < (uint32_t) id) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    return low;
+}
+
+int
+frec_mcompile_remove(mfrec_t *mfrec, ssize_t id)
+{
+    if (id < 0 || id >= mfrec->count || mfrec->patterns[id].is_removed) {
+        return (REG_BADPAT);
+    }
+
+    // The pattern is only ordered by its literal until it is freed. The
+    // patterns with the same literal follow it in this order.
+    string literal;
+    bool has_twin = false;
+    if (mfrec->by_literal != NULL
+        && frec_engine_literal(&mfrec->patterns[id], &literal)) {
+        ssize_t live = mfrec->count - mfrec->removed;
+        ssize_t at = literal_index(mfrec, live, literal, (uint32_t) id);
+        if (at < live && mfrec->by_literal[at] == (uint32_t) id) {
+            memmove(&mfrec->by_literal[at], &mfrec->by_literal[at + 1],
+                sizeof(uint32_t) * (live - at - 1));
         }
+
+        string other;
+        has_twin = at < live - 1 && frec_engine_literal(
+                &mfrec->patterns[mfrec->by_literal[at]], &other)
+            && compare_literals(literal, other,
+                mfrec->cflags & REG_ICASE) == 0;
+    }
+
+    frec_regfree(&mfrec->patterns[id]);
+    mfrec->patterns[id].is_removed = true;
+    mfrec->removed++;
+
+    // A removed pattern in the tables only costs a few comparisons, until
+    // enough of them have accumulated. Aho-Corasick only reports one of the
+    // patterns with the same literal, which may be the removed one.
+    bool fast = mfrec->type == MHEUR_NONE;
+    if (!fast && (mfrec->type == MHEUR_LITERAL || mfrec->type == MHEUR_LONGEST)
+        && !(has_twin && mfrec->aho_corasick != NULL)) {
+        fast = engine_remove(mfrec, engine_index(mfrec, id)) == REG_OK
+            && !engine_needs_rebuild(mfrec);
+    }
+    if (fast) {
+        return (REG_OK);
     }
 
+    if (frec_mcompile_engine(mfrec) != REG_OK) {
+        mfrec->type = MHEUR_NONE;
+    }
     return (REG_OK);
 }
@@ -14,6 +14,22 @@
 int
 frec_compile(frec_t *frec, string pattern, int cflags);
 
+// Compiles the automaton of the original matcher, if it was deferred by
+// frec_compile. Safe to call from multiple threads that share the struct.
+// Returns REG_OK once the original field can be used.
+int
+frec_compile_original(const frec_t *frec);
+
+// References the literal that the multi-pattern engines use for the
+// pattern. Returns false if it has none, or an empty one.
+bool
+frec_engine_literal(const frec_t *frec, string *literal);
+
+// Returns the character of the string at the given position, in lower case
+// if icase is set. The patterns of a set are ordered by these.
+unsigned int
+frec_literal_char(string str, ssize_t at, bool icase);
+
 // Given an mfrec_t struct and n patterns, compile an NFA struct
 // (supplied by the underlying library), a Boyer-Moore fast text
 // searching struct, and a custom heuristic struct for each pattern.
@@ -24,4 +40,21 @@ frec_compile(frec_t *frec, string pattern, int cflags);
 int
 frec_mcompile(mfrec_t *mfrec, const string *patterns, ssize_t n, int cflags);
 
+// Selects the matching type of an mfrec_t struct whose patterns are already
+// compiled, and compiles its multi-pattern engine over the patterns that
+// weren't removed. Any previous engine is freed.
+int
+frec_mcompile_engine(mfrec_t *mfrec);
+
+// Compiles the pattern and adds it to the set, with the next id. Literals
+// of Wu-Manber sets are added to its tables directly, any other change
+// compiles the engine of the set again.
+int
+frec_mcompile_add(mfrec_t *mfrec, string pattern, ssize_t *id);
+
+// Removes the pattern with the given id from the set. The ids of the others
+// stay the same. Returns REG_BADPAT if there is no such pattern.
+int
+frec_mcompile_remove(mfrec_t *mfrec, ssize_t id);
+
 #endif // FREC_COMPILE_H
@@ -0,0 +1,772 @@
+#include <ctype.h>
+#include <frec-config.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "dfa.h"
+
+// Limits of the supported patterns.
+#define DFA_MAX_NFA 10000  // Number of NFA nodes.
+#define DFA_MAX_DEPTH 256  // Depth of nested groups.
+#define DFA_MAX_REPEAT 255 // Bounds of repetitions (RE_DUP_MAX).
+
+// The serial of the last compiled NFA.
+static uint64_t next_serial = 0;
+
+// Types of the syntax tree nodes.
+#define AST_SET 0    // A byte of the set.
+#define AST_CAT 1    // left, then right.
+#define AST_ALT 2    // left or right.
+#define AST_REPEAT 3 // left, from min to max times (-1 if unbounded).
+#define AST_BOL 4    // ^ anchor.
+#define AST_EOL 5    // $ anchor.
+#define AST_EMPTY 6  // The empty string.
+
+typedef struct ast_node {
+    int type;
+    int left;
+    int right;
+    int min;
+    int max;
+    uint32_t set;
+} ast_node;
+
+// State of the pattern parser. The syntax tree is built in the ast array,
+// the byte sets of its nodes in the sets array.
+typedef struct dfa_parser {
+    const unsigned char *patt;
+    ssize_t len;
+    ssize_t pos;
+    ssize_t branch_start; // Where the last branch started.
+    int depth;
+
+    bool extended;
+    bool icase;
+    bool newline;
+    bool literal;
+    bool multibyte;
+
+    ast_node *ast;
+    int ast_count;
+    int ast_cap;
+
+    uint32_t (*sets)[8];
+    uint32_t set_count;
+    uint32_t set_cap;
+
+    int err; // Set to REG_BADPAT or REG_ESPACE on failure.
+} dfa_parser;
+
+static void
+set_add(uint32_t *set, unsigned char c)
+{
+    set[c >> 5] |= (uint32_t) 1 << (c & 31);
+}
+
+static bool
+set_has(const uint32_t *set, unsigned char c)
+{
+    return (set[c >> 5] >> (c & 31)) & 1;
+}
+
+static int
+new_node(dfa_parser *p, int type, int left, int right)
+{
+    if (p->ast_count == p->ast_cap) {
+        int cap = (p->ast_cap == 0) ? 64 : p->ast_cap * 2;
+        ast_node *ast = realloc(p->ast, sizeof(ast_node) * cap);
+        if (ast == NULL) {
+            p->err = REG_ESPACE;
+            return -1;
+        }
+        p->ast = ast;
+        p->ast_cap = cap;
+    }
+
+    ast_node *node = &p->ast[p->ast_count];
+    node->type = type;
+    node->left = left;
+    node->right = right;
+    node->min = 0;
+    node->max = 0;
+    node->set = 0;
+    return p->ast_count++;
+}
+
+// Creates a set node. Its byte set is filled by the caller.
+static int
+new_set_node(dfa_parser *p, uint32_t **set)
+{
+    if (p->set_count == p->set_cap) {
+        uint32_t cap = (p->set_cap == 0) ? 16 : p->set_cap * 2;
+        uint32_t (*sets)[8] = realloc(p->sets, sizeof(*sets) * cap);
+        if (sets == NULL) {
+            p->err = REG_ESPACE;
+            return -1;
+        }
+        p->sets = sets;
+        p->set_cap = cap;
+    }
+
+    int node = new_node(p, AST_SET, -1, -1);
+    if (node == -1) {
+        return -1;
+    }
+
+    p->ast[node].set = p->set_count;
+    *set = p->sets[p->set_count++];
+    memset(*set, 0, sizeof(uint32_t) * 8);
+    return node;
+}
+
+static int
+fail(dfa_parser *p)
+{
+    if (p->err == REG_OK) {
+        p->err = REG_BADPAT;
+    }
+    return -1;
+}
+
+// Adds both cases of the set members with REG_ICASE.
+static void
+fold_set(const dfa_parser *p, uint32_t *set)
+{
+    if (!p->icase) {
+        return;
+    }
+    for (int c = 0; c < 256; c++) {
+        if (set_has(set, c)) {
+            set_add(set, tolower(c));
+            set_add(set, toupper(c));
+        }
+    }
+}
+
+static int
+parse_char(dfa_parser *p, unsigned char c)
+{
+    // Multibyte characters are left for the original matcher.
+    if (p->multibyte && c >= 0x80) {
+        return fail(p);
+    }
+
+    uint32_t *set;
+    int node = new_set_node(p, &set);
+    if (node != -1) {
+        set_add(set, c);
+        fold_set(p, set);
+    }
+    return node;
+}
+
+static int
+parse_dot(dfa_parser *p)
+{
+    // In multibyte locales, the wildcard matches characters, not bytes.
+    if (p->multibyte) {
+        return fail(p);
+    }
+
+    uint32_t *set;
+    int node = new_set_node(p, &set);
+    if (node != -1) {
+        memset(set, 0xff, sizeof(uint32_t) * 8);
+        if (p->newline) {
+            set[0] &= ~((uint32_t) 1 << '\n');
+        }
+    }
+    return node;
+}
+
+// Adds the members of the named character class to the set.
+static bool
+add_class(dfa_parser *p, uint32_t *set, const char *name, size_t len)
+{
+    static const struct {
+        const char *name;
+        int (*test)(int);
+        bool ascii; // Whether it only has ASCII members in any locale.
+    } classes[] = {
+        {"alpha", isalpha, false}, {"digit", isdigit, true},
+        {"alnum", isalnum, false}, {"upper", isupper, false},
+        {"lower", islower, false}, {"space", isspace, true},
+        {"blank", isblank, true}, {"punct", ispunct, false},
+        {"print", isprint, false}, {"graph", isgraph, false},
+        {"cntrl", iscntrl, false}, {"xdigit", isxdigit, true}
+    };
+
+    for (size_t i = 0; i < sizeof(classes) / sizeof(classes[0]); i++) {
+        if (strlen(classes[i].name) != len
+            || strncmp(classes[i].name, name, len) != 0) {
+            continue;
+        }
+        if (p->multibyte && !classes[i].ascii) {
+            return false;
+        }
+
+        int until = (p->multibyte) ? 128 : 256;
+        for (int c = 0; c < until; c++) {
+            if (classes[i].test(c)) {
+                set_add(set, c);
+            }
+        }
+        return true;
+    }
+    return false;
+}
+
+// Parses a bracket expression, after its opening bracket.
+static int
+parse_bracket(dfa_parser *p)
+{
+    uint32_t *set;
+    int node = new_set_node(p, &set);
+    if (node == -1) {
+        return -1;
+    }
+
+    bool negate = false;
+    if (p->pos < p->len && p->patt[p->pos] == '^') {
+        negate = true;
+        p->pos++;
+    }
+
+    bool first = true;
+    while (true) {
+        if (p->pos >= p->len) {
+            return fail(p);
+        }
+
+        unsigned char c = p->patt[p->pos];
+        if (c == ']' && !first) {
+            p->pos++;
+            break;
+        }
+        first = false;
+
+        // Character classes. Collating elements and equivalence classes
+        // are not supported.
+        if (c == '[' && p->pos + 1 < p->len) {
+            unsigned char kind = p->patt[p->pos + 1];
+            if (kind == '.' || kind == '=') {
+                return fail(p);
+            } else if (kind == ':') {
+                ssize_t start = p->pos + 2;
+                ssize_t end = start;
+                while (end + 1 < p->len
+                    && !(p->patt[end] == ':' && p->patt[end + 1] == ']')) {
+                    end++;
+                }
+                if (end + 1 >= p->len || !add_class(p, set,
+                    (const char *) p->patt + start, end - start)) {
+                    return fail(p);
+                }
+                p->pos = end + 2;
+                continue;
+            }
+        }
+
+        // Backslashes may or may not be escapes, depending on the library.
+        if (c == '\\' || (p->multibyte && c >= 0x80)) {
+            return fail(p);
+        }
+
+        // Ranges, unless the dash is the last character.
+        p->pos++;
+        if (p->pos + 1 < p->len && p->patt[p->pos] == '-'
+            && p->patt[p->pos + 1] != ']') {
+            unsigned char end = p->patt[p->pos + 1];
+            if (end == '[' || end == '\\' || end < c
+                || (p->multibyte && end >= 0x80)) {
+                return fail(p);
+            }
+            for (int i = c; i <= end; i++) {
+                set_add(set, i);
+            }
+            p->pos += 2;
+        } else {
+            set_add(set, c);
+        }
+    }
+
+    fold_set(p, set);
+
+    if (negate) {
+        // Negated sets would match bytes of multibyte characters.
+        if (p->multibyte) {
+            return fail(p);
+        }
+        for (int i = 0; i < 8; i++) {
+            set[i] = ~set[i];
+        }
+        if (p->newline) {
+            set[0] &= ~((uint32_t) 1 << '\n');
+        }
+    }
+    return node;
+}
+
+static int parse_regex(dfa_parser *p);
+
+// Parses an interval after its opening brace, into min and max.
+static bool
+parse_interval(dfa_parser *p, int *min, int *max)
+{
+    int values[2] = { -1, -1 };
+    int count = 0;
+
+    for (int i = 0; i < 2; i++) {
+        int value = -1;
+        while (p->pos < p->len && isdigit(p->patt[p->pos])) {
+            value = (value == -1) ? 0 : value;
+            value = value * 10 + (p->patt[p->pos] - '0');
+            if (value > DFA_MAX_REPEAT) {
+                return false;
+            }
+            p->pos++;
+        }
+        values[i] = value;
+        count++;
+
+        if (i == 0 && p->pos < p->len && p->patt[p->pos] == ',') {
+            p->pos++;
+        } else {
+            break;
+        }
+    }
+
+    // The closing brace is escaped in basic mode.
+    if (!p->extended) {
+        if (p->pos >= p->len || p->patt[p->pos] != '\\') {
+            return false;
+        }
+        p->pos++;
+    }
+    if (p->pos >= p->len || p->patt[p->pos] != '}') {
+        return false;
+    }
+    p->pos++;
+
+    if (values[0] == -1) {
+        return false;
+    }
+
+    *min = values[0];
+    *max = (count == 1) ? values[0] : values[1];
+    return *max == -1 || *min <= *max;
+}
+
+// Whether the parser is at the end of a branch.
+static bool
+at_branch_end(const dfa_parser *p)
+{
+    if (p->pos >= p->len) {
+        return true;
+    }
+    if (p->literal) {
+        return false;
+    }
+
+    unsigned char c = p->patt[p->pos];
+    if (p->extended) {
+        return c == '|' || (c == ')' && p->depth > 0);
+    }
+    return c == '\\' && p->pos + 1 < p->len && p->patt[p->pos + 1] == ')'
+        && p->depth > 0;
+}
+
+static int
+parse_atom(dfa_parser *p)
+{
+    unsigned char c = p->patt[p->pos++];
+
+    if (p->literal) {
+        return parse_char(p, c);
+    }
+
+    switch (c) {
+        case '.':
+            return parse_dot(p);
+        case '[':
+            return parse_bracket(p);
+        case '^':
+            // Basic mode only has a ^ anchor at the start of the pattern.
+            // Anchors elsewhere than at the edges of the outermost branches
+            // are left for the original matcher.
+            if (p->depth > 0 || p->pos - 1 != p->branch_start) {
+                return fail(p);
+            }
+            return new_node(p, AST_BOL, -1, -1);
+        case '$':
+            // Basic mode only has a $ anchor at the end of the pattern.
+            if (p->depth > 0 || !at_branch_end(p)) {
+                return fail(p);
+            }
+            return new_node(p, AST_EOL, -1, -1);
+        case '*':
+            return fail(p);
+    }
+
+    if (p->extended) {
+        switch (c) {
+            case '(': {
+                if (++p->depth > DFA_MAX_DEPTH) {
+                    return fail(p);
+                }
+                int node = parse_regex(p);
+                if (node == -1 || p->pos >= p->len || p->patt[p->pos] != ')') {
+                    return fail(p);
+                }
+                p->pos++;
+                p->depth--;
+                return node;
+            }
+            case ')':
+            case '+':
+            case '?':
+            case '{':
+            case '|':
+                return fail(p);
+            case '\\':
+                if (p->pos >= p->len
+                    || !strchr("^.[]$()|*+?{}\\", p->patt[p->pos])) {
+                    return fail(p);
+                }
+                return parse_char(p, p->patt[p->pos++]);
+        }
+        return parse_char(p, c);
+    }
+
+    if (c == '\\') {
+        if (p->pos >= p->len) {
+            return fail(p);
+        }
+
+        unsigned char e = p->patt[p->pos++];
+        if (e == '(') {
+            if (++p->depth > DFA_MAX_DEPTH) {
+                return fail(p);
+            }
+            int node = parse_regex(p);
+            if (node == -1 || p->pos + 1 >= p->len
+                || p->patt[p->pos] != '\\' || p->patt[p->pos + 1] != ')') {
+                return fail(p);
+            }
+            p->pos += 2;
+            p->depth--;
+            return node;
+        } else if (strchr(".[]*^$\\", e)) {
+            return parse_char(p, e);
+        }
+        return fail(p);
+    }
+
+    return parse_char(p, c);
+}
+
+static int
+parse_piece(dfa_parser *p)
+{
+    int node = parse_atom(p);
+
+    while (node != -1 && p->pos < p->len && !p->literal) {
+        unsigned char c = p->patt[p->pos];
+        int min, max;
+
+        if (c == '*') {
+            min = 0;
+            max = -1;
+            p->pos++;
+        } else if (p->extended && (c == '+' || c == '?')) {
+            min = (c == '+') ? 1 : 0;
+            max = (c == '+') ? -1 : 1;
+            p->pos++;
+        } else if (p->extended && c == '{') {
+            p->pos++;
+            if (!parse_interval(p, &min, &max)) {
+                return fail(p);
+            }
+        } else if (!p->extended && c == '\\' && p->pos + 1 < p->len
+            && p->patt[p->pos + 1] == '{') {
+            p->pos += 2;
+            if (!parse_interval(p, &min, &max)) {
+                return fail(p);
+            }
+        } else {
+            break;
+        }
+
+        // Repeated anchors are left for the original matcher.
+        int type = p->ast[node].type;
+        if (type == AST_BOL || type == AST_EOL) {
+            return fail(p);
+        }
+
+        int repeat = new_node(p, AST_REPEAT, node, -1);
+        if (repeat == -1) {
+            return -1;
+        }
+        p->ast[repeat].min = min;
+        p->ast[repeat].max = max;
+        node = repeat;
+    }
+
+    return node;
+}
+
+static int
+parse_branch(dfa_parser *p)
+{
+    int node = -1;
+    p->branch_start = p->pos;
+
+    while (!at_branch_end(p)) {
+        int piece = parse_piece(p);
+        if (piece == -1) {
+            return -1;
+        }
+        node = (node == -1) ? piece : new_node(p, AST_CAT, node, piece);
+        if (node == -1) {
+            return -1;
+        }
+    }
+
+    return (node == -1) ? new_node(p, AST_EMPTY, -1, -1) : node;
+}
+
+static int
+parse_regex(dfa_parser *p)
+{
+    int node = parse_branch(p);
+
+    while (node != -1 && p->extended && !p->literal
+        && p->pos < p->len && p->patt[p->pos] == '|') {
+        p->pos++;
+
+        // Empty alternatives are left for the original matcher.
+        int branch = parse_branch(p);
+        if (branch == -1 || p->ast[node].type == AST_EMPTY
+            || p->ast[branch].type == AST_EMPTY) {
+            return fail(p);
+        }
+        node = new_node(p, AST_ALT, node, branch);
+    }
+
+    return node;
+}
+
+// Appends a node to the NFA. Returns its index, or DFA_UNKNOWN if the
+// NFA grew too large or on memory errors.
+static uint32_t
+emit_node(dfa_comp *comp, uint32_t *cap, uint32_t type, uint32_t out)
+{
+    if (comp->nfa_count >= DFA_MAX_NFA) {
+        return DFA_UNKNOWN;
+    }
+
+    if (comp->nfa_count == *cap) {
+        uint32_t new_cap = (*cap == 0) ? 64 : *cap * 2;
+        nfa_node *nfa = realloc(comp->nfa, sizeof(nfa_node) * new_cap);
+        if (nfa == NULL) {
+            return DFA_UNKNOWN;
+        }
+        comp->nfa = nfa;
+        *cap = new_cap;
+    }
+
+    nfa_node *node = &comp->nfa[comp->nfa_count];
+    node->type = type;
+    node->set = 0;
+    node->out = out;
+    node->out1 = DFA_UNKNOWN;
+    return comp->nfa_count++;
+}
+
+// Builds the NFA of the given syntax tree node backwards: the returned
+// node matches the tree node, and continues at next.
+static uint32_t
+emit(dfa_comp *comp, uint32_t *cap, const dfa_parser *p, int index,
+    uint32_t next)
+{
+    // Concatenations are built left-deep, walk them without recursion.
+    while (p->ast[index].type == AST_CAT && next != DFA_UNKNOWN) {
+        next = emit(comp, cap, p, p->ast[index].right, next);
+        index = p->ast[index].left;
+    }
+    if (next == DFA_UNKNOWN) {
+        return DFA_UNKNOWN;
+    }
+
+    const ast_node *node = &p->ast[index];
+    uint32_t id;
+
+    switch (node->type) {
+        case AST_SET:
+            id = emit_node(comp, cap, NFA_SET, next);
+            if (id != DFA_UNKNOWN) {
+                comp->nfa[id].set = node->set;
+            }
+            return id;
+        case AST_BOL:
+            comp->has_bol = true;
+            return emit_node(comp, cap, NFA_BOL, next);
+        case AST_EOL:
+            return emit_node(comp, cap, NFA_EOL, next);
+        case AST_EMPTY:
+            return next;
+        case AST_ALT: {
+            uint32_t left = emit(comp, cap, p, node->left, next);
+            uint32_t right = emit(comp, cap, p, node->right, next);
+            if (left == DFA_UNKNOWN || right == DFA_UNKNOWN) {
+                return DFA_UNKNOWN;
+            }
+            id = emit_node(comp, cap, NFA_SPLIT, left);
+            if (id != DFA_UNKNOWN) {
+                comp->nfa[id].out1 = right;
+            }
+            return id;
+        }
+    }
+
+    // Repetitions: the optional copies come last, either as a loop, or
+    // nested into each other, then the mandatory copies.
+    int min = node->min;
+    int max = node->max;
+    int sub = node->left;
+    uint32_t tail = next;
+
+    if (max == -1) {
+        uint32_t loop = emit_node(comp, cap, NFA_SPLIT, DFA_UNKNOWN);
+        if (loop == DFA_UNKNOWN) {
+            return DFA_UNKNOWN;
+        }
+        uint32_t body = emit(comp, cap, p, sub, loop);
+        if (body == DFA_UNKNOWN) {
+            return DFA_UNKNOWN;
+        }
+        comp->nfa[loop].out = body;
+        comp->nfa[loop].out1 = next;
+        tail = loop;
+    } else {
+        for (int i = min; i < max; i++) {
+            uint32_t body = emit(comp, cap, p, sub, tail);
+            if (body == DFA_UNKNOWN) {
+                return DFA_UNKNOWN;
+            }
+            tail = emit_node(comp, cap, NFA_SPLIT, body);
+            if (tail == DFA_UNKNOWN) {
+                return DFA_UNKNOWN;
+            }
+            comp->nfa[tail].out1 = next;
+        }
+    }
+
+    for (int i = 0; i < min; i++) {
+        tail = emit(comp, cap, p, sub, tail);
+        if (tail == DFA_UNKNOWN) {
+            return DFA_UNKNOWN;
+        }
+    }
+    return tail;
+}
+
+// Splits the bytes into classes, such that each byte set (and the line
+// feed, which is special with anchors) either contains all bytes of a
+// class, or none of them.
+static void
+build_classes(dfa_comp *comp)
+{
+    uint16_t remap[256][2];
+    uint16_t classes[256];
+
+    for (int c = 0; c < 256; c++) {
+        classes[c] = (c == '\n') ? 1 : 0;
+    }
+    uint16_t count = 2;
+
+    for (uint32_t s = 0; s < comp->set_count; s++) {
+        memset(remap, 0xff, sizeof(remap));
+        uint16_t next = 0;
+
+        for (int c = 0; c < 256; c++) {
+            uint16_t *target = &remap[classes[c]][set_has(comp->sets[s], c)];
+            if (*target == 0xffff) {
+                *target = next++;
+            }
+            classes[c] = *target;
+        }
+        count = next;
+    }
+
+    for (int c = 255; c >= 0; c--) {
+        comp->classes[c] = (uint8_t) classes[c];
+        comp->class_repr[classes[c]] = c;
+    }
+    comp->class_count = count;
+}
+
+void
+dfa_assign_serial(dfa_comp *comp)
+{
+    comp->serial = __atomic_add_fetch(&next_serial, 1, __ATOMIC_RELAXED);
+}
+
+int
+dfa_compile(dfa_comp *comp, string pattern, int cflags)
+{
+    dfa_comp_init(comp, cflags);
+
+    if (pattern.is_wide) {
+        return (REG_BADPAT);
+    }
+
+    dfa_parser p;
+    p.patt = (const unsigned char *) pattern.stnd;
+    p.len = pattern.len;
+    p.pos = 0;
+    p.depth = 0;
+    p.extended = cflags & REG_EXTENDED;
+    p.icase = cflags & REG_ICASE;
+    p.newline = cflags & REG_NEWLINE;
+    p.literal = cflags & REG_LITERAL;
+    p.multibyte = MB_CUR_MAX > 1;
+    p.ast = NULL;
+    p.ast_count = 0;
+    p.ast_cap = 0;
+    p.sets = NULL;
+    p.set_count = 0;
+    p.set_cap = 0;
+    p.err = REG_OK;
+
+    int root = parse_regex(&p);
+    if (root != -1 && p.pos != p.len) {
+        root = fail(&p);
+    }
+
+    // Build the NFA from the syntax tree, ending in the match node.
+    uint32_t cap = 0;
+    if (root != -1) {
+        uint32_t match = emit_node(comp, &cap, NFA_MATCH, DFA_UNKNOWN);
+        comp->nfa_start = (match == DFA_UNKNOWN)
+            ? DFA_UNKNOWN
+            : emit(comp, &cap, &p, root, match);
+        if (comp->nfa_start == DFA_UNKNOWN) {
+            root = fail(&p);
+        }
+    }
+
+    free(p.ast);
+    comp->sets = p.sets;
+    comp->set_count = p.set_count;
+
+    if (root == -1) {
+        dfa_comp_free(comp);
+        return p.err;
+    }
+
+    build_classes(comp);
+    dfa_assign_serial(comp);
+
+    return (REG_OK);
+}
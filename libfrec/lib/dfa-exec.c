@@ -0,0 +1,439 @@
+#include <frec-config.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "dfa.h"
+
+// Limits of the lazily built automata. If an automaton would have more
+// states, the caches are emptied and the original matcher is used for the
+// current text. After too many such resets, the DFA isn't used anymore.
+#define DFA_MAX_STATES 4096
+#define DFA_TABLE_SIZE (2 * DFA_MAX_STATES)
+#define DFA_MAX_RESETS 16
+
+// Returned internally if the automaton is full.
+#define DFA_FULL (-2)
+
+static bool
+set_has(const uint32_t *set, unsigned char c)
+{
+    return (set[c >> 5] >> (c & 31)) & 1;
+}
+
+// Starts a new closure: nodes added before are not marked anymore.
+static void
+next_mark(const dfa_comp *comp, dfa_context *ctx)
+{
+    if (++ctx->mark == 0) {
+        memset(ctx->marks, 0, sizeof(uint32_t) * comp->nfa_count);
+        ctx->mark = 1;
+    }
+}
+
+// Adds the nodes reachable from id without consuming bytes to out. The
+// ^ anchors are passed if bol is set, the $ anchors if eol is set, or are
+// added to out otherwise.
+static void
+add_closure(const dfa_comp *comp, dfa_context *ctx, uint32_t id, bool bol,
+    bool eol, uint32_t *out, uint32_t *count)
+{
+    uint32_t *stack = ctx->stack;
+    uint32_t top = 0;
+    stack[top++] = id;
+
+    while (top > 0) {
+        id = stack[--top];
+        if (ctx->marks[id] == ctx->mark) {
+            continue;
+        }
+        ctx->marks[id] = ctx->mark;
+
+        const nfa_node *node = &comp->nfa[id];
+        switch (node->type) {
+            case NFA_SPLIT:
+                stack[top++] = node->out1;
+                stack[top++] = node->out;
+                break;
+            case NFA_BOL:
+                if (bol) {
+                    stack[top++] = node->out;
+                }
+                break;
+            case NFA_EOL:
+                if (eol) {
+                    stack[top++] = node->out;
+                } else {
+                    out[(*count)++] = id;
+                }
+                break;
+            default:
+                out[(*count)++] = id;
+        }
+    }
+}
+
+// Adds the nodes that can be reached from the set through $ anchors to out.
+static void
+add_eol_closure(const dfa_comp *comp, dfa_context *ctx, const uint32_t *set,
+    uint32_t len, bool bol, uint32_t *out, uint32_t *count)
+{
+    next_mark(comp, ctx);
+    for (uint32_t i = 0; i < len; i++) {
+        if (comp->nfa[set[i]].type == NFA_EOL) {
+            add_closure(comp, ctx, comp->nfa[set[i]].out, bol, true,
+                out, count);
+        }
+    }
+}
+
+static int
+compare_ids(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *) a;
+    uint32_t y = *(const uint32_t *) b;
+    return (x > y) - (x < y);
+}
+
+static uint32_t
+hash_set(const uint32_t *set, uint32_t len, bool bol)
+{
+    uint32_t hash = 2166136261u ^ bol;
+    for (uint32_t i = 0; i < len; i++) {
+        hash = (hash ^ set[i]) * 16777619u;
+    }
+    return hash;
+}
+
+// Makes room for a new state in the cache. Returns false if it is full.
+static bool
+grow_cache(dfa_cache *cache, uint32_t class_count, uint32_t len)
+{
+    if (cache->state_count >= DFA_MAX_STATES) {
+        return false;
+    }
+
+    if (cache->table == NULL) {
+        cache->table = malloc(sizeof(uint32_t) * DFA_TABLE_SIZE);
+        if (cache->table == NULL) {
+            return false;
+        }
+        memset(cache->table, 0xff, sizeof(uint32_t) * DFA_TABLE_SIZE);
+    }
+
+    if (cache->state_count == cache->state_cap) {
+        uint32_t cap = (cache->state_cap == 0) ? 16 : cache->state_cap * 2;
+
+        uint32_t *trans = realloc(cache->trans,
+            sizeof(uint32_t) * cap * class_count);
+        if (trans == NULL) {
+            return false;
+        }
+        cache->trans = trans;
+
+        uint8_t *flags = realloc(cache->flags, cap);
+        if (flags == NULL) {
+            return false;
+        }
+        cache->flags = flags;
+
+        uint32_t *set_start = realloc(cache->set_start,
+            sizeof(uint32_t) * (cap + 1));
+        if (set_start == NULL) {
+            return false;
+        }
+        if (cache->state_cap == 0) {
+            set_start[0] = 0;
+        }
+        cache->set_start = set_start;
+        cache->state_cap = cap;
+    }
+
+    if (cache->nodes == NULL || cache->nodes_len + len > cache->nodes_cap) {
+        uint32_t cap = (cache->nodes_cap == 0) ? 256 : cache->nodes_cap;
+        while (cap < cache->nodes_len + len) {
+            cap *= 2;
+        }
+
+        uint32_t *nodes = realloc(cache->nodes, sizeof(uint32_t) * cap);
+        if (nodes == NULL) {
+            return false;
+        }
+        cache->nodes = nodes;
+        cache->nodes_cap = cap;
+    }
+
+    return true;
+}
+
+// Returns the state of the given NFA node set (which is sorted here),
+// creating it if needed. Returns DFA_UNKNOWN if the cache is full.
+static uint32_t
+find_state(const dfa_comp *comp, dfa_context *ctx, dfa_cache *cache,
+    uint32_t *set, uint32_t len, bool bol)
+{
+    qsort(set, len, sizeof(uint32_t), compare_ids);
+
+    uint32_t slot = hash_set(set, len, bol) & (DFA_TABLE_SIZE - 1);
+    while (cache->table != NULL && cache->table[slot] != DFA_UNKNOWN) {
+        uint32_t state = cache->table[slot];
+        uint32_t start = cache->set_start[state];
+        uint32_t end = cache->set_start[state + 1];
+
+        if (end - start == len && ((cache->flags[state] & DFA_BOL) != 0) == bol
+            && memcmp(cache->nodes + start, set, sizeof(uint32_t) * len) == 0) {
+            return state;
+        }
+        slot = (slot + 1) & (DFA_TABLE_SIZE - 1);
+    }
+
+    if (!grow_cache(cache, comp->class_count, len)) {
+        return DFA_UNKNOWN;
+    }
+
+    // The table was allocated with the first state.
+    slot = hash_set(set, len, bol) & (DFA_TABLE_SIZE - 1);
+    while (cache->table[slot] != DFA_UNKNOWN) {
+        slot = (slot + 1) & (DFA_TABLE_SIZE - 1);
+    }
+
+    uint32_t state = cache->state_count++;
+    cache->table[slot] = state;
+
+    memcpy(cache->nodes + cache->nodes_len, set, sizeof(uint32_t) * len);
+    cache->nodes_len += len;
+    cache->set_start[state + 1] = cache->nodes_len;
+
+    memset(cache->trans + (size_t) state * comp->class_count, 0xff,
+        sizeof(uint32_t) * comp->class_count);
+
+    // Compute the flags of the state.
+    uint8_t flags = (bol) ? DFA_BOL : 0;
+    if (len == 0 && cache->anchored) {
+        flags |= DFA_DEAD;
+    }
+
+    bool has_eol = false;
+    for (uint32_t i = 0; i < len; i++) {
+        uint32_t type = comp->nfa[set[i]].type;
+        if (type == NFA_MATCH) {
+            flags |= DFA_ACCEPT;
+        } else if (type == NFA_EOL) {
+            has_eol = true;
+        }
+    }
+
+    if (has_eol && !(flags & DFA_ACCEPT)) {
+        uint32_t *eol = ctx->buffer + 2 * comp->nfa_count;
+        uint32_t count = 0;
+        add_eol_closure(comp, ctx, set, len, bol, eol, &count);
+        for (uint32_t i = 0; i < count; i++) {
+            if (comp->nfa[eol[i]].type == NFA_MATCH) {
+                flags |= DFA_ACCEPT_EOL;
+            }
+        }
+    }
+
+    cache->flags[state] = flags;
+    return state;
+}
+
+// Returns the start state, at the start of a line if bol is set.
+static uint32_t
+start_state(const dfa_comp *comp, dfa_context *ctx, dfa_cache *cache, bool bol)
+{
+    bol = bol && comp->has_bol;
+    if (cache->start[bol] != DFA_UNKNOWN) {
+        return cache->start[bol];
+    }
+
+    uint32_t *set = ctx->buffer;
+    uint32_t count = 0;
+    next_mark(comp, ctx);
+    add_closure(comp, ctx, comp->nfa_start, bol, false, set, &count);
+
+    uint32_t state = find_state(comp, ctx, cache, set, count, bol);
+    cache->start[bol] = state;
+    return state;
+}
+
+// Computes the transition of the state on the given byte class.
+static uint32_t
+compute_transition(const dfa_comp *comp, dfa_context *ctx, dfa_cache *cache,
+    uint32_t state, uint32_t cls)
+{
+    unsigned char c = comp->class_repr[cls];
+    bool newline = comp->cflags & REG_NEWLINE;
+    bool is_lf = (c == '\n');
+    bool bol = (cache->flags[state] & DFA_BOL) != 0;
+
+    // Copy the set, the cache arrays may be moved by find_state.
+    uint32_t *source = ctx->buffer + comp->nfa_count;
+    uint32_t start = cache->set_start[state];
+    uint32_t len = cache->set_start[state + 1] - start;
+    memcpy(source, cache->nodes + start, sizeof(uint32_t) * len);
+
+    // A $ anchor matches before the line feed with REG_NEWLINE.
+    if (newline && is_lf) {
+        add_eol_closure(comp, ctx, cache->nodes + start, len, bol,
+            source, &len);
+    }
+
+    bool next_bol = newline && is_lf && comp->has_bol;
+    uint32_t *target = ctx->buffer;
+    uint32_t count = 0;
+
+    next_mark(comp, ctx);
+    for (uint32_t i = 0; i < len; i++) {
+        const nfa_node *node = &comp->nfa[source[i]];
+        if (node->type == NFA_SET && set_has(comp->sets[node->set], c)) {
+            add_closure(comp, ctx, node->out, next_bol, false,
+                target, &count);
+        }
+    }
+
+    // The unanchored automaton can start a new match anywhere.
+    if (!cache->anchored) {
+        add_closure(comp, ctx, comp->nfa_start, next_bol, false,
+            target, &count);
+    }
+
+    uint32_t next = find_state(comp, ctx, cache, target, count, next_bol);
+    if (next != DFA_UNKNOWN) {
+        cache->trans[(size_t) state * comp->class_count + cls] = next;
+    }
+    return next;
+}
+
+// Whether a match ends at position i of the text in the given state.
+static inline bool
+accepts(const dfa_comp *comp, uint8_t flags, const unsigned char *text,
+    ssize_t len, ssize_t i, bool noteol)
+{
+    if (flags & DFA_ACCEPT) {
+        return true;
+    }
+    if (flags & DFA_ACCEPT_EOL) {
+        return (i == len && !noteol)
+            || ((comp->cflags & REG_NEWLINE) && i < len && text[i] == '\n');
+    }
+    return false;
+}
+
+static int
+execute(frec_match_t *result, const dfa_comp *comp, dfa_context *ctx,
+    string text, int eflags, bool bounds)
+{
+    const unsigned char *t = (const unsigned char *) text.stnd;
+    ssize_t len = text.len;
+    bool newline = comp->cflags & REG_NEWLINE;
+    bool bol = !(eflags & REG_NOTBOL);
+    bool noteol = eflags & REG_NOTEOL;
+    uint32_t k = comp->class_count;
+
+    // Find the earliest end of any match with the unanchored automaton.
+    dfa_cache *cache = &ctx->unanchored;
+    uint32_t state = start_state(comp, ctx, cache, bol);
+    if (state == DFA_UNKNOWN) {
+        return (DFA_FULL);
+    }
+
+    ssize_t first_end = -1;
+    if (accepts(comp, cache->flags[state], t, len, 0, noteol)) {
+        first_end = 0;
+    }
+
+    for (ssize_t i = 0; i < len && first_end == -1; i++) {
+        uint32_t cls = comp->classes[t[i]];
+        uint32_t next = cache->trans[(size_t) state * k + cls];
+        if (next == DFA_UNKNOWN) {
+            next = compute_transition(comp, ctx, cache, state, cls);
+            if (next == DFA_UNKNOWN) {
+                return (DFA_FULL);
+            }
+        }
+        state = next;
+
+        uint8_t flags = cache->flags[state];
+        if ((flags & (DFA_ACCEPT | DFA_ACCEPT_EOL))
+            && accepts(comp, flags, t, len, i + 1, noteol)) {
+            first_end = i + 1;
+        }
+    }
+
+    if (first_end == -1) {
+        return (REG_NOMATCH);
+    }
+    if (!bounds) {
+        return (REG_OK);
+    }
+
+    // The leftmost match starts at the latest where the earliest one ends.
+    // Try each start with the anchored automaton, and find the longest match
+    // from the first one that matches. Pathological texts are left for the
+    // original matcher.
+    cache = &ctx->anchored;
+    ssize_t budget = 4 * len + 4096;
+
+    for (ssize_t s = 0; s <= first_end; s++) {
+        bool at_bol = (s == 0) ? bol : (newline && t[s - 1] == '\n');
+        state = start_state(comp, ctx, cache, at_bol);
+        if (state == DFA_UNKNOWN) {
+            return (DFA_FULL);
+        }
+
+        ssize_t end = -1;
+        if (accepts(comp, cache->flags[state], t, len, s, noteol)) {
+            end = s;
+        }
+
+        for (ssize_t i = s; i < len; i++) {
+            if (cache->flags[state] & DFA_DEAD) {
+                break;
+            }
+            if (--budget < 0) {
+                return (DFA_FALLBACK);
+            }
+
+            uint32_t cls = comp->classes[t[i]];
+            uint32_t next = cache->trans[(size_t) state * k + cls];
+            if (next == DFA_UNKNOWN) {
+                next = compute_transition(comp, ctx, cache, state, cls);
+                if (next == DFA_UNKNOWN) {
+                    return (DFA_FULL);
+                }
+            }
+            state = next;
+
+            if (accepts(comp, cache->flags[state], t, len, i + 1, noteol)) {
+                end = i + 1;
+            }
+        }
+
+        if (end != -1) {
+            result->soffset = s;
+            result->eoffset = end;
+            return (REG_OK);
+        }
+    }
+
+    return (DFA_FALLBACK);
+}
+
+int
+dfa_execute(frec_match_t *result, const dfa_comp *comp, dfa_context *ctx,
+    string text, int eflags, bool bounds)
+{
+    if (text.is_wide || ctx->resets > DFA_MAX_RESETS) {
+        return (DFA_FALLBACK);
+    }
+
+    int ret = execute(result, comp, ctx, text, eflags, bounds);
+    if (ret == DFA_FULL) {
+        dfa_cache_reset(&ctx->unanchored);
+        dfa_cache_reset(&ctx->anchored);
+        ctx->resets++;
+        ret = DFA_FALLBACK;
+    }
+
+    return ret;
+}
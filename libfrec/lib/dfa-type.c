@@ -0,0 +1,103 @@
+#include <frec-config.h>
+#include <stdlib.h>
+#include "dfa-type.h"
+
+static void
+cache_init(dfa_cache *cache, bool anchored)
+{
+    cache->state_count = 0;
+    cache->state_cap = 0;
+    cache->trans = NULL;
+    cache->flags = NULL;
+    cache->set_start = NULL;
+    cache->nodes = NULL;
+    cache->nodes_len = 0;
+    cache->nodes_cap = 0;
+    cache->table = NULL;
+    cache->start[0] = DFA_UNKNOWN;
+    cache->start[1] = DFA_UNKNOWN;
+    cache->anchored = anchored;
+}
+
+static void
+cache_free(dfa_cache *cache)
+{
+    free(cache->trans);
+    free(cache->flags);
+    free(cache->set_start);
+    free(cache->nodes);
+    free(cache->table);
+    cache_init(cache, cache->anchored);
+}
+
+void
+dfa_comp_init(dfa_comp *comp, int cflags)
+{
+    comp->nfa = NULL;
+    comp->nfa_count = 0;
+    comp->nfa_start = 0;
+    comp->sets = NULL;
+    comp->set_count = 0;
+    comp->class_count = 0;
+    comp->has_bol = false;
+    comp->serial = 0;
+    comp->cflags = cflags;
+    comp->borrowed = false;
+}
+
+void
+dfa_comp_free(dfa_comp *comp)
+{
+    if (comp != NULL) {
+        if (!comp->borrowed) {
+            free(comp->nfa);
+            free(comp->sets);
+        }
+        dfa_comp_init(comp, comp->cflags);
+    }
+}
+
+dfa_context *
+dfa_context_create(const dfa_comp *comp)
+{
+    dfa_context *ctx = malloc(sizeof(dfa_context));
+    if (ctx == NULL) {
+        return NULL;
+    }
+
+    ctx->serial = comp->serial;
+    cache_init(&ctx->unanchored, false);
+    cache_init(&ctx->anchored, true);
+
+    // Temporary storage of the state construction (see dfa-exec.c).
+    ctx->stack = malloc(sizeof(uint32_t) * (2 * comp->nfa_count + 2));
+    ctx->marks = calloc(comp->nfa_count, sizeof(uint32_t));
+    ctx->mark = 0;
+    ctx->buffer = malloc(sizeof(uint32_t) * (3 * comp->nfa_count));
+    ctx->resets = 0;
+
+    if (ctx->stack == NULL || ctx->marks == NULL || ctx->buffer == NULL) {
+        dfa_context_free(ctx);
+        return NULL;
+    }
+    return ctx;
+}
+
+void
+dfa_context_free(dfa_context *ctx)
+{
+    if (ctx != NULL) {
+        cache_free(&ctx->unanchored);
+        cache_free(&ctx->anchored);
+        free(ctx->stack);
+        free(ctx->marks);
+        free(ctx->buffer);
+        free(ctx);
+    }
+}
+
+void
+dfa_cache_reset(dfa_cache *cache)
+{
+    cache_free(cache);
+}
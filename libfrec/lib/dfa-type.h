@@ -0,0 +1,107 @@
+#ifndef FREC_DFA_TYPE_H
+#define FREC_DFA_TYPE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+// Types of the NFA nodes.
+#define NFA_SET 0   // Consumes a byte of its set, then continues at out.
+#define NFA_SPLIT 1 // Continues at both out and out1.
+#define NFA_BOL 2   // Continues at out at the start of a line.
+#define NFA_EOL 3   // Continues at out at the end of a line.
+#define NFA_MATCH 4 // The end of a match.
+
+// A node of the Thompson NFA built from the pattern.
+typedef struct nfa_node {
+    uint32_t type;
+    uint32_t set;  // Index of the byte set of NFA_SET nodes.
+    uint32_t out;
+    uint32_t out1;
+} nfa_node;
+
+// Marks a transition that wasn't computed yet, or a missing state.
+#define DFA_UNKNOWN UINT32_MAX
+
+// Flags of the DFA states.
+#define DFA_ACCEPT 0x01     // The NFA match node is in the state.
+#define DFA_ACCEPT_EOL 0x02 // The match node is reached if a $ can match.
+#define DFA_BOL 0x04        // The state was entered at the start of a line.
+#define DFA_DEAD 0x08       // No match can be reached from the state.
+
+// A lazily built DFA. Each state is a set of NFA nodes (the ones consuming
+// bytes, the $ anchors that were not passed yet, and the match node),
+// and transitions are only computed when they are first needed.
+// The unanchored automaton can start a match at any position, while the
+// anchored one only at its start.
+typedef struct dfa_cache {
+    uint32_t state_count;    // Number of states.
+    uint32_t state_cap;      // Capacity of the per-state arrays.
+    uint32_t *trans;         // Transitions of each state for each byte
+                             // class, or DFA_UNKNOWN.
+    uint8_t *flags;          // Flags of each state.
+    uint32_t *set_start;     // Start of the NFA node set of each state in
+                             // the nodes array, followed by its end.
+    uint32_t *nodes;         // The sorted NFA node sets of the states.
+    uint32_t nodes_len;      // Length of the nodes array.
+    uint32_t nodes_cap;      // Capacity of the nodes array.
+    uint32_t *table;         // Hash table of the states, by their sets.
+    uint32_t start[2];       // Start states outside and at the start of a
+                             // line, or DFA_UNKNOWN.
+    bool anchored;           // Whether this is the anchored automaton.
+} dfa_cache;
+
+// The compiled NFA of a pattern. It isn't modified while matching, the
+// DFAs built from it are kept in a separate context by each user.
+typedef struct dfa_comp {
+    nfa_node *nfa;           // The nodes of the NFA.
+    uint32_t nfa_count;      // Number of NFA nodes.
+    uint32_t nfa_start;      // The start node.
+    uint32_t (*sets)[8];     // The byte sets of the NFA_SET nodes.
+    uint32_t set_count;      // Number of byte sets.
+
+    uint8_t classes[256];    // The class of each byte. Bytes of the same
+                             // class are in the same byte sets.
+    uint8_t class_repr[256]; // A byte of each class.
+    uint32_t class_count;    // Number of byte classes.
+    bool has_bol;            // Whether the NFA contains ^ anchors.
+
+    uint64_t serial;         // Unique identifier of the compiled NFA.
+    int cflags;              // Compilation flags.
+    bool borrowed;           // The NFA points into a serialized blob, and
+                             // is not freed.
+} dfa_comp;
+
+// The DFAs built from an NFA, and the storage needed to build them.
+typedef struct dfa_context {
+    uint64_t serial;         // Identifier of the NFA the DFAs belong to.
+    dfa_cache unanchored;    // The lazily built automata.
+    dfa_cache anchored;
+
+    uint32_t *stack;         // Temporary storage of the state construction.
+    uint32_t *marks;
+    uint32_t mark;
+    uint32_t *buffer;
+
+    int resets;              // Number of times the caches were emptied.
+} dfa_context;
+
+void
+dfa_comp_init(dfa_comp *comp, int cflags);
+
+void
+dfa_comp_free(dfa_comp *comp);
+
+// Creates an empty context for the DFAs of the given NFA. Returns NULL on
+// memory errors.
+dfa_context *
+dfa_context_create(const dfa_comp *comp);
+
+void
+dfa_context_free(dfa_context *ctx);
+
+// Empties the lazily built automata, keeping the NFA.
+void
+dfa_cache_reset(dfa_cache *cache);
+
+#endif //FREC_DFA_TYPE_H
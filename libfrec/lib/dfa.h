@@ -0,0 +1,34 @@
+#ifndef FREC_DFA_H
+#define FREC_DFA_H
+
+#include <frec-match.h>
+#include "dfa-type.h"
+#include "string-type.h"
+
+// Returned by dfa_execute if the original matcher has to be used instead.
+#define DFA_FALLBACK (-1)
+
+// Parses the given standard character pattern into an NFA, from which DFAs
+// are built lazily at match time. Only a subset of the regex syntax is
+// supported: literals, bracket expressions, the . wildcard, ^ and $ anchors,
+// grouping, alternation and repetitions. Returns REG_BADPAT for anything
+// else (e.g. back references), in which case the original matcher has to be
+// used, and REG_ESPACE on memory errors.
+int
+dfa_compile(dfa_comp *comp, string pattern, int cflags);
+
+// Gives the compiled NFA a new unique serial, which identifies its DFAs
+// in the scratch spaces.
+void
+dfa_assign_serial(dfa_comp *comp);
+
+// Finds the leftmost-longest match in the given standard character text,
+// and stores its bounds in result if bounds is set. The DFAs are built in
+// the given context, which must have been created for comp, and must not be
+// used by multiple threads at the same time. Returns REG_OK or REG_NOMATCH,
+// or DFA_FALLBACK if the automata grew too large.
+int
+dfa_execute(frec_match_t *result, const dfa_comp *comp, dfa_context *ctx,
+    string text, int eflags, bool bounds);
+
+#endif // FREC_DFA_H
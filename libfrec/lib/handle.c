@@ -0,0 +1,179 @@
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <frec.h>
+
+// Pattern sets are replaced while readers may still be using them, so they
+// are reclaimed based on epochs. Each publication increments the epoch of
+// the handle, and readers record the epoch they saw when pinning. A version
+// that was replaced in a given epoch can only be used by readers that pinned
+// before it, so it can be freed once every pinned reader has a later one.
+
+// The epoch of readers that don't have anything pinned.
+#define EPOCH_IDLE 0
+
+struct frec_version {
+    mfrec_t set;
+    uint64_t retired_at;    // The epoch that replaced it.
+    frec_version *next;     // The next retired version.
+};
+
+static frec_version *
+create_version(mfrec_t *preg)
+{
+    frec_version *version = malloc(sizeof(frec_version));
+    if (version == NULL) {
+        return NULL;
+    }
+
+    version->set = *preg;
+    version->retired_at = 0;
+    version->next = NULL;
+    return version;
+}
+
+static void
+free_version(frec_version *version)
+{
+    frec_mregfree(&version->set);
+    free(version);
+}
+
+// Frees the retired versions that no reader can use anymore. Returns how
+// many of them are kept. Must be called with the lock held.
+static size_t
+reclaim_locked(frec_handle_t *handle)
+{
+    uint64_t oldest = UINT64_MAX;
+    for (frec_reader_t *r = handle->readers; r != NULL; r = r->next) {
+        uint64_t epoch = __atomic_load_n(&r->epoch, __ATOMIC_SEQ_CST);
+        if (epoch != EPOCH_IDLE && epoch < oldest) {
+            oldest = epoch;
+        }
+    }
+
+    size_t kept = 0;
+    frec_version **link = &handle->retired;
+    while (*link != NULL) {
+        frec_version *version = *link;
+        if (version->retired_at <= oldest) {
+            *link = version->next;
+            free_version(version);
+        } else {
+            link = &version->next;
+            kept++;
+        }
+    }
+    return kept;
+}
+
+int
+frec_handle_init(frec_handle_t *handle, mfrec_t *preg)
+{
+    handle->current = create_version(preg);
+    if (handle->current == NULL) {
+        return (REG_ESPACE);
+    }
+
+    handle->retired = NULL;
+    handle->epoch = 1;
+    handle->readers = NULL;
+    pthread_mutex_init(&handle->lock, NULL);
+    return (REG_OK);
+}
+
+int
+frec_handle_publish(frec_handle_t *handle, mfrec_t *preg)
+{
+    // The new version is complete before it is published.
+    frec_version *version = create_version(preg);
+    if (version == NULL) {
+        return (REG_ESPACE);
+    }
+
+    pthread_mutex_lock(&handle->lock);
+
+    // Readers that pin after the epoch changed can only see the new version.
+    frec_version *old = __atomic_exchange_n(&handle->current, version,
+        __ATOMIC_SEQ_CST);
+    old->retired_at = __atomic_add_fetch(&handle->epoch, 1, __ATOMIC_SEQ_CST);
+    old->next = handle->retired;
+    handle->retired = old;
+
+    reclaim_locked(handle);
+
+    pthread_mutex_unlock(&handle->lock);
+    return (REG_OK);
+}
+
+size_t
+frec_handle_reclaim(frec_handle_t *handle)
+{
+    pthread_mutex_lock(&handle->lock);
+    size_t kept = reclaim_locked(handle);
+    pthread_mutex_unlock(&handle->lock);
+    return kept;
+}
+
+void
+frec_handle_free(frec_handle_t *handle)
+{
+    while (handle->retired != NULL) {
+        frec_version *next = handle->retired->next;
+        free_version(handle->retired);
+        handle->retired = next;
+    }
+
+    free_version(handle->current);
+    handle->current = NULL;
+    pthread_mutex_destroy(&handle->lock);
+}
+
+int
+frec_reader_init(frec_reader_t *reader, frec_handle_t *handle)
+{
+    reader->handle = handle;
+    reader->epoch = EPOCH_IDLE;
+
+    pthread_mutex_lock(&handle->lock);
+    reader->next = handle->readers;
+    handle->readers = reader;
+    pthread_mutex_unlock(&handle->lock);
+    return (REG_OK);
+}
+
+const mfrec_t *
+frec_reader_pin(frec_reader_t *reader)
+{
+    frec_handle_t *handle = reader->handle;
+
+    // The epoch is recorded before the version is read, so that a writer
+    // that replaces this version afterwards sees that it may be in use.
+    uint64_t epoch = __atomic_load_n(&handle->epoch, __ATOMIC_SEQ_CST);
+    __atomic_store_n(&reader->epoch, epoch, __ATOMIC_SEQ_CST);
+
+    frec_version *version = __atomic_load_n(&handle->current, __ATOMIC_SEQ_CST);
+    return &version->set;
+}
+
+void
+frec_reader_unpin(frec_reader_t *reader)
+{
+    __atomic_store_n(&reader->epoch, EPOCH_IDLE, __ATOMIC_RELEASE);
+}
+
+void
+frec_reader_free(frec_reader_t *reader)
+{
+    frec_handle_t *handle = reader->handle;
+
+    pthread_mutex_lock(&handle->lock);
+    frec_reader_t **link = &handle->readers;
+    while (*link != NULL && *link != reader) {
+        link = &(*link)->next;
+    }
+    if (*link != NULL) {
+        *link = reader->next;
+    }
+    pthread_mutex_unlock(&handle->lock);
+}
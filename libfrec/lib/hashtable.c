@@ -31,29 +31,132 @@
 
 #include "hashtable.h"
 
+#define TAG_USED 0x80000000u
+#define ALIGN_TO(x, a) (((x) + (a) - 1) & ~((size_t) (a) - 1))
+
 /*
  * Returns a 32-bit hash of the given buffer with the given length.
- * The init value should be 0, or the previous hash value to extend
- * the previous hash.
+ * FNV-1a over the bytes, followed by the MurmurHash3 finalizer, so that
+ * the low bits used for indexing depend on every bit of the key.
  */
 static uint32_t
-hash32_buf(const void *buf, size_t len, uint32_t hash)
+hash32_buf(const void *buf, size_t len)
 {
 	const unsigned char *p = buf;
+	uint32_t hash = 2166136261u;
 
 	while (len > 0) {
-		hash = HASHSTEP(hash, *p++);
+		hash = (hash ^ *p++) * 16777619u;
 		len--;
 	}
 
+	hash ^= hash >> 16;
+	hash *= 0x85ebca6bu;
+	hash ^= hash >> 13;
+	hash *= 0xc2b2ae35u;
+	hash ^= hash >> 16;
+
 	return (hash);
 }
 
+/* Returns a pointer to the tag of the slot with the given index. */
+static inline uint32_t *
+slot_tag(const hashtable *tbl, size_t index)
+{
+	return ((uint32_t *) (tbl->slots + index * tbl->slot_size));
+}
+
+/* Returns a pointer to the key of the slot with the given index. */
+static inline void *
+slot_key(const hashtable *tbl, size_t index)
+{
+	return (tbl->slots + index * tbl->slot_size + sizeof(uint32_t));
+}
+
+/* Returns a pointer to the value of the slot with the given index. */
+static inline void *
+slot_value(const hashtable *tbl, size_t index)
+{
+	return (tbl->slots + index * tbl->slot_size + tbl->val_offset);
+}
+
 /*
- * Initializes a hash table that can hold table_size number of entries,
- * each of which has a key of key_size bytes and a value of value_size
- * bytes. On successful allocation returns a pointer to the hash table.
- * Otherwise, returns NULL and sets errno to indicate the error.
+ * Finds the slot of the given key with the given tag. Returns its index,
+ * or the index of the empty slot where it could be inserted.
+ */
+static size_t
+find_slot(const hashtable *tbl, const void *key, uint32_t tag)
+{
+	size_t mask = tbl->tbl_size - 1;
+	size_t index = tag & mask;
+
+	/* The load factor guarantees that there is at least one empty slot. */
+	for (;;) {
+		uint32_t curr = *slot_tag(tbl, index);
+		if (curr == 0) {
+			return (index);
+		}
+		if (curr == tag &&
+		    memcmp(slot_key(tbl, index), key, tbl->key_size) == 0) {
+			return (index);
+		}
+		index = (index + 1) & mask;
+	}
+}
+
+/*
+ * Allocates a zeroed slot array for the given table with the given
+ * slot count. Returns NULL and sets errno on failure.
+ */
+static unsigned char *
+alloc_slots(const hashtable *tbl, size_t slot_count)
+{
+	unsigned char *slots = calloc(slot_count, tbl->slot_size);
+	if (slots == NULL) {
+		errno = ENOMEM;
+	}
+	return (slots);
+}
+
+/*
+ * Doubles the slot count of the given table and reinserts every entry.
+ * Returns HASH_OK on success, or HASH_FAIL on memory errors.
+ */
+static int
+hashtable_grow(hashtable *tbl)
+{
+	size_t old_size = tbl->tbl_size;
+	unsigned char *old_slots = tbl->slots;
+
+	unsigned char *slots = alloc_slots(tbl, old_size * 2);
+	if (slots == NULL) {
+		return (HASH_FAIL);
+	}
+
+	tbl->slots = slots;
+	tbl->tbl_size = old_size * 2;
+
+	for (size_t i = 0; i < old_size; i++) {
+		unsigned char *old = old_slots + i * tbl->slot_size;
+		uint32_t tag = *(uint32_t *) old;
+		if (tag == 0) {
+			continue;
+		}
+
+		size_t index = find_slot(tbl, old + sizeof(uint32_t), tag);
+		memcpy(slot_tag(tbl, index), old, tbl->slot_size);
+	}
+
+	free(old_slots);
+	return (HASH_OK);
+}
+
+/*
+ * Initializes a hash table that can hold at least table_size entries
+ * before it has to grow, each of which has a key of key_size bytes and
+ * a value of value_size bytes. On successful allocation returns a pointer
+ * to the hash table. Otherwise, returns NULL and sets errno to indicate
+ * the error.
  */
 hashtable *
 hashtable_init(size_t table_size, size_t key_size, size_t value_size)
@@ -66,17 +169,25 @@ hashtable_init(size_t table_size, size_t key_size, size_t value_size)
 		return (NULL);
 	}
 
-	tbl->entries = calloc(sizeof(hashtable_entry *), table_size);
-	if (tbl->entries == NULL) {
+	/* Values are aligned so that the returned pointers can be used. */
+	tbl->key_size = key_size;
+	tbl->val_size = value_size;
+	tbl->val_offset = ALIGN_TO(sizeof(uint32_t) + key_size, sizeof(void *));
+	tbl->slot_size = ALIGN_TO(tbl->val_offset + value_size, sizeof(void *));
+	tbl->count = 0;
+
+	/* Round up to a power of two that respects the maximum load factor. */
+	tbl->tbl_size = 8;
+	while (tbl->tbl_size / 4 * 3 < table_size) {
+		tbl->tbl_size *= 2;
+	}
+
+	tbl->slots = alloc_slots(tbl, tbl->tbl_size);
+	if (tbl->slots == NULL) {
 		free(tbl);
-		errno = ENOMEM;
 		return (NULL);
 	}
 
-	tbl->tbl_size = table_size;
-	tbl->key_size = key_size;
-	tbl->val_size = value_size;
-
 	return (tbl);
 }
 
@@ -84,104 +195,51 @@ hashtable_init(size_t table_size, size_t key_size, size_t value_size)
  * Places the given key-value pair to the hashtable tbl. Returns:
  *     HASH_OK:      if key was newly added to the table with value.
  *     HASH_UPDATED: if key was present, and has been updated with value.
- *     HASH_FULL:	 if the table is full and the entry couldn't be added.
  *     HASH_FAIL:	 if a memory error occurred.
  */
 int
 hashtable_put(hashtable *tbl, const void *key, const void *value)
 {
-    uint32_t hash = 0;
-	hash = hash32_buf(key, tbl->key_size, hash) % tbl->tbl_size;
-	uint32_t initial_hash = hash;
-
-	/* On hash collision entries are inserted at the next free space. */
-	while (tbl->entries[hash] != NULL) {
-		if (memcmp(tbl->entries[hash]->key, key, tbl->key_size) == 0)
-		{
-			memcpy(tbl->entries[hash]->value, value, tbl->val_size);
-			return (HASH_UPDATED);
-		}
-
-		hash = (hash + 1) % tbl->tbl_size;
-
-		/* This means the table is full, and the key isn't present. */
-		if (hash == initial_hash) {
-			return (HASH_FULL);
-		}
-	}
+	uint32_t tag = hash32_buf(key, tbl->key_size) | TAG_USED;
+	size_t index = find_slot(tbl, key, tag);
 
-	tbl->entries[hash] = malloc(sizeof(hashtable_entry));
-	if (tbl->entries[hash] == NULL) {
-		errno = ENOMEM;
-		return (HASH_FAIL);
-	}
-
-	tbl->entries[hash]->key = malloc(tbl->key_size);
-	if (tbl->entries[hash]->key == NULL) {
-		errno = ENOMEM;
-		free(tbl->entries[hash]);
-		return (HASH_FAIL);
+	if (*slot_tag(tbl, index) != 0) {
+		memcpy(slot_value(tbl, index), value, tbl->val_size);
+		return (HASH_UPDATED);
 	}
 
-	tbl->entries[hash]->value = malloc(tbl->val_size);
-	if (tbl->entries[hash]->value == NULL) {
-		errno = ENOMEM;
-		free(tbl->entries[hash]->key);
-		free(tbl->entries[hash]);
-		return (HASH_FAIL);
+	/* Grow before the table gets too crowded, and find the new slot. */
+	if (tbl->count + 1 > tbl->tbl_size / 4 * 3) {
+		if (hashtable_grow(tbl) != HASH_OK) {
+			return (HASH_FAIL);
+		}
+		index = find_slot(tbl, key, tag);
 	}
 
-	memcpy(tbl->entries[hash]->key, key, tbl->key_size);
-	memcpy(tbl->entries[hash]->value, value, tbl->val_size);
+	*slot_tag(tbl, index) = tag;
+	memcpy(slot_key(tbl, index), key, tbl->key_size);
+	memcpy(slot_value(tbl, index), value, tbl->val_size);
+	tbl->count++;
 
 	return (HASH_OK);
 }
 
 /*
- * Returns a pointer to the hashtable_entry pointer with the given key,
- * or NULL, if no such entry is found.
+ * Retrieves the value for key from the hash table tbl. Returns a pointer
+ * to the value stored inside the table, or NULL if the key is not present.
+ * The pointer is valid until the next modification of the table.
  */
-static hashtable_entry **
-hashtable_lookup(const hashtable *tbl, const void *key)
+void *
+hashtable_get(const hashtable *tbl, const void *key)
 {
-    uint32_t hash = 0;
-	hash = hash32_buf(key, tbl->key_size, hash) % tbl->tbl_size;
-	uint32_t initial_hash = hash;
-
-	while (tbl->entries[hash] != NULL) {
-		if (memcmp(tbl->entries[hash]->key, key, tbl->key_size) == 0) {
-			return (&(tbl->entries[hash]));
-		}
+	uint32_t tag = hash32_buf(key, tbl->key_size) | TAG_USED;
+	size_t index = find_slot(tbl, key, tag);
 
-		hash = (hash + 1) % tbl->tbl_size;
-
-		/* This means the table is full, and the key isn't present. */
-		if (hash == initial_hash) {
-			return (NULL);
-		}
-	}
-
-	return (NULL);
-}
-
-/*
- * Retrieves the value for key from the hash table tbl and places
- * it to the space indicated by the value argument.
- * Returns HASH_OK if the value has been found and retrieved or
- * HASH_NOTFOUND otherwise.
- */
-int
-hashtable_get(hashtable *tbl, const void *key, void *value)
-{
-	hashtable_entry **entry_ptr = hashtable_lookup(tbl, key);
-	if (entry_ptr == NULL) {
-		return (HASH_NOTFOUND);
+	if (*slot_tag(tbl, index) == 0) {
+		return (NULL);
 	}
 
-    hashtable_entry *entry = *entry_ptr;
-
-	memcpy(value, entry->value, tbl->val_size);
-	return (HASH_OK);
+	return (slot_value(tbl, index));
 }
 
 /*
@@ -192,18 +250,34 @@ hashtable_get(hashtable *tbl, const void *key, void *value)
 int
 hashtable_remove(hashtable *tbl, const void *key)
 {
-	hashtable_entry **entry_ptr = hashtable_lookup(tbl, key);
-	if (entry_ptr == NULL) {
+	uint32_t tag = hash32_buf(key, tbl->key_size) | TAG_USED;
+	size_t index = find_slot(tbl, key, tag);
+
+	if (*slot_tag(tbl, index) == 0) {
 		return (HASH_NOTFOUND);
 	}
 
-    hashtable_entry *entry = *entry_ptr;
-
-	free(entry->key);
-	free(entry->value);
-	free(entry);
+	/*
+	 * Shift the following entries of the probe sequence backwards, so that
+	 * no tombstones are needed: an entry may fill the hole if its home slot
+	 * is not cyclically between the hole and its current position.
+	 */
+	size_t mask = tbl->tbl_size - 1;
+	size_t hole = index;
+	size_t next = (hole + 1) & mask;
+
+	while (*slot_tag(tbl, next) != 0) {
+		size_t home = *slot_tag(tbl, next) & mask;
+		if (((next - home) & mask) >= ((next - hole) & mask)) {
+			memcpy(slot_tag(tbl, hole), slot_tag(tbl, next),
+			    tbl->slot_size);
+			hole = next;
+		}
+		next = (next + 1) & mask;
+	}
 
-	*entry_ptr = NULL;
+	*slot_tag(tbl, hole) = 0;
+	tbl->count--;
 	return (HASH_OK);
 }
 
@@ -219,18 +293,6 @@ hashtable_free(hashtable *tbl)
 		return;
 	}
 
-	if (tbl->entries != NULL) {
-		for (size_t i = 0; i < tbl->tbl_size; i++) {
-			hashtable_entry *entry = tbl->entries[i];
-			if (entry != NULL)
-			{
-				free(entry->key);
-				free(entry->value);
-				free(entry);
-			}
-		}
-
-		free(tbl->entries);
-	}
+	free(tbl->slots);
 	free(tbl);
 }
@@ -3,6 +3,7 @@
 #ifndef HASHTABLE_H
 #define HASHTABLE_H 1
 
+#include <stdint.h>
 #include <sys/types.h>
 
 #define HASH_OK 0
@@ -11,25 +12,27 @@
 #define HASH_FULL 3
 #define HASH_NOTFOUND 4
 
-#define HASHSTEP(x, c) (((x << 5) + x) + (c))
-
-typedef struct hashtable_entry
-{
-	void *key;                  /* Pointer to an entry key. */
-	void *value;                /* Pointer to an entry value. */
-} hashtable_entry;
-
+/*
+ * Open addressing hash table with linear probing. Every slot is stored
+ * inline in one contiguous array: a 32-bit tag (the hash of the key with
+ * its top bit set, or 0 for empty slots), followed by the key and the value.
+ * The slot count is always a power of two, and the table grows when it is
+ * three quarters full.
+ */
 typedef struct hashtable
 {
-	size_t tbl_size;            /* Max entry count of the table. */
+	size_t tbl_size;            /* Slot count of the table. */
 	size_t key_size;            /* Size of an entry key. */
 	size_t val_size;            /* Size of an entry value. */
-	hashtable_entry **entries;  /* Array of entry pointers. */
+	size_t val_offset;          /* Offset of the value inside a slot. */
+	size_t slot_size;           /* Size of a slot, including padding. */
+	size_t count;               /* Number of occupied slots. */
+	unsigned char *slots;       /* The slot array. */
 } hashtable;
 
 hashtable *hashtable_init(size_t, size_t, size_t);
 int hashtable_put(hashtable *, const void *, const void *);
-int hashtable_get(hashtable *, const void *, void *);
+void *hashtable_get(const hashtable *, const void *);
 int hashtable_remove(hashtable *, const void *);
 void hashtable_free(hashtable *);
 
@@ -1,23 +1,86 @@
-
+#include <ctype.h>
 #include <stdlib.h>
 #include <string.h>
+#include <wctype.h>
 #include <frec-config.h>
+#include "byte-freq.h"
 #include "heuristic.h"
 #include "regex-parser.h"
 #include "string-type.h"
+#include "teddy-comp.h"
+#include "wm-comp.h"
+
+// Bounds of repetitions (MAX_REPEAT).
+#define MAX_REPEAT 255
+// Groups are only parsed up to this depth.
+#define MAX_DEPTH 16
+// Repeated literals are only expanded up to this length.
+#define MAX_REPEAT_LEN 64
+// Matches longer than this are better bounded by their lines, if they can't
+// span multiple lines anyway.
+#define MAX_WINDOW 256
+// Lengths above this are treated as unknown.
+#define MAX_LENGTH (1 << 24)
+// Bracket expressions that match at most this many characters are expanded
+// into the literals that they may match.
+#define MAX_CLASS_SIZE 8
+// Literal runs are expanded into at most this many variants, so they contain
+// at most MAX_RUN_CLASSES such bracket expressions.
+#define MAX_VARIANTS 16
+#define MAX_RUN_CLASSES 4
+
+// Where the parsing of a branch stopped.
+#define STOP_END 0   // At the end of the pattern.
+#define STOP_PIPE 1  // At a '|' character.
+#define STOP_CLOSE 2 // At the closing parenthesis of the enclosing group.
+
+// The kinds of the last atom of a branch, that quantifiers apply to.
+#define ATOM_NONE 0  // There's no such atom, e.g. at the start or after '^'.
+#define ATOM_CHAR 1  // A literal character.
+#define ATOM_CLASS 2 // A '.' or a bracket expression.
+#define ATOM_UNIT 3  // A group, or any atom after a quantifier.
 
+// What is known about a part of the pattern: a branch, a group, or a
+// repeated atom.
 typedef struct heur_parser {
-    string *fragments;
+    string *fragments; // Literals that occur in every match, in order.
     ssize_t frag_index;
 
     ssize_t max_length;
     bool length_known;
 
     bool reg_newline_set;
-    bool may_match_lf;
-    bool has_literal_prefix;
+    bool may_match_lf;       // Whether a match may contain a line feed.
+    bool has_literal_prefix; // Every match starts with the first fragment.
+    bool has_literal_suffix; // Every match ends with the last fragment.
+    bool is_exact;           // The only match is the (only) fragment.
+
+    string *variants;        // The rarest expanded run of the branch, if any.
+    ssize_t variant_count;   // Every match contains one of these literals.
+    unsigned int variant_score;
+    bool variants_at_start;  // Every match starts with one of them.
 } heur_parser;
 
+// The characters that a bracket expression matches, if there are only a few.
+typedef struct small_class {
+    char stnd[MAX_CLASS_SIZE];
+    wchar_t wide[MAX_CLASS_SIZE];
+    ssize_t count; // 0 if there are more of them, or they can't be listed.
+} small_class;
+
+// A run of literal characters and small bracket expressions of a branch.
+// Any match contains one of the literals that it expands to.
+typedef struct class_run {
+    string literal; // The run, with the first character of each class.
+    ssize_t capacity;
+    small_class classes[MAX_RUN_CLASSES];
+    ssize_t positions[MAX_RUN_CLASSES]; // Where the classes are in the run.
+    ssize_t class_count;
+    ssize_t variant_count;
+    bool at_start;  // Whether the run starts every match of the branch.
+    bool icase;
+} class_run;
+
 // Utility function.
 static ssize_t max(ssize_t a, ssize_t b) { return (a > b) ? a : b; }
 
@@ -52,10 +115,40 @@ heur_parser_init(heur_parser *parser, int cflags)
     parser->reg_newline_set = cflags & REG_NEWLINE;
     parser->may_match_lf = false;
     parser->has_literal_prefix = true;
+    parser->has_literal_suffix = false;
+    parser->is_exact = true;
+
+    parser->variants = NULL;
+    parser->variant_count = 0;
+    parser->variant_score = 0;
+    parser->variants_at_start = false;
 
     return true;
 }
 
+// Free the fragments of the heuristic parser, but keep the parser usable.
+static void
+heur_parser_clear(heur_parser *parser)
+{
+    for (ssize_t i = 0; i < parser->frag_index; i++) {
+        string_free(&parser->fragments[i]);
+    }
+    parser->frag_index = 0;
+}
+
+// Free the expanded variants of the heuristic parser.
+static void
+heur_parser_free_variants(heur_parser *parser)
+{
+    for (ssize_t i = 0; i < parser->variant_count; i++) {
+        string_free(&parser->variants[i]);
+    }
+    free(parser->variants);
+
+    parser->variants = NULL;
+    parser->variant_count = 0;
+}
+
 // Free the heuristic parser.
 static void
 heur_parser_free(heur_parser *parser)
@@ -63,13 +156,12 @@ heur_parser_free(heur_parser *parser)
     if (parser != NULL) {
         // Free every currently occupied string.
         if (parser->fragments != NULL) {
-            for (ssize_t i = 0; i < parser->frag_index; i++) {
-                string_free(&parser->fragments[i]);
-            }
+            heur_parser_clear(parser);
         }
 
         // Then free the array itself too.
         free(parser->fragments);
+        heur_parser_free_variants(parser);
     }
 }
 
@@ -87,9 +179,10 @@ heur_parser_push(heur_parser *parser, string fragment)
         return (REG_OK);
     }
 
-    // If we used up too many fragments, return an error.
+    // If we used up every fragment, the rest isn't kept. The ones we have
+    // still occur in every match.
     if (parser->frag_index >= MAX_FRAGMENTS) {
-        return (REG_BADPAT);
+        return (REG_OK);
     }
 
     // Duplicate the given fragment and write it to the fragment array.
@@ -103,71 +196,338 @@ heur_parser_push(heur_parser *parser, string fragment)
     return (REG_OK);
 }
 
+// Appends src to the literal run of a branch, growing its storage as needed.
+static bool
+run_append(string *run, ssize_t *capacity, string src)
+{
+    size_t size = (run->is_wide) ? sizeof(wchar_t) : sizeof(char);
+
+    if (run->len + src.len >= *capacity) {
+        ssize_t new_capacity = max(*capacity * 2, run->len + src.len + 1);
+        void *old = (run->is_wide) ? (void *) run->wide : (void *) run->stnd;
+        void *content = realloc(old, size * new_capacity);
+        if (content == NULL) {
+            return false;
+        }
+
+        if (run->is_wide) {
+            run->wide = content;
+        } else {
+            run->stnd = content;
+        }
+        *capacity = new_capacity;
+    }
+
+    memcpy(string_index(run, run->len), string_index(&src, 0), size * src.len);
+    run->len += src.len;
+    string_null_terminate(run);
+    return true;
+}
+
+// Ends the literal run of a branch: it is pushed as a fragment, and the
+// next run starts empty.
+static int
+end_run(heur_parser *parser, string *run)
+{
+    int ret = heur_parser_push(parser, *run);
+    run->len = 0;
+    string_null_terminate(run);
+    return ret;
+}
+
+// Returns the character of the pattern at the given position.
+static wchar_t
+pattern_char_at(string pattern, ssize_t at)
+{
+    return (pattern.is_wide)
+        ? pattern.wide[at]
+        : (wchar_t) (unsigned char) pattern.stnd[at];
+}
+
+// Adds the characters from low to high to the members of the class. Returns
+// false if there are too many of them.
+static bool
+add_class_members(small_class *cls, wchar_t low, wchar_t high, bool is_wide,
+    bool icase)
+{
+    if (high < low || high - low >= MAX_CLASS_SIZE) {
+        return false;
+    }
+
+    for (wchar_t c = low; c <= high; c++) {
+        // In case insensitive mode, case variants are the same member.
+        wchar_t member = c;
+        if (icase) {
+            member = (is_wide) ? (wchar_t) towlower(c) : tolower(c);
+        }
+
+        bool found = false;
+        for (ssize_t i = 0; i < cls->count && !found; i++) {
+            found = cls->wide[i] == member;
+        }
+        if (found) {
+            continue;
+        } else if (cls->count == MAX_CLASS_SIZE) {
+            return false;
+        }
+
+        cls->wide[cls->count] = member;
+        cls->stnd[cls->count] = (char) member;
+        cls->count++;
+    }
+    return true;
+}
+
 // Handle an opening square bracket in the pattern at the given iter
-// position.
+// position. If the bracket expression only matches a few characters, they
+// are stored in cls.
 static int
-handle_square_bracket(heur_parser *parser, string pattern, ssize_t *iter)
+handle_square_bracket(heur_parser *parser, string pattern, ssize_t *iter,
+    int cflags, small_class *cls)
 {
     ssize_t pos = *iter + 1;
+    cls->count = 0;
+    bool listed = true;
 
-    // Check whether the contents are negated (which may match linefeeds).
+    // Check whether the contents are negated (which may match linefeeds,
+    // unless REG_NEWLINE was set).
     if (pos < pattern.len && string_has_char_at(pattern, pos, '^', L'^')) {
-        parser->may_match_lf = true;
+        parser->may_match_lf |= !parser->reg_newline_set;
+        listed = false;
         pos++;
     }
 
-    // And then advance up to the closing bracket.
-    while(pos < pattern.len) {
+    // And then advance up to the closing bracket. A closing bracket right
+    // at the start is one of the members.
+    ssize_t first = pos;
+    while (pos < pattern.len) {
         if (string_has_char_at(pattern, pos, '[', L'[')) {
             return (REG_BADPAT);
-        } else if (string_has_char_at(pattern, pos, '\n', L'\n')) {
-            parser->may_match_lf = true;
-        } else if (string_has_char_at(pattern, pos, ']', L']')) {
+        } else if (string_has_char_at(pattern, pos, ']', L']') && pos > first) {
             break;
         }
+
+        // A '-' between two members is a range.
+        wchar_t low = pattern_char_at(pattern, pos);
+        wchar_t high = low;
+        if (pos + 2 < pattern.len
+            && string_has_char_at(pattern, pos + 1, '-', L'-')
+            && !string_has_char_at(pattern, pos + 2, ']', L']')) {
+            pos += 2;
+            high = pattern_char_at(pattern, pos);
+        }
+
+        if (low <= L'\n' && L'\n' <= high) {
+            parser->may_match_lf = true;
+        }
+
+        // Bytes of multibyte characters can't be listed one by one.
+        if (!pattern.is_wide && MB_CUR_MAX > 1 && high > 0x7f) {
+            listed = false;
+        }
+        if (listed) {
+            listed = add_class_members(cls, low, high, pattern.is_wide,
+                cflags & REG_ICASE);
+        }
         pos++;
     }
 
+    if (!listed) {
+        cls->count = 0;
+    }
     *iter = pos;
     return (REG_OK);
 }
 
-// Handle an enclosure marked by the op and cl characters as the opening
-// and closing characters respectively. Use a wrapper function instead!
+// The rarity of the occurrences of either one of two literals, approximated
+// on the log scale the same way as byte frequencies.
+static unsigned int
+rarity_sum(unsigned int a, unsigned int b)
+{
+    unsigned int low = (a < b) ? a : b;
+    unsigned int diff = (a < b) ? b - a : a - b;
+    unsigned int gain = (diff < 12) ? 12 - diff : 0;
+
+    return (gain > low) ? 0 : low - gain;
+}
+
+// Starts an empty class run.
+static bool
+class_run_init(class_run *xrun, bool is_wide, int cflags)
+{
+    xrun->capacity = 1;
+    xrun->class_count = 0;
+    xrun->variant_count = 1;
+    xrun->at_start = false;
+    xrun->icase = cflags & REG_ICASE;
+    return string_copy(&xrun->literal,
+        (is_wide) ? (void *) L"" : (void *) "", 0, is_wide);
+}
+
+// Appends a literal character to the class run.
+static bool
+class_run_append(class_run *xrun, const heur_parser *parser, string literal)
+{
+    // The run starts every match if nothing can precede it.
+    if (xrun->literal.len == 0) {
+        xrun->at_start = parser->length_known && parser->max_length == 0;
+    }
+    return run_append(&xrun->literal, &xrun->capacity, literal);
+}
+
+// Expands the class run into its variants, which are kept by the parser if
+// they are rarer than the ones it has.
+static int
+expand_class_run(heur_parser *parser, const class_run *xrun)
+{
+    ssize_t count = xrun->variant_count;
+    string *variants = malloc(sizeof(string) * count);
+    if (variants == NULL) {
+        return (REG_ESPACE);
+    }
+
+    unsigned int score = 0;
+    for (ssize_t i = 0; i < count; i++) {
+        if (!string_duplicate(&variants[i], xrun->literal)) {
+            for (ssize_t j = 0; j < i; j++) {
+                string_free(&variants[j]);
+            }
+            free(variants);
+            return (REG_ESPACE);
+        }
+
+        // Each variant selects a different member from each class.
+        ssize_t index = i;
+        for (ssize_t k = xrun->class_count - 1; k >= 0; k--) {
+            const small_class *cls = &xrun->classes[k];
+            ssize_t at = xrun->positions[k];
+            if (variants[i].is_wide) {
+                variants[i].wide[at] = cls->wide[index % cls->count];
+            } else {
+                variants[i].stnd[at] = cls->stnd[index % cls->count];
+            }
+            index /= cls->count;
+        }
+
+        // The candidates of each variant add up.
+        unsigned int curr = literal_rarity(variants[i], xrun->icase);
+        score = (i == 0) ? curr : rarity_sum(score, curr);
+    }
+
+    bool rarer = parser->variant_count == 0
+        || score > parser->variant_score
+        || (score == parser->variant_score
+            && xrun->literal.len > parser->variants[0].len);
+    if (!rarer) {
+        for (ssize_t i = 0; i < count; i++) {
+            string_free(&variants[i]);
+        }
+        free(variants);
+        return (REG_OK);
+    }
+
+    heur_parser_free_variants(parser);
+    parser->variants = variants;
+    parser->variant_count = count;
+    parser->variant_score = score;
+    parser->variants_at_start = xrun->at_start;
+    return (REG_OK);
+}
+
+// Ends the class run of a branch. If it has any classes, it is expanded,
+// and the next run starts empty.
 static int
-handle_enclosure(
-    heur_parser *parser, string pattern, ssize_t *iter,
-    char stnd_op, char stnd_cl, wchar_t wide_op, wchar_t wide_cl
-) {
-    ssize_t pos = *iter;
+end_class_run(heur_parser *parser, class_run *xrun)
+{
+    int ret = REG_OK;
+    if (xrun->class_count > 0) {
+        ret = expand_class_run(parser, xrun);
+    }
 
-    int depth = 0;
+    xrun->literal.len = 0;
+    string_null_terminate(&xrun->literal);
+    xrun->class_count = 0;
+    xrun->variant_count = 1;
+    return ret;
+}
 
-    // While there's chars to read.
-    while (pos < pattern.len) {
-        if (string_has_char_at(pattern, pos, stnd_op, wide_op)) {
-            // Increase depth on an opening character.
-            depth++;
-        } else if (string_has_char_at(pattern, pos, stnd_cl, wide_cl)) {
-            // Decrease it on a closing one.
-            depth--;
-        } else if (
-            string_has_char_at(pattern, pos, '.', L'.')
-            || string_has_char_at(pattern, pos, '\n', L'\n')
-        ) {
-            // And mark that linefeeds can be matched on a '.' or a '\n'.
-            parser->may_match_lf = true;
+// Appends a small bracket expression to the class run. If the run would have
+// too many variants, it is ended first.
+static int
+class_run_add(heur_parser *parser, class_run *xrun, const small_class *cls)
+{
+    if (xrun->class_count == MAX_RUN_CLASSES
+        || xrun->variant_count * cls->count > MAX_VARIANTS) {
+        int ret = end_class_run(parser, xrun);
+        if (ret != REG_OK) {
+            return ret;
         }
+    }
+
+    string first;
+    bool is_wide = xrun->literal.is_wide;
+    string_borrow(&first, (is_wide) ? (void *) cls->wide : (void *) cls->stnd,
+        1, is_wide);
+
+    xrun->classes[xrun->class_count] = *cls;
+    xrun->positions[xrun->class_count] = xrun->literal.len;
+    xrun->class_count++;
+    xrun->variant_count *= cls->count;
+    return (class_run_append(xrun, parser, first)) ? (REG_OK) : (REG_ESPACE);
+}
 
-        // If the current depth is 0, break, otherwise advance.
-        if (depth == 0) {
+// Reads a decimal number of the pattern from the given position, and leaves
+// pos after it. Returns -1 if there's none.
+static int
+read_number(string pattern, ssize_t *pos)
+{
+    int value = -1;
+    while (*pos < pattern.len) {
+        wchar_t c = (pattern.is_wide) ? pattern.wide[*pos] : pattern.stnd[*pos];
+        if (c < L'0' || c > L'9') {
             break;
         }
+
+        value = (value == -1) ? 0 : value;
+        value = value * 10 + (c - L'0');
+        if (value > MAX_REPEAT) {
+            return (MAX_REPEAT + 1);
+        }
+        (*pos)++;
+    }
+    return value;
+}
+
+// Handle an opening curly brace in the pattern at the given iter position.
+// The bounds of the repetition are stored in min_count and max_count (-1 if
+// unbounded), and iter is advanced to the closing brace.
+static int
+handle_curlybraces(string pattern, ssize_t *iter, bool extended,
+    int *min_count, int *max_count)
+{
+    ssize_t pos = *iter + 1;
+
+    *min_count = read_number(pattern, &pos);
+    *max_count = *min_count;
+    if (pos < pattern.len && string_has_char_at(pattern, pos, ',', L',')) {
+        pos++;
+        *max_count = read_number(pattern, &pos);
+    }
+    *min_count = (*min_count == -1) ? 0 : *min_count;
+
+    // In BRE, the closing brace is escaped.
+    if (!extended) {
+        if (pos >= pattern.len || !string_has_char_at(pattern, pos, '\\', L'\\')) {
+            return (REG_BADPAT);
+        }
         pos++;
     }
+    if (pos >= pattern.len || !string_has_char_at(pattern, pos, '}', L'}')) {
+        return (REG_BADPAT);
+    }
 
-    // If depth is not 0, the opening character was not closed.
-    if (depth != 0) {
+    if (*min_count > MAX_REPEAT || *max_count > MAX_REPEAT
+        || (*max_count != -1 && *max_count < *min_count)) {
         return (REG_BADPAT);
     }
 
@@ -175,94 +535,661 @@ handle_enclosure(
     return (REG_OK);
 }
 
-// Wrapper for handle_enclosure.
+// Applies a repetition to a unit of the pattern, from min_count to
+// max_count times (-1 if unbounded).
 static int
-handle_curlybraces(heur_parser *parser, string pattern, ssize_t *iter)
+repeat_unit(heur_parser *unit, int min_count, int max_count)
 {
-    return handle_enclosure(parser, pattern, iter, '{', '}', L'{', L'}');
+    if (max_count == -1 || !unit->length_known
+        || unit->max_length > MAX_LENGTH / max(max_count, 1)) {
+        unit->length_known = false;
+    } else {
+        unit->max_length *= max_count;
+    }
+
+    // If the unit is optional, none of its fragments are required.
+    if (min_count == 0) {
+        heur_parser_clear(unit);
+        unit->has_literal_prefix = false;
+        unit->has_literal_suffix = false;
+        unit->is_exact = false;
+        return (REG_OK);
+    }
+
+    // The first repetition starts with the prefix of the unit, and the
+    // last one ends with its suffix, so only literals need any changes.
+    if (!unit->is_exact || unit->frag_index == 0) {
+        return (REG_OK);
+    }
+
+    // Literals are repeated min_count times. If that's exactly the unit,
+    // it stays a literal, otherwise it is both its prefix and its suffix.
+    string literal = unit->fragments[0];
+    ssize_t copies = min_count;
+    bool exact = (min_count == max_count);
+    if (literal.len * min_count > MAX_REPEAT_LEN) {
+        copies = max(1, MAX_REPEAT_LEN / literal.len);
+        exact = false;
+    }
+
+    string repeated;
+    ssize_t capacity = 1;
+    if (!string_copy(&repeated, (literal.is_wide) ? (void *) L"" : (void *) "",
+            0, literal.is_wide)) {
+        return (REG_ESPACE);
+    }
+    for (ssize_t i = 0; i < copies; i++) {
+        if (!run_append(&repeated, &capacity, literal)) {
+            string_free(&repeated);
+            return (REG_ESPACE);
+        }
+    }
+
+    heur_parser_clear(unit);
+    int ret = heur_parser_push(unit, repeated);
+    if (ret == REG_OK && !exact) {
+        ret = heur_parser_push(unit, repeated);
+    }
+    string_free(&repeated);
+
+    unit->has_literal_suffix = true;
+    unit->is_exact = exact;
+    return ret;
 }
 
-// Wrapper for handle_enclosure.
+// Appends a unit of the pattern to the branch of the parser, whose literal
+// run ended right before the unit. Literals that span the boundaries of
+// the unit are joined with the run.
 static int
-handle_parentheses(heur_parser *parser, string pattern, ssize_t *iter)
+append_unit(heur_parser *parser, string *run, ssize_t *capacity,
+    const heur_parser *unit)
 {
-    return handle_enclosure(parser, pattern, iter, '(', ')', L'(', L')');
+    parser->max_length += unit->max_length;
+    parser->length_known &= unit->length_known;
+    parser->may_match_lf |= unit->may_match_lf;
+
+    ssize_t count = unit->frag_index;
+    if (unit->is_exact) {
+        bool success = count == 0
+            || run_append(run, capacity, unit->fragments[0]);
+        return (success) ? (REG_OK) : (REG_ESPACE);
+    }
+    parser->is_exact = false;
+
+    // The prefix of the unit continues the run.
+    ssize_t first = 0;
+    if (count > 0 && unit->has_literal_prefix) {
+        if (!run_append(run, capacity, unit->fragments[0])) {
+            return (REG_ESPACE);
+        }
+        first = 1;
+    }
+    int ret = end_run(parser, run);
+
+    // Its suffix starts the next run.
+    ssize_t last = count;
+    if (count > 0 && unit->has_literal_suffix) {
+        last = count - 1;
+    }
+
+    for (ssize_t i = first; ret == REG_OK && i < last; i++) {
+        ret = heur_parser_push(parser, unit->fragments[i]);
+    }
+
+    if (ret == REG_OK && count > 0 && unit->has_literal_suffix
+        && !run_append(run, capacity, unit->fragments[count - 1])) {
+        ret = (REG_ESPACE);
+    }
+    return ret;
 }
 
-// Build final heuristic output from the given parser.
+// Returns the length of the longest common prefix of a and b, or of their
+// longest common suffix if from_end is set.
+static ssize_t
+common_length(string a, string b, bool from_end)
+{
+    ssize_t len = 0;
+    while (len < a.len && len < b.len) {
+        ssize_t at_a = (from_end) ? a.len - len - 1 : len;
+        ssize_t at_b = (from_end) ? b.len - len - 1 : len;
+        if (!string_compare(&a, at_a, &b, at_b, 1)) {
+            break;
+        }
+        len++;
+    }
+    return len;
+}
+
+// Merges another alternative of a group into the parser of the group. Only
+// the literal prefix and suffix that are common to every alternative are
+// kept, as nothing else is known to occur in every match.
 static int
-build_heuristic(heur *heuristic, heur_parser parser)
+merge_alternative(heur_parser *group, const heur_parser *alt)
 {
-    // Set the maximum length.
-    heuristic->max_length = (parser.length_known) ? (parser.max_length) : (-1);
+    group->max_length = max(group->max_length, alt->max_length);
+    group->length_known &= alt->length_known;
+    group->may_match_lf |= alt->may_match_lf;
 
-    // Set heuristic type.
-    if (parser.length_known || parser.reg_newline_set || !parser.may_match_lf) {
-        heuristic->heur_type = HEUR_LONGEST;
-    } else if (parser.has_literal_prefix) {
-        heuristic->heur_type = HEUR_PREFIX;
-    } else {
-        // We can't use either one of the above heuristics, return early.
+    ssize_t prefix_len = 0;
+    if (group->frag_index > 0 && alt->frag_index > 0
+        && group->has_literal_prefix && alt->has_literal_prefix) {
+        prefix_len = common_length(group->fragments[0], alt->fragments[0],
+            false);
+    }
+
+    ssize_t suffix_len = 0;
+    string group_last;
+    if (group->frag_index > 0 && alt->frag_index > 0
+        && group->has_literal_suffix && alt->has_literal_suffix) {
+        group_last = group->fragments[group->frag_index - 1];
+        suffix_len = common_length(group_last,
+            alt->fragments[alt->frag_index - 1], true);
+    }
+
+    string prefix;
+    string suffix;
+    string_init(&prefix);
+    string_init(&suffix);
+    bool success = true;
+    if (prefix_len > 0) {
+        string section;
+        string_borrow_section(&section, group->fragments[0], 0, prefix_len);
+        success &= string_duplicate(&prefix, section);
+    }
+    if (suffix_len > 0) {
+        string section;
+        string_borrow_section(&section, group_last,
+            group_last.len - suffix_len, group_last.len);
+        success &= string_duplicate(&suffix, section);
+    }
+
+    heur_parser_clear(group);
+    int ret = (success) ? (REG_OK) : (REG_ESPACE);
+    if (ret == REG_OK && prefix_len > 0) {
+        ret = heur_parser_push(group, prefix);
+    }
+    if (ret == REG_OK && suffix_len > 0) {
+        ret = heur_parser_push(group, suffix);
+    }
+    string_free(&prefix);
+    string_free(&suffix);
+
+    group->has_literal_prefix = prefix_len > 0;
+    group->has_literal_suffix = suffix_len > 0;
+    group->is_exact = false;
+    return ret;
+}
+
+static int
+parse_branch(heur_parser *parser, string pattern, ssize_t *iter, int cflags,
+    int depth, int *stop);
+
+// Handle an opening parenthesis in the pattern at the given iter position.
+// The alternatives of the group are parsed into the group parser, and iter
+// is advanced to the closing parenthesis.
+static int
+handle_parentheses(heur_parser *group, string pattern, ssize_t *iter,
+    int cflags, int depth)
+{
+    if (depth > MAX_DEPTH) {
         return (REG_BADPAT);
     }
 
-    string best_pattern;
+    ssize_t pos = *iter + 1;
+    int stop = STOP_PIPE;
+    for (bool first = true; stop == STOP_PIPE; first = false) {
+        heur_parser alt;
+        if (!heur_parser_init(&alt, cflags)) {
+            if (!first) {
+                heur_parser_free(group);
+            }
+            return (REG_ESPACE);
+        }
 
-    if (heuristic->heur_type == HEUR_PREFIX) {
-        // If prefix heuristics is used, we'll use the first fragment.
-        string_reference(&best_pattern, parser.fragments[0]);
-    } else {
-        // Otherwise, we find the longest fragment.
-        size_t i = 0;
-        for (size_t j = 1; j < parser.frag_index; j++) {
-            if (parser.fragments[j].len > parser.fragments[i].len) {
-                i = j;
+        int ret = parse_branch(&alt, pattern, &pos, cflags, depth, &stop);
+        if (ret == REG_OK && stop == STOP_END) {
+            // The group was not closed.
+            ret = (REG_BADPAT);
+        }
+
+        if (ret == REG_OK && first) {
+            *group = alt;
+        } else {
+            if (ret == REG_OK) {
+                ret = merge_alternative(group, &alt);
             }
+            heur_parser_free(&alt);
+        }
+
+        if (ret != REG_OK) {
+            if (!first) {
+                heur_parser_free(group);
+            }
+            return ret;
         }
 
-        // And use that.
-        string_reference(&best_pattern, parser.fragments[i]);
+        // Skip the '|' after the alternative.
+        if (stop == STOP_PIPE) {
+            pos++;
+        }
+    }
+
+    *iter = pos;
+    return (REG_OK);
+}
+
+// Turns the last atom of a branch into a unit, so that a quantifier can be
+// applied to it.
+static int
+make_unit(heur_parser *unit, int atom, string literal, int cflags)
+{
+    if (!heur_parser_init(unit, cflags)) {
+        return (REG_ESPACE);
     }
 
-    // Compile final Boyer-Moore literal field.
-    int ret = bm_compile_literal(&heuristic->literal_comp, best_pattern, 0);
+    unit->max_length = 1;
+    if (atom == ATOM_CHAR) {
+        unit->has_literal_suffix = true;
+        return heur_parser_push(unit, literal);
+    }
+
+    unit->has_literal_prefix = false;
+    unit->is_exact = false;
+    return (REG_OK);
+}
+
+// Adds the last atom of a branch to the parser, once it is complete. Small
+// bracket expressions continue the class run, but end the literal run.
+static int
+append_atom(heur_parser *parser, string *run, ssize_t *capacity,
+    class_run *xrun, int atom, string literal, const small_class *cls,
+    heur_parser *unit)
+{
+    int ret = REG_OK;
+    switch (atom) {
+        case ATOM_CHAR:
+            if (!class_run_append(xrun, parser, literal)
+                || !run_append(run, capacity, literal)) {
+                ret = (REG_ESPACE);
+            }
+            parser->max_length++;
+            break;
+        case ATOM_CLASS:
+            ret = (cls->count > 1)
+                ? class_run_add(parser, xrun, cls)
+                : end_class_run(parser, xrun);
+            if (ret == REG_OK) {
+                ret = end_run(parser, run);
+            }
+            parser->max_length++;
+            parser->is_exact = false;
+            break;
+        case ATOM_UNIT:
+            ret = end_class_run(parser, xrun);
+            if (ret == REG_OK) {
+                ret = append_unit(parser, run, capacity, unit);
+            }
+            heur_parser_free(unit);
+            break;
+    }
     return ret;
 }
 
-/*
- * Preprocess the given pattern with the given length and compilation flags.
- * Outputs the gathered heuristic data into the given heur struct pointer.
- * The struct is fully initialized with this function.
- * 
- * May return REG_BADPAT or REG_ESPACE on failure.
- */
-int
-frec_preprocess_heur(heur *heuristic, string pattern, int cflags)
+// Returns whether fragment a should be searched for before fragment b:
+// if it is rarer, or if it is longer and as rare.
+static bool
+is_more_selective(string a, unsigned int a_score, string b, unsigned int b_score)
 {
-    // Initialize heuristic parser.
-    heur_parser parser;
-    bool success = heur_parser_init(&parser, cflags);
-    if (!success) {
+    return a_score > b_score || (a_score == b_score && a.len > b.len);
+}
+
+// Returns whether the needle occurs in the haystack.
+static bool
+string_contains(string haystack, string needle)
+{
+    for (ssize_t i = 0; i + needle.len <= haystack.len; i++) {
+        if (string_compare(&haystack, i, &needle, 0, needle.len)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Returns whether the needle occurs in each one of the literals.
+static bool
+literals_contain(const string *literals, ssize_t count, string needle)
+{
+    for (ssize_t i = 0; i < count; i++) {
+        if (!string_contains(literals[i], needle)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Compiles the fragments of the parser, so that they can be searched for
+// before calling the original matcher. Each fragment occurs in every match,
+// the rarer ones are searched for first, as they rule out the most sections.
+// Fragments that occur in each one of the searched literals are skipped.
+static int
+build_fragments(heur *heuristic, heur_parser parser, const string *searched,
+    ssize_t searched_count, int cflags)
+{
+    bool icase = cflags & REG_ICASE;
+    unsigned int scores[MAX_FRAGMENTS];
+    for (ssize_t i = 0; i < parser.frag_index; i++) {
+        scores[i] = literal_rarity(parser.fragments[i], icase);
+    }
+
+    ssize_t order[MAX_FRAGMENTS];
+    ssize_t count = 0;
+    for (ssize_t i = 0; i < parser.frag_index; i++) {
+        if (literals_contain(searched, searched_count, parser.fragments[i])) {
+            continue;
+        }
+
+        ssize_t j = count++;
+        for (; j > 0 && is_more_selective(parser.fragments[i], scores[i],
+                parser.fragments[order[j - 1]], scores[order[j - 1]]); j--) {
+            order[j] = order[j - 1];
+        }
+        order[j] = i;
+    }
+
+    if (count == 0) {
+        return (REG_OK);
+    }
+
+    heuristic->fragments = malloc(sizeof(bm_comp) * count);
+    if (heuristic->fragments == NULL) {
         return (REG_ESPACE);
     }
 
-    // This fragment will be the one we modify. Its length is set to 0
-    // so that it can be filled with the parsed characters.
-    string fragment;
-    success = string_duplicate(&fragment, pattern);
-    if (!success) {
-        heur_parser_free(&parser);
+    for (ssize_t i = 0; i < count; i++) {
+        bm_comp_init(&heuristic->fragments[i], cflags);
+        heuristic->fragment_count++;
+
+        int ret = bm_compile_literal(&heuristic->fragments[i],
+            parser.fragments[order[i]], cflags & REG_ICASE);
+        if (ret != REG_OK) {
+            return ret;
+        }
+    }
+
+    return (REG_OK);
+}
+
+// Frees the compiled fragments of the heuristic.
+static void
+free_fragments(heur *heuristic)
+{
+    for (ssize_t i = 0; i < heuristic->fragment_count; i++) {
+        bm_comp_free(&heuristic->fragments[i]);
+    }
+    free(heuristic->fragments);
+
+    heuristic->fragments = NULL;
+    heuristic->fragment_count = 0;
+}
+
+// Returns the maximum length of the matches that the windows around the
+// candidates are based on, or -1 if they are based on lines.
+static ssize_t
+window_length(const heur_parser *parser)
+{
+    if (!parser->length_known) {
+        return (-1);
+    }
+
+    // Long matches are better bounded by their lines, if they can't span
+    // multiple lines.
+    if (parser->max_length > MAX_WINDOW && !parser->may_match_lf) {
+        return (-1);
+    }
+    return parser->max_length;
+}
+
+// Selects the heuristic type that can be used with what the parser found
+// out about the pattern. Returns -1 if neither one can be used.
+static int
+select_type(const heur_parser *parser)
+{
+    if (parser->length_known || !parser->may_match_lf) {
+        return (HEUR_LONGEST);
+    } else if (parser->has_literal_prefix || parser->variants_at_start) {
+        return (HEUR_PREFIX);
+    }
+    return (-1);
+}
+
+// Returns the index of the fragment that the given heuristic type searches
+// for, or -1 if the parser has no such fragment. Its rarity is stored in
+// score.
+static ssize_t
+select_fragment(const heur_parser *parser, int heur_type, int cflags,
+    unsigned int *score)
+{
+    // Without a literal fragment (e.g. in 'x*'), nothing can be filtered.
+    // Prefix heuristics need one that starts every match.
+    if (parser->frag_index == 0
+        || (heur_type == HEUR_PREFIX && !parser->has_literal_prefix)) {
+        return (-1);
+    }
+
+    bool icase = cflags & REG_ICASE;
+    ssize_t best = 0;
+    *score = literal_rarity(parser->fragments[0], icase);
+
+    // If prefix heuristics is used, we'll use the first fragment.
+    // Otherwise, we find the rarest fragment, as the fewest candidates
+    // are found for it.
+    if (heur_type == HEUR_LONGEST) {
+        for (ssize_t j = 1; j < parser->frag_index; j++) {
+            unsigned int curr = literal_rarity(parser->fragments[j], icase);
+            if (is_more_selective(parser->fragments[j], curr,
+                    parser->fragments[best], *score)) {
+                best = j;
+                *score = curr;
+            }
+        }
+    }
+
+    return (parser->fragments[best].len == 0) ? (-1) : (best);
+}
+
+// Compiles the literals of the alternatives with Teddy, or with Wu-Manber if
+// Teddy can't handle them.
+static int
+compile_alternatives(heur *heuristic, const string *literals, ssize_t count,
+    int cflags)
+{
+    // Teddy only compares case insensitively if MB_CUR_MAX == 1.
+    if (!literals[0].is_wide && count <= TEDDY_MAX_PATTERNS
+        && !((cflags & REG_ICASE) && MB_CUR_MAX > 1)) {
+        heuristic->teddy = malloc(sizeof(teddy_comp));
+        if (heuristic->teddy == NULL) {
+            return (REG_ESPACE);
+        }
+        return teddy_compile(heuristic->teddy, literals, count, cflags);
+    }
+
+    heuristic->wu_manber = malloc(sizeof(wm_comp));
+    if (heuristic->wu_manber == NULL) {
+        return (REG_ESPACE);
+    }
+    return wm_compile(heuristic->wu_manber, literals, count, cflags);
+}
+
+// Selects the literals that the candidates of the branch are found by: its
+// rarest fragment, or the variants of its rarest expanded run, if they are
+// rarer. These are referenced in literals, which must have room for
+// MAX_VARIANTS of them. Returns their count, or -1 if the branch has none.
+// Their rarity is stored in score.
+static ssize_t
+select_literals(const heur_parser *parser, int heur_type, int cflags,
+    string *literals, unsigned int *score)
+{
+    ssize_t best = select_fragment(parser, heur_type, cflags, score);
+
+    bool use_variants = parser->variant_count > 0
+        && (heur_type == HEUR_LONGEST || parser->variants_at_start)
+        && (best == -1 || parser->variant_score > *score);
+    if (use_variants) {
+        for (ssize_t i = 0; i < parser->variant_count; i++) {
+            string_reference(&literals[i], parser->variants[i]);
+        }
+        *score = parser->variant_score;
+        return parser->variant_count;
+    } else if (best == -1) {
+        return (-1);
+    }
+
+    string_reference(&literals[0], parser->fragments[best]);
+    return 1;
+}
+
+// Build final heuristic output from the given parser.
+static int
+build_heuristic(heur *heuristic, heur_parser parser, int cflags)
+{
+    // Set the maximum length.
+    heuristic->max_length = window_length(&parser);
+
+    // Set heuristic type. If we can't use either one of them, return early.
+    heuristic->heur_type = select_type(&parser);
+    if (heuristic->heur_type == -1) {
+        return (REG_BADPAT);
+    }
+
+    string literals[MAX_VARIANTS];
+    ssize_t count = select_literals(&parser, heuristic->heur_type, cflags,
+        literals, &heuristic->score);
+    if (count == -1) {
+        return (REG_BADPAT);
+    }
+
+    // Compile final Boyer-Moore literal field. The multi-pattern engines
+    // of pattern sets search for this one, even if the variants of an
+    // expanded run are searched for otherwise. Only the case of the text
+    // matters to the literals, their offsets are always needed.
+    unsigned int score;
+    ssize_t best = select_fragment(&parser, heuristic->heur_type, cflags,
+        &score);
+    int ret = REG_OK;
+    if (best != -1) {
+        ret = bm_compile_literal(&heuristic->literal_comp,
+            parser.fragments[best], cflags & REG_ICASE);
+    }
+    if (ret == REG_OK && count > 1) {
+        ret = compile_alternatives(heuristic, literals, count, cflags);
+    }
+    if (ret != REG_OK) {
+        return ret;
+    }
+
+    // The other fragments are checked around each candidate.
+    ret = build_fragments(heuristic, parser, literals, count, cflags);
+    if (ret != REG_OK) {
+        free_fragments(heuristic);
+    }
+    return ret;
+}
+
+// Build the heuristic of a pattern with multiple alternatives, from the
+// parsers of each of them. Every match contains the literal fragment of one
+// of the alternatives, so these are searched for all at once.
+static int
+build_alternation(heur *heuristic, const heur_parser *branches, ssize_t count,
+    int cflags)
+{
+    // Merge what is known about the alternatives. Prefix heuristics need
+    // each of them to start with their literals.
+    heur_parser merged = branches[0];
+    merged.has_literal_prefix = true;
+    for (ssize_t i = 0; i < count; i++) {
+        merged.max_length = max(merged.max_length, branches[i].max_length);
+        merged.length_known &= branches[i].length_known;
+        merged.may_match_lf |= branches[i].may_match_lf;
+        merged.has_literal_prefix &= branches[i].has_literal_prefix
+            || branches[i].variants_at_start;
+    }
+    merged.variants_at_start = false;
+
+    heuristic->max_length = window_length(&merged);
+    heuristic->heur_type = select_type(&merged);
+    if (heuristic->heur_type == -1) {
+        return (REG_BADPAT);
+    }
+
+    // If any of the alternatives has no literal, nothing can be filtered.
+    // The candidates of each alternative add up.
+    string literals[MAX_FRAGMENTS * MAX_VARIANTS];
+    ssize_t total = 0;
+    for (ssize_t i = 0; i < count; i++) {
+        unsigned int score;
+        ssize_t found = select_literals(&branches[i], heuristic->heur_type,
+            cflags, &literals[total], &score);
+        if (found == -1) {
+            return (REG_BADPAT);
+        }
+        total += found;
+        heuristic->score = (i == 0) ? score : rarity_sum(heuristic->score, score);
+    }
+
+    return compile_alternatives(heuristic, literals, total, cflags);
+}
+
+// Parses one alternative of the pattern into the parser, starting from the
+// given iter position. Stops at the end of the pattern, at a '|' that isn't
+// enclosed by brackets or parentheses, or at the parenthesis that closes
+// the group of the alternative, and leaves iter there. Where it stopped is
+// stored in stop.
+static int
+parse_branch(heur_parser *parser, string pattern, ssize_t *iter, int cflags,
+    int depth, int *stop)
+{
+    // The literal run that the parsed characters are added to. It ends at
+    // anything that isn't a literal, and is then pushed as a fragment.
+    string run;
+    if (!string_copy(&run, (pattern.is_wide) ? (void *) L"" : (void *) "", 0,
+            pattern.is_wide)) {
+        return (REG_ESPACE);
+    }
+    ssize_t capacity = 1;
+
+    // The run that small bracket expressions are expanded in.
+    class_run xrun;
+    if (!class_run_init(&xrun, pattern.is_wide, cflags)) {
+        string_free(&run);
         return (REG_ESPACE);
     }
-    fragment.len = 0;
 
     /* Initialize regex parser. */
     regex_parser reg_parser;
     reg_parser.escaped = false;
     reg_parser.extended = cflags & REG_EXTENDED;
 
+    // The last atom isn't added to the branch until we know whether a
+    // quantifier follows it.
+    int atom = ATOM_NONE;
+    string literal;
+    small_class cls;
+    heur_parser unit;
+    string_init(&literal);
+    cls.count = 0;
+
     int ret = REG_OK;
-    for (ssize_t i = 0; i < pattern.len; i++) {
+    ssize_t i;
+    *stop = STOP_END;
+    for (i = *iter; ret == REG_OK && i < pattern.len; i++) {
+        // The alternative ends at the closing parenthesis of its group,
+        // which is escaped in BRE.
+        if (depth > 0 && string_has_char_at(pattern, i, ')', L')')
+            && reg_parser.escaped != reg_parser.extended) {
+            *stop = STOP_CLOSE;
+            break;
+        }
+
         // Parse each character.
         parse_result result;
         if (pattern.is_wide) {
@@ -271,110 +1198,188 @@ frec_preprocess_heur(heur *heuristic, string pattern, int cflags)
             result = parse_char(&reg_parser, pattern.stnd[i]);
         }
 
-        // Execute preliminary actions.
+        // The alternative ends at a '|' character.
+        if (result == SPEC_PIPE) {
+            *stop = STOP_PIPE;
+            break;
+        }
+
+        // Quantifiers apply to the last atom, which becomes a unit.
+        int min_count = -1;
+        int max_count = -1;
         switch (result) {
-            // Save a normal character or a newline.
-            case NORMAL_CHAR:
-                string_append_from(&fragment, pattern, i);
-                parser.max_length++;
-                break;
-            case NORMAL_NEWLINE:
-                string_append(&fragment, '\n', L'\n');
-                parser.max_length++;
-                parser.may_match_lf = true;
+            case SPEC_ASTERISK:
+                min_count = 0;
                 break;
-            // Skip when we should skip any action.
-            case SHOULD_SKIP:
+            case SPEC_PLUS:
+                min_count = 1;
                 break;
-            // In case of a bad pattern or a | char (unsupported),
-            // signal an error (handled below the switch).
-            case BAD_PATTERN:
-            case SPEC_PIPE:
-                ret = (REG_BADPAT);
+            case SPEC_QMARK:
+                min_count = 0;
+                max_count = 1;
                 break;
-            // These special characters make the last literal char optional.
             case SPEC_CURLYBRACE:
-            case SPEC_ASTERISK:
-            case SPEC_QMARK:
-                fragment.len = max(0, fragment.len - 1);
-            // The above and these others make the pattern variable length.
-            case SPEC_PLUS:
-            case SPEC_PAREN:
-                parser.length_known = false;
-            // In the above cases and for any other special character,
-            // we need to end the current literal segment.
+                ret = handle_curlybraces(pattern, &i, reg_parser.extended,
+                    &min_count, &max_count);
+                break;
+            // Escape characters don't end the atom.
+            case SHOULD_SKIP:
+                continue;
             default:
-                string_null_terminate(&fragment);
-                // Return failures are handled below the switch.
-                ret = heur_parser_push(&parser, fragment);
-                // Reset fragment position for the next fragment.
-                fragment.len = 0;
                 break;
         }
 
         if (ret != REG_OK) {
-            string_free(&fragment);
-            heur_parser_free(&parser);
-            return ret;
+            break;
+        } else if (min_count != -1 && atom == ATOM_NONE) {
+            // There's nothing to repeat, so we can't tell what this means.
+            parser->length_known = false;
+            parser->is_exact = false;
+            ret = end_class_run(parser, &xrun);
+            if (ret == REG_OK) {
+                ret = end_run(parser, &run);
+            }
+            continue;
+        } else if (min_count != -1) {
+            if (atom != ATOM_UNIT) {
+                ret = make_unit(&unit, atom, literal, cflags);
+                atom = ATOM_UNIT;
+            }
+            if (ret == REG_OK) {
+                ret = repeat_unit(&unit, min_count, max_count);
+            }
+            continue;
+        }
+
+        // Otherwise the last atom is complete, and it is added to the branch.
+        ret = append_atom(parser, &run, &capacity, &xrun, atom, literal, &cls,
+            &unit);
+        atom = ATOM_NONE;
+        if (ret != REG_OK) {
+            break;
         }
 
-        // Execute extra actions. For a few special characters, we need to
-        // do extra work after finishing the segment.
         switch (result) {
-            // A . any character operator may include line feeds, and also
-            // modifies the maximum length.
+            // Save a normal character or a newline.
+            case NORMAL_CHAR:
+                string_borrow_section(&literal, pattern, i, i + 1);
+                atom = ATOM_CHAR;
+                break;
+            case NORMAL_NEWLINE:
+                string_borrow(&literal, (pattern.is_wide)
+                    ? (void *) L"\n" : (void *) "\n", 1, pattern.is_wide);
+                parser->may_match_lf = true;
+                atom = ATOM_CHAR;
+                break;
+            // A . any character operator may include line feeds, unless
+            // REG_NEWLINE was set.
             case SPEC_DOT:
-                parser.may_match_lf = true;
-                parser.max_length++;
+                parser->may_match_lf |= !parser->reg_newline_set;
+                cls.count = 0;
+                atom = ATOM_CLASS;
                 break;
             /* On a '[' character, we need to advance our iterator. */
             case SPEC_BRACKET:
-                ret = handle_square_bracket(&parser, pattern, &i);
-                parser.max_length++;
+                ret = handle_square_bracket(parser, pattern, &i, cflags, &cls);
+                atom = ATOM_CLASS;
+
+                // A single character is just a literal.
+                if (cls.count == 1) {
+                    string_borrow(&literal, (pattern.is_wide)
+                        ? (void *) cls.wide : (void *) cls.stnd, 1,
+                        pattern.is_wide);
+                    atom = ATOM_CHAR;
+                }
                 break;
-            /* On a '(' or a '{' we advance too, but with a different logic. */
+            /* On a '(', the group is parsed as a unit. */
             case SPEC_PAREN:
-                ret = handle_parentheses(&parser, pattern, &i);
+                ret = handle_parentheses(&unit, pattern, &i, cflags, depth + 1);
+                atom = (ret == REG_OK) ? (ATOM_UNIT) : (ATOM_NONE);
                 break;
-            case SPEC_CURLYBRACE:
-                ret = handle_curlybraces(&parser, pattern, &i);
+            // In case of a bad pattern, signal an error.
+            case BAD_PATTERN:
+                ret = (REG_BADPAT);
                 break;
+            // Anchors end the current literal segment.
             default:
+                parser->is_exact = false;
+                ret = end_class_run(parser, &xrun);
+                if (ret == REG_OK) {
+                    ret = end_run(parser, &run);
+                }
                 break;
         }
+    }
 
-        // If any of the extra actions failed, we return.
-        if (ret != REG_OK) {
-            string_free(&fragment);
-            heur_parser_free(&parser);
-            return ret;
-        }
+    // We read the whole alternative. If the last atom or the last segment
+    // was not finished, we finish it.
+    if (ret == REG_OK) {
+        ret = append_atom(parser, &run, &capacity, &xrun, atom, literal, &cls,
+            &unit);
+    } else if (atom == ATOM_UNIT) {
+        heur_parser_free(&unit);
+    }
+    if (ret == REG_OK) {
+        ret = end_class_run(parser, &xrun);
     }
 
-    // We exited the loop, which means we read the whole pattern.
-    // If the last segment was not finished, we finish it.
-    if (fragment.len > 0) {
-        string_null_terminate(&fragment);
-        ret = heur_parser_push(&parser, fragment);
-        if (ret != REG_OK) {
-            string_free(&fragment);
-            heur_parser_free(&parser);
-            return ret;
+    if (ret == REG_OK && run.len > 0) {
+        ssize_t count = parser->frag_index;
+        ret = heur_parser_push(parser, run);
+        parser->has_literal_suffix = parser->frag_index > count;
+    }
+
+    *iter = i;
+    string_free(&run);
+    string_free(&xrun.literal);
+    return ret;
+}
+
+/*
+ * Preprocess the given pattern with the given length and compilation flags.
+ * Outputs the gathered heuristic data into the given heur struct pointer.
+ * The struct is fully initialized with this function.
+ * 
+ * May return REG_BADPAT or REG_ESPACE on failure.
+ */
+int
+frec_preprocess_heur(heur *heuristic, string pattern, int cflags)
+{
+    // Each alternative of the pattern is parsed by its own heuristic parser.
+    heur_parser branches[MAX_FRAGMENTS];
+    ssize_t count = 0;
+
+    int ret = REG_OK;
+    for (ssize_t i = 0; ret == REG_OK && i <= pattern.len; i++) {
+        int stop;
+        if (count == MAX_FRAGMENTS) {
+            ret = (REG_BADPAT);
+        } else if (!heur_parser_init(&branches[count], cflags)) {
+            ret = (REG_ESPACE);
+        } else {
+            ret = parse_branch(&branches[count++], pattern, &i, cflags, 0,
+                &stop);
         }
     }
 
-    // Initialize and fill Boyer-Moore compilation data for the best fragment.
-    bm_comp_init(&heuristic->literal_comp, cflags);
-    ret = build_heuristic(heuristic, parser);
+    if (ret == REG_OK && count == 1) {
+        // Initialize and fill Boyer-Moore compilation data for the best
+        // fragment.
+        bm_comp_init(&heuristic->literal_comp, cflags);
+        ret = build_heuristic(heuristic, branches[0], cflags);
 
-    // Free Boyer-Moore data if compilation failed.
-    if (ret != REG_OK) {
-        bm_comp_free(&heuristic->literal_comp);
+        // Free Boyer-Moore data if compilation failed.
+        if (ret != REG_OK) {
+            bm_comp_free(&heuristic->literal_comp);
+        }
+    } else if (ret == REG_OK) {
+        ret = build_alternation(heuristic, branches, count, cflags);
     }
 
-    // And free the temporary fragment, as well as the heuristic parser.
-    string_free(&fragment);
-    heur_parser_free(&parser);
+    // And free the heuristic parsers.
+    for (ssize_t i = 0; i < count; i++) {
+        heur_parser_free(&branches[i]);
+    }
     return ret;
 }
 
@@ -386,6 +1391,13 @@ frec_create_heur()
         return NULL;
     }
 
+    // The literal struct is freed even if the preprocessing fails early.
+    bm_comp_init(&heuristic->literal_comp, 0);
+    heuristic->fragments = NULL;
+    heuristic->fragment_count = 0;
+    heuristic->teddy = NULL;
+    heuristic->wu_manber = NULL;
+    heuristic->score = 0;
     return heuristic;
 }
 
@@ -394,6 +1406,47 @@ frec_free_heur(heur *heuristic)
 {
     if (heuristic != NULL) {
         bm_comp_free(&heuristic->literal_comp);
+        free_fragments(heuristic);
+
+        teddy_comp_free(heuristic->teddy);
+        free(heuristic->teddy);
+        wm_comp_free(heuristic->wu_manber);
+        free(heuristic->wu_manber);
+
         free(heuristic);
     }
 }
+
+int
+frec_heur_candidate(frec_match_t *candidate, const heur *heuristic,
+    string text, int eflags)
+{
+    if (heuristic->teddy != NULL) {
+        return teddy_execute(candidate, heuristic->teddy, text, eflags);
+    } else if (heuristic->wu_manber != NULL) {
+        return wm_execute(candidate, heuristic->wu_manber, text, eflags);
+    }
+    return bm_execute(candidate, &heuristic->literal_comp, text, eflags);
+}
+
+ssize_t
+frec_heur_literal_len(const heur *heuristic)
+{
+    if (heuristic->teddy != NULL) {
+        return heuristic->teddy->len_shortest;
+    } else if (heuristic->wu_manber != NULL) {
+        return heuristic->wu_manber->len_shortest;
+    }
+    return heuristic->literal_comp.pattern.len;
+}
+
+bool
+frec_heur_has_fragments(const heur *heuristic, string text, int eflags)
+{
+    for (ssize_t i = 0; i < heuristic->fragment_count; i++) {
+        if (bm_execute(NULL, &heuristic->fragments[i], text, eflags) != REG_OK) {
+            return false;
+        }
+    }
+    return true;
+}
@@ -4,6 +4,8 @@
 #include <stdbool.h>
 #include "bm.h"
 #include "string-type.h"
+#include "teddy-type.h"
+#include "wm-type.h"
 
 #define MAX_FRAGMENTS 32
 
@@ -12,7 +14,12 @@
 
 typedef struct heur {
 	bm_comp literal_comp;	/* BM prep struct for the longest literal fragment of the pattern. */
+	bm_comp *fragments;			/* BM prep structs for the other required fragments, rarest first. */
+	ssize_t fragment_count;		/* The number of these fragments. */
+	teddy_comp *teddy;			/* Teddy prep struct for the literals of the alternatives, if any. */
+	wm_comp *wu_manber;			/* Wu-Manber prep struct for these, if Teddy can't be used. */
 	ssize_t max_length;			/* The maximum possible length of the pattern. -1 if not bound. */
+	unsigned int score;			/* The estimated rarity of the candidates (see literal_rarity). */
 	int heur_type;				/* The type of the heuristic. */
 } heur;
 
@@ -22,4 +29,19 @@ void frec_free_heur(heur *h);
 int
 frec_preprocess_heur(heur *heur, string pattern, int cflags);
 
+// Finds the first candidate of a match in the text: the literal fragment of
+// the pattern, or the literal of any of its alternatives.
+int
+frec_heur_candidate(frec_match_t *candidate, const heur *heur, string text,
+    int eflags);
+
+// Returns the length of the shortest literal that candidates are found by.
+ssize_t
+frec_heur_literal_len(const heur *heur);
+
+// Returns whether every required fragment of the heuristic occurs in the
+// text. If not, the text can't contain a match of the pattern.
+bool
+frec_heur_has_fragments(const heur *heur, string text, int eflags);
+
 #endif
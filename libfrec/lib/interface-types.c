@@ -1,7 +1,10 @@
 #include <stdlib.h>
 
+#include "ac-type.h"
 #include "bm-type.h"
+#include "dfa-type.h"
 #include "frec-internal.h"
+#include "teddy-type.h"
 #include "wm-type.h"
 
 void
@@ -10,7 +13,15 @@ frec_regfree(frec_t *preg)
     bm_comp_free(preg->boyer_moore);
     free(preg->boyer_moore);
     frec_free_heur(preg->heuristic);
-    _dist_regfree(&preg->original);
+    dfa_comp_free(preg->dfa);
+    free(preg->dfa);
+    if (!preg->is_borrowed) {
+        free(preg->source);
+    }
+    if (preg->has_original) {
+        _dist_regfree(&preg->original);
+        preg->has_original = false;
+    }
 }
 
 void
@@ -23,9 +34,30 @@ frec_mregfree(mfrec_t *preg)
         }
 
         for (ssize_t i = 0; i < until; i++) {
-            frec_regfree(&preg->patterns[i]);
+            if (!preg->patterns[i].is_removed) {
+                frec_regfree(&preg->patterns[i]);
+            }
         }
 
+        free(preg->patterns);
+        preg->patterns = NULL;
+
         wm_comp_free(preg->wu_manber);
+        free(preg->wu_manber);
+        preg->wu_manber = NULL;
+
+        ac_comp_free(preg->aho_corasick);
+        free(preg->aho_corasick);
+        preg->aho_corasick = NULL;
+
+        teddy_comp_free(preg->teddy);
+        free(preg->teddy);
+        preg->teddy = NULL;
+
+        free(preg->ids);
+        preg->ids = NULL;
+
+        free(preg->by_literal);
+        preg->by_literal = NULL;
     }
 }
@@ -24,11 +24,13 @@
  * SUCH DAMAGE.
  */
 
+#include <limits.h>
 #include <stdbool.h>
 #include <stdlib.h>
 #include <wchar.h>
 #include <string.h>
 
+#include "byte-freq.h"
 #include "compile.h"
 #include "heuristic.h"
 #include "match.h"
@@ -87,8 +89,8 @@ frec_regwcomp(frec_t *preg, const wchar_t *regex, int cflags)
 
 
 static int
-execute_match(const void *preg, string text,
-    size_t nmatch, frec_match_t pmatch[], int eflags, bool multi)
+execute_match(const void *preg, string text, size_t nmatch,
+    frec_match_t pmatch[], int eflags, bool multi, frec_scratch_t *scratch)
 {
     // Handle REG_STARTEND and optional start and end offsets.
     ssize_t offset_start = 0;
@@ -112,18 +114,20 @@ execute_match(const void *preg, string text,
     int ret;
     if (multi) {
         nosub_not_set = (((mfrec_t *)preg)->cflags & REG_NOSUB) == 0;
-        ret = frec_mmatch(pmatch, nmatch, preg, text, eflags);
+        ret = frec_mmatch(pmatch, nmatch, preg, text, eflags, scratch);
     } else {
         nosub_not_set = (((frec_t *)preg)->cflags & REG_NOSUB) == 0;
-        ret = frec_match(pmatch, nmatch, preg, text, eflags);
+        ret = frec_match(pmatch, nmatch, preg, text, eflags, scratch);
     }
 
     // Fix offsets that may have been messed up by REG_STARTEND.
 	if (ret == REG_OK) {
         if (eflags & REG_STARTEND && nosub_not_set) {
-            for (ssize_t i = 0; i < nmatch && pmatch[i].soffset != -1; i++) {
-                pmatch[i].soffset += offset_start;
-                pmatch[i].eoffset += offset_start;
+            for (ssize_t i = 0; i < nmatch; i++) {
+                if (pmatch[i].soffset != -1) {
+                    pmatch[i].soffset += offset_start;
+                    pmatch[i].eoffset += offset_start;
+                }
             }
         }
     }
@@ -135,10 +139,7 @@ int
 frec_regnexec(const frec_t *preg, const char *str, size_t len,
     size_t nmatch, frec_match_t pmatch[], int eflags)
 {
-    string text;
-    string_borrow(&text, str, (ssize_t) len, false);
-
-	return execute_match(preg, text, nmatch, pmatch, eflags, false);
+    return frec_regnexec_r(preg, str, len, nmatch, pmatch, eflags, NULL);
 }
 
 int
@@ -154,10 +155,7 @@ int
 frec_regwnexec(const frec_t *preg, const wchar_t *str, size_t len,
     size_t nmatch, frec_match_t pmatch[], int eflags)
 {
-    string text;
-    string_borrow(&text, str, (ssize_t) len, true);
-
-	return execute_match(preg, text, nmatch, pmatch, eflags, false);
+    return frec_regwnexec_r(preg, str, len, nmatch, pmatch, eflags, NULL);
 }
 
 int
@@ -168,6 +166,42 @@ frec_regwexec(
 	return frec_regwnexec(preg, str, wcslen(str), nmatch, pmatch, eflags);
 }
 
+int
+frec_regnexec_r(const frec_t *preg, const char *str, size_t len,
+    size_t nmatch, frec_match_t pmatch[], int eflags, frec_scratch_t *scratch)
+{
+    string text;
+    string_borrow(&text, str, (ssize_t) len, false);
+
+	return execute_match(preg, text, nmatch, pmatch, eflags, false, scratch);
+}
+
+int
+frec_regexec_r(const frec_t *preg, const char *str,
+    size_t nmatch, frec_match_t pmatch[], int eflags, frec_scratch_t *scratch)
+{
+    return frec_regnexec_r(preg, str, strlen(str), nmatch, pmatch, eflags,
+        scratch);
+}
+
+int
+frec_regwnexec_r(const frec_t *preg, const wchar_t *str, size_t len,
+    size_t nmatch, frec_match_t pmatch[], int eflags, frec_scratch_t *scratch)
+{
+    string text;
+    string_borrow(&text, str, (ssize_t) len, true);
+
+	return execute_match(preg, text, nmatch, pmatch, eflags, false, scratch);
+}
+
+int
+frec_regwexec_r(const frec_t *preg, const wchar_t *str,
+    size_t nmatch, frec_match_t pmatch[], int eflags, frec_scratch_t *scratch)
+{
+    return frec_regwnexec_r(preg, str, wcslen(str), nmatch, pmatch, eflags,
+        scratch);
+}
+
 size_t
 frec_regerror(
     int errcode, const frec_t *preg, char *errbuf, size_t errbuf_size
@@ -175,6 +209,20 @@ frec_regerror(
     return _dist_regerror(errcode, &preg->original, errbuf, errbuf_size);
 }
 
+int
+frec_literal_score(const frec_t *preg, unsigned int *score)
+{
+    if (preg->boyer_moore != NULL) {
+        *score = literal_rarity(preg->boyer_moore->pattern,
+            preg->cflags & REG_ICASE);
+    } else if (preg->heuristic != NULL) {
+        *score = preg->heuristic->score;
+    } else {
+        return (REG_NOMATCH);
+    }
+    return (REG_OK);
+}
+
 
 
 int
@@ -253,16 +301,63 @@ frec_mregwcomp(mfrec_t *preg, size_t nr, const wchar_t **regex, int cflags)
     return ret;
 }
 
+static int
+add_pattern(mfrec_t *preg, string pattern, size_t *id)
+{
+    ssize_t added;
+    int ret = frec_mcompile_add(preg, pattern, &added);
+    if (ret == REG_OK && id != NULL) {
+        *id = (size_t) added;
+    }
+    return ret;
+}
+
+int
+frec_mnadd(mfrec_t *preg, const char *regex, size_t len, size_t *id)
+{
+    string pattern;
+    string_borrow(&pattern, regex, (ssize_t) len, false);
+
+    return add_pattern(preg, pattern, id);
+}
+
+int
+frec_madd(mfrec_t *preg, const char *regex, size_t *id)
+{
+    return frec_mnadd(preg, regex, strlen(regex), id);
+}
+
+int
+frec_mwnadd(mfrec_t *preg, const wchar_t *regex, size_t len, size_t *id)
+{
+    string pattern;
+    string_borrow(&pattern, regex, (ssize_t) len, true);
+
+    return add_pattern(preg, pattern, id);
+}
+
+int
+frec_mwadd(mfrec_t *preg, const wchar_t *regex, size_t *id)
+{
+    return frec_mwnadd(preg, regex, wcslen(regex), id);
+}
+
+int
+frec_mremove(mfrec_t *preg, size_t id)
+{
+    if (id > (size_t) SSIZE_MAX) {
+        return (REG_BADPAT);
+    }
+    return frec_mcompile_remove(preg, (ssize_t) id);
+}
+
 
 int
 frec_mregnexec(
     const mfrec_t *preg, const char *str, size_t len,
     size_t nmatch, frec_match_t pmatch[], int eflags
 ) {
-    string text;
-    string_borrow(&text, str, (ssize_t) len, false);
-
-	return execute_match(preg, text, nmatch, pmatch, eflags, true);
+    return frec_mregnexec_r(preg, str, len, nmatch, pmatch, eflags, NULL);
 }
 
 int
@@ -278,10 +373,7 @@ frec_mregwnexec(
     const mfrec_t *preg, const wchar_t *str, size_t len,
     size_t nmatch, frec_match_t pmatch[], int eflags
 ) {
-    string text;
-    string_borrow(&text, str, (ssize_t) len, false);
-
-	return execute_match(preg, text, nmatch, pmatch, eflags, true);
+    return frec_mregwnexec_r(preg, str, len, nmatch, pmatch, eflags, NULL);
 }
 
 int
@@ -292,6 +384,238 @@ frec_mregwexec(
 	return frec_mregwnexec(preg, str, wcslen(str), nmatch, pmatch, eflags);
 }
 
+int
+frec_mregnexec_r(const mfrec_t *preg, const char *str, size_t len,
+    size_t nmatch, frec_match_t pmatch[], int eflags, frec_scratch_t *scratch)
+{
+    string text;
+    string_borrow(&text, str, (ssize_t) len, false);
+
+	return execute_match(preg, text, nmatch, pmatch, eflags, true, scratch);
+}
+
+int
+frec_mregexec_r(const mfrec_t *preg, const char *str,
+    size_t nmatch, frec_match_t pmatch[], int eflags, frec_scratch_t *scratch)
+{
+    return frec_mregnexec_r(preg, str, strlen(str), nmatch, pmatch, eflags,
+        scratch);
+}
+
+int
+frec_mregwnexec_r(const mfrec_t *preg, const wchar_t *str, size_t len,
+    size_t nmatch, frec_match_t pmatch[], int eflags, frec_scratch_t *scratch)
+{
+    string text;
+    string_borrow(&text, str, (ssize_t) len, true);
+
+	return execute_match(preg, text, nmatch, pmatch, eflags, true, scratch);
+}
+
+int
+frec_mregwexec_r(const mfrec_t *preg, const wchar_t *str,
+    size_t nmatch, frec_match_t pmatch[], int eflags, frec_scratch_t *scratch)
+{
+    return frec_mregwnexec_r(preg, str, wcslen(str), nmatch, pmatch, eflags,
+        scratch);
+}
+
+
+static int
+execute_match_all(const void *preg, string text,
+    size_t nmatch, frec_match_t pmatch[], int eflags,
+    frec_match_cb cb, void *arg, bool multi)
+{
+    // Handle REG_STARTEND the same way as execute_match does.
+    ssize_t offset_start = 0;
+    ssize_t offset_end = text.len;
+
+    if (eflags & REG_STARTEND) {
+        offset_start = pmatch[0].soffset;
+        offset_end = pmatch[0].eoffset;
+    }
+
+    if (offset_start > offset_end) {
+        return (REG_NOMATCH);
+    }
+
+    string_offset(&text, offset_start);
+    text.len = offset_end - offset_start;
+
+    // Reported offsets are relative to the whole text.
+    if (multi) {
+        return frec_mmatch_all(pmatch, nmatch, preg, text, offset_start,
+            eflags, cb, arg);
+    } else {
+        return frec_match_all(pmatch, nmatch, preg, text, offset_start,
+            eflags, cb, arg);
+    }
+}
+
+int
+frec_regnexec_all(
+    const frec_t *preg, const char *str, size_t len,
+    size_t nmatch, frec_match_t pmatch[], int eflags,
+    frec_match_cb cb, void *arg
+) {
+    string text;
+    string_borrow(&text, str, (ssize_t) len, false);
+
+    return execute_match_all(preg, text, nmatch, pmatch, eflags,
+        cb, arg, false);
+}
+
+int
+frec_regexec_all(
+    const frec_t *preg, const char *str,
+    size_t nmatch, frec_match_t pmatch[], int eflags,
+    frec_match_cb cb, void *arg
+) {
+    return frec_regnexec_all(preg, str, strlen(str), nmatch, pmatch, eflags,
+        cb, arg);
+}
+
+int
+frec_regwnexec_all(
+    const frec_t *preg, const wchar_t *str, size_t len,
+    size_t nmatch, frec_match_t pmatch[], int eflags,
+    frec_match_cb cb, void *arg
+) {
+    string text;
+    string_borrow(&text, str, (ssize_t) len, true);
+
+    return execute_match_all(preg, text, nmatch, pmatch, eflags,
+        cb, arg, false);
+}
+
+int
+frec_regwexec_all(
+    const frec_t *preg, const wchar_t *str,
+    size_t nmatch, frec_match_t pmatch[], int eflags,
+    frec_match_cb cb, void *arg
+) {
+    return frec_regwnexec_all(preg, str, wcslen(str), nmatch, pmatch, eflags,
+        cb, arg);
+}
+
+int
+frec_mregnexec_all(
+    const mfrec_t *preg, const char *str, size_t len,
+    size_t nmatch, frec_match_t pmatch[], int eflags,
+    frec_match_cb cb, void *arg
+) {
+    string text;
+    string_borrow(&text, str, (ssize_t) len, false);
+
+    return execute_match_all(preg, text, nmatch, pmatch, eflags,
+        cb, arg, true);
+}
+
+int
+frec_mregexec_all(
+    const mfrec_t *preg, const char *str,
+    size_t nmatch, frec_match_t pmatch[], int eflags,
+    frec_match_cb cb, void *arg
+) {
+    return frec_mregnexec_all(preg, str, strlen(str), nmatch, pmatch, eflags,
+        cb, arg);
+}
+
+int
+frec_mregwnexec_all(
+    const mfrec_t *preg, const wchar_t *str, size_t len,
+    size_t nmatch, frec_match_t pmatch[], int eflags,
+    frec_match_cb cb, void *arg
+) {
+    string text;
+    string_borrow(&text, str, (ssize_t) len, true);
+
+    return execute_match_all(preg, text, nmatch, pmatch, eflags,
+        cb, arg, true);
+}
+
+int
+frec_mregwexec_all(
+    const mfrec_t *preg, const wchar_t *str,
+    size_t nmatch, frec_match_t pmatch[], int eflags,
+    frec_match_cb cb, void *arg
+) {
+    return frec_mregwnexec_all(preg, str, wcslen(str), nmatch, pmatch, eflags,
+        cb, arg);
+}
+
+int
+frec_regncount(
+    const frec_t *preg, const char *str, size_t len,
+    int eflags, int mode, size_t *count
+) {
+    string text;
+    string_borrow(&text, str, (ssize_t) len, false);
+
+    return frec_count(preg, text, eflags, mode == FREC_COUNT_LINES, count);
+}
+
+int
+frec_regcount(
+    const frec_t *preg, const char *str, int eflags, int mode, size_t *count
+) {
+    return frec_regncount(preg, str, strlen(str), eflags, mode, count);
+}
+
+int
+frec_regwncount(
+    const frec_t *preg, const wchar_t *str, size_t len,
+    int eflags, int mode, size_t *count
+) {
+    string text;
+    string_borrow(&text, str, (ssize_t) len, true);
+
+    return frec_count(preg, text, eflags, mode == FREC_COUNT_LINES, count);
+}
+
+int
+frec_regwcount(
+    const frec_t *preg, const wchar_t *str, int eflags, int mode, size_t *count
+) {
+    return frec_regwncount(preg, str, wcslen(str), eflags, mode, count);
+}
+
+int
+frec_mregncount(
+    const mfrec_t *preg, const char *str, size_t len,
+    int eflags, int mode, size_t *count
+) {
+    string text;
+    string_borrow(&text, str, (ssize_t) len, false);
+
+    return frec_mcount(preg, text, eflags, mode == FREC_COUNT_LINES, count);
+}
+
+int
+frec_mregcount(
+    const mfrec_t *preg, const char *str, int eflags, int mode, size_t *count
+) {
+    return frec_mregncount(preg, str, strlen(str), eflags, mode, count);
+}
+
+int
+frec_mregwncount(
+    const mfrec_t *preg, const wchar_t *str, size_t len,
+    int eflags, int mode, size_t *count
+) {
+    string text;
+    string_borrow(&text, str, (ssize_t) len, true);
+
+    return frec_mcount(preg, text, eflags, mode == FREC_COUNT_LINES, count);
+}
+
+int
+frec_mregwcount(
+    const mfrec_t *preg, const wchar_t *str, int eflags, int mode, size_t *count
+) {
+    return frec_mregwncount(preg, str, wcslen(str), eflags, mode, count);
+}
+
 size_t
 frec_mregerror(int errcode, const mfrec_t *preg, int *errpatn, char *errbuf,
     size_t errbuf_size)
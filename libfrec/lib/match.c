@@ -1,30 +1,70 @@
 
+#include <string.h>
+
 #include <frec-config.h>
 #include <frec-match.h>
 
+#include "ac-comp.h"
+#include "compile.h"
+#include "dfa.h"
 #include "heuristic.h"
 #include "match.h"
+#include "scratch.h"
 #include "string-type.h"
+#include "teddy-comp.h"
 #include "wm-comp.h"
 
+// Windows of dense candidates are merged up to this length, so that the
+// fragments are still checked in small sections.
+#define MAX_MERGED_WINDOW 4096
+// Windows of this many patterns of a set may wait for more candidates.
+#define MAX_PENDING_WINDOWS 16
+// This many complete windows are kept between the matches of a set.
+#define MAX_KEPT_WINDOWS 64
+
 /* Utility functions. */
 static ssize_t max(ssize_t a, ssize_t b) { return (a > b) ? a : b; }
 static ssize_t min(ssize_t a, ssize_t b) { return (a < b) ? a : b; }
 
-// Use the original library-supplied matcher on the given text.
+// Use the original library-supplied matcher on the given text. If only the
+// bounds of the match are needed, the lazy DFA is tried first.
 static int
 match_original(
     frec_match_t result[], size_t nmatch,
-    const regex_t *orig, string text, int eflags
+    const frec_t *preg, string text, int eflags, frec_scratch_t *scratch
 ) {
-    // Allocate temporary storage for the pmatch.
-    regmatch_t *pmatch = malloc(sizeof(regmatch_t) * nmatch);
+    const regex_t *orig = &preg->original;
+    bool nosub = preg->cflags & REG_NOSUB;
+
+    scratch = scratch_get(scratch);
+    if (scratch == NULL) {
+        return (REG_ESPACE);
+    }
+
+    // The DFA is skipped if its context can't be allocated.
+    if (preg->dfa != NULL && !text.is_wide && (nmatch <= 1 || nosub)) {
+        dfa_context *ctx = scratch_dfa(scratch, preg->dfa);
+        int ret = (ctx == NULL) ? DFA_FALLBACK : dfa_execute(result,
+            preg->dfa, ctx, text, eflags, nmatch > 0 && !nosub);
+        if (ret != DFA_FALLBACK) {
+            return ret;
+        }
+    }
+
+    // Literal patterns are only compiled for the original matcher here.
+    int ret = frec_compile_original(preg);
+    if (ret != REG_OK) {
+        return ret;
+    }
+
+    // Get temporary storage for the pmatch.
+    regmatch_t *pmatch = scratch_pmatch(scratch, nmatch);
     if (pmatch == NULL) {
         return (REG_ESPACE);
     }
 
     // Call the correct library function.
-    int ret = (text.is_wide)
+    ret = (text.is_wide)
         ? _dist_regwnexec(orig, text.wide, text.len, nmatch, pmatch, eflags)
         : _dist_regnexec(orig, text.stnd, text.len, nmatch, pmatch, eflags);
 
@@ -36,84 +76,267 @@ match_original(
         }
     }
 
-    free(pmatch);
     return ret;
 }
 
-// Use compiled heuristics to find matches.
+// Returns the eflags to use when matching the text from position pos.
+// The remaining text only starts a line at the beginning of the text,
+// or after a line break if REG_NEWLINE was set, whatever eflags says.
 static int
-match_heuristic(
-        frec_match_t result[], size_t nmatch,
-        const heur *heur, const regex_t *orig, string text, int eflags
-) {
-    int ret;
+eflags_at(string text, ssize_t pos, int cflags, int eflags)
+{
+    if (pos == 0) {
+        return eflags;
+    }
 
-    if (heur->heur_type == HEUR_LONGEST) {
-        // This heuristic type means that we either have a maximum possible
-        // match size, or if we don't, no line feed can occur in a match.
+    bool after_lf = (text.is_wide)
+        ? text.wide[pos - 1] == L'\n'
+        : text.stnd[pos - 1] == '\n';
+    if ((cflags & REG_NEWLINE) && after_lf) {
+        return eflags & ~REG_NOTBOL;
+    }
 
-        frec_match_t candidate; // We'll store our potential candidate here.
-        ssize_t glob_offset = 0; // Global offset from the start of input.
+    return eflags | REG_NOTBOL;
+}
 
-        // While we have text to read.
-        while (text.len > 0) {
+// Returns the eflags to use when matching the text up to position end. The
+// text only ends a line at its end, or before a line break if REG_NEWLINE
+// was set, whatever eflags says.
+static int
+eflags_until(string text, ssize_t end, int cflags, int eflags)
+{
+    if (end == text.len) {
+        return eflags;
+    }
 
-            // Find candidate match.
-            ret = bm_execute(&candidate, &heur->literal_comp, text, eflags);
+    bool before_lf = (text.is_wide)
+        ? text.wide[end] == L'\n'
+        : text.stnd[end] == '\n';
+    if ((cflags & REG_NEWLINE) && before_lf) {
+        return eflags & ~REG_NOTEOL;
+    }
 
-            // If no candidates were found, return as such.
-            if (ret != REG_OK) {
-                return ret;
-            }
+    return eflags | REG_NOTEOL;
+}
 
-            ssize_t start = candidate.soffset;
-            ssize_t end = candidate.eoffset;
+// Returns the end of a window that contains the whole of any match starting
+// at the given position, if the window ending at end may cut it short.
+static ssize_t
+complete_window_end(const heur *heur, string text, ssize_t soffset, ssize_t end)
+{
+    if (heur == NULL || heur->heur_type != HEUR_LONGEST
+        || heur->max_length == -1) {
+        return end;
+    }
+    return max(end, min(text.len, soffset + heur->max_length));
+}
 
-            if (heur->max_length != -1) {
-                // If we know the max length of a match, set start
-                // and end to have exactly that much wiggle room.
-                ssize_t delta = heur->max_length - (end - start);
+// Matches the pattern in the section of the text from start to end. The
+// section doesn't start or end a line just because it starts or ends there.
+// The offsets of the match are relative to the text.
+static int
+match_section(
+    frec_match_t result[], size_t nmatch, const frec_t *preg,
+    string text, int eflags, ssize_t start, ssize_t end,
+    frec_scratch_t *scratch
+) {
+    string section;
+    string_borrow_section(&section, text, start, end);
+    int section_eflags = eflags_at(text, start, preg->cflags, eflags);
+    section_eflags = eflags_until(text, end, preg->cflags, section_eflags);
 
-                start = max(0, start - delta);
-                end = min(text.len, end + delta);
-            } else {
-                // If we don't know its max length, we know that a
-                // match never overlaps multiple lines. As such, we
-                // set start and end to the nearest line breaks.
+    int ret = match_original(result, nmatch, preg, section, section_eflags,
+        scratch);
 
-                start = find_lf_backward(text, start);
-                end = find_lf_forward(text, end);
+    if (ret == REG_OK && !(preg->cflags & REG_NOSUB)) {
+        for (size_t i = 0; i < nmatch; i++) {
+            if (result[i].soffset != -1) {
+                result[i].soffset += start;
+                result[i].eoffset += start;
             }
+        }
+    }
+    return ret;
+}
 
-            // Create a text excerpt from this section, and call the
-            // library supplied matcher for at most one match.
-            string section;
-            string_borrow_section(&section, text, start, end);
+// Computes the submatches of a match, once its bounds are known. It was
+// found in the section from start to end.
+static int
+match_captures(
+    frec_match_t result[], size_t nmatch, const frec_t *preg,
+    string text, int eflags, frec_match_t bounds, ssize_t start, ssize_t end,
+    frec_scratch_t *scratch
+) {
+    // Literal patterns don't have any subexpressions.
+    if (preg->boyer_moore != NULL) {
+        result[0] = bounds;
+        for (size_t i = 1; i < nmatch; i++) {
+            result[i].soffset = -1;
+            result[i].eoffset = -1;
+        }
+        return (REG_OK);
+    }
 
-            ret = match_original(result, nmatch, orig, section, eflags);
+    // Patterns that the DFA supports only see the text around the match
+    // through anchors, which the eflags of the section take care of. Others
+    // may have word boundaries or back references, so those are matched in
+    // the whole section again.
+    if (preg->dfa != NULL && !text.is_wide) {
+        start = bounds.soffset;
+        end = bounds.eoffset;
+    }
+    return match_section(result, nmatch, preg, text, eflags, start, end,
+        scratch);
+}
 
-            // If we found a match, break out of the while loop.
-            // The match was found relative to glob_offset + start.
-            if (ret == REG_OK) {
-                glob_offset += start;
-                break;
-            }
+// Finds the next candidate of a HEUR_LONGEST heuristic from pos, and the
+// window around it that contains every match the candidate can be part of.
+// Advances pos past the candidate.
+static int
+next_window(
+    const heur *heur, string text, int eflags,
+    ssize_t *pos, ssize_t *start, ssize_t *end
+) {
+    if (*pos >= text.len) {
+        return (REG_NOMATCH);
+    }
+
+    frec_match_t candidate;
+    string rest;
+    string_borrow_section(&rest, text, *pos, text.len);
+    int ret = frec_heur_candidate(&candidate, heur, rest, eflags);
+    if (ret != REG_OK) {
+        return ret;
+    }
+
+    *start = *pos + candidate.soffset;
+    *end = *pos + candidate.eoffset;
 
-            // Else modify the offsets and continue with the rest of the text.
-            // No match was found before end, so we can shift the offset by it.
-            string_offset(&text, end);
-            glob_offset += end;
+    if (heur->max_length != -1) {
+        // If we know the max length of a match, set start and end to have
+        // exactly that much wiggle room. Any of the literals may start at
+        // the candidate, so the shortest one gives the most room.
+        ssize_t delta = heur->max_length - frec_heur_literal_len(heur);
+
+        // A match around the next candidate may still start inside this
+        // window, so only this one is skipped.
+        *pos = *start + 1;
+        *end = min(text.len, *start + heur->max_length);
+        *start = max(0, *start - delta);
+    } else {
+        // If we don't know its max length, we know that a match never
+        // overlaps multiple lines. As such, we set start and end to the
+        // nearest line breaks.
+        *start = find_lf_backward(text, *start);
+        *end = find_lf_forward(text, *end);
+        *pos = *end;
+    }
+    return (REG_OK);
+}
+
+// Calls the library supplied matcher on a window of the text, for at most
+// one match. The offsets of the match are relative to the text.
+static int
+match_window(
+    frec_match_t result[], size_t nmatch,
+    const heur *heur, const frec_t *preg, string text, int eflags,
+    ssize_t start, ssize_t end, frec_scratch_t *scratch
+) {
+    // Cheap literal checks rule out most sections before the original
+    // matcher is called.
+    string section;
+    string_borrow_section(&section, text, start, end);
+    if (!frec_heur_has_fragments(heur, section, eflags)) {
+        return (REG_NOMATCH);
+    }
+
+    // Most windows don't have a match either, so they are only checked for
+    // one at first. The DFA finds its bounds at the same time, but the
+    // original matcher is much faster without computing any.
+    bool has_bounds = nmatch > 0 && !(preg->cflags & REG_NOSUB);
+    bool dfa_bounds = has_bounds && preg->dfa != NULL && !text.is_wide;
+
+    frec_match_t bounds;
+    int ret = match_section(&bounds, dfa_bounds ? 1 : 0, preg, text, eflags,
+        start, end, scratch);
+    if (ret != REG_OK || !has_bounds) {
+        return ret;
+    } else if (!dfa_bounds) {
+        ret = match_section(&bounds, 1, preg, text, eflags, start, end,
+            scratch);
+        if (ret != REG_OK) {
+            return ret;
         }
+    }
 
-        // If we found a match, we'll fix the offsets in all its submatches.
-        if (ret == REG_OK) {
-            for (size_t i = 0; i < nmatch && result[i].soffset != -1; i++) {
-                result[i].soffset += glob_offset;
-                result[i].eoffset += glob_offset;
+    // A match that doesn't contain the candidate may continue past the
+    // window, so it is matched again in one that fits it.
+    ssize_t full_end = complete_window_end(heur, text, bounds.soffset, end);
+    if (full_end > end) {
+        end = full_end;
+        ret = match_section(&bounds, 1, preg, text, eflags, start, end,
+            scratch);
+        if (ret != REG_OK) {
+            return ret;
+        }
+    }
+
+    // The submatches are only computed for the confirmed match.
+    if (nmatch == 1) {
+        result[0] = bounds;
+        return (REG_OK);
+    }
+    return match_captures(result, nmatch, preg, text, eflags, bounds,
+        start, end, scratch);
+}
+
+// Use compiled heuristics to find matches.
+static int
+match_heuristic(
+        frec_match_t result[], size_t nmatch,
+        const heur *heur, const frec_t *preg, string text, int eflags,
+        frec_scratch_t *scratch
+) {
+    int ret = REG_NOMATCH;
+
+    if (heur->heur_type == HEUR_LONGEST) {
+        // This heuristic type means that we either have a maximum possible
+        // match size, or if we don't, no line feed can occur in a match.
+
+        ssize_t pos = 0; // The next candidate is searched from here.
+        ssize_t start = 0; // The window that is verified next.
+        ssize_t end = 0;
+        int found = next_window(heur, text, eflags, &pos, &start, &end);
+
+        while (found == REG_OK) {
+            // Dense candidates have overlapping windows, which are merged
+            // while they overlap or touch, so that each part of the text is
+            // only verified once. Every match a candidate can be part of is
+            // inside the merged window, so its leftmost match is still the
+            // leftmost one of the text.
+            ssize_t next_start = 0;
+            ssize_t next_end = 0;
+            while ((found = next_window(heur, text, eflags, &pos,
+                        &next_start, &next_end)) == REG_OK
+                && next_start <= end + 1 && end - start < MAX_MERGED_WINDOW) {
+                end = max(end, next_end);
+            }
+            if (found != REG_OK && found != REG_NOMATCH) {
+                return found;
             }
+
+            ret = match_window(result, nmatch, heur, preg, text, eflags,
+                start, end, scratch);
+            if (ret != REG_NOMATCH) {
+                return ret;
+            }
+
+            // The window that wasn't merged is verified next.
+            start = next_start;
+            end = next_end;
         }
 
-        return ret;
+        return found;
     } else {
         // This heuristic type means that we don't know the maximum match size,
         // nor can we separate the input text by line feeds. As such, we search
@@ -121,34 +344,25 @@ match_heuristic(
         // the start of this candidate to the end of the original text.
 
         frec_match_t candidate;
-        ret = bm_execute(&candidate, &heur->literal_comp, text, eflags);
+        ret = frec_heur_candidate(&candidate, heur, text, eflags);
 
         // If not even a candidate was found, we'll return early.
         if (ret != REG_OK) {
             return ret;
         }
 
-        // Run the original matcher on this subtext.
-        string_offset(&text, candidate.soffset);
-        ret = match_original(result, nmatch, orig, text, eflags);
-
-        // Fix offsets that we messed up above, and return.
-        if (nmatch > 0 && ret == REG_OK) {
-            for (size_t i = 0; i < nmatch && result[i].soffset != -1; i++) {
-                result[i].soffset += candidate.soffset;
-                result[i].eoffset += candidate.soffset;
-            }
-        }
-        return ret;
+        // Run the original matcher from this candidate to the end of the
+        // text, if the other fragments occur in it at all.
+        return match_window(result, nmatch, heur, preg, text, eflags,
+            candidate.soffset, text.len, scratch);
     }
 }
 
 int
 frec_match(
     frec_match_t pmatch[], size_t nmatch,
-    const frec_t *preg, string text, int eflags
+    const frec_t *preg, string text, int eflags, frec_scratch_t *scratch
 ) {
-    const regex_t *orig = &preg->original;
     bm_comp *bm = preg->boyer_moore;
     heur *hr = preg->heuristic;
 
@@ -156,102 +370,583 @@ frec_match(
         frec_match_t *result = (nmatch == 0) ? NULL : &pmatch[0];
         return bm_execute(result, bm, text, eflags);
     } else if (hr != NULL) {
-        return match_heuristic(pmatch, nmatch, hr, orig, text, eflags);
+        return match_heuristic(pmatch, nmatch, hr, preg, text, eflags,
+            scratch);
     } else {
-        return match_original(pmatch, nmatch, orig, text, eflags);
+        return match_original(pmatch, nmatch, preg, text, eflags, scratch);
     }
 }
 
-int
-frec_mmatch(
-    frec_match_t pmatch[], size_t nmatch,
-    const mfrec_t *preg, string text, int eflags
+// Finds the leftmost match of the literal set of preg with Teddy,
+// Aho-Corasick or Wu-Manber, depending on which one was compiled.
+static int
+match_literal_set(
+    frec_match_t *result, const mfrec_t *preg, string text, int eflags
 ) {
-    bool no_sub = (preg->cflags & REG_NOSUB) || nmatch == 0 || pmatch == NULL;
+    int ret;
+    if (preg->teddy != NULL) {
+        ret = teddy_execute(result, preg->teddy, text, eflags);
+    } else if (preg->aho_corasick != NULL) {
+        ret = ac_execute(result, preg->aho_corasick, text, eflags);
+    } else {
+        ret = wm_execute(result, preg->wu_manber, text, eflags);
+    }
 
-    // If the pattern count is 1, use the single pattern matcher above.
-    if (preg->type == MHEUR_SINGLE) {
-        return frec_match(pmatch, nmatch, &preg->patterns[0], text, eflags);
+    // The engine doesn't know the patterns that were removed from the set.
+    if (ret == REG_OK && result != NULL && preg->ids != NULL) {
+        result->pattern_id = preg->ids[result->pattern_id];
     }
+    return ret;
+}
 
-    // The patterns are literal, we can use Wu-Manber directly.
-    if (preg->type == MHEUR_LITERAL) {
-        return wm_execute(pmatch, preg->wu_manber, text, eflags);
+// Computes the window around a candidate of a pattern of the set, which
+// contains every match of the pattern that the candidate can be part of.
+// The matches are searched from position from of the text.
+static void
+candidate_window(
+    const heur *heur, string text, ssize_t from, frec_match_t candidate,
+    ssize_t *start, ssize_t *end
+) {
+    if (heur == NULL) {
+        // The pattern was literal, so the candidate is the match.
+        *start = candidate.soffset;
+        *end = candidate.eoffset;
+    } else if (heur->heur_type == HEUR_PREFIX) {
+        // Matches start with the literal, but may reach anywhere after it.
+        *start = candidate.soffset;
+        *end = text.len;
+    } else if (heur->max_length != -1) {
+        // The match has exactly this much wiggle room around the literal.
+        ssize_t delta = heur->max_length
+            - (candidate.eoffset - candidate.soffset);
+        *start = max(from, candidate.soffset - delta);
+        *end = min(text.len, candidate.eoffset + delta);
+    } else {
+        // Otherwise a match never overlaps multiple lines.
+        string rest;
+        string_borrow_section(&rest, text, from, text.len);
+        *start = from + find_lf_backward(rest, candidate.soffset - from);
+        *end = find_lf_forward(text, candidate.eoffset);
     }
+}
 
-    // We can use heuristics for optimization - search for the longest literal
-    // fragment of each pattern, and only call the regex automaton when a match
-    // is possible near our current position.
-    if (preg->type == MHEUR_LONGEST) {
-        frec_match_t candidate;
-        ssize_t glob_offset = 0; // Global offset from the start of input.
-        int ret;
+// Returns the position from which candidates can only be part of matches
+// that start after the given position.
+static ssize_t
+reach_limit(const mfrec_t *preg, string text, ssize_t pos)
+{
+    ssize_t limit = pos + preg->reach + 1;
+    if (preg->reach_lines) {
+        limit = max(limit, find_lf_forward(text, pos) + 1);
+    }
+    return limit;
+}
+
+// A window of the text, in which a pattern of the set is verified.
+typedef struct set_window {
+    size_t id;      // The pattern of the set.
+    ssize_t start;
+    ssize_t end;
+} set_window;
+
+// The leftmost match of the set so far, and the window it was found in.
+typedef struct set_best {
+    frec_match_t match; // Its soffset is -1 while there's none.
+    ssize_t start;
+    ssize_t end;
+    ssize_t stop;       // Candidates from here can't precede it.
+} set_best;
+
+// The windows of the candidates are only verified once no more candidates
+// of the same pattern overlap or touch them. Until then they wait here, and
+// are merged with those candidates.
+typedef struct set_pending {
+    set_window windows[MAX_PENDING_WINDOWS];
+    ssize_t count;
+} set_pending;
+
+// A complete window, which either was verified and matched, or starts
+// after the best match, so it wasn't needed yet.
+typedef struct set_kept {
+    set_window window;
+    frec_match_t match; // The match in the window, if it was verified.
+    bool verified;
+} set_kept;
+
+// The state of a search for the leftmost match of an MHEUR_LONGEST set.
+// match_all keeps it between the matches it reports, so that the text
+// after a match isn't scanned for candidates again, and only the windows
+// overlapping the match are verified again.
+typedef struct set_search {
+    set_pending pending;    // Windows that may still grow.
+    set_kept kept[MAX_KEPT_WINDOWS];
+    ssize_t kept_count;
+    bool keep;              // Whether the complete windows are kept.
+    bool overflow;          // Whether some of them didn't fit.
+    ssize_t scanned;        // Candidates were searched for up to here,
+    frec_match_t candidate; // and this is the next one, unless its
+                            // soffset is -1.
+    bool exhausted;         // Whether there are no more candidates.
+} set_search;
+
+// Starts a search for the matches of the set. If keep is set, the search
+// can be continued after the end of the match it finds.
+static void
+set_search_init(set_search *search, bool keep)
+{
+    search->pending.count = 0;
+    search->kept_count = 0;
+    search->keep = keep;
+    search->overflow = false;
+    search->scanned = 0;
+    search->candidate.soffset = -1;
+    search->exhausted = false;
+}
+
+// Keeps a complete window for the next searches, if there's room for it.
+static void
+keep_window(set_search *search, set_window window, frec_match_t match,
+    bool verified)
+{
+    if (!search->keep) {
+        return;
+    } else if (search->kept_count == MAX_KEPT_WINDOWS) {
+        search->overflow = true;
+        return;
+    }
+
+    set_kept *kept = &search->kept[search->kept_count++];
+    kept->window = window;
+    kept->match = match;
+    kept->verified = verified;
+}
+
+// Makes the match the best one, if it precedes the best one so far. Of
+// matches starting at the same position, the pattern with the lowest id
+// is reported.
+static void
+offer_best(set_best *best, const mfrec_t *preg, string text,
+    set_window window, frec_match_t found)
+{
+    if (best->match.soffset == -1 || found.soffset < best->match.soffset
+        || (found.soffset == best->match.soffset
+            && found.pattern_id < best->match.pattern_id)) {
+        best->match = found;
+        best->start = window.start;
+        best->end = window.end;
+        best->stop = min(best->stop, reach_limit(preg, text, found.soffset));
+    }
+}
+
+// Verifies a pattern of the set in its window, and stores its match in
+// found. The end of the window is moved if the match needs more text.
+static int
+verify_set_window(
+    frec_match_t *found, const mfrec_t *preg, string text, int eflags,
+    set_window *window, frec_scratch_t *scratch
+) {
+    const frec_t *curr = &preg->patterns[window->id];
+    ssize_t start = window->start;
+    ssize_t end = window->end;
+
+    string section;
+    string_borrow_section(&section, text, start, end);
+    int section_eflags = eflags_at(text, start, preg->cflags, eflags);
+    section_eflags = eflags_until(text, end, preg->cflags, section_eflags);
+
+    // With REG_NOSUB, the match is only known to be in the window.
+    found->soffset = 0;
+    found->eoffset = end - start;
+    int ret = frec_match(found, 1, curr, section, section_eflags, scratch);
+    if (ret != REG_OK) {
+        return ret;
+    }
+
+    // The match may continue past the window, see match_window.
+    ssize_t full_end = complete_window_end(curr->heuristic, text,
+        start + found->soffset, end);
+    if (full_end > end) {
+        end = full_end;
+        string_borrow_section(&section, text, start, end);
+        section_eflags = eflags_at(text, start, preg->cflags, eflags);
+        section_eflags = eflags_until(text, end, preg->cflags,
+            section_eflags);
+        ret = frec_match(found, 1, curr, section, section_eflags, scratch);
+        if (ret != REG_OK) {
+            return ret;
+        }
+    }
+
+    found->soffset += start;
+    found->eoffset += start;
+    found->pattern_id = window->id;
+    window->end = end;
+    return (REG_OK);
+}
+
+// Verifies a complete window, unless its matches can't precede the best
+// one, in which case it is only kept. Returns REG_OK if it was verified and
+// matched, REG_NOMATCH otherwise, or the error of the verification.
+static int
+settle_set_window(
+    set_best *best, set_search *search, const mfrec_t *preg, string text,
+    int eflags, set_window window, frec_scratch_t *scratch
+) {
+    frec_match_t found = {-1, -1, window.id};
+    if (best->match.soffset != -1 && window.start > best->match.soffset) {
+        keep_window(search, window, found, false);
+        return (REG_NOMATCH);
+    }
+
+    int ret = verify_set_window(&found, preg, text, eflags, &window,
+        scratch);
+    if (ret != REG_OK) {
+        return ret;
+    }
+
+    offer_best(best, preg, text, window, found);
+    keep_window(search, window, found, true);
+    return (REG_OK);
+}
+
+// Adds the window of a candidate of the set to the pending ones. Returns
+// REG_OK if a window was verified and matched, REG_NOMATCH otherwise, or
+// the error of the verification. Matches are searched from position from.
+static int
+add_set_window(
+    set_best *best, set_search *search, const mfrec_t *preg, string text,
+    ssize_t from, int eflags, frec_match_t candidate, frec_scratch_t *scratch
+) {
+    set_window window = {candidate.pattern_id, 0, 0};
+    candidate_window(preg->patterns[window.id].heuristic, text, from,
+        candidate, &window.start, &window.end);
+
+    // Each pattern has at most one pending window, which the window
+    // of its next candidate may extend.
+    set_pending *pending = &search->pending;
+    set_window *windows = pending->windows;
+    ssize_t i = pending->count - 1;
+    while (i >= 0 && windows[i].id != window.id) {
+        i--;
+    }
+    if (i >= 0 && window.start <= windows[i].end + 1
+        && windows[i].end - windows[i].start < MAX_MERGED_WINDOW) {
+        windows[i].end = max(windows[i].end, window.end);
+        return (REG_NOMATCH);
+    }
+
+    // Otherwise the pending window of the pattern is complete, and
+    // if there are too many, the oldest one is complete too.
+    if (i < 0 && pending->count == MAX_PENDING_WINDOWS) {
+        i = 0;
+    }
+    int ret = REG_NOMATCH;
+    if (i >= 0) {
+        ret = settle_set_window(best, search, preg, text, eflags, windows[i],
+            scratch);
+        if (ret != REG_OK && ret != REG_NOMATCH) {
+            return ret;
+        }
+        pending->count--;
+        memmove(&windows[i], &windows[i + 1],
+            sizeof(set_window) * (pending->count - i));
+    }
+    windows[pending->count++] = window;
+    return ret;
+}
+
+// Returns the first pattern in by_literal between low and high, whose
+// literal has a character above c at depth, or one that is at least c if
+// lower is set. All of these literals are longer than depth.
+static ssize_t
+literal_bound(
+    const mfrec_t *preg, ssize_t low, ssize_t high, ssize_t depth,
+    unsigned int c, bool lower
+) {
+    bool icase = preg->cflags & REG_ICASE;
+    while (low < high) {
+        ssize_t mid = low + (high - low) / 2;
+        string literal;
+        frec_engine_literal(&preg->patterns[preg->by_literal[mid]], &literal);
+
+        unsigned int mid_c = frec_literal_char(literal, depth, icase);
+        if (lower ? mid_c < c : mid_c <= c) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    return low;
+}
 
-        // While we have text to read.
-        while (text.len > 0) {
-            // Find candidate match, or return early if no match was found.
-            ret = wm_execute(&candidate, preg->wu_manber, text, eflags);
-            if (ret != REG_OK) {
+// Adds the windows of every pattern whose literal occurs at the position
+// of the candidate. The engines only report one of them, so if a literal
+// is the prefix of another, the others are looked up in by_literal.
+static int
+add_set_candidate(
+    set_best *best, set_search *search, const mfrec_t *preg, string text,
+    ssize_t from, int eflags, frec_match_t candidate, frec_scratch_t *scratch
+) {
+    if (!preg->literal_ties) {
+        return add_set_window(best, search, preg, text, from, eflags,
+            candidate, scratch);
+    }
+
+    // The literals are narrowed down one character at a time. Those that
+    // end at a depth precede the longer ones in by_literal.
+    bool icase = preg->cflags & REG_ICASE;
+    ssize_t pos = candidate.soffset;
+    ssize_t low = 0;
+    ssize_t high = preg->count - preg->removed;
+    int result = REG_NOMATCH;
+    for (ssize_t depth = 0; low < high; depth++) {
+        while (low < high) {
+            size_t id = preg->by_literal[low];
+            string literal;
+            frec_engine_literal(&preg->patterns[id], &literal);
+            if (literal.len != depth) {
+                break;
+            }
+
+            frec_match_t found = {pos, pos + depth, id};
+            int ret = add_set_window(best, search, preg, text, from, eflags,
+                found, scratch);
+            if (ret == REG_OK) {
+                result = REG_OK;
+            } else if (ret != REG_NOMATCH) {
                 return ret;
             }
+            low++;
+        }
+
+        if (low == high || pos + depth >= text.len) {
+            break;
+        }
+        unsigned int c = frec_literal_char(text, pos + depth, icase);
+        low = literal_bound(preg, low, high, depth, c, true);
+        high = literal_bound(preg, low, high, depth, c, false);
+    }
+    return result;
+}
+
+// Prepares the search to continue from position pos, after the match it
+// found last. The windows overlapping that match are verified again from
+// pos, the others keep their results.
+static void
+resume_set_search(set_search *search, ssize_t pos)
+{
+    if (search->overflow) {
+        set_search_init(search, true);
+        search->scanned = pos;
+        return;
+    }
 
-            ssize_t start = candidate.soffset;
-            ssize_t end = candidate.eoffset;
+    ssize_t at = 0;
+    for (ssize_t i = 0; i < search->kept_count; i++) {
+        set_kept kept = search->kept[i];
+        if (kept.window.start < pos) {
+            if (kept.window.end <= pos) {
+                continue;
+            }
+            kept.window.start = pos;
+            kept.verified = false;
+        }
+        search->kept[at++] = kept;
+    }
+    search->kept_count = at;
 
-            heur *heur = preg->patterns[candidate.pattern_id].heuristic;
+    set_pending *pending = &search->pending;
+    at = 0;
+    for (ssize_t i = 0; i < pending->count; i++) {
+        set_window window = pending->windows[i];
+        if (window.end <= pos) {
+            continue;
+        }
+        window.start = max(window.start, pos);
+        pending->windows[at++] = window;
+    }
+    pending->count = at;
 
-            // If heur is not null, then the pattern wasn't literal, and
-            // as such, we need to modify start and end.
-            if (heur != NULL) {
-                if (heur->max_length != -1) {
-                    // If we know the max length of a match, set start
-                    // and end to have exactly that much wiggle room.
-                    ssize_t delta = heur->max_length - (end - start);
+    if (search->candidate.soffset != -1 && search->candidate.soffset < pos) {
+        search->candidate.soffset = -1;
+    }
+    search->scanned = max(search->scanned, pos);
+}
 
-                    start = max(0, start - delta);
-                    end = min(text.len, end + delta);
-                } else {
-                    // If we don't know its max length, we know that a
-                    // match never overlaps multiple lines. As such, we
-                    // set start and end to the nearest line breaks.
+// Finds the leftmost match of an MHEUR_LONGEST set in the text from
+// position pos, and stores it in best. If no_sub is set, any match is
+// enough. The search is continued with resume_set_search.
+static int
+search_set(
+    set_best *best, set_search *search, const mfrec_t *preg, string text,
+    ssize_t pos, int eflags, bool no_sub, frec_scratch_t *scratch
+) {
+    best->match.soffset = -1;
+    best->stop = text.len;
 
-                    start = find_lf_backward(text, start);
-                    end = find_lf_forward(text, end);
-                }
+    // The kept windows are verified first, as they precede the candidates
+    // that weren't found yet.
+    ssize_t at = 0;
+    for (ssize_t i = 0; i < search->kept_count; i++) {
+        set_kept kept = search->kept[i];
+        if (!kept.verified && (best->match.soffset == -1
+            || kept.window.start <= best->match.soffset)) {
+            int ret = verify_set_window(&kept.match, preg, text, eflags,
+                &kept.window, scratch);
+            if (ret == REG_NOMATCH) {
+                continue;
+            } else if (ret != REG_OK) {
+                return ret;
             }
+            kept.verified = true;
+        }
+        if (kept.verified) {
+            offer_best(best, preg, text, kept.window, kept.match);
+        }
+        search->kept[at++] = kept;
+    }
+    search->kept_count = at;
 
-            // Create a text excerpt from this section, and call the
-            // library supplied matcher for at most one match.
-            string section;
-            string_borrow_section(&section, text, start, end);
-
-            frec_t *curr_preg = &preg->patterns[candidate.pattern_id];
-            ret = frec_match(pmatch, nmatch, curr_preg, section, eflags);
+    // A candidate may belong to a match that starts before the one
+    // found around an earlier candidate, so the candidates are checked
+    // until none of the patterns could reach back to the best match.
+    ssize_t scan = search->scanned;
+    while (scan < best->stop) {
+        frec_match_t candidate = search->candidate;
+        if (candidate.soffset == -1) {
+            if (search->exhausted) {
+                break;
+            }
 
-            // If we found a match, break out of the while loop.
-            // The match was found relative to glob_offset + start.
-            if (ret == REG_OK) {
-                glob_offset += start;
+            string rest;
+            string_borrow_section(&rest, text, scan, text.len);
+            int ret = match_literal_set(&candidate, preg, rest,
+                eflags_at(text, scan, preg->cflags, eflags));
+            if (ret == REG_NOMATCH) {
+                search->exhausted = true;
                 break;
+            } else if (ret != REG_OK) {
+                return ret;
             }
+            candidate.soffset += scan;
+            candidate.eoffset += scan;
+        }
 
-            // Else modify the offsets and continue with the rest of the text.
-            // No match was found before end, so we can shift the offset by it.
-            string_offset(&text, end);
-            glob_offset += end;
+        // The candidate is only kept until the best match is known.
+        search->candidate = candidate;
+        if (candidate.soffset >= best->stop) {
+            break;
         }
+        search->candidate.soffset = -1;
+        scan = candidate.soffset + 1;
 
-        // If we found a match, we'll fix the offsets in all its submatches.
-        if (ret == REG_OK) {
-            for (size_t i = 0; i < nmatch && pmatch[i].soffset != -1; i++) {
-                pmatch[i].soffset += glob_offset;
-                pmatch[i].eoffset += glob_offset;
+        int ret = add_set_candidate(best, search, preg, text, pos, eflags,
+            candidate, scratch);
+        if (ret == REG_OK && no_sub) {
+            return (REG_OK);
+        } else if (ret != REG_OK && ret != REG_NOMATCH) {
+            return ret;
+        }
+    }
+    search->scanned = scan;
+
+    // The remaining windows are complete if they may precede the best
+    // match, and are verified in the order of their candidates.
+    set_pending *pending = &search->pending;
+    at = 0;
+    for (ssize_t i = 0; i < pending->count; i++) {
+        set_window window = pending->windows[i];
+        if (best->match.soffset != -1 && window.start > best->match.soffset) {
+            pending->windows[at++] = window;
+            continue;
+        }
+
+        int ret = settle_set_window(best, search, preg, text, eflags, window,
+            scratch);
+        if (ret == REG_OK && no_sub) {
+            return (REG_OK);
+        } else if (ret != REG_OK && ret != REG_NOMATCH) {
+            return ret;
+        }
+    }
+    pending->count = at;
+
+    return (best->match.soffset == -1) ? (REG_NOMATCH) : (REG_OK);
+}
+
+// Stores the best match of the set in pmatch, with the submatches computed
+// in the same window as it was found in.
+static int
+set_submatches(
+    frec_match_t pmatch[], size_t nmatch, const mfrec_t *preg, string text,
+    int eflags, const set_best *best, frec_scratch_t *scratch
+) {
+    if (nmatch == 1) {
+        pmatch[0] = best->match;
+        return (REG_OK);
+    }
+
+    string section;
+    string_borrow_section(&section, text, best->start, best->end);
+    int section_eflags = eflags_at(text, best->start, preg->cflags, eflags);
+    section_eflags = eflags_until(text, best->end, preg->cflags,
+        section_eflags);
+
+    size_t best_id = best->match.pattern_id;
+    int ret = frec_match(pmatch, nmatch, &preg->patterns[best_id],
+        section, section_eflags, scratch);
+
+    if (ret == REG_OK) {
+        for (size_t i = 0; i < nmatch; i++) {
+            if (pmatch[i].soffset != -1) {
+                pmatch[i].soffset += best->start;
+                pmatch[i].eoffset += best->start;
             }
+            pmatch[i].pattern_id = best_id;
         }
+    }
+    return ret;
+}
+
+int
+frec_mmatch(
+    frec_match_t pmatch[], size_t nmatch,
+    const mfrec_t *preg, string text, int eflags, frec_scratch_t *scratch
+) {
+    bool no_sub = (preg->cflags & REG_NOSUB) || nmatch == 0 || pmatch == NULL;
 
+    // If the pattern count is 1, use the single pattern matcher above.
+    if (preg->type == MHEUR_SINGLE) {
+        int ret = frec_match(pmatch, nmatch, &preg->patterns[0], text, eflags,
+            scratch);
+        for (size_t i = 0; i < nmatch && pmatch != NULL; i++) {
+            pmatch[i].pattern_id = 0;
+        }
         return ret;
     }
 
+    // The patterns are literal, we can use the multi-pattern engine directly.
+    if (preg->type == MHEUR_LITERAL) {
+        return match_literal_set(pmatch, preg, text, eflags);
+    }
+
+    // We can use heuristics for optimization - search for the longest literal
+    // fragment of each pattern, and only call the regex automaton when a match
+    // is possible near our current position.
+    if (preg->type == MHEUR_LONGEST) {
+        set_best best;
+        set_search search;
+        set_search_init(&search, false);
+
+        int ret = search_set(&best, &search, preg, text, 0, eflags, no_sub,
+            scratch);
+        if (ret != REG_OK || no_sub) {
+            return ret;
+        }
+        return set_submatches(pmatch, nmatch, preg, text, eflags, &best,
+            scratch);
+    }
+
 
     // Otherwise preg->type == MHEUR_NONE.
     // No way to speed up matching, so we simply run a single pattern matcher
@@ -261,7 +956,10 @@ frec_mmatch(
         // If the actual offsets don't matter, we just need one match.
         for (ssize_t i = 0; i < preg->count; i++) {
             frec_t *curr = &preg->patterns[i];
-            int ret = frec_match(pmatch, nmatch, curr, text, eflags);
+            if (curr->is_removed) {
+                continue;
+            }
+            int ret = frec_match(pmatch, nmatch, curr, text, eflags, scratch);
 
             // If the result is REG_OK or an error, return immediately.
             if (ret != REG_NOMATCH) {
@@ -270,8 +968,11 @@ frec_mmatch(
         }
         return (REG_NOMATCH);
     } else {
-        // Otherwise we may need up to count matches.
-        frec_match_t *matches = malloc(preg->count * sizeof(frec_match_t));
+        // Otherwise we may need up to count matches. Only the bounds of
+        // each are needed at first.
+        scratch = scratch_get(scratch);
+        frec_match_t *matches = (scratch == NULL)
+            ? NULL : scratch_matches(scratch, preg->count);
         if (matches == NULL) {
             return (REG_ESPACE);
         }
@@ -280,21 +981,23 @@ frec_mmatch(
         bool matched = false;
         for (ssize_t i = 0; i < preg->count; i++) {
             frec_t *curr = &preg->patterns[i];
-            int ret = frec_match(&matches[i], nmatch, curr, text, eflags);
+            if (curr->is_removed) {
+                matches[i].soffset = -1;
+                continue;
+            }
+            int ret = frec_match(&matches[i], 1, curr, text, eflags, scratch);
 
             if (ret == REG_OK) {
                 matched = true;
             } else if (ret == REG_NOMATCH) {
                 matches[i].soffset = -1;
             } else {
-                free(matches);
                 return ret;
             }
         }
 
         // Handle results.
         if (!matched) {
-            free(matches);
             return (REG_NOMATCH);
         } else {
             ssize_t first = -1;
@@ -315,17 +1018,500 @@ frec_mmatch(
                 }
             }
 
-            // Now that we have the correct index, we'll run a frec_match
-            // with every submatch available.
-            string section;
-            string_borrow_section(&section, text,
-                    matches[first].soffset, matches[first].eoffset);
+            // Now that we have the correct index, we'll compute every
+            // submatch of its match.
+            int ret = REG_OK;
+            if (nmatch == 1) {
+                pmatch[0] = matches[first];
+            } else {
+                ret = match_captures(pmatch, nmatch, &preg->patterns[first],
+                    text, eflags, matches[first], 0, text.len, scratch);
+            }
+
+            if (ret == REG_OK) {
+                for (size_t i = 0; i < nmatch; i++) {
+                    pmatch[i].pattern_id = first;
+                }
+            }
+            return ret;
+        }
+    }
+}
+
+// Finds the leftmost match of an MHEUR_NONE pattern set in the text
+// starting at pos, like frec_mmatch does, but the next match of each
+// pattern is kept in the next array (with absolute offsets, -1 if there
+// are no more matches, and -2 if unknown). Only the patterns whose match
+// was passed have to be searched again.
+static int
+mmatch_none_cached(
+    frec_match_t pmatch[], size_t nmatch, const mfrec_t *preg,
+    string text, ssize_t pos, int eflags, frec_match_t *next
+) {
+    string rest;
+    string_borrow_section(&rest, text, pos, text.len);
+
+    ssize_t best = -1;
+    for (ssize_t i = 0; i < preg->count; i++) {
+        if (next[i].soffset == -1 || preg->patterns[i].is_removed) {
+            continue;
+        }
+
+        if (next[i].soffset < pos) {
+            int ret = frec_match(&next[i], 1, &preg->patterns[i], rest, eflags,
+                NULL);
+            if (ret == REG_NOMATCH) {
+                next[i].soffset = -1;
+                continue;
+            } else if (ret != REG_OK) {
+                return ret;
+            }
+            next[i].soffset += pos;
+            next[i].eoffset += pos;
+        }
+
+        if (best == -1 || next[i].soffset < next[best].soffset) {
+            best = i;
+        }
+    }
+
+    if (best == -1) {
+        return (REG_NOMATCH);
+    }
+
+    // Submatches are only needed for the selected pattern.
+    if (nmatch > 1) {
+        int ret = match_captures(pmatch, nmatch, &preg->patterns[best],
+            text, eflags, next[best], pos, text.len, NULL);
+        if (ret != REG_OK) {
+            return ret;
+        }
+
+        for (size_t i = 0; i < nmatch; i++) {
+            if (pmatch[i].soffset != -1) {
+                pmatch[i].soffset -= pos;
+                pmatch[i].eoffset -= pos;
+            }
+        }
+    } else {
+        pmatch[0].soffset = next[best].soffset - pos;
+        pmatch[0].eoffset = next[best].eoffset - pos;
+    }
+
+    for (size_t i = 0; i < nmatch; i++) {
+        pmatch[i].pattern_id = best;
+    }
+    return (REG_OK);
+}
+
+// Finds the leftmost match of an MHEUR_LONGEST set in the text starting
+// at pos, like frec_mmatch does, but continues the search that found the
+// previous match.
+static int
+mmatch_longest_resumed(
+    frec_match_t pmatch[], size_t nmatch, const mfrec_t *preg,
+    string text, ssize_t pos, int eflags, set_search *search
+) {
+    resume_set_search(search, pos);
+
+    set_best best;
+    int ret = search_set(&best, search, preg, text, pos, eflags, false, NULL);
+    if (ret == REG_OK) {
+        ret = set_submatches(pmatch, nmatch, preg, text, eflags, &best, NULL);
+    }
+    if (ret != REG_OK) {
+        return ret;
+    }
+
+    for (size_t i = 0; i < nmatch; i++) {
+        if (pmatch[i].soffset != -1) {
+            pmatch[i].soffset -= pos;
+            pmatch[i].eoffset -= pos;
+        }
+    }
+    return (REG_OK);
+}
 
-            int ret = frec_match(pmatch, nmatch,
-                    &preg->patterns[first], section, eflags);
+// The common loop of the match iteration functions. Either single or
+// multi is set, and next is the cache of mmatch_none_cached, or search is
+// the one of mmatch_longest_resumed, or both are NULL.
+static int
+match_all(
+    frec_match_t pmatch[], size_t nmatch,
+    const frec_t *single, const mfrec_t *multi, frec_match_t *next,
+    set_search *search, string text, ssize_t base, int eflags,
+    frec_match_cb cb, void *arg
+) {
+    frec_match_t local;
+    if (nmatch == 0 || pmatch == NULL) {
+        pmatch = &local;
+        nmatch = 1;
+    }
+
+    // The offsets were already applied by the caller.
+    eflags &= ~REG_STARTEND;
+
+    int cflags = (single != NULL) ? single->cflags : multi->cflags;
+    bool found = false;
+    ssize_t pos = 0;
+
+    while (pos <= text.len) {
+        string rest;
+        string_borrow_section(&rest, text, pos, text.len);
+        int flags = eflags_at(text, pos, cflags, eflags);
+
+        int ret;
+        if (single != NULL) {
+            ret = frec_match(pmatch, nmatch, single, rest, flags, NULL);
+        } else if (next != NULL) {
+            ret = mmatch_none_cached(pmatch, nmatch, multi, text, pos,
+                flags, next);
+        } else if (search != NULL) {
+            ret = mmatch_longest_resumed(pmatch, nmatch, multi, text, pos,
+                eflags, search);
+        } else {
+            ret = frec_mmatch(pmatch, nmatch, multi, rest, flags, NULL);
+        }
 
-            free(matches);
+        if (ret == REG_NOMATCH) {
+            break;
+        } else if (ret != REG_OK) {
             return ret;
         }
+        found = true;
+
+        // Without submatches, the end of the match is unknown.
+        if (cflags & REG_NOSUB) {
+            cb(pmatch, nmatch, arg);
+            break;
+        }
+
+        for (size_t i = 0; i < nmatch; i++) {
+            if (pmatch[i].soffset != -1) {
+                pmatch[i].soffset += pos;
+                pmatch[i].eoffset += pos;
+            }
+            if (single != NULL) {
+                pmatch[i].pattern_id = 0;
+            }
+        }
+
+        // Continue after the match, or after its position if it was empty.
+        ssize_t end = pmatch[0].eoffset;
+        pos = (end > pmatch[0].soffset) ? end : end + 1;
+
+        if (base != 0) {
+            for (size_t i = 0; i < nmatch; i++) {
+                if (pmatch[i].soffset != -1) {
+                    pmatch[i].soffset += base;
+                    pmatch[i].eoffset += base;
+                }
+            }
+        }
+
+        if (cb(pmatch, nmatch, arg) != 0) {
+            break;
+        }
     }
+
+    return found ? (REG_OK) : (REG_NOMATCH);
+}
+
+int
+frec_match_all(
+    frec_match_t pmatch[], size_t nmatch, const frec_t *preg,
+    string text, ssize_t base, int eflags, frec_match_cb cb, void *arg
+) {
+    return match_all(pmatch, nmatch, preg, NULL, NULL, NULL,
+        text, base, eflags, cb, arg);
+}
+
+int
+frec_mmatch_all(
+    frec_match_t pmatch[], size_t nmatch, const mfrec_t *preg,
+    string text, ssize_t base, int eflags, frec_match_cb cb, void *arg
+) {
+    // Sets searched by their literal fragments keep their candidates and
+    // windows after the reported match between the iterations.
+    if (preg->type == MHEUR_LONGEST && !(preg->cflags & REG_NOSUB)) {
+        set_search search;
+        set_search_init(&search, true);
+        return match_all(pmatch, nmatch, NULL, preg, NULL, &search,
+            text, base, eflags, cb, arg);
+    }
+
+    // Patterns without multi-pattern heuristics are searched one-by-one,
+    // so the next match of each one is kept between the iterations.
+    if (preg->type != MHEUR_NONE || (preg->cflags & REG_NOSUB)) {
+        return match_all(pmatch, nmatch, NULL, preg, NULL, NULL,
+            text, base, eflags, cb, arg);
+    }
+
+    frec_scratch_t *scratch = scratch_get(NULL);
+    if (scratch == NULL) {
+        return (REG_ESPACE);
+    }
+
+    size_t next_len;
+    frec_match_t *next = scratch_take_next(scratch, preg->count, &next_len);
+    if (next == NULL) {
+        return (REG_ESPACE);
+    }
+    for (ssize_t i = 0; i < preg->count; i++) {
+        next[i].soffset = -2;
+    }
+
+    int ret = match_all(pmatch, nmatch, NULL, preg, next, NULL,
+        text, base, eflags, cb, arg);
+
+    scratch_put_next(scratch, next, next_len);
+    return ret;
+}
+
+// Returns the start of the line containing pos, searching back to from.
+static ssize_t
+line_start(string text, ssize_t from, ssize_t pos)
+{
+    while (pos > from) {
+        bool is_lf = (text.is_wide)
+            ? text.wide[pos - 1] == L'\n'
+            : text.stnd[pos - 1] == '\n';
+        if (is_lf) {
+            break;
+        }
+        pos--;
+    }
+    return pos;
+}
+
+// Returns the end of the line containing pos (the position of its line feed,
+// or the length of the text).
+static ssize_t
+line_end(string text, ssize_t pos)
+{
+    if (text.is_wide) {
+        return find_lf_forward(text, pos);
+    }
+
+    const char *lf = memchr(text.stnd + pos, '\n', text.len - pos);
+    return (lf == NULL) ? text.len : lf - text.stnd;
+}
+
+static int
+count_match(const frec_match_t *pmatch, size_t nmatch, void *arg)
+{
+    (void) pmatch;
+    (void) nmatch;
+
+    (*(size_t *) arg)++;
+    return 0;
+}
+
+// Counts the matches of a literal pattern with Boyer-Moore directly.
+static int
+count_bm(const bm_comp *bm, string text, int eflags, size_t *count)
+{
+    frec_match_t match;
+    ssize_t pos = 0;
+
+    while (pos <= text.len) {
+        string rest;
+        string_borrow_section(&rest, text, pos, text.len);
+
+        int flags = eflags_at(text, pos,
+            bm->is_nline_set ? REG_NEWLINE : 0, eflags);
+        int ret = bm_execute_offsets(&match, bm, rest, flags);
+        if (ret == REG_NOMATCH) {
+            break;
+        } else if (ret != REG_OK) {
+            return ret;
+        }
+
+        (*count)++;
+        pos += (match.eoffset > match.soffset)
+            ? match.eoffset
+            : match.eoffset + 1;
+    }
+
+    return (REG_OK);
+}
+
+// Counts the matches of a literal pattern set with its engine directly.
+static int
+count_literal_set(const mfrec_t *preg, string text, int eflags, size_t *count)
+{
+    frec_match_t match;
+    ssize_t pos = 0;
+
+    while (pos < text.len) {
+        string rest;
+        string_borrow_section(&rest, text, pos, text.len);
+
+        int flags = eflags_at(text, pos, preg->cflags, eflags);
+        int ret = match_literal_set(&match, preg, rest, flags);
+        if (ret == REG_NOMATCH) {
+            break;
+        } else if (ret != REG_OK) {
+            return ret;
+        }
+
+        (*count)++;
+        pos += match.eoffset;
+    }
+
+    return (REG_OK);
+}
+
+// Checks whether the line [start, end) of the text matches on its own.
+static int
+verify_line(
+    const frec_t *single, const mfrec_t *multi,
+    string text, ssize_t start, ssize_t end, int eflags
+) {
+    frec_match_t match;
+    string line;
+    string_borrow_section(&line, text, start, end);
+
+    if (single != NULL) {
+        return frec_match(&match, 1, single, line, eflags, NULL);
+    } else if (multi->type != MHEUR_NONE) {
+        return frec_mmatch(&match, 1, multi, line, eflags, NULL);
+    }
+
+    // Any pattern will do, we don't need the leftmost one.
+    for (ssize_t i = 0; i < multi->count; i++) {
+        if (multi->patterns[i].is_removed) {
+            continue;
+        }
+        int ret = frec_match(&match, 1, &multi->patterns[i], line, eflags,
+            NULL);
+        if (ret != REG_NOMATCH) {
+            return ret;
+        }
+    }
+    return (REG_NOMATCH);
+}
+
+// Finds the first position in the text where a line can match. Sets exact
+// if the candidate itself is a match that doesn't need to be verified.
+static int
+find_line_candidate(
+    frec_match_t *candidate, bool *exact,
+    const frec_t *single, const mfrec_t *multi, string text, int eflags
+) {
+    *exact = false;
+
+    if (multi != NULL && multi->type == MHEUR_SINGLE) {
+        single = &multi->patterns[0];
+    }
+
+    if (single != NULL) {
+        const bm_comp *bm = single->boyer_moore;
+        const heur *hr = single->heuristic;
+
+        // Anchored literals have to be matched on each line separately.
+        if (bm != NULL && !bm->has_bol_anchor && !bm->has_eol_anchor) {
+            *exact = true;
+            return bm_execute_offsets(candidate, bm, text, eflags);
+        } else if (hr != NULL) {
+            // Every match contains a literal of the heuristic.
+            return frec_heur_candidate(candidate, hr, text, eflags);
+        }
+    } else if (multi->type == MHEUR_LITERAL || multi->type == MHEUR_LONGEST) {
+        return match_literal_set(candidate, multi, text, eflags);
+    }
+
+    // Without any literal, every line is a candidate.
+    candidate->soffset = 0;
+    candidate->eoffset = 0;
+    return (REG_OK);
+}
+
+// The common loop of the line counting functions. Each line is matched on
+// its own, like grep does. The literal engines skip to the next line that
+// can match, and each such line is verified at most once.
+static int
+count_lines(
+    const frec_t *single, const mfrec_t *multi,
+    string text, int eflags, size_t *count
+) {
+    ssize_t pos = 0;
+
+    while (pos < text.len) {
+        string rest;
+        string_borrow_section(&rest, text, pos, text.len);
+
+        frec_match_t candidate;
+        bool exact;
+        int ret = find_line_candidate(&candidate, &exact,
+            single, multi, rest, eflags);
+        if (ret == REG_NOMATCH) {
+            break;
+        } else if (ret != REG_OK) {
+            return ret;
+        }
+
+        ssize_t start = line_start(text, pos, pos + candidate.soffset);
+        ssize_t end = line_end(text, pos + candidate.soffset);
+
+        if (exact && pos + candidate.eoffset <= end) {
+            ret = REG_OK;
+        } else {
+            ret = verify_line(single, multi, text, start, end, eflags);
+        }
+
+        if (ret == REG_OK) {
+            (*count)++;
+        } else if (ret != REG_NOMATCH) {
+            return ret;
+        }
+
+        pos = end + 1;
+    }
+
+    return (REG_OK);
+}
+
+int
+frec_count(
+    const frec_t *preg, string text, int eflags, bool lines, size_t *count
+) {
+    *count = 0;
+    eflags &= ~REG_STARTEND;
+
+    if (lines) {
+        return count_lines(preg, NULL, text, eflags, count);
+    }
+
+    if (preg->boyer_moore != NULL) {
+        return count_bm(preg->boyer_moore, text, eflags, count);
+    }
+
+    frec_match_t match;
+    int ret = frec_match_all(&match, 1, preg, text, 0, eflags,
+        count_match, count);
+    return (ret == REG_NOMATCH) ? (REG_OK) : ret;
+}
+
+int
+frec_mcount(
+    const mfrec_t *preg, string text, int eflags, bool lines, size_t *count
+) {
+    *count = 0;
+    eflags &= ~REG_STARTEND;
+
+    if (lines) {
+        return count_lines(NULL, preg, text, eflags, count);
+    }
+
+    if (preg->type == MHEUR_SINGLE) {
+        return frec_count(&preg->patterns[0], text, eflags, false, count);
+    } else if (preg->type == MHEUR_LITERAL) {
+        return count_literal_set(preg, text, eflags, count);
+    }
+
+    frec_match_t match;
+    int ret = frec_mmatch_all(&match, 1, preg, text, 0, eflags,
+        count_match, count);
+    return (ret == REG_NOMATCH) ? (REG_OK) : ret;
 }
@@ -17,11 +17,35 @@ find_lf_forward(string text, ssize_t pos);
 // The matching is done using the preg preprocessing struct, the given text,
 // and the given eflags. Returns REG_OK if a match was found, REG_NOMATCH if
 // none were found, and REG_ESPACE on memory allocation errors.
-// If nmatch is 0, pmatch isn't modified.
+// If nmatch is 0, pmatch isn't modified. Temporary storage is taken from
+// the scratch space, or from the default one of the thread if it is NULL.
 int
-frec_match(frec_match_t pmatch[], size_t nmatch, const frec_t *preg, string text, int eflags);
+frec_match(frec_match_t pmatch[], size_t nmatch, const frec_t *preg, string text, int eflags, frec_scratch_t *scratch);
 
 int
-frec_mmatch(frec_match_t pmatch[], size_t nmatch, const mfrec_t *preg, string text, int eflags);
+frec_mmatch(frec_match_t pmatch[], size_t nmatch, const mfrec_t *preg, string text, int eflags, frec_scratch_t *scratch);
+
+// Calls cb for every successive, non-overlapping match in the given text,
+// until cb returns non-zero. The current match is stored in pmatch, which
+// is replaced by a single internal element if nmatch is 0. Every reported
+// offset is moved by base. Returns REG_OK if any match was found.
+int
+frec_match_all(frec_match_t pmatch[], size_t nmatch, const frec_t *preg,
+    string text, ssize_t base, int eflags, frec_match_cb cb, void *arg);
+
+int
+frec_mmatch_all(frec_match_t pmatch[], size_t nmatch, const mfrec_t *preg,
+    string text, ssize_t base, int eflags, frec_match_cb cb, void *arg);
+
+// Counts the non-overlapping matches in the given text, or with lines set,
+// the lines of the text that contain a match. Each line is matched on its
+// own in the latter case. The result is stored in count.
+int
+frec_count(const frec_t *preg, string text, int eflags, bool lines,
+    size_t *count);
+
+int
+frec_mcount(const mfrec_t *preg, string text, int eflags, bool lines,
+    size_t *count);
 
 #endif // FREC_MATCH_H
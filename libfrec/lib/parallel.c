@@ -0,0 +1,95 @@
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <frec.h>
+
+#include "parallel.h"
+
+// The number of compilation threads. Sequential by default.
+static size_t thread_count = 1;
+
+typedef struct parallel_task {
+    parallel_fn fn;
+    void *arg;
+    size_t worker;
+    pthread_t thread;
+    bool started;
+} parallel_task;
+
+static void *
+run_task(void *data)
+{
+    parallel_task *task = data;
+    task->fn(task->arg, task->worker);
+    return NULL;
+}
+
+void
+frec_set_compile_threads(int count)
+{
+    size_t threads = (count > 0) ? (size_t) count : 1;
+
+    // Zero or less selects one thread for each processor.
+    if (count <= 0) {
+        long online = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = (online > 0) ? (size_t) online : 1;
+    }
+
+    __atomic_store_n(&thread_count, threads, __ATOMIC_RELAXED);
+}
+
+size_t
+parallel_threads(void)
+{
+    return __atomic_load_n(&thread_count, __ATOMIC_RELAXED);
+}
+
+size_t
+parallel_workers(size_t work, size_t min_share)
+{
+    size_t workers = parallel_threads();
+    if (work / min_share < workers) {
+        workers = work / min_share;
+    }
+    return (workers == 0) ? 1 : workers;
+}
+
+void
+parallel_run(parallel_fn fn, void *arg, size_t workers)
+{
+    parallel_task *tasks = NULL;
+    if (workers > 1) {
+        tasks = malloc(sizeof(parallel_task) * workers);
+    }
+
+    // Without memory for the threads, every worker runs here.
+    if (tasks == NULL) {
+        for (size_t i = 0; i < workers; i++) {
+            fn(arg, i);
+        }
+        return;
+    }
+
+    for (size_t i = 1; i < workers; i++) {
+        tasks[i].fn = fn;
+        tasks[i].arg = arg;
+        tasks[i].worker = i;
+        tasks[i].started =
+            pthread_create(&tasks[i].thread, NULL, run_task, &tasks[i]) == 0;
+    }
+
+    fn(arg, 0);
+    for (size_t i = 1; i < workers; i++) {
+        if (!tasks[i].started) {
+            fn(arg, i);
+        }
+    }
+
+    for (size_t i = 1; i < workers; i++) {
+        if (tasks[i].started) {
+            pthread_join(tasks[i].thread, NULL);
+        }
+    }
+    free(tasks);
+}
@@ -0,0 +1,26 @@
+#ifndef FREC_PARALLEL_H
+#define FREC_PARALLEL_H
+
+#include <stddef.h>
+
+// A worker of parallel_run, called with its index in [0, workers).
+typedef void (*parallel_fn)(void *arg, size_t worker);
+
+// Returns the number of threads that pattern sets are compiled with.
+// Set by frec_set_compile_threads, at least 1.
+size_t
+parallel_threads(void);
+
+// Returns how many workers to split the given amount of work between, so
+// that each of them gets at least min_share of it.
+size_t
+parallel_workers(size_t work, size_t min_share);
+
+// Runs fn for every worker index in [0, workers), each on its own thread.
+// The calling thread runs worker 0, and any worker that a thread couldn't
+// be started for, so every worker runs exactly once. Returns after all of
+// them finished.
+void
+parallel_run(parallel_fn fn, void *arg, size_t workers);
+
+#endif // FREC_PARALLEL_H
@@ -0,0 +1,225 @@
+#include <pthread.h>
+#include <stdlib.h>
+
+#include <frec.h>
+#include "scratch.h"
+
+// If a scratch space was used with more lazy DFAs than this, it is emptied
+// before a new one is added. DFAs of freed patterns are dropped this way.
+#define SCRATCH_MAX_DFA 1024
+
+// The default scratch space of each thread, freed when the thread exits.
+static pthread_key_t thread_key;
+static pthread_once_t thread_once = PTHREAD_ONCE_INIT;
+static bool thread_key_ok = false;
+
+static void
+free_thread_scratch(void *scratch)
+{
+    frec_scratch_free(scratch);
+    free(scratch);
+}
+
+static void
+create_thread_key(void)
+{
+    thread_key_ok = pthread_key_create(&thread_key, free_thread_scratch) == 0;
+}
+
+// Grows the array to hold at least n (and at least one) elements of the
+// given size.
+static void *
+grow(void *array, size_t *len, size_t n, size_t size)
+{
+    if (n <= *len && *len > 0) {
+        return array;
+    }
+
+    size_t cap = (*len == 0) ? 4 : *len;
+    while (cap < n) {
+        cap *= 2;
+    }
+
+    void *result = realloc(array, cap * size);
+    if (result != NULL) {
+        *len = cap;
+    }
+    return result;
+}
+
+int
+frec_scratch_init(frec_scratch_t *scratch)
+{
+    scratch->pmatch = NULL;
+    scratch->pmatch_len = 0;
+    scratch->matches = NULL;
+    scratch->matches_len = 0;
+    scratch->next = NULL;
+    scratch->next_len = 0;
+    scratch->dfa = NULL;
+    scratch->dfa_len = 0;
+    scratch->dfa_count = 0;
+
+    return (REG_OK);
+}
+
+void
+frec_scratch_free(frec_scratch_t *scratch)
+{
+    if (scratch != NULL) {
+        free(scratch->pmatch);
+        free(scratch->matches);
+        free(scratch->next);
+        for (size_t i = 0; i < scratch->dfa_len; i++) {
+            dfa_context_free(scratch->dfa[i]);
+        }
+        free(scratch->dfa);
+        frec_scratch_init(scratch);
+    }
+}
+
+frec_scratch_t *
+scratch_get(frec_scratch_t *scratch)
+{
+    if (scratch != NULL) {
+        return scratch;
+    }
+
+    pthread_once(&thread_once, create_thread_key);
+    if (!thread_key_ok) {
+        return NULL;
+    }
+
+    scratch = pthread_getspecific(thread_key);
+    if (scratch == NULL) {
+        scratch = malloc(sizeof(frec_scratch_t));
+        if (scratch == NULL) {
+            return NULL;
+        }
+        frec_scratch_init(scratch);
+
+        if (pthread_setspecific(thread_key, scratch) != 0) {
+            free(scratch);
+            return NULL;
+        }
+    }
+
+    return scratch;
+}
+
+regmatch_t *
+scratch_pmatch(frec_scratch_t *scratch, size_t n)
+{
+    regmatch_t *pmatch = grow(scratch->pmatch, &scratch->pmatch_len, n,
+        sizeof(regmatch_t));
+    if (pmatch != NULL) {
+        scratch->pmatch = pmatch;
+    }
+    return pmatch;
+}
+
+frec_match_t *
+scratch_matches(frec_scratch_t *scratch, size_t n)
+{
+    frec_match_t *matches = grow(scratch->matches, &scratch->matches_len, n,
+        sizeof(frec_match_t));
+    if (matches != NULL) {
+        scratch->matches = matches;
+    }
+    return matches;
+}
+
+frec_match_t *
+scratch_take_next(frec_scratch_t *scratch, size_t n, size_t *len)
+{
+    *len = scratch->next_len;
+    frec_match_t *next = grow(scratch->next, len, n, sizeof(frec_match_t));
+    if (next != NULL) {
+        scratch->next = NULL;
+        scratch->next_len = 0;
+    }
+    return next;
+}
+
+void
+scratch_put_next(frec_scratch_t *scratch, frec_match_t *next, size_t len)
+{
+    // A callback may have given back its own storage meanwhile, the larger
+    // one of the two is kept.
+    if (scratch->next_len >= len) {
+        free(next);
+        return;
+    }
+
+    free(scratch->next);
+    scratch->next = next;
+    scratch->next_len = len;
+}
+
+static size_t
+dfa_slot(const frec_scratch_t *scratch, uint64_t serial)
+{
+    size_t slot = (size_t) (serial * 0x9e3779b97f4a7c15u) & (scratch->dfa_len - 1);
+    while (scratch->dfa[slot] != NULL && scratch->dfa[slot]->serial != serial) {
+        slot = (slot + 1) & (scratch->dfa_len - 1);
+    }
+    return slot;
+}
+
+// Makes room for one more DFA in the hash table. Returns false on memory
+// errors.
+static bool
+grow_dfa_table(frec_scratch_t *scratch)
+{
+    if (scratch->dfa_count >= SCRATCH_MAX_DFA) {
+        for (size_t i = 0; i < scratch->dfa_len; i++) {
+            dfa_context_free(scratch->dfa[i]);
+            scratch->dfa[i] = NULL;
+        }
+        scratch->dfa_count = 0;
+    }
+    if (2 * (scratch->dfa_count + 1) <= scratch->dfa_len) {
+        return true;
+    }
+
+    size_t len = (scratch->dfa_len == 0) ? 16 : 2 * scratch->dfa_len;
+    dfa_context **table = calloc(len, sizeof(dfa_context *));
+    if (table == NULL) {
+        return false;
+    }
+
+    dfa_context **old = scratch->dfa;
+    size_t old_len = scratch->dfa_len;
+    scratch->dfa = table;
+    scratch->dfa_len = len;
+
+    for (size_t i = 0; i < old_len; i++) {
+        if (old[i] != NULL) {
+            table[dfa_slot(scratch, old[i]->serial)] = old[i];
+        }
+    }
+    free(old);
+    return true;
+}
+
+dfa_context *
+scratch_dfa(frec_scratch_t *scratch, const dfa_comp *comp)
+{
+    if (scratch->dfa_len > 0) {
+        dfa_context *ctx = scratch->dfa[dfa_slot(scratch, comp->serial)];
+        if (ctx != NULL) {
+            return ctx;
+        }
+    }
+
+    if (!grow_dfa_table(scratch)) {
+        return NULL;
+    }
+
+    dfa_context *ctx = dfa_context_create(comp);
+    if (ctx != NULL) {
+        scratch->dfa[dfa_slot(scratch, comp->serial)] = ctx;
+        scratch->dfa_count++;
+    }
+    return ctx;
+}
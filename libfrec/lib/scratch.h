@@ -0,0 +1,39 @@
+#ifndef FREC_SCRATCH_H
+#define FREC_SCRATCH_H
+
+#include <frec-types.h>
+#include "dfa-type.h"
+
+// Returns the given scratch space, or if it is NULL, the default one of the
+// calling thread. Returns NULL if the latter can't be allocated.
+frec_scratch_t *
+scratch_get(frec_scratch_t *scratch);
+
+// Returns storage for n submatches of the original matcher from the
+// scratch space, growing it if needed. Returns NULL on memory errors.
+regmatch_t *
+scratch_pmatch(frec_scratch_t *scratch, size_t n);
+
+// Returns storage for n matches from the scratch space, growing it if
+// needed. Returns NULL on memory errors.
+frec_match_t *
+scratch_matches(frec_scratch_t *scratch, size_t n);
+
+// Takes the storage for the next match of n patterns, which match iteration
+// keeps between its iterations, from the scratch space, growing it if needed.
+// The scratch space is left without it until scratch_put_next is called, so
+// that the callbacks of the iteration may iterate as well. Stores its
+// capacity in len, and returns NULL on memory errors.
+frec_match_t *
+scratch_take_next(frec_scratch_t *scratch, size_t n, size_t *len);
+
+// Gives the storage taken by scratch_take_next back to the scratch space.
+void
+scratch_put_next(frec_scratch_t *scratch, frec_match_t *next, size_t len);
+
+// Returns the context of the lazy DFA compiled in comp from the scratch
+// space, creating it if needed. Returns NULL on memory errors.
+dfa_context *
+scratch_dfa(frec_scratch_t *scratch, const dfa_comp *comp);
+
+#endif // FREC_SCRATCH_H
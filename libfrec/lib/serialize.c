@@ -0,0 +1,1090 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ac-type.h"
+#include "compile.h"
+#include "dfa-type.h"
+#include "dfa.h"
+#include "frec-internal.h"
+#include "teddy-type.h"
+#include "wm-type.h"
+
+// Every blob starts with this header. The payload that follows it is a
+// sequence of 8 byte words and arrays, both aligned to 8 bytes. Arrays are
+// stored as their length in bytes, followed by their content, padded with
+// zeroes. Nothing in the payload is an address, so the blob can be used
+// from wherever it is loaded.
+#define BLOB_MAGIC "FRECBLOB"
+#define BLOB_VERSION 3
+#define BLOB_BYTE_ORDER 0x01020304
+
+#define BLOB_SINGLE 1
+#define BLOB_MULTI 2
+
+typedef struct blob_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;     // Reads differently on other byte orders.
+    uint32_t size_size;      // sizeof(size_t) of the writer.
+    uint32_t wchar_size;     // sizeof(wchar_t) of the writer.
+    uint32_t kind;           // BLOB_SINGLE or BLOB_MULTI.
+    uint32_t reserved;
+    uint64_t payload_len;
+    uint64_t checksum;       // Checksum of the payload.
+} blob_header;
+
+// Flags of the pattern records.
+#define RECORD_BM 0x01
+#define RECORD_HEUR 0x02
+#define RECORD_DFA 0x04
+#define RECORD_LITERAL 0x08
+#define RECORD_WIDE 0x10
+#define RECORD_REMOVED 0x20
+
+// The multi-pattern engine stored after the pattern records.
+#define ENGINE_NONE 0
+#define ENGINE_TEDDY 1
+#define ENGINE_AC 2
+#define ENGINE_WM 3
+#define ENGINE_REBUILD 4
+
+typedef struct blob_writer {
+    unsigned char *data;
+    size_t len;
+    size_t cap;
+    bool failed;
+} blob_writer;
+
+typedef struct blob_reader {
+    const unsigned char *data;
+    size_t len;
+    size_t pos;
+    bool failed;
+} blob_reader;
+
+// Word-wise FNV-1a over the payload, which is a multiple of 8 bytes long.
+static uint64_t
+checksum(const unsigned char *data, size_t len)
+{
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (size_t i = 0; i < len; i += 8) {
+        uint64_t word;
+        memcpy(&word, data + i, 8);
+        hash = (hash ^ word) * 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+// Appends len bytes, padded with zeroes, and returns where they start.
+static unsigned char *
+reserve(blob_writer *w, size_t len)
+{
+    size_t padded = (len + 7) & ~(size_t) 7;
+    if (w->failed) {
+        return NULL;
+    }
+
+    if (w->len + padded > w->cap) {
+        size_t cap = (w->cap == 0) ? 4096 : w->cap;
+        while (w->len + padded > cap) {
+            cap *= 2;
+        }
+
+        unsigned char *data = realloc(w->data, cap);
+        if (data == NULL) {
+            w->failed = true;
+            return NULL;
+        }
+        w->data = data;
+        w->cap = cap;
+    }
+
+    unsigned char *start = w->data + w->len;
+    memset(start, 0, padded);
+    w->len += padded;
+    return start;
+}
+
+static void
+put_raw(blob_writer *w, const void *content, size_t len)
+{
+    unsigned char *start = reserve(w, len);
+    if (start != NULL && len != 0) {
+        memcpy(start, content, len);
+    }
+}
+
+static void
+put_word(blob_writer *w, uint64_t word)
+{
+    put_raw(w, &word, 8);
+}
+
+static void
+put_array(blob_writer *w, const void *content, size_t len)
+{
+    put_word(w, len);
+    put_raw(w, content, len);
+}
+
+// Strings are stored with a terminating null character.
+static void
+put_string(blob_writer *w, string str)
+{
+    size_t size = str.is_wide ? sizeof(wchar_t) : sizeof(char);
+    const void *content = str.is_wide
+        ? (const void *) str.wide : (const void *) str.stnd;
+
+    put_word(w, size * str.len + size);
+    unsigned char *start = reserve(w, size * str.len + size);
+    if (start != NULL && str.len != 0) {
+        memcpy(start, content, size * str.len);
+    }
+}
+
+static uint64_t
+get_word(blob_reader *r)
+{
+    if (r->failed || r->len - r->pos < 8) {
+        r->failed = true;
+        return 0;
+    }
+
+    uint64_t word;
+    memcpy(&word, r->data + r->pos, 8);
+    r->pos += 8;
+    return word;
+}
+
+// Returns the array at the current position, which must be len bytes long.
+// Empty arrays are returned as NULL.
+static const void *
+get_array(blob_reader *r, size_t len)
+{
+    uint64_t stored = get_word(r);
+    if (r->failed || stored != len || r->len - r->pos < len) {
+        r->failed = true;
+        return NULL;
+    }
+
+    const void *content = (len != 0) ? r->data + r->pos : NULL;
+    r->pos += (len + 7) & ~(size_t) 7;
+    if (r->pos > r->len) {
+        r->failed = true;
+        return NULL;
+    }
+    return content;
+}
+
+// Reads an array whose length is not known in advance. It must be a
+// multiple of size bytes long.
+static const void *
+get_any_array(blob_reader *r, size_t size, size_t *count)
+{
+    *count = 0;
+    size_t pos = r->pos;
+    uint64_t stored = get_word(r);
+    r->pos = pos;
+    if (r->failed || stored % size != 0 || stored > r->len) {
+        r->failed = true;
+        return NULL;
+    }
+
+    *count = stored / size;
+    return get_array(r, stored);
+}
+
+// Borrows the string at the current position from the blob.
+static void
+get_string(blob_reader *r, string *str, bool is_wide)
+{
+    size_t size = is_wide ? sizeof(wchar_t) : sizeof(char);
+    size_t count;
+    const char *content = get_any_array(r, size, &count);
+    if (r->failed || count == 0) {
+        r->failed = true;
+        string_init(str);
+        return;
+    }
+
+    // The terminator is checked, so the string can be used as a C string.
+    for (size_t i = 0; i < size; i++) {
+        if (content[size * (count - 1) + i] != 0) {
+            r->failed = true;
+            string_init(str);
+            return;
+        }
+    }
+    string_borrow(str, content, (ssize_t) (count - 1), is_wide);
+}
+
+static void
+write_bm(blob_writer *w, const bm_comp *comp)
+{
+    put_string(w, comp->pattern);
+    put_array(w, comp->good_shifts,
+        (comp->good_shifts == NULL) ? 0 : sizeof(unsigned int) * comp->pattern.len);
+    put_array(w, comp->bad_shifts_stnd, sizeof(comp->bad_shifts_stnd));
+    put_word(w, comp->rare_offsets[0]);
+    put_word(w, comp->rare_offsets[1]);
+    put_word(w, comp->has_bol_anchor | comp->has_eol_anchor << 1
+        | comp->has_glob_match << 2 | comp->is_icase_set << 3
+        | comp->is_nosub_set << 4 | comp->is_nline_set << 5);
+}
+
+static void
+read_bm(blob_reader *r, bm_comp *comp)
+{
+    bm_comp_init(comp, 0);
+    comp->is_borrowed = true;
+
+    get_string(r, &comp->pattern, false);
+
+    size_t count;
+    comp->good_shifts = (unsigned int *)
+        get_any_array(r, sizeof(unsigned int), &count);
+    if (count != 0 && count != (size_t) comp->pattern.len) {
+        r->failed = true;
+    }
+
+    const void *bad_shifts = get_array(r, sizeof(comp->bad_shifts_stnd));
+    if (bad_shifts != NULL) {
+        memcpy(comp->bad_shifts_stnd, bad_shifts, sizeof(comp->bad_shifts_stnd));
+    }
+
+    for (int i = 0; i < 2; i++) {
+        comp->rare_offsets[i] = (ssize_t) get_word(r);
+        if (comp->rare_offsets[i] < 0 || comp->rare_offsets[i] > comp->pattern.len) {
+            r->failed = true;
+        }
+    }
+
+    uint64_t flags = get_word(r);
+    comp->has_bol_anchor = flags & 0x01;
+    comp->has_eol_anchor = flags & 0x02;
+    comp->has_glob_match = flags & 0x04;
+    comp->is_icase_set = flags & 0x08;
+    comp->is_nosub_set = flags & 0x10;
+    comp->is_nline_set = flags & 0x20;
+}
+
+static void
+write_dfa(blob_writer *w, const dfa_comp *comp)
+{
+    put_array(w, comp->nfa, sizeof(nfa_node) * comp->nfa_count);
+    put_array(w, comp->sets, sizeof(*comp->sets) * comp->set_count);
+    put_array(w, comp->classes, sizeof(comp->classes));
+    put_array(w, comp->class_repr, sizeof(comp->class_repr));
+    put_word(w, comp->nfa_start);
+    put_word(w, comp->class_count);
+    put_word(w, comp->has_bol);
+    put_word(w, (uint64_t) comp->cflags);
+}
+
+// Checks that the nodes of the NFA only lead to other nodes and byte sets
+// of it, and that every byte has one of the classes.
+static bool
+check_dfa(const dfa_comp *comp)
+{
+    for (uint32_t i = 0; i < comp->nfa_count; i++) {
+        const nfa_node *node = &comp->nfa[i];
+        if (node->type > NFA_MATCH
+            || (node->type == NFA_SET && node->set >= comp->set_count)
+            || (node->type != NFA_MATCH && node->out >= comp->nfa_count)
+            || (node->type == NFA_SPLIT && node->out1 >= comp->nfa_count)) {
+            return false;
+        }
+    }
+    for (size_t c = 0; c < 256; c++) {
+        if (comp->classes[c] >= comp->class_count) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void
+read_dfa(blob_reader *r, dfa_comp *comp)
+{
+    dfa_comp_init(comp, 0);
+    comp->borrowed = true;
+
+    size_t count;
+    comp->nfa = (nfa_node *) get_any_array(r, sizeof(nfa_node), &count);
+    comp->nfa_count = (uint32_t) count;
+    comp->sets = (uint32_t (*)[8]) get_any_array(r, sizeof(*comp->sets), &count);
+    comp->set_count = (uint32_t) count;
+
+    const void *classes = get_array(r, sizeof(comp->classes));
+    const void *class_repr = get_array(r, sizeof(comp->class_repr));
+    if (classes != NULL && class_repr != NULL) {
+        memcpy(comp->classes, classes, sizeof(comp->classes));
+        memcpy(comp->class_repr, class_repr, sizeof(comp->class_repr));
+    }
+
+    comp->nfa_start = (uint32_t) get_word(r);
+    comp->class_count = (uint32_t) get_word(r);
+    comp->has_bol = get_word(r);
+    comp->cflags = (int) get_word(r);
+    if (comp->nfa_start >= comp->nfa_count || comp->class_count > 256
+        || (!r->failed && !check_dfa(comp))) {
+        r->failed = true;
+    }
+
+    // The serials of the compiled NFAs are only unique within a process.
+    dfa_assign_serial(comp);
+}
+
+// The engines are stored by the same functions as the ones of pattern sets.
+static void write_teddy(blob_writer *w, const teddy_comp *comp);
+static void read_teddy(blob_reader *r, teddy_comp *comp);
+static void write_wm(blob_writer *w, const wm_comp *comp);
+static void read_wm(blob_reader *r, wm_comp *comp);
+
+// Heuristics search for one literal fragment with Boyer-Moore, or for several
+// literals with one of the multi-pattern engines, and check the other
+// fragments.
+static void
+write_heur(blob_writer *w, const heur *heuristic)
+{
+    put_word(w, (uint64_t) heuristic->max_length);
+    put_word(w, (uint64_t) heuristic->heur_type);
+    put_word(w, heuristic->score);
+
+    if (heuristic->teddy != NULL) {
+        put_word(w, ENGINE_TEDDY);
+        write_teddy(w, heuristic->teddy);
+    } else if (heuristic->wu_manber != NULL) {
+        put_word(w, ENGINE_WM);
+        write_wm(w, heuristic->wu_manber);
+    } else {
+        put_word(w, ENGINE_NONE);
+    }
+
+    write_bm(w, &heuristic->literal_comp);
+    put_word(w, (uint64_t) heuristic->fragment_count);
+    for (ssize_t i = 0; i < heuristic->fragment_count; i++) {
+        write_bm(w, &heuristic->fragments[i]);
+    }
+}
+
+// Reads a heuristic into a struct created by frec_create_heur. Returns false
+// if memory couldn't be allocated.
+static bool
+read_heur(blob_reader *r, heur *heuristic)
+{
+    heuristic->max_length = (ssize_t) get_word(r);
+    heuristic->heur_type = (int) get_word(r);
+    heuristic->score = (unsigned int) get_word(r);
+
+    uint64_t engine = get_word(r);
+    if (engine == ENGINE_TEDDY) {
+        heuristic->teddy = malloc(sizeof(teddy_comp));
+        if (heuristic->teddy == NULL) {
+            return false;
+        }
+        read_teddy(r, heuristic->teddy);
+    } else if (engine == ENGINE_WM) {
+        heuristic->wu_manber = malloc(sizeof(wm_comp));
+        if (heuristic->wu_manber == NULL) {
+            return false;
+        }
+        read_wm(r, heuristic->wu_manber);
+    } else if (engine != ENGINE_NONE) {
+        r->failed = true;
+        return true;
+    }
+
+    read_bm(r, &heuristic->literal_comp);
+
+    uint64_t count = get_word(r);
+    if (count >= MAX_FRAGMENTS) {
+        r->failed = true;
+    } else if (count > 0) {
+        heuristic->fragments = malloc(sizeof(bm_comp) * count);
+        if (heuristic->fragments == NULL) {
+            return false;
+        }
+        for (uint64_t i = 0; i < count; i++) {
+            read_bm(r, &heuristic->fragments[i]);
+            heuristic->fragment_count++;
+        }
+    }
+    return true;
+}
+
+static void
+write_frec(blob_writer *w, const frec_t *frec)
+{
+    size_t size = frec->source_wide ? sizeof(wchar_t) : sizeof(char);
+
+    // Only the place of removed patterns is kept.
+    if (frec->is_removed) {
+        put_word(w, RECORD_REMOVED);
+        return;
+    }
+
+    // Wide patterns are compiled again when they are read.
+    uint64_t flags = (frec->is_literal ? RECORD_LITERAL : 0);
+    if (frec->source_wide) {
+        flags |= RECORD_WIDE;
+    } else {
+        flags |= (frec->boyer_moore != NULL ? RECORD_BM : 0)
+            | (frec->heuristic != NULL ? RECORD_HEUR : 0)
+            | (frec->dfa != NULL ? RECORD_DFA : 0);
+    }
+
+    put_word(w, flags);
+    put_word(w, (uint64_t) frec->cflags);
+    put_word(w, (uint64_t) frec->source_cflags);
+    put_array(w, frec->source, size * frec->source_len);
+
+    if (flags & RECORD_BM) {
+        write_bm(w, frec->boyer_moore);
+    }
+    if (flags & RECORD_HEUR) {
+        write_heur(w, frec->heuristic);
+    }
+    if (flags & RECORD_DFA) {
+        write_dfa(w, frec->dfa);
+    }
+}
+
+// Reads a pattern record into frec. On failure, nothing is left to free.
+static int
+read_frec(blob_reader *r, frec_t *frec)
+{
+    uint64_t flags = get_word(r);
+    if (flags == RECORD_REMOVED) {
+        frec->boyer_moore = NULL;
+        frec->heuristic = NULL;
+        frec->dfa = NULL;
+        frec->source = NULL;
+        frec->is_borrowed = true;
+        frec->has_original = false;
+        frec->is_removed = true;
+        return r->failed ? (REG_BADPAT) : (REG_OK);
+    }
+
+    int cflags = (int) get_word(r);
+    int source_cflags = (int) get_word(r);
+
+    bool is_wide = flags & RECORD_WIDE;
+    size_t size = is_wide ? sizeof(wchar_t) : sizeof(char);
+    size_t count;
+    const void *source = get_any_array(r, size, &count);
+    if (r->failed) {
+        return (REG_BADPAT);
+    }
+
+    // Wide patterns don't have anything else stored.
+    if (is_wide) {
+        string pattern;
+        string_borrow(&pattern, (source != NULL) ? source : L"",
+            (ssize_t) count, true);
+        return frec_compile(frec, pattern, source_cflags);
+    }
+
+    // The automaton of the original matcher can't be stored, so it is
+    // compiled from the pattern by frec_compile_original, once a match
+    // first needs it. Most never do, as they are found by the stored
+    // engines, and the pattern was already validated when it was written.
+    bool is_literal = flags & RECORD_LITERAL;
+    frec->has_original = false;
+
+    frec->boyer_moore = NULL;
+    frec->heuristic = NULL;
+    frec->dfa = NULL;
+    frec->cflags = cflags;
+    frec->is_literal = is_literal;
+    frec->source = (void *) source;
+    frec->source_len = count;
+    frec->source_wide = false;
+    frec->source_cflags = source_cflags;
+    frec->is_borrowed = true;
+    frec->is_removed = false;
+
+    if (flags & RECORD_BM) {
+        frec->boyer_moore = malloc(sizeof(bm_comp));
+        if (frec->boyer_moore == NULL) {
+            frec_regfree(frec);
+            return (REG_ESPACE);
+        }
+        read_bm(r, frec->boyer_moore);
+    }
+    if (flags & RECORD_HEUR) {
+        frec->heuristic = frec_create_heur();
+        if (frec->heuristic == NULL) {
+            frec_regfree(frec);
+            return (REG_ESPACE);
+        }
+        if (!read_heur(r, frec->heuristic)) {
+            frec_regfree(frec);
+            return (REG_ESPACE);
+        }
+    }
+    if (flags & RECORD_DFA) {
+        frec->dfa = malloc(sizeof(dfa_comp));
+        if (frec->dfa == NULL) {
+            frec_regfree(frec);
+            return (REG_ESPACE);
+        }
+        read_dfa(r, frec->dfa);
+    }
+
+    if (r->failed) {
+        frec_regfree(frec);
+        return (REG_BADPAT);
+    }
+    return (REG_OK);
+}
+
+static void
+write_teddy(blob_writer *w, const teddy_comp *comp)
+{
+    put_word(w, comp->count);
+    put_word(w, comp->len_shortest);
+    put_word(w, comp->fp_len);
+    put_word(w, comp->bucket_count);
+    put_word(w, comp->is_icase_set);
+    put_word(w, (uint64_t) comp->cflags);
+    put_array(w, comp->prefixes, sizeof(comp->prefixes));
+    put_array(w, comp->prefix_masks, sizeof(comp->prefix_masks));
+    put_array(w, comp->lo_masks, sizeof(comp->lo_masks));
+    put_array(w, comp->hi_masks, sizeof(comp->hi_masks));
+    put_array(w, comp->bucket_start, sizeof(comp->bucket_start));
+    put_array(w, comp->bucket_ids, sizeof(comp->bucket_ids));
+    for (ssize_t i = 0; i < comp->count; i++) {
+        put_string(w, comp->patterns[i]);
+    }
+}
+
+// Copies an array of a known length into the given field.
+static void
+read_fixed(blob_reader *r, void *field, size_t len)
+{
+    const void *content = get_array(r, len);
+    if (content != NULL) {
+        memcpy(field, content, len);
+    }
+}
+
+static void
+read_teddy(blob_reader *r, teddy_comp *comp)
+{
+    teddy_comp_init(comp, 0);
+
+    comp->count = (ssize_t) get_word(r);
+    comp->len_shortest = (ssize_t) get_word(r);
+    comp->fp_len = (ssize_t) get_word(r);
+    comp->bucket_count = (int) get_word(r);
+    comp->is_icase_set = get_word(r);
+    comp->cflags = (int) get_word(r);
+    if (comp->count < 0 || comp->count > TEDDY_MAX_PATTERNS
+        || comp->fp_len < 0 || comp->fp_len > TEDDY_MAX_FINGERPRINT
+        || comp->bucket_count < 0 || comp->bucket_count > TEDDY_BUCKETS) {
+        r->failed = true;
+        comp->count = 0;
+        return;
+    }
+
+    read_fixed(r, comp->prefixes, sizeof(comp->prefixes));
+    read_fixed(r, comp->prefix_masks, sizeof(comp->prefix_masks));
+    read_fixed(r, comp->lo_masks, sizeof(comp->lo_masks));
+    read_fixed(r, comp->hi_masks, sizeof(comp->hi_masks));
+    read_fixed(r, comp->bucket_start, sizeof(comp->bucket_start));
+    read_fixed(r, comp->bucket_ids, sizeof(comp->bucket_ids));
+    for (ssize_t i = 0; i < comp->count; i++) {
+        get_string(r, &comp->patterns[i], false);
+    }
+
+    // The buckets are looked up by any bit of the masks, so each of them
+    // has to stay within the ids, and the ids within the patterns.
+    for (int b = 0; b <= TEDDY_BUCKETS; b++) {
+        if (comp->bucket_start[b] > comp->count) {
+            r->failed = true;
+        }
+    }
+    for (ssize_t i = 0; i < comp->count; i++) {
+        if (comp->bucket_ids[i] >= comp->count) {
+            r->failed = true;
+        }
+    }
+}
+
+static void
+write_ac(blob_writer *w, const ac_comp *comp)
+{
+    uint32_t n = comp->state_count;
+
+    put_word(w, comp->state_count);
+    put_word(w, comp->dense_count);
+    put_word(w, comp->count);
+    put_word(w, comp->len_longest);
+    put_word(w, (uint64_t) comp->cflags);
+    put_array(w, comp->fold, sizeof(comp->fold));
+    put_array(w, comp->dense, sizeof(uint32_t) * 256 * comp->dense_count);
+    put_array(w, comp->edge_start, sizeof(uint32_t) * (n + 1));
+    put_array(w, comp->edges, sizeof(ac_edge) * comp->edge_start[n]);
+    put_array(w, comp->fail, sizeof(uint32_t) * n);
+    put_array(w, comp->output, sizeof(uint32_t) * n);
+    put_array(w, comp->dict, sizeof(uint32_t) * n);
+    put_array(w, comp->depth, sizeof(uint32_t) * n);
+}
+
+// Checks that every state and pattern that the tables refer to exists.
+// The failure and dictionary links lead to shallower states, which come
+// earlier, so following them always ends. No transition gets deeper by
+// more than one character, so matches never start before the text.
+static bool
+check_ac(const ac_comp *comp)
+{
+    uint32_t n = comp->state_count;
+    if (comp->dense_count == 0 || comp->edge_start[0] != 0
+        || comp->depth[0] != 0 || comp->fail[0] != 0
+        || comp->dict[0] != AC_NONE || comp->count <= 0) {
+        return false;
+    }
+
+    for (uint32_t s = 0; s < n; s++) {
+        uint32_t depth = comp->depth[s];
+        if (comp->edge_start[s] > comp->edge_start[s + 1]
+            || (comp->output[s] != AC_NONE
+                && comp->output[s] >= (uint64_t) comp->count)) {
+            return false;
+        }
+
+        uint32_t fail = comp->fail[s];
+        uint32_t dict = comp->dict[s];
+        if (s > 0 && (fail >= s || comp->depth[fail] >= depth
+            || (dict != AC_NONE && (dict >= s || comp->depth[dict] >= depth)))) {
+            return false;
+        }
+
+        for (uint32_t e = comp->edge_start[s]; e < comp->edge_start[s + 1]; e++) {
+            uint32_t t = comp->edges[e].target & AC_STATE_MASK;
+            if (t >= n || comp->depth[t] > depth + 1) {
+                return false;
+            }
+        }
+        if (s < comp->dense_count) {
+            for (size_t c = 0; c < 256; c++) {
+                uint32_t t = comp->dense[(size_t) s * 256 + c] & AC_STATE_MASK;
+                if (t >= n || comp->depth[t] > depth + 1) {
+                    return false;
+                }
+            }
+        }
+    }
+    return true;
+}
+
+static void
+read_ac(blob_reader *r, ac_comp *comp)
+{
+    ac_comp_init(comp, 0);
+    comp->borrowed = true;
+
+    comp->state_count = (uint32_t) get_word(r);
+    comp->dense_count = (uint32_t) get_word(r);
+    comp->count = (ssize_t) get_word(r);
+    comp->len_longest = (ssize_t) get_word(r);
+    comp->cflags = (int) get_word(r);
+
+    // Every state has at least one byte in the blob.
+    uint32_t n = comp->state_count;
+    if (r->failed || n == 0 || n > r->len || comp->dense_count > n) {
+        r->failed = true;
+        return;
+    }
+
+    read_fixed(r, comp->fold, sizeof(comp->fold));
+    comp->dense = (uint32_t *)
+        get_array(r, sizeof(uint32_t) * 256 * comp->dense_count);
+    comp->edge_start = (uint32_t *) get_array(r, sizeof(uint32_t) * (n + 1));
+
+    size_t count;
+    comp->edges = (ac_edge *) get_any_array(r, sizeof(ac_edge), &count);
+    if (comp->edge_start != NULL && comp->edge_start[n] != count) {
+        r->failed = true;
+    }
+
+    comp->fail = (uint32_t *) get_array(r, sizeof(uint32_t) * n);
+    comp->output = (uint32_t *) get_array(r, sizeof(uint32_t) * n);
+    comp->dict = (uint32_t *) get_array(r, sizeof(uint32_t) * n);
+    comp->depth = (uint32_t *) get_array(r, sizeof(uint32_t) * n);
+    if (!r->failed && !check_ac(comp)) {
+        r->failed = true;
+    }
+}
+
+static void
+write_wm(blob_writer *w, const wm_comp *comp)
+{
+    size_t table_size = comp->table_mask + 1;
+
+    put_word(w, comp->count);
+    put_word(w, comp->len_shortest);
+    put_word(w, comp->block_len);
+    put_word(w, comp->shift_def);
+    put_word(w, comp->table_mask);
+    put_word(w, (uint64_t) comp->cflags);
+    put_string(w, comp->arena);
+    put_array(w, comp->offsets, sizeof(size_t) * (comp->count + 1));
+    put_array(w, comp->shift, sizeof(uint16_t) * table_size);
+    put_array(w, comp->buckets, sizeof(uint32_t) * (table_size + 1));
+    put_array(w, comp->bucket_ids, sizeof(uint32_t) * comp->count);
+    put_array(w, comp->bucket_prefix, sizeof(uint32_t) * comp->count);
+}
+
+// Checks that the buckets stay within the ids, the ids within the
+// patterns, and the patterns within the arena. The blocks that are hashed
+// have to fit before the end of the shortest pattern.
+static bool
+check_wm(const wm_comp *comp)
+{
+    size_t table_size = comp->table_mask + 1;
+    uint32_t count = (uint32_t) comp->count;
+    if (comp->block_len < 1 || comp->block_len > comp->len_shortest
+        || comp->buckets[0] != 0
+        || comp->buckets[table_size] != count || comp->offsets[0] != 0
+        || comp->offsets[count] != (size_t) comp->arena.len) {
+        return false;
+    }
+
+    for (size_t i = 0; i < table_size; i++) {
+        if (comp->buckets[i] > comp->buckets[i + 1]) {
+            return false;
+        }
+    }
+    for (uint32_t i = 0; i < count; i++) {
+        if (comp->bucket_ids[i] >= count
+            || comp->offsets[i] > comp->offsets[i + 1]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void
+read_wm(blob_reader *r, wm_comp *comp)
+{
+    comp->count = (ssize_t) get_word(r);
+    comp->len_shortest = (ssize_t) get_word(r);
+    comp->block_len = (ssize_t) get_word(r);
+    comp->shift_def = (ssize_t) get_word(r);
+    comp->table_mask = (size_t) get_word(r);
+    comp->cflags = (int) get_word(r);
+    comp->borrowed = true;
+
+    // Loaded tables can't be edited, the set is compiled again instead.
+    comp->extra_head = NULL;
+    comp->extra_next = NULL;
+    comp->removed = NULL;
+    comp->base_count = comp->count;
+    comp->capacity = comp->count;
+    comp->arena_cap = 0;
+    comp->edits = 0;
+
+    // The tables are checked against the length of the blob before their
+    // sizes are computed, so that these can't overflow.
+    string_init(&comp->arena);
+    if (r->failed || comp->count <= 0 || (size_t) comp->count > r->len
+        || comp->table_mask > r->len || (comp->table_mask & (comp->table_mask + 1))) {
+        r->failed = true;
+        return;
+    }
+
+    size_t table_size = comp->table_mask + 1;
+    get_string(r, &comp->arena, false);
+    comp->offsets = (size_t *) get_array(r, sizeof(size_t) * (comp->count + 1));
+    comp->shift = (uint16_t *) get_array(r, sizeof(uint16_t) * table_size);
+    comp->buckets = (uint32_t *) get_array(r, sizeof(uint32_t) * (table_size + 1));
+    comp->bucket_ids = (uint32_t *) get_array(r, sizeof(uint32_t) * comp->count);
+    comp->bucket_prefix = (uint32_t *) get_array(r, sizeof(uint32_t) * comp->count);
+    if (!r->failed && !check_wm(comp)) {
+        r->failed = true;
+    }
+}
+
+// Checks the header of the blob and prepares a reader of its payload.
+static int
+open_blob(blob_reader *r, const void *blob, size_t len, uint32_t kind)
+{
+    blob_header header;
+    if (blob == NULL || len < sizeof(header) || (uintptr_t) blob % 8 != 0) {
+        return (REG_BADPAT);
+    }
+    memcpy(&header, blob, sizeof(header));
+
+    if (memcmp(header.magic, BLOB_MAGIC, 8) != 0
+        || header.version != BLOB_VERSION
+        || header.byte_order != BLOB_BYTE_ORDER
+        || header.size_size != sizeof(size_t)
+        || header.wchar_size != sizeof(wchar_t)
+        || header.kind != kind
+        || header.reserved != 0
+        || header.payload_len != len - sizeof(header)
+        || header.payload_len % 8 != 0) {
+        return (REG_BADPAT);
+    }
+
+    r->data = (const unsigned char *) blob + sizeof(header);
+    r->len = header.payload_len;
+    r->pos = 0;
+    r->failed = false;
+
+    if (checksum(r->data, r->len) != header.checksum) {
+        return (REG_BADPAT);
+    }
+    return (REG_OK);
+}
+
+// Prepends the header to the written payload and hands it to the caller.
+static int
+close_blob(blob_writer *w, uint32_t kind, void **blob, size_t *len)
+{
+    if (w->failed) {
+        free(w->data);
+        return (REG_ESPACE);
+    }
+
+    unsigned char *data = malloc(sizeof(blob_header) + w->len);
+    if (data == NULL) {
+        free(w->data);
+        return (REG_ESPACE);
+    }
+
+    blob_header header;
+    memcpy(header.magic, BLOB_MAGIC, 8);
+    header.version = BLOB_VERSION;
+    header.byte_order = BLOB_BYTE_ORDER;
+    header.size_size = sizeof(size_t);
+    header.wchar_size = sizeof(wchar_t);
+    header.kind = kind;
+    header.reserved = 0;
+    header.payload_len = w->len;
+    header.checksum = checksum(w->data, w->len);
+
+    memcpy(data, &header, sizeof(header));
+    if (w->len != 0) {
+        memcpy(data + sizeof(header), w->data, w->len);
+    }
+    free(w->data);
+
+    *blob = data;
+    *len = sizeof(header) + w->len;
+    return (REG_OK);
+}
+
+int
+frec_serialize(const frec_t *preg, void **blob, size_t *len)
+{
+    blob_writer w = {NULL, 0, 0, false};
+    write_frec(&w, preg);
+    return close_blob(&w, BLOB_SINGLE, blob, len);
+}
+
+int
+frec_deserialize(frec_t *preg, const void *blob, size_t len)
+{
+    blob_reader r;
+    int ret = open_blob(&r, blob, len, BLOB_SINGLE);
+    if (ret != REG_OK) {
+        return ret;
+    }
+
+    ret = read_frec(&r, preg);
+    if (ret == REG_OK && (r.pos != r.len || preg->is_removed)) {
+        frec_regfree(preg);
+        return (REG_BADPAT);
+    }
+    return ret;
+}
+
+int
+frec_mserialize(const mfrec_t *preg, void **blob, size_t *len)
+{
+    blob_writer w = {NULL, 0, 0, false};
+
+    uint64_t engine = ENGINE_NONE;
+    if (preg->teddy != NULL) {
+        engine = ENGINE_TEDDY;
+    } else if (preg->aho_corasick != NULL) {
+        engine = ENGINE_AC;
+    } else if (preg->wu_manber != NULL) {
+        engine = ENGINE_WM;
+    }
+
+    // Sets of wide patterns are compiled again when they are read, and so
+    // are the engines that don't match the patterns of the set one to one.
+    bool is_wide = preg->count > 0 && preg->patterns[0].source_wide;
+    bool edited = preg->removed > 0
+        || (preg->teddy != NULL && preg->teddy->edits > 0)
+        || (preg->aho_corasick != NULL && preg->aho_corasick->edits > 0)
+        || (preg->wu_manber != NULL && preg->wu_manber->edits > 0);
+    if (is_wide || edited) {
+        engine = ENGINE_REBUILD;
+    }
+
+    put_word(&w, preg->count);
+    put_word(&w, (uint64_t) preg->cflags);
+    put_word(&w, preg->are_literal);
+    put_word(&w, (uint64_t) preg->type);
+    put_word(&w, (uint64_t) preg->reach);
+    put_word(&w, preg->reach_lines);
+    put_word(&w, engine);
+
+    for (ssize_t i = 0; i < preg->count; i++) {
+        write_frec(&w, &preg->patterns[i]);
+    }
+
+    switch (engine) {
+        case ENGINE_TEDDY:
+            write_teddy(&w, preg->teddy);
+            break;
+        case ENGINE_AC:
+            write_ac(&w, preg->aho_corasick);
+            break;
+        case ENGINE_WM:
+            write_wm(&w, preg->wu_manber);
+            break;
+    }
+
+    // Followed by the patterns of the engine, ordered by their literal.
+    if (engine != ENGINE_NONE && engine != ENGINE_REBUILD) {
+        put_word(&w, preg->literal_ties);
+        put_array(&w, preg->by_literal, sizeof(uint32_t) * preg->count);
+    }
+
+    return close_blob(&w, BLOB_MULTI, blob, len);
+}
+
+int
+frec_mdeserialize(mfrec_t *preg, const void *blob, size_t len)
+{
+    blob_reader r;
+    int ret = open_blob(&r, blob, len, BLOB_MULTI);
+    if (ret != REG_OK) {
+        return ret;
+    }
+
+    // Every pattern record takes at least one word.
+    ssize_t count = (ssize_t) get_word(&r);
+    int cflags = (int) get_word(&r);
+    bool are_literal = get_word(&r);
+    int type = (int) get_word(&r);
+    ssize_t reach = (ssize_t) get_word(&r);
+    bool reach_lines = get_word(&r);
+    uint64_t engine = get_word(&r);
+    if (r.failed || count <= 0 || (size_t) count > r.len / 8) {
+        return (REG_BADPAT);
+    }
+
+    preg->wu_manber = NULL;
+    preg->aho_corasick = NULL;
+    preg->teddy = NULL;
+    preg->ids = NULL;
+    preg->by_literal = NULL;
+    preg->literal_ties = false;
+    preg->patterns = malloc(sizeof(frec_t) * count);
+    if (preg->patterns == NULL) {
+        return (REG_ESPACE);
+    }
+
+    preg->count = count;
+    preg->cflags = cflags;
+    preg->are_literal = are_literal;
+    preg->type = type;
+    preg->reach = reach;
+    preg->reach_lines = reach_lines;
+    preg->err = -1;
+    preg->removed = 0;
+    preg->capacity = count;
+
+    for (ssize_t i = 0; i < count; i++) {
+        ret = read_frec(&r, &preg->patterns[i]);
+        if (ret != REG_OK) {
+            preg->err = i;
+            frec_mregfree(preg);
+            return ret;
+        }
+        if (preg->patterns[i].is_removed) {
+            preg->removed++;
+        }
+    }
+
+    switch (engine) {
+        case ENGINE_NONE:
+            break;
+        case ENGINE_TEDDY:
+            preg->teddy = malloc(sizeof(teddy_comp));
+            if (preg->teddy != NULL) {
+                read_teddy(&r, preg->teddy);
+            }
+            break;
+        case ENGINE_AC:
+            preg->aho_corasick = malloc(sizeof(ac_comp));
+            if (preg->aho_corasick != NULL) {
+                read_ac(&r, preg->aho_corasick);
+            }
+            break;
+        case ENGINE_WM:
+            preg->wu_manber = malloc(sizeof(wm_comp));
+            if (preg->wu_manber != NULL) {
+                read_wm(&r, preg->wu_manber);
+            }
+            break;
+        case ENGINE_REBUILD:
+            if (!r.failed && r.pos == r.len) {
+                ret = frec_mcompile_engine(preg);
+                if (ret != REG_OK) {
+                    frec_mregfree(preg);
+                    return ret;
+                }
+            }
+            break;
+        default:
+            r.failed = true;
+            break;
+    }
+
+    if (engine != ENGINE_NONE && engine != ENGINE_REBUILD && preg->teddy == NULL
+        && preg->aho_corasick == NULL && preg->wu_manber == NULL) {
+        frec_mregfree(preg);
+        return (REG_ESPACE);
+    }
+
+    // The order is copied, as adding patterns changes it.
+    if (engine != ENGINE_NONE && engine != ENGINE_REBUILD) {
+        preg->literal_ties = get_word(&r);
+        const uint32_t *by_literal = (const uint32_t *)
+            get_array(&r, sizeof(uint32_t) * count);
+        preg->by_literal = malloc(sizeof(uint32_t) * count);
+        if (preg->by_literal == NULL) {
+            frec_mregfree(preg);
+            return (REG_ESPACE);
+        }
+        for (ssize_t i = 0; i < count && by_literal != NULL; i++) {
+            if (by_literal[i] >= (uint32_t) count) {
+                r.failed = true;
+            }
+            preg->by_literal[i] = by_literal[i];
+        }
+    }
+
+    // The stored engines report matches by the index of the pattern.
+    bool stored = engine != ENGINE_REBUILD;
+    if (stored && (preg->removed > 0
+        || (preg->teddy != NULL && preg->teddy->count != count)
+        || (preg->aho_corasick != NULL && preg->aho_corasick->count != count)
+        || (preg->wu_manber != NULL && preg->wu_manber->count != count))) {
+        r.failed = true;
+    }
+    if (r.failed || r.pos != r.len) {
+        frec_mregfree(preg);
+        return (REG_BADPAT);
+    }
+    return (REG_OK);
+}
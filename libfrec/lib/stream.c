@@ -0,0 +1,355 @@
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "frec-internal.h"
+#include "match.h"
+#include "string-type.h"
+
+// How much text has to be kept between the chunks of a stream.
+#define STREAM_BOUNDED 0 // The length of the longest match is known.
+#define STREAM_LINES 1   // Matches never contain line feeds.
+#define STREAM_WHOLE 2   // Nothing is known, the whole stream is kept.
+
+// Data of one scan, passed to the match callback.
+typedef struct stream_scan {
+    frec_stream_t *stream;
+    ssize_t limit; // Matches can only be reported if they start before this.
+} stream_scan;
+
+// Returns the stream mode of a single pattern, and sets max_length if the
+// length of its matches is bounded.
+static int
+pattern_mode(const frec_t *preg, ssize_t *max_length)
+{
+    const bm_comp *bm = preg->boyer_moore;
+    const heur *hr = preg->heuristic;
+
+    if (bm != NULL) {
+        *max_length = bm->pattern.len;
+        return (STREAM_BOUNDED);
+    } else if (hr != NULL && hr->max_length != -1) {
+        *max_length = hr->max_length;
+        return (STREAM_BOUNDED);
+    }
+
+    // Unbounded longest heuristics are only used if no match can contain
+    // a line feed (see build_heuristic).
+    if ((hr != NULL && hr->heur_type == HEUR_LONGEST)
+        || (preg->cflags & REG_NEWLINE)) {
+        return (STREAM_LINES);
+    }
+    return (STREAM_WHOLE);
+}
+
+static void
+stream_init(
+    frec_stream_t *stream, const frec_t *single, const mfrec_t *multi,
+    int eflags, frec_match_cb cb, void *arg
+) {
+    stream->single = single;
+    stream->multi = multi;
+    stream->cb = cb;
+    stream->arg = arg;
+    stream->eflags = eflags & ~REG_STARTEND;
+
+    stream->carry = NULL;
+    stream->carry_len = 0;
+    stream->carry_cap = 0;
+    stream->carry_base = 0;
+    stream->carry_bol = true;
+    stream->length = 0;
+    stream->ends_lf = true;
+    stream->resume = 0;
+    stream->found = false;
+    stream->stopped = false;
+
+    // The most restrictive mode of the patterns is used.
+    stream->mode = STREAM_BOUNDED;
+    stream->max_length = 0;
+
+    ssize_t count = (single != NULL) ? 1 : multi->count;
+    for (ssize_t i = 0; i < count; i++) {
+        const frec_t *curr = (single != NULL) ? single : &multi->patterns[i];
+        if (curr->is_removed) {
+            continue;
+        }
+
+        ssize_t len = 0;
+        int mode = pattern_mode(curr, &len);
+        if (mode > stream->mode) {
+            stream->mode = mode;
+        }
+        if (len > stream->max_length) {
+            stream->max_length = len;
+        }
+    }
+}
+
+// Reports the matches that start before the limit of the scan.
+static int
+report_match(const frec_match_t *pmatch, size_t nmatch, void *arg)
+{
+    stream_scan *scan = arg;
+    frec_stream_t *stream = scan->stream;
+
+    int cflags = (stream->single != NULL)
+        ? stream->single->cflags
+        : stream->multi->cflags;
+
+    // Without submatches, the offsets are unknown, but any match in the
+    // text seen so far is a match in the whole stream.
+    if (cflags & REG_NOSUB) {
+        stream->found = true;
+        stream->stopped = true;
+        stream->cb(pmatch, nmatch, stream->arg);
+        return 1;
+    }
+
+    // The match may still be extended by the next chunk.
+    if (pmatch[0].soffset >= scan->limit) {
+        return 1;
+    }
+
+    stream->found = true;
+    stream->resume = (pmatch[0].eoffset > pmatch[0].soffset)
+        ? pmatch[0].eoffset
+        : pmatch[0].eoffset + 1;
+
+    if (stream->cb(pmatch, nmatch, stream->arg) != 0) {
+        stream->stopped = true;
+        return 1;
+    }
+    return 0;
+}
+
+// Searches the buffer, holding the stream from base to base + len, for
+// matches starting from the resume position. The byte before the buffer
+// was a line feed if bol is set. If final is not set, only the matches
+// that can't be changed by the rest of the stream are reported.
+static int
+scan_buffer(
+    frec_stream_t *stream, const char *buf, ssize_t base, ssize_t len,
+    bool bol, bool final
+) {
+    ssize_t limit = base + len;
+    if (!final) {
+        if (stream->mode == STREAM_BOUNDED) {
+            // One more byte is needed to know whether a $ can match.
+            limit = base + len - stream->max_length - 1;
+        } else if (stream->mode == STREAM_LINES) {
+            limit = base;
+            for (ssize_t i = len - 1; i >= 0; i--) {
+                if (buf[i] == '\n') {
+                    limit = base + i + 1;
+                    break;
+                }
+            }
+
+            // The bounded patterns of a set may match across line feeds.
+            if (stream->max_length > 0
+                && limit > base + len - stream->max_length - 1) {
+                limit = base + len - stream->max_length - 1;
+            }
+        } else {
+            limit = base;
+        }
+    }
+
+    if (stream->resume < base) {
+        stream->resume = base;
+    }
+
+    ssize_t start = stream->resume - base;
+    if (stream->stopped || start > len || (!final && stream->resume >= limit)) {
+        return (REG_OK);
+    }
+
+    // The text continues after the buffer, its end is not the end of a line.
+    int cflags = (stream->single != NULL)
+        ? stream->single->cflags
+        : stream->multi->cflags;
+    int eflags = stream->eflags | (final ? 0 : REG_NOTEOL);
+
+    bool at_bol = (start == 0) ? bol : buf[start - 1] == '\n';
+    if (stream->resume > 0 && !((cflags & REG_NEWLINE) && at_bol)) {
+        eflags |= REG_NOTBOL;
+    }
+
+    string text;
+    string_borrow(&text, buf + start, len - start, false);
+
+    stream_scan scan = { stream, final ? (base + len + 1) : limit };
+    frec_match_t match;
+
+    int ret = (stream->single != NULL)
+        ? frec_match_all(&match, 1, stream->single, text, stream->resume,
+            eflags, report_match, &scan)
+        : frec_mmatch_all(&match, 1, stream->multi, text, stream->resume,
+            eflags, report_match, &scan);
+
+    if (ret != REG_OK && ret != REG_NOMATCH) {
+        return ret;
+    }
+
+    // No other match can start before the limit.
+    if (!stream->stopped && stream->resume < limit) {
+        stream->resume = limit;
+    }
+    return (REG_OK);
+}
+
+// Appends the given text to the carry buffer of the stream.
+static int
+append_carry(frec_stream_t *stream, const char *text, ssize_t len)
+{
+    if (len == 0) {
+        return (REG_OK);
+    }
+
+    if (stream->carry_len + len > stream->carry_cap) {
+        ssize_t cap = (stream->carry_cap == 0) ? 256 : stream->carry_cap;
+        while (cap < stream->carry_len + len) {
+            cap *= 2;
+        }
+
+        char *carry = realloc(stream->carry, cap);
+        if (carry == NULL) {
+            return (REG_ESPACE);
+        }
+        stream->carry = carry;
+        stream->carry_cap = cap;
+    }
+
+    memcpy(stream->carry + stream->carry_len, text, len);
+    stream->carry_len += len;
+    return (REG_OK);
+}
+
+// Keeps the part of the buffer (holding the stream from base) after the
+// resume position in the carry buffer. The buffer may be the carry itself.
+static int
+keep_rest(
+    frec_stream_t *stream, const char *buf, ssize_t base, ssize_t len,
+    bool bol
+) {
+    ssize_t from = stream->resume - base;
+    if (from > len) {
+        from = len;
+    }
+
+    bool carry_bol = (from == 0) ? bol : buf[from - 1] == '\n';
+
+    if (buf == stream->carry) {
+        memmove(stream->carry, stream->carry + from, len - from);
+        stream->carry_len = len - from;
+    } else {
+        stream->carry_len = 0;
+        int ret = append_carry(stream, buf + from, len - from);
+        if (ret != REG_OK) {
+            return ret;
+        }
+    }
+
+    stream->carry_base = base + from;
+    stream->carry_bol = carry_bol;
+    return (REG_OK);
+}
+
+int
+frec_stream_open(
+    frec_stream_t *stream, const frec_t *preg, int eflags,
+    frec_match_cb cb, void *arg
+) {
+    stream_init(stream, preg, NULL, eflags, cb, arg);
+    return (REG_OK);
+}
+
+int
+frec_mstream_open(
+    frec_stream_t *stream, const mfrec_t *preg, int eflags,
+    frec_match_cb cb, void *arg
+) {
+    stream_init(stream, NULL, preg, eflags, cb, arg);
+    return (REG_OK);
+}
+
+int
+frec_stream_feed(frec_stream_t *stream, const char *chunk, size_t len)
+{
+    if (stream->stopped || len == 0) {
+        return (REG_OK);
+    }
+
+    ssize_t chunk_base = stream->length;
+    ssize_t chunk_len = (ssize_t) len;
+    bool chunk_bol = stream->ends_lf;
+
+    stream->length += chunk_len;
+    stream->ends_lf = chunk[chunk_len - 1] == '\n';
+
+    int ret;
+
+    // Matches starting in the kept text are searched for in a window that
+    // also holds as much of the chunk as they may need.
+    if (stream->carry_len > 0 || stream->mode == STREAM_WHOLE) {
+        ssize_t head = chunk_len;
+        if (stream->mode == STREAM_BOUNDED) {
+            head = stream->max_length + 1;
+        } else if (stream->mode == STREAM_LINES) {
+            const char *lf = memchr(chunk, '\n', chunk_len);
+            head = (lf == NULL) ? chunk_len : (lf - chunk) + 1;
+            if (head < stream->max_length + 1) {
+                head = stream->max_length + 1;
+            }
+        }
+        if (head > chunk_len) {
+            head = chunk_len;
+        }
+
+        ret = append_carry(stream, chunk, head);
+        if (ret != REG_OK) {
+            return ret;
+        }
+
+        ret = scan_buffer(stream, stream->carry, stream->carry_base,
+            stream->carry_len, stream->carry_bol, false);
+        if (ret != REG_OK) {
+            return ret;
+        }
+
+        // If the window held the whole chunk, only the kept text remains.
+        if (head == chunk_len) {
+            return keep_rest(stream, stream->carry, stream->carry_base,
+                stream->carry_len, stream->carry_bol);
+        }
+
+        // Otherwise, every match starting in the kept text was found.
+        stream->carry_len = 0;
+    }
+
+    // The rest of the chunk is searched in place.
+    ret = scan_buffer(stream, chunk, chunk_base, chunk_len, chunk_bol, false);
+    if (ret != REG_OK) {
+        return ret;
+    }
+
+    return keep_rest(stream, chunk, chunk_base, chunk_len, chunk_bol);
+}
+
+int
+frec_stream_close(frec_stream_t *stream)
+{
+    int ret = scan_buffer(stream, stream->carry, stream->carry_base,
+        stream->carry_len, stream->carry_bol, true);
+
+    free(stream->carry);
+    stream->carry = NULL;
+    stream->carry_len = 0;
+    stream->carry_cap = 0;
+
+    if (ret != REG_OK) {
+        return ret;
+    }
+    return (stream->found) ? (REG_OK) : (REG_NOMATCH);
+}
@@ -0,0 +1,591 @@
+#include <frec-config.h>
+#include <ctype.h>
+#include <string.h>
+#include "teddy-comp.h"
+#include "teddy-type.h"
+
+// SSSE3 and AVX2 are selected at runtime, the scalar version is used on
+// other machines and for the end of the text.
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+    #include <immintrin.h>
+    #define TEDDY_HAVE_SSSE3 1
+    #define TEDDY_HAVE_AVX2 1
+#endif
+
+// Sets with at most this many patterns use only eight buckets, which
+// makes the vectorized lookups cheaper.
+#define TEDDY_SLIM_MAX_PATTERNS 16
+
+// Utility functions.
+static ssize_t min(ssize_t a, ssize_t b) { return (a < b) ? a : b; }
+
+// Returns the character of the pattern at the given position, converted
+// to lower case in case insensitive mode.
+static inline unsigned char
+pattern_char_at(const teddy_comp *comp, ssize_t id, ssize_t at)
+{
+    unsigned char c = (unsigned char) comp->patterns[id].stnd[at];
+    return comp->is_icase_set ? (unsigned char) tolower(c) : c;
+}
+
+// Compares the fingerprints of two patterns, for sorting.
+static int
+compare_fingerprints(const teddy_comp *comp, ssize_t a, ssize_t b)
+{
+    for (ssize_t k = 0; k < comp->fp_len; k++) {
+        int diff = pattern_char_at(comp, a, k) - pattern_char_at(comp, b, k);
+        if (diff != 0) {
+            return diff;
+        }
+    }
+    return 0;
+}
+
+// Sets the bit of the given bucket in the masks of character c at
+// fingerprint position k.
+static void
+add_to_masks(teddy_comp *comp, ssize_t k, unsigned char c, int bucket)
+{
+    int half = (bucket / 8) * 16;
+    comp->lo_masks[k][half + (c & 0x0f)] |= (unsigned char) (1 << (bucket % 8));
+    comp->hi_masks[k][half + (c >> 4)] |= (unsigned char) (1 << (bucket % 8));
+}
+
+// Divides the patterns into the buckets. Patterns with similar
+// fingerprints are put into the same bucket, so that they don't set
+// more bits in the masks than needed.
+static void
+fill_buckets(teddy_comp *comp)
+{
+    ssize_t count = comp->count;
+    uint8_t order[TEDDY_MAX_PATTERNS];
+
+    // Sort the ids by their fingerprints with insertion sort.
+    for (ssize_t i = 0; i < count; i++) {
+        ssize_t at = i;
+        while (at > 0 && compare_fingerprints(comp, order[at - 1], i) > 0) {
+            order[at] = order[at - 1];
+            at--;
+        }
+        order[at] = (uint8_t) i;
+    }
+
+    // Split this order evenly, and sort each bucket by id.
+    int buckets = comp->bucket_count;
+    ssize_t per_bucket = (count + buckets - 1) / buckets;
+    for (int b = 0; b <= buckets; b++) {
+        comp->bucket_start[b] = (uint8_t) min(b * per_bucket, count);
+    }
+
+    for (int b = 0; b < buckets; b++) {
+        ssize_t start = comp->bucket_start[b];
+        ssize_t end = comp->bucket_start[b + 1];
+
+        for (ssize_t i = start; i < end; i++) {
+            uint8_t id = order[i];
+            ssize_t at = i;
+            while (at > start && comp->bucket_ids[at - 1] > id) {
+                comp->bucket_ids[at] = comp->bucket_ids[at - 1];
+                at--;
+            }
+            comp->bucket_ids[at] = id;
+        }
+    }
+}
+
+// Fills the prefix of the pattern with the given id, in the byte order of
+// the machine.
+static void
+fill_prefix(teddy_comp *comp, ssize_t id)
+{
+    unsigned char prefix[4] = {0};
+    unsigned char mask[4] = {0};
+
+    for (ssize_t k = 0; k < min(comp->patterns[id].len, 4); k++) {
+        prefix[k] = pattern_char_at(comp, id, k);
+        mask[k] = 0xff;
+    }
+
+    memcpy(&comp->prefixes[id], prefix, 4);
+    memcpy(&comp->prefix_masks[id], mask, 4);
+}
+
+// Sets the bits of the fingerprint of the pattern with the given id in
+// the masks of its bucket.
+static void
+fill_pattern_masks(teddy_comp *comp, ssize_t id, int bucket)
+{
+    for (ssize_t k = 0; k < comp->fp_len; k++) {
+        unsigned char c = pattern_char_at(comp, id, k);
+        add_to_masks(comp, k, c, bucket);
+        if (comp->is_icase_set) {
+            add_to_masks(comp, k, (unsigned char) toupper(c), bucket);
+        }
+    }
+}
+
+// Fills the nibble masks based on the buckets. Positions after the end of
+// the fingerprint allow every bucket, so that the vectorized scanners can
+// always test three positions.
+static void
+fill_masks(teddy_comp *comp)
+{
+    for (int b = 0; b < comp->bucket_count; b++) {
+        for (ssize_t i = comp->bucket_start[b]; i < comp->bucket_start[b + 1]; i++) {
+            fill_pattern_masks(comp, comp->bucket_ids[i], b);
+        }
+    }
+
+    for (ssize_t k = comp->fp_len; k < TEDDY_MAX_FINGERPRINT; k++) {
+        memset(comp->lo_masks[k], 0xff, 32);
+        memset(comp->hi_masks[k], 0xff, 32);
+    }
+}
+
+int
+teddy_compile(teddy_comp *comp, const string *patterns, ssize_t count,
+    int cflags)
+{
+    teddy_comp_init(comp, cflags);
+
+    if (count <= 0 || count > TEDDY_MAX_PATTERNS) {
+        return (REG_BADPAT);
+    }
+
+    // The case insensitive comparisons only work if MB_CUR_MAX == 1.
+    if (comp->is_icase_set && MB_CUR_MAX > 1) {
+        return (REG_BADPAT);
+    }
+
+    comp->count = count;
+    comp->len_shortest = patterns[0].len;
+
+    // Copy patterns to compilation struct. Wide and empty patterns are
+    // rejected, the same way as by the other multi-pattern engines.
+    for (ssize_t i = 0; i < count; i++) {
+        if (patterns[i].is_wide || patterns[i].len == 0) {
+            return (REG_BADPAT);
+        }
+
+        bool success = string_duplicate(&comp->patterns[i], patterns[i]);
+        if (!success) {
+            return (REG_ESPACE);
+        }
+
+        comp->len_shortest = min(comp->len_shortest, patterns[i].len);
+    }
+
+    comp->fp_len = min(comp->len_shortest, TEDDY_MAX_FINGERPRINT);
+    comp->bucket_count = (count > TEDDY_SLIM_MAX_PATTERNS)
+        ? TEDDY_BUCKETS
+        : TEDDY_SLIM_BUCKETS;
+    for (ssize_t i = 0; i < count; i++) {
+        fill_prefix(comp, i);
+    }
+
+    fill_buckets(comp);
+    fill_masks(comp);
+
+    return (REG_OK);
+}
+
+// Returns the number of bits that would be set in the masks of the given
+// bucket, if the pattern with the given id was put into it.
+static int
+count_new_bits(const teddy_comp *comp, ssize_t id, int bucket)
+{
+    int half = (bucket / 8) * 16;
+    unsigned char bit = (unsigned char) (1 << (bucket % 8));
+
+    int bits = 0;
+    for (ssize_t k = 0; k < comp->fp_len; k++) {
+        unsigned char c = pattern_char_at(comp, id, k);
+        bits += !(comp->lo_masks[k][half + (c & 0x0f)] & bit);
+        bits += !(comp->hi_masks[k][half + (c >> 4)] & bit);
+    }
+    return bits;
+}
+
+int
+teddy_add(teddy_comp *comp, string pattern)
+{
+    if (comp->count >= TEDDY_MAX_PATTERNS || pattern.is_wide
+        || pattern.len == 0 || pattern.len < comp->fp_len) {
+        return (REG_BADPAT);
+    }
+
+    ssize_t id = comp->count;
+    if (!string_duplicate(&comp->patterns[id], pattern)) {
+        return (REG_ESPACE);
+    }
+    fill_prefix(comp, id);
+
+    // Select the bucket that the pattern changes the least, and the
+    // smaller one of these.
+    int best = 0;
+    int best_bits = -1;
+    for (int b = 0; b < comp->bucket_count; b++) {
+        int bits = count_new_bits(comp, id, b);
+        if (best_bits == -1 || bits < best_bits || (bits == best_bits
+            && comp->bucket_start[b + 1] - comp->bucket_start[b]
+                < comp->bucket_start[best + 1] - comp->bucket_start[best])) {
+            best = b;
+            best_bits = bits;
+        }
+    }
+
+    // The id is the largest one, so it goes to the end of the bucket.
+    ssize_t end = comp->bucket_start[best + 1];
+    ssize_t total = comp->bucket_start[comp->bucket_count];
+    memmove(&comp->bucket_ids[end + 1], &comp->bucket_ids[end], total - end);
+    comp->bucket_ids[end] = (uint8_t) id;
+    for (int b = best + 1; b <= comp->bucket_count; b++) {
+        comp->bucket_start[b]++;
+    }
+    fill_pattern_masks(comp, id, best);
+
+    comp->len_shortest = min(comp->len_shortest, pattern.len);
+    comp->count++;
+    comp->edits++;
+    return (REG_OK);
+}
+
+int
+teddy_remove(teddy_comp *comp, ssize_t id)
+{
+    if (id < 0 || id >= comp->count) {
+        return (REG_BADPAT);
+    }
+
+    for (int b = 0; b < comp->bucket_count; b++) {
+        for (ssize_t i = comp->bucket_start[b]; i < comp->bucket_start[b + 1]; i++) {
+            if (comp->bucket_ids[i] != id) {
+                continue;
+            }
+
+            ssize_t total = comp->bucket_start[comp->bucket_count];
+            memmove(&comp->bucket_ids[i], &comp->bucket_ids[i + 1],
+                total - i - 1);
+            for (int next = b + 1; next <= comp->bucket_count; next++) {
+                comp->bucket_start[next]--;
+            }
+            comp->edits++;
+            return (REG_OK);
+        }
+    }
+
+    // The pattern was already removed.
+    return (REG_BADPAT);
+}
+
+bool
+teddy_needs_rebuild(const teddy_comp *comp)
+{
+    // Removed patterns leave their bits in the masks, and larger sets
+    // would use all the buckets.
+    ssize_t removed = comp->count - comp->bucket_start[comp->bucket_count];
+    return removed > comp->count / 2
+        || (comp->bucket_count == TEDDY_SLIM_BUCKETS
+            && comp->count > TEDDY_SLIM_MAX_PATTERNS);
+}
+
+// Returns whether the pattern with the given id matches at position pos.
+static inline bool
+verify_pattern(const teddy_comp *comp, ssize_t id, string text, ssize_t pos)
+{
+    const string *patt = &comp->patterns[id];
+    if (pos > text.len - patt->len) {
+        return false;
+    }
+
+    if (!comp->is_icase_set) {
+        return memcmp(patt->stnd, &text.stnd[pos], patt->len) == 0;
+    }
+
+    for (ssize_t i = 0; i < patt->len; i++) {
+        if (tolower((unsigned char) patt->stnd[i])
+            != tolower((unsigned char) text.stnd[pos + i])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Returns the first four characters of the text at position pos, or less
+// at the end of the text, in lower case with REG_ICASE.
+static inline uint32_t
+text_prefix_at(const teddy_comp *comp, string text, ssize_t pos)
+{
+    unsigned char prefix[4] = {0};
+    ssize_t len = min(text.len - pos, 4);
+
+    memcpy(prefix, &text.stnd[pos], len);
+    if (comp->is_icase_set) {
+        for (ssize_t k = 0; k < len; k++) {
+            prefix[k] = (unsigned char) tolower(prefix[k]);
+        }
+    }
+
+    uint32_t value;
+    memcpy(&value, prefix, 4);
+    return value;
+}
+
+// Verifies the patterns of every bucket set in bits at position pos.
+// Returns the lowest id of the matching patterns, or -1.
+static inline ssize_t
+verify_buckets(const teddy_comp *comp, string text, ssize_t pos,
+    unsigned int bits)
+{
+    ssize_t found = -1;
+    uint32_t prefix = text_prefix_at(comp, text, pos);
+
+    while (bits != 0) {
+        int b = __builtin_ctz(bits);
+        bits &= bits - 1;
+
+        // The ids of a bucket are in increasing order, so the first match
+        // is the best one of the bucket.
+        for (ssize_t i = comp->bucket_start[b]; i < comp->bucket_start[b + 1]; i++) {
+            ssize_t id = comp->bucket_ids[i];
+            if (found != -1 && id > found) {
+                break;
+            }
+            if ((prefix & comp->prefix_masks[id]) != comp->prefixes[id]) {
+                continue;
+            }
+            if (verify_pattern(comp, id, text, pos)) {
+                found = id;
+                break;
+            }
+        }
+    }
+
+    return found;
+}
+
+// Scalar version of the scanner, testing one position per step, starting
+// from pos. Returns the first matching position, and sets the pattern id.
+static ssize_t
+scan_scalar(const teddy_comp *comp, string text, ssize_t pos, ssize_t *id)
+{
+    const unsigned char *chars = (const unsigned char *) text.stnd;
+
+    for (ssize_t i = pos; i + comp->fp_len <= text.len; i++) {
+        unsigned int bits = 0xffff;
+        for (ssize_t k = 0; k < comp->fp_len && bits != 0; k++) {
+            unsigned char lo = chars[i + k] & 0x0f;
+            unsigned char hi = chars[i + k] >> 4;
+            bits &= (comp->lo_masks[k][lo] & comp->hi_masks[k][hi])
+                | (comp->lo_masks[k][16 + lo] & comp->hi_masks[k][16 + hi]) << 8;
+        }
+
+        if (bits != 0) {
+            *id = verify_buckets(comp, text, i, bits);
+            if (*id >= 0) {
+                return i;
+            }
+        }
+    }
+
+    return -1;
+}
+
+// Verifies the candidates of a vectorized block starting at position pos.
+// Bit j of mask is set if position pos + j has any bucket bits, which are
+// in bits[j], and in bits[j + stride] for buckets 8 to 15.
+static inline ssize_t
+verify_block(const teddy_comp *comp, string text, ssize_t pos,
+    unsigned int mask, const unsigned char *bits, int stride, ssize_t *id)
+{
+    while (mask != 0) {
+        int j = __builtin_ctz(mask);
+        unsigned int buckets = bits[j] | (unsigned int) bits[j + stride] << 8;
+
+        *id = verify_buckets(comp, text, pos + j, buckets);
+        if (*id >= 0) {
+            return pos + j;
+        }
+        mask &= mask - 1;
+    }
+
+    return -1;
+}
+
+#ifdef TEDDY_HAVE_SSSE3
+// Looks up the bucket bits of 16 positions starting at the given text
+// pointer, from the three masks starting at lo and hi.
+__attribute__((target("ssse3")))
+static inline __m128i
+lookup_ssse3(const __m128i *lo, const __m128i *hi, const char *text)
+{
+    const __m128i nibble = _mm_set1_epi8(0x0f);
+    __m128i res = _mm_set1_epi8((char) 0xff);
+
+    for (int k = 0; k < TEDDY_MAX_FINGERPRINT; k++) {
+        __m128i v = _mm_loadu_si128((const __m128i *) &text[k]);
+        __m128i v_lo = _mm_and_si128(v, nibble);
+        __m128i v_hi = _mm_and_si128(_mm_srli_epi16(v, 4), nibble);
+        res = _mm_and_si128(res, _mm_and_si128(
+            _mm_shuffle_epi8(lo[k], v_lo), _mm_shuffle_epi8(hi[k], v_hi)));
+    }
+
+    return res;
+}
+
+// SSSE3 version of the scanner. Looks up the buckets of 16 positions per
+// step, for all three fingerprint characters, and both halves of the masks
+// if every bucket is used. Only advances *pos while a whole block can be
+// loaded, the remainder is left for the scalar one.
+__attribute__((target("ssse3")))
+static ssize_t
+scan_ssse3(const teddy_comp *comp, string text, ssize_t *pos, ssize_t *id)
+{
+    bool fat = comp->bucket_count > TEDDY_SLIM_BUCKETS;
+    __m128i lo[2 * TEDDY_MAX_FINGERPRINT];
+    __m128i hi[2 * TEDDY_MAX_FINGERPRINT];
+    for (int k = 0; k < TEDDY_MAX_FINGERPRINT; k++) {
+        for (int half = 0; half < 2; half++) {
+            int at = half * TEDDY_MAX_FINGERPRINT + k;
+            lo[at] = _mm_loadu_si128((const __m128i *) &comp->lo_masks[k][half * 16]);
+            hi[at] = _mm_loadu_si128((const __m128i *) &comp->hi_masks[k][half * 16]);
+        }
+    }
+
+    const __m128i zero = _mm_setzero_si128();
+    ssize_t i = *pos;
+    for (; i + 16 + TEDDY_MAX_FINGERPRINT - 1 <= text.len; i += 16) {
+        __m128i res = lookup_ssse3(lo, hi, &text.stnd[i]);
+        __m128i res_fat = fat
+            ? lookup_ssse3(&lo[TEDDY_MAX_FINGERPRINT],
+                &hi[TEDDY_MAX_FINGERPRINT], &text.stnd[i])
+            : zero;
+
+        unsigned int mask = ~_mm_movemask_epi8(_mm_cmpeq_epi8(
+            _mm_or_si128(res, res_fat), zero)) & 0xffff;
+        if (mask == 0) {
+            continue;
+        }
+
+        unsigned char bits[32];
+        _mm_storeu_si128((__m128i *) bits, res);
+        _mm_storeu_si128((__m128i *) &bits[16], res_fat);
+
+        ssize_t found = verify_block(comp, text, i, mask, bits, 16, id);
+        if (found >= 0) {
+            *pos = found;
+            return found;
+        }
+    }
+
+    *pos = i;
+    return -1;
+}
+#endif
+
+#ifdef TEDDY_HAVE_AVX2
+// AVX2 version of the scanner. If only eight buckets are used, 32 positions
+// are tested per step. Otherwise 16 positions are loaded into both lanes,
+// and each lane is tested against one half of the masks.
+// See scan_ssse3 for more information.
+__attribute__((target("avx2")))
+static ssize_t
+scan_avx2(const teddy_comp *comp, string text, ssize_t *pos, ssize_t *id)
+{
+    bool fat = comp->bucket_count > TEDDY_SLIM_BUCKETS;
+    const __m256i nibble = _mm256_set1_epi8(0x0f);
+    const __m256i zero = _mm256_setzero_si256();
+
+    __m256i lo[TEDDY_MAX_FINGERPRINT];
+    __m256i hi[TEDDY_MAX_FINGERPRINT];
+    for (int k = 0; k < TEDDY_MAX_FINGERPRINT; k++) {
+        if (fat) {
+            lo[k] = _mm256_loadu_si256((const __m256i *) comp->lo_masks[k]);
+            hi[k] = _mm256_loadu_si256((const __m256i *) comp->hi_masks[k]);
+        } else {
+            lo[k] = _mm256_broadcastsi128_si256(
+                _mm_loadu_si128((const __m128i *) comp->lo_masks[k]));
+            hi[k] = _mm256_broadcastsi128_si256(
+                _mm_loadu_si128((const __m128i *) comp->hi_masks[k]));
+        }
+    }
+
+    int step = fat ? 16 : 32;
+    ssize_t i = *pos;
+    for (; i + step + TEDDY_MAX_FINGERPRINT - 1 <= text.len; i += step) {
+        __m256i res = _mm256_set1_epi8((char) 0xff);
+        for (int k = 0; k < TEDDY_MAX_FINGERPRINT; k++) {
+            const char *at = &text.stnd[i + k];
+            __m256i v = fat
+                ? _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *) at))
+                : _mm256_loadu_si256((const __m256i *) at);
+            __m256i v_lo = _mm256_and_si256(v, nibble);
+            __m256i v_hi = _mm256_and_si256(_mm256_srli_epi16(v, 4), nibble);
+            res = _mm256_and_si256(res, _mm256_and_si256(
+                _mm256_shuffle_epi8(lo[k], v_lo),
+                _mm256_shuffle_epi8(hi[k], v_hi)));
+        }
+
+        unsigned int mask = ~(unsigned int) _mm256_movemask_epi8(
+            _mm256_cmpeq_epi8(res, zero));
+        if (mask == 0) {
+            continue;
+        }
+
+        unsigned char bits[64] = {0};
+        _mm256_storeu_si256((__m256i *) bits, res);
+
+        ssize_t found = fat
+            ? verify_block(comp, text, i, (mask | mask >> 16) & 0xffff,
+                bits, 16, id)
+            : verify_block(comp, text, i, mask, bits, 32, id);
+        if (found >= 0) {
+            *pos = found;
+            return found;
+        }
+    }
+
+    *pos = i;
+    return -1;
+}
+#endif
+
+int
+teddy_execute(frec_match_t *result, const teddy_comp *comp, string text,
+    int eflags)
+{
+    (void) eflags;
+
+    if (text.is_wide) {
+        return (REG_BADPAT);
+    }
+
+    ssize_t pos = 0;
+    ssize_t found = -1;
+    ssize_t id = -1;
+
+#ifdef TEDDY_HAVE_AVX2
+    if (__builtin_cpu_supports("avx2")) {
+        found = scan_avx2(comp, text, &pos, &id);
+    }
+#endif
+#ifdef TEDDY_HAVE_SSSE3
+    if (found < 0 && __builtin_cpu_supports("ssse3")) {
+        found = scan_ssse3(comp, text, &pos, &id);
+    }
+#endif
+    if (found < 0) {
+        found = scan_scalar(comp, text, pos, &id);
+    }
+
+    if (found < 0) {
+        return (REG_NOMATCH);
+    }
+
+    if (result != NULL) {
+        result->soffset = found;
+        result->eoffset = found + comp->patterns[id].len;
+        result->pattern_id = id;
+    }
+    return (REG_OK);
+}
@@ -0,0 +1,45 @@
+#ifndef FREC_TEDDY_COMP_H
+#define FREC_TEDDY_COMP_H
+
+#include <frec-match.h>
+#include "teddy-type.h"
+
+// Implements the Teddy algorithm for small sets of literal patterns.
+// The leading characters of each text position are tested against every
+// pattern at once with packed nibble lookups (16 or 32 positions at a
+// time), and only the buckets of patterns selected this way are verified.
+// Only standard character patterns are supported, at most
+// TEDDY_MAX_PATTERNS of them.
+//
+// Given a pattern array with count elements, and global compilation flags,
+// fills the given comp compilation struct.
+int
+teddy_compile(teddy_comp *comp, const string *patterns, ssize_t count,
+    int cflags);
+
+// Adds a pattern to the compiled set, with the next id. It is put into the
+// bucket whose masks change the least. Returns REG_BADPAT if the set is
+// full, or if the pattern is shorter than the fingerprints. These need to
+// be compiled again.
+int
+teddy_add(teddy_comp *comp, string pattern);
+
+// Removes the pattern with the given id from its bucket. Its bits stay in
+// the masks, which only makes the buckets match more positions.
+int
+teddy_remove(teddy_comp *comp, ssize_t id);
+
+// Returns whether the set was edited so much since it was compiled that
+// it should be compiled again.
+bool
+teddy_needs_rebuild(const teddy_comp *comp);
+
+// Finds the leftmost match in the given text. If multiple patterns match
+// at the same position, the one with the lowest id is reported. The literals
+// have no anchors, so eflags is unused, it is only taken to match the other
+// engines.
+int
+teddy_execute(frec_match_t *result, const teddy_comp *comp, string text,
+    int eflags);
+
+#endif //FREC_TEDDY_COMP_H
@@ -0,0 +1,33 @@
+#include <frec-config.h>
+#include <string.h>
+#include "teddy-type.h"
+
+void
+teddy_comp_init(teddy_comp *comp, int cflags)
+{
+    for (int i = 0; i < TEDDY_MAX_PATTERNS; i++) {
+        string_init(&comp->patterns[i]);
+    }
+    comp->count = 0;
+    comp->len_shortest = 0;
+    comp->fp_len = 0;
+    comp->bucket_count = TEDDY_SLIM_BUCKETS;
+
+    memset(comp->lo_masks, 0, sizeof(comp->lo_masks));
+    memset(comp->hi_masks, 0, sizeof(comp->hi_masks));
+    memset(comp->bucket_start, 0, sizeof(comp->bucket_start));
+    comp->edits = 0;
+
+    comp->is_icase_set = cflags & REG_ICASE;
+    comp->cflags = cflags;
+}
+
+void
+teddy_comp_free(teddy_comp *comp)
+{
+    if (comp != NULL) {
+        for (int i = 0; i < TEDDY_MAX_PATTERNS; i++) {
+            string_free(&comp->patterns[i]);
+        }
+    }
+}
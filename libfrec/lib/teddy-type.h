@@ -0,0 +1,58 @@
+#ifndef FREC_TEDDY_TYPE_H
+#define FREC_TEDDY_TYPE_H
+
+#include <stdint.h>
+#include <sys/types.h>
+#include "string-type.h"
+
+// Maximum number of patterns Teddy can handle.
+#define TEDDY_MAX_PATTERNS 64
+// Maximum number of buckets. Each bucket is one bit of the masks: the
+// first eight are in the first half of the masks, the rest in the second.
+// Larger sets use all 16 buckets, smaller ones only the first eight.
+#define TEDDY_BUCKETS 16
+#define TEDDY_SLIM_BUCKETS 8
+// Maximum number of leading pattern characters in the fingerprints.
+#define TEDDY_MAX_FINGERPRINT 3
+
+// Teddy compilation struct. The patterns are divided into buckets, and
+// each leading character position of the fingerprint has two masks:
+// bit b of lo_masks[k][n] (or lo_masks[k][16 + n] for buckets 8 to 15) is
+// set if a pattern in bucket b has a character with low nibble n at
+// position k, and the same for hi_masks and the high nibble. A text position can only start a match of bucket b if bit b is
+// set in the masks of every fingerprint character.
+typedef struct teddy_comp {
+    string patterns[TEDDY_MAX_PATTERNS]; // Pattern array.
+    uint32_t prefixes[TEDDY_MAX_PATTERNS]; // The first (at most) four
+                             // characters of each pattern, for quick
+                             // verification. Lower case with REG_ICASE.
+    uint32_t prefix_masks[TEDDY_MAX_PATTERNS]; // The bits of the prefixes
+                             // that are used.
+    ssize_t count;           // Number of patterns.
+
+    ssize_t len_shortest;    // Length of the shortest pattern.
+    ssize_t fp_len;          // Number of fingerprint characters.
+
+    unsigned char lo_masks[TEDDY_MAX_FINGERPRINT][32];
+    unsigned char hi_masks[TEDDY_MAX_FINGERPRINT][32];
+    int bucket_count;        // Number of buckets used.
+
+    uint8_t bucket_start[TEDDY_BUCKETS + 1]; // Start of each bucket in the
+                             // id array, followed by the pattern count.
+    uint8_t bucket_ids[TEDDY_MAX_PATTERNS]; // Pattern ids of each bucket,
+                             // in increasing order.
+
+    ssize_t edits;           // Number of patterns added and removed since
+                             // the compilation.
+
+    bool is_icase_set;       // Whether REG_ICASE was set.
+    int cflags;              // Compilation flags.
+} teddy_comp;
+
+void
+teddy_comp_init(teddy_comp *comp, int cflags);
+
+void
+teddy_comp_free(teddy_comp *comp);
+
+#endif //FREC_TEDDY_TYPE_H
@@ -1,148 +1,636 @@
 #include <frec-config.h>
+#include <stdlib.h>
+#include <string.h>
+#include "parallel.h"
 #include "wm-comp.h"
 #include "wm-type.h"
 
-#define WM_B 2
+// Large pattern sets use 3 character blocks, as with 2 character blocks
+// most of the 64K shift table entries would already be zero.
+// This is the number of block positions above which that happens.
+#define WM_B3_THRESHOLD 4096
+
+// Bits of the shift table index for each block length. Blocks of up to
+// two standard characters are indexed directly, the rest are hashed.
+#define WM_BITS_B1 8
+#define WM_BITS_B2 16
+#define WM_BITS_B3 20
+
+// Bucket lists shorter than this are searched linearly for the prefix
+// group of a text position, longer ones with a binary search.
+#define WM_LINEAR_GROUP 16
+
+// A set is compiled again once more patterns were added to or removed from
+// it than half of its size plus this.
+#define WM_EDIT_SLACK 64
+
+// The tables of large sets are built in parallel, if every thread gets at
+// least this many patterns.
+#define WM_MIN_SHARE 4096
 
 // Utility functions
 static ssize_t min(ssize_t a, ssize_t b) { return (a < b) ? a : b; }
 
+// Returns the full 32-bit hash of the block of the given length in str,
+// starting at pos. Blocks of at most two standard characters are hashed to
+// their own value, so that they can be used as a direct table index.
+static inline uint32_t
+hash_block(const string *str, ssize_t pos, ssize_t len)
+{
+    uint32_t hash = 0;
+
+    if (str->is_wide) {
+        for (ssize_t i = 0; i < len; i++) {
+            hash = (hash ^ (uint32_t) str->wide[pos + i]) * 0x9e3779b1u;
+        }
+        return hash ^ (hash >> 15);
+    }
+
+    const unsigned char *chars = (const unsigned char *) &str->stnd[pos];
+    for (ssize_t i = 0; i < len; i++) {
+        hash = (hash << 8) | chars[i];
+    }
+
+    if (len <= 2) {
+        return hash;
+    }
+    hash *= 0x9e3779b1u;
+    return hash ^ (hash >> 15);
+}
+
+// Returns the index of the block in the shift and suffix tables.
+static inline size_t
+index_block(const wm_comp *comp, const string *str, ssize_t pos)
+{
+    return hash_block(str, pos, comp->block_len) & comp->table_mask;
+}
+
+// Returns the block length to use based on the number and the length
+// of the patterns.
+static ssize_t
+block_len_for(ssize_t count, ssize_t len_shortest)
+{
+    if (len_shortest < 2) {
+        return 1;
+    } else if (len_shortest >= 3 && count * (len_shortest - 1) > WM_B3_THRESHOLD) {
+        return 3;
+    } else {
+        return 2;
+    }
+}
+
+// Selects the block length based on the number and the length of the
+// patterns, and sets the size of the tables accordingly.
+static void
+select_block_len(wm_comp *comp, bool is_wide)
+{
+    comp->block_len = block_len_for(comp->count, comp->len_shortest);
+
+    int bits = WM_BITS_B2;
+    if (comp->block_len == 1) {
+        bits = WM_BITS_B1;
+    } else if (comp->block_len == 3) {
+        bits = WM_BITS_B3;
+    }
+
+    // Wide characters are always hashed, so they need a larger table.
+    if (is_wide && bits < WM_BITS_B2) {
+        bits = WM_BITS_B2;
+    }
+
+    comp->table_mask = ((size_t) 1 << bits) - 1;
+}
+
+// Copies every pattern one after the other into the arena of comp, and
+// fills the offset table. Also sets the length of the shortest pattern.
+static bool
+build_arena(wm_comp *comp, const string *patterns, ssize_t count)
+{
+    bool is_wide = patterns[0].is_wide;
+    size_t total = 0;
+
+    comp->len_shortest = patterns[0].len;
+    for (ssize_t i = 0; i < count; i++) {
+        comp->offsets[i] = total;
+        total += patterns[i].len;
+
+        if (patterns[i].len < comp->len_shortest) {
+            comp->len_shortest = patterns[i].len;
+        }
+    }
+    comp->offsets[count] = total;
+
+    size_t char_size = is_wide ? sizeof(wchar_t) : sizeof(char);
+    char *content = malloc(char_size * (total + 1));
+    if (content == NULL) {
+        return false;
+    }
+
+    for (ssize_t i = 0; i < count; i++) {
+        const void *src = is_wide
+            ? (const void *) patterns[i].wide : (const void *) patterns[i].stnd;
+        memcpy(content + char_size * comp->offsets[i], src,
+            char_size * patterns[i].len);
+    }
+    memset(content + char_size * total, 0, char_size);
+
+    string_borrow(&comp->arena, content, (ssize_t) total, is_wide);
+    comp->arena.owned = true;
+    comp->arena_cap = total + 1;
+    return true;
+}
+
+// Stable counting sort of the ids in src into dst, based on the given keys.
+// The count array must have room for key_max + 1 elements.
+static void
+sort_by_key(uint32_t *dst, const uint32_t *src, const uint32_t *keys,
+    uint32_t shift, uint32_t key_mask, uint32_t *counts, ssize_t n)
+{
+    memset(counts, 0, sizeof(uint32_t) * ((size_t) key_mask + 1));
+    for (ssize_t i = 0; i < n; i++) {
+        counts[(keys[src[i]] >> shift) & key_mask]++;
+    }
+
+    uint32_t sum = 0;
+    for (size_t k = 0; k <= key_mask; k++) {
+        uint32_t curr = counts[k];
+        counts[k] = sum;
+        sum += curr;
+    }
+
+    for (ssize_t i = 0; i < n; i++) {
+        dst[counts[(keys[src[i]] >> shift) & key_mask]++] = src[i];
+    }
+}
+
+// Builds the bucket lists: the patterns are ordered by the index of their
+// last block (the bucket), then by their prefix hash, and then by their id.
+// Every step is a stable counting sort, so the time needed is linear.
+static bool
+build_buckets(wm_comp *comp, const uint32_t *bucket_of,
+    const uint32_t *prefix, ssize_t count)
+{
+    size_t table_size = comp->table_mask + 1;
+
+    comp->buckets = malloc(sizeof(uint32_t) * (table_size + 1));
+    comp->bucket_ids = malloc(sizeof(uint32_t) * count);
+    comp->bucket_prefix = malloc(sizeof(uint32_t) * count);
+    uint32_t *order = malloc(sizeof(uint32_t) * count);
+    uint32_t *counts = malloc(sizeof(uint32_t) * (UINT16_MAX + 1));
+    if (comp->buckets == NULL || comp->bucket_ids == NULL
+        || comp->bucket_prefix == NULL || order == NULL || counts == NULL) {
+        free(order);
+        free(counts);
+        return false;
+    }
+
+    for (ssize_t i = 0; i < count; i++) {
+        order[i] = (uint32_t) i;
+    }
+
+    // Sort by the prefix hash, 16 bits at a time, then by the bucket.
+    sort_by_key(comp->bucket_ids, order, prefix, 0, UINT16_MAX, counts, count);
+    sort_by_key(order, comp->bucket_ids, prefix, 16, UINT16_MAX, counts, count);
+    sort_by_key(comp->bucket_ids, order, bucket_of, 0,
+        (uint32_t) comp->table_mask, comp->buckets, count);
+
+    // After the last sort, each count holds the end of its bucket.
+    for (size_t k = table_size; k > 0; k--) {
+        comp->buckets[k] = comp->buckets[k - 1];
+    }
+    comp->buckets[0] = 0;
+
+    for (ssize_t i = 0; i < count; i++) {
+        comp->bucket_prefix[i] = prefix[comp->bucket_ids[i]];
+    }
+
+    free(order);
+    free(counts);
+    return true;
+}
+
+// Fills the shift table with the blocks of the patterns in [start, end), and
+// saves the bucket and the prefix hash of each of them.
+static void
+fill_tables(const wm_comp *comp, uint16_t *shift, uint32_t *bucket_of,
+    uint32_t *prefix, ssize_t start, ssize_t end)
+{
+    ssize_t len_shortest = comp->len_shortest;
+    ssize_t block = comp->block_len;
+    size_t table_size = comp->table_mask + 1;
+
+    // Blocks that are not present in any pattern allow the default shift.
+    for (size_t i = 0; i < table_size; i++) {
+        shift[i] = (uint16_t) comp->shift_def;
+    }
+
+    for (ssize_t i = start; i < end; i++) {
+        string patt = wm_pattern(comp, i);
+
+        // Every block of the first len_shortest chars of the pattern
+        // limits the shift to the distance of its end from that point.
+        for (ssize_t j = 0; j <= len_shortest - block; j++) {
+            size_t index = index_block(comp, &patt, j);
+            ssize_t curr = len_shortest - block - j;
+
+            if (curr < shift[index]) {
+                shift[index] = (uint16_t) curr;
+            }
+        }
+
+        // The last of these blocks selects the bucket of the pattern,
+        // and the first block is saved for quick filtering.
+        bucket_of[i] = (uint32_t) index_block(comp, &patt, len_shortest - block);
+        prefix[i] = hash_block(&patt, 0, block);
+    }
+}
+
+// The tables of a set, built by several threads at once. Each thread
+// fills a shift table of its own from a range of the patterns, then these
+// are merged into the first one, which is the shift table of the set.
+typedef struct wm_job {
+    const wm_comp *comp;
+    uint16_t **shifts;
+    uint32_t *bucket_of;
+    uint32_t *prefix;
+    size_t workers;
+} wm_job;
+
+static void
+fill_worker(void *arg, size_t worker)
+{
+    wm_job *job = arg;
+    size_t count = (size_t) job->comp->count;
+
+    fill_tables(job->comp, job->shifts[worker], job->bucket_of, job->prefix,
+        (ssize_t) (count * worker / job->workers),
+        (ssize_t) (count * (worker + 1) / job->workers));
+}
+
+static void
+merge_worker(void *arg, size_t worker)
+{
+    wm_job *job = arg;
+    size_t table_size = job->comp->table_mask + 1;
+    size_t start = table_size * worker / job->workers;
+    size_t end = table_size * (worker + 1) / job->workers;
+
+    uint16_t *shift = job->shifts[0];
+    for (size_t w = 1; w < job->workers; w++) {
+        const uint16_t *other = job->shifts[w];
+        for (size_t i = start; i < end; i++) {
+            if (other[i] < shift[i]) {
+                shift[i] = other[i];
+            }
+        }
+    }
+}
+
+// Builds the shift table, and the bucket and prefix hash of each pattern,
+// on multiple threads for large sets. Falls back to a single thread if
+// there's no memory for the shift tables of the others.
+static void
+build_tables(wm_comp *comp, uint32_t *bucket_of, uint32_t *prefix)
+{
+    size_t table_size = comp->table_mask + 1;
+    size_t workers = parallel_workers((size_t) comp->count, WM_MIN_SHARE);
+
+    uint16_t **shifts = (workers > 1) ? calloc(workers, sizeof(uint16_t *)) : NULL;
+    for (size_t w = 1; shifts != NULL && w < workers; w++) {
+        shifts[w] = malloc(sizeof(uint16_t) * table_size);
+        if (shifts[w] == NULL) {
+            workers = w;
+        }
+    }
+
+    if (shifts == NULL || workers == 1) {
+        free(shifts);
+        fill_tables(comp, comp->shift, bucket_of, prefix, 0, comp->count);
+        return;
+    }
+
+    shifts[0] = comp->shift;
+    wm_job job = {comp, shifts, bucket_of, prefix, workers};
+    parallel_run(fill_worker, &job, workers);
+    parallel_run(merge_worker, &job, workers);
+
+    for (size_t w = 1; w < workers; w++) {
+        free(shifts[w]);
+    }
+    free(shifts);
+}
+
+ssize_t
+wm_max_shift(ssize_t count, ssize_t len_shortest)
+{
+    return len_shortest - block_len_for(count, len_shortest) + 1;
+}
 
 int
 wm_compile(wm_comp *comp, const string *patterns, ssize_t count, int cflags)
 {
+    // Pattern ids are stored on 32 bits.
+    if (count <= 0 || (uint64_t) count > UINT32_MAX) {
+        return (REG_BADPAT);
+    }
+
     // Zero-initialize compilation struct.
     bool success = wm_comp_init(comp, count, cflags);
     if (!success) {
         return (REG_ESPACE);
     }
-    comp->shift_def = WM_B;
 
-    // Copy patterns to compilation struct
-    for (int i = 0; i < count; i++) {
-        string_duplicate(&comp->patterns[i], patterns[i]);
+    // Copy patterns to compilation struct.
+    success = build_arena(comp, patterns, count);
+    if (!success) {
+        return (REG_ESPACE);
+    }
+
+    // Empty patterns can't be handled by Wu-Manber.
+    ssize_t len_shortest = comp->len_shortest;
+    if (len_shortest == 0) {
+        return (REG_BADPAT);
+    }
+
+    select_block_len(comp, patterns[0].is_wide);
+    ssize_t block = comp->block_len;
+    size_t table_size = comp->table_mask + 1;
+
+    // Initialize the tables.
+    comp->shift = malloc(sizeof(uint16_t) * table_size);
+    uint32_t *bucket_of = malloc(sizeof(uint32_t) * count);
+    uint32_t *prefix = malloc(sizeof(uint32_t) * count);
+    if (comp->shift == NULL || bucket_of == NULL || prefix == NULL) {
+        free(bucket_of);
+        free(prefix);
+        return (REG_ESPACE);
+    }
+
+    comp->shift_def = min(len_shortest - block + 1, UINT16_MAX);
+    build_tables(comp, bucket_of, prefix);
+
+    success = build_buckets(comp, bucket_of, prefix, count);
+    free(bucket_of);
+    free(prefix);
+    if (!success) {
+        return (REG_ESPACE);
+    }
+
+    return (REG_OK);
+}
+
+// Returns the first position in the [start, end) range of the bucket lists
+// where the prefix hash is not less than the given one.
+static inline uint32_t
+find_group(const wm_comp *comp, uint32_t start, uint32_t end, uint32_t prefix)
+{
+    const uint32_t *prefixes = comp->bucket_prefix;
+
+    if (end - start < WM_LINEAR_GROUP) {
+        while (start < end && prefixes[start] < prefix) {
+            start++;
+        }
+        return start;
+    }
+
+    while (start < end) {
+        uint32_t mid = start + (end - start) / 2;
+        if (prefixes[mid] < prefix) {
+            start = mid + 1;
+        } else {
+            end = mid;
+        }
+    }
+    return start;
+}
+
+// Checks whether the pattern with the given id occurs in the text at the
+// given position, unless it was removed.
+static inline bool
+matches_at(const wm_comp *comp, uint32_t id, string text, ssize_t text_st)
+{
+    ssize_t len = (ssize_t) (comp->offsets[id + 1] - comp->offsets[id]);
+    if (text_st > text.len - len) {
+        return false;
+    }
+    if (comp->removed != NULL && comp->removed[id]) {
+        return false;
+    }
+
+    return string_compare(&comp->arena, (ssize_t) comp->offsets[id],
+        &text, text_st, len);
+}
+
+static inline int
+report(frec_match_t *result, bool sub, const wm_comp *comp, uint32_t id,
+    ssize_t text_st)
+{
+    if (sub) {
+        result->soffset = text_st;
+        result->eoffset = text_st + (ssize_t) (comp->offsets[id + 1] - comp->offsets[id]);
+        result->pattern_id = id;
+    }
+    return (REG_OK);
+}
+
+// Makes room for at least one more pattern in the arrays indexed by id.
+static bool
+grow_patterns(wm_comp *comp)
+{
+    if (comp->count < comp->capacity) {
+        return true;
+    }
+    ssize_t capacity = comp->capacity * 2;
+
+    size_t *offsets = realloc(comp->offsets, sizeof(size_t) * (capacity + 1));
+    if (offsets == NULL) {
+        return false;
+    }
+    comp->offsets = offsets;
+
+    if (comp->extra_next != NULL) {
+        uint32_t *next = realloc(comp->extra_next, sizeof(uint32_t) * capacity);
+        if (next == NULL) {
+            return false;
+        }
+        comp->extra_next = next;
+    }
+
+    if (comp->removed != NULL) {
+        uint8_t *removed = realloc(comp->removed, capacity);
+        if (removed == NULL) {
+            return false;
+        }
+        memset(removed + comp->capacity, 0, capacity - comp->capacity);
+        comp->removed = removed;
+    }
+
+    comp->capacity = capacity;
+    return true;
+}
+
+// Appends the pattern to the arena, growing it if needed.
+static bool
+append_arena(wm_comp *comp, string pattern)
+{
+    size_t char_size = pattern.is_wide ? sizeof(wchar_t) : sizeof(char);
+    size_t total = comp->offsets[comp->count];
+    size_t needed = total + pattern.len + 1;
+
+    if (needed > comp->arena_cap) {
+        size_t cap = (comp->arena_cap * 2 > needed) ? comp->arena_cap * 2 : needed;
+        char *content = pattern.is_wide
+            ? (char *) comp->arena.wide : comp->arena.stnd;
+        content = realloc(content, char_size * cap);
+        if (content == NULL) {
+            return false;
+        }
+
+        string_borrow(&comp->arena, content, comp->arena.len, pattern.is_wide);
+        comp->arena.owned = true;
+        comp->arena_cap = cap;
+    }
+
+    char *content = pattern.is_wide ? (char *) comp->arena.wide : comp->arena.stnd;
+    const void *src = pattern.is_wide
+        ? (const void *) pattern.wide : (const void *) pattern.stnd;
+    memcpy(content + char_size * total, src, char_size * pattern.len);
+    memset(content + char_size * (total + pattern.len), 0, char_size);
+
+    comp->arena.len = (ssize_t) (total + pattern.len);
+    comp->offsets[comp->count + 1] = total + pattern.len;
+    return true;
+}
+
+int
+wm_add(wm_comp *comp, string pattern)
+{
+    if (comp->borrowed || pattern.len < comp->len_shortest
+        || pattern.is_wide != comp->arena.is_wide
+        || (uint64_t) comp->count >= UINT32_MAX - 1) {
+        return (REG_BADPAT);
     }
 
-    // Find and set the shortest pattern length.
-    ssize_t len_shortest = patterns[0].len;
-    for (ssize_t i = 1; i < count; i++) {
-        if (patterns[i].len < len_shortest) {
-            len_shortest = patterns[i].len;
+    size_t table_size = comp->table_mask + 1;
+    if (comp->extra_head == NULL) {
+        comp->extra_head = malloc(sizeof(uint32_t) * table_size);
+        comp->extra_next = malloc(sizeof(uint32_t) * comp->capacity);
+        if (comp->extra_head == NULL || comp->extra_next == NULL) {
+            free(comp->extra_head);
+            free(comp->extra_next);
+            comp->extra_head = NULL;
+            comp->extra_next = NULL;
+            return (REG_ESPACE);
         }
+        memset(comp->extra_head, 0xff, sizeof(uint32_t) * table_size);
     }
-    comp->len_shortest = len_shortest;
 
-    // Initialize shift table.
-    size_t elem_count = /*(len_shortest - WM_B + 1)*/ 2 * count * 2;
-    size_t size = (patterns[0].is_wide) ? sizeof(wchar_t) : sizeof(char);
-    comp->shift = hashtable_init(elem_count, size, sizeof(wm_entry));
-    if (comp->shift == NULL) {
+    if (!grow_patterns(comp) || !append_arena(comp, pattern)) {
         return (REG_ESPACE);
     }
 
-    // Stores the current entry.
-    wm_entry entry;
+    // The shifts only ever get smaller, like during the compilation.
+    ssize_t len_shortest = comp->len_shortest;
+    ssize_t block = comp->block_len;
+    for (ssize_t j = 0; j <= len_shortest - block; j++) {
+        size_t index = index_block(comp, &pattern, j);
+        ssize_t shift = len_shortest - block - j;
 
-    // For each pattern string
-    for (ssize_t i = 0; i < count; i++) {
+        if (shift < comp->shift[index]) {
+            comp->shift[index] = (uint16_t) shift;
+        }
+    }
 
-        // Process the current string char by char
-        for (ssize_t j = 0; j <= len_shortest - WM_B; j++) {
-            ssize_t shift = len_shortest - WM_B - j;
-
-            void *curr_char = string_index(&patterns[i], j);
-            int ret = hashtable_get(comp->shift, curr_char, &entry);
-
-            switch (ret) {
-                case HASH_NOTFOUND:
-                    entry.shift = shift;
-                    entry.prefix_cnt = 0;
-                    entry.suffix_cnt = 0;
-                    break;
-                case HASH_OK:
-                    entry.shift = min(entry.shift, shift);
-                    break;
-            }
+    uint32_t id = (uint32_t) comp->count;
+    size_t bucket = index_block(comp, &pattern, len_shortest - block);
+    comp->extra_next[id] = comp->extra_head[bucket];
+    comp->extra_head[bucket] = id;
 
-            // If we are at the first or last char, update prefix / suffix list
-            if (j == 0) {
-                entry.prefix_list[entry.prefix_cnt++] = i;
-            } else if (j == len_shortest - WM_B) {
-                entry.suffix_list[entry.suffix_cnt++] = i;
-            }
+    comp->count++;
+    comp->edits++;
+    return (REG_OK);
+}
 
-            ret = hashtable_put(comp->shift, curr_char, &entry);
-            if (ret != HASH_OK && ret != HASH_UPDATED) {
-                return (REG_BADPAT);
-            }
+int
+wm_remove(wm_comp *comp, ssize_t id)
+{
+    if (comp->borrowed || id < 0 || id >= comp->count) {
+        return (REG_BADPAT);
+    }
+
+    if (comp->removed == NULL) {
+        comp->removed = calloc(comp->capacity, 1);
+        if (comp->removed == NULL) {
+            return (REG_ESPACE);
         }
     }
 
+    // The shifts of its blocks stay as they were, which is still correct.
+    comp->removed[id] = 1;
+    comp->edits++;
     return (REG_OK);
 }
 
+bool
+wm_needs_rebuild(const wm_comp *comp)
+{
+    return comp->edits > comp->base_count / 2 + WM_EDIT_SLACK;
+}
+
 int
 wm_execute(frec_match_t *result, const wm_comp *comp, string text, int eflags)
 {
-    ssize_t pos = comp->len_shortest;
+    ssize_t len_shortest = comp->len_shortest;
+    ssize_t block = comp->block_len;
 
-    wm_entry s_entry, p_entry;
+    // Whether or not we should substitute.
+    bool sub = !(comp->cflags & REG_NOSUB) && result != NULL;
+    // TODO Temporary fix, nosub generally isn't used.
+    sub = result != NULL;
 
-    while (pos <= text.len) {
-        void *curr_char = string_index(&text, pos - WM_B);
-        int ret = hashtable_get(comp->shift, curr_char, &s_entry);
+    // The current end of the search window.
+    ssize_t pos = len_shortest;
 
-        ssize_t shift = (ret == HASH_OK) ? s_entry.shift : comp->shift_def;
+    while (pos <= text.len) {
+        size_t index = index_block(comp, &text, pos - block);
+        ssize_t shift = comp->shift[index];
 
         if (shift != 0) {
             pos += shift;
-        } else {
-            curr_char = string_index(&text, pos - comp->len_shortest);
-            ret = hashtable_get(comp->shift, curr_char, &p_entry);
+            continue;
+        }
 
-            if (ret == HASH_NOTFOUND) {
-                pos++;
-                continue;
+        // Every pattern in the bucket is a potential match starting at the
+        // beginning of the window, but only the ones in the group of the
+        // same prefix hash need to be compared. These are sorted by id.
+        ssize_t text_st = pos - len_shortest;
+        uint32_t prefix = hash_block(&text, text_st, block);
+
+        uint32_t end = comp->buckets[index + 1];
+        uint32_t at = find_group(comp, comp->buckets[index], end, prefix);
+
+        for (; at < end && comp->bucket_prefix[at] == prefix; at++) {
+            uint32_t id = comp->bucket_ids[at];
+            if (matches_at(comp, id, text, text_st)) {
+                return report(result, sub, comp, id, text_st);
             }
+        }
 
-            for (ssize_t i = 0; i < p_entry.prefix_cnt; i++) {
-                for (ssize_t j = 0; j < s_entry.suffix_cnt; j++) {
-                    unsigned char s_id = s_entry.suffix_list[j];
-                    unsigned char p_id = p_entry.prefix_list[i];
-
-                    if (s_id < p_id) {
-                        continue;
-                    }
-                    if (s_id > p_id) {
-                        break;
-                    }
-
-                    // If s_id == p_id, compare the pattern and the text
-                    const string *curr_pat = &comp->patterns[s_id];
-                    ssize_t text_st = pos - comp->len_shortest;
-
-                    if (text_st <= text.len - curr_pat->len) {
-                        if (string_compare(
-                            curr_pat, 0, &text, text_st, curr_pat->len
-                        )) {
-                            // Whether or not we should substitute.
-                            bool sub = !(comp->cflags & REG_NOSUB) && result != NULL;
-                            // TODO Temporary fix, nosub generally isn't used.
-                            sub = true;
-
-                            if (sub) {
-                                result->soffset = text_st;
-                                result->eoffset = text_st + curr_pat->len;
-                                result->pattern_id = s_id;
-                            }
-                            return (REG_OK);
-                        }
-                    }
+        // The patterns added later have larger ids than the ones above.
+        if (comp->extra_head != NULL) {
+            uint32_t best = UINT32_MAX;
+            for (uint32_t id = comp->extra_head[index]; id != UINT32_MAX;
+                id = comp->extra_next[id]) {
+                if (id < best && matches_at(comp, id, text, text_st)) {
+                    best = id;
                 }
             }
-
-            pos++;
+            if (best != UINT32_MAX) {
+                return report(result, sub, comp, best, text_st);
+            }
         }
+
+        pos++;
     }
 
     return (REG_NOMATCH);
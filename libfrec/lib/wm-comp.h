@@ -19,6 +19,29 @@
 int
 wm_compile(wm_comp *comp, const string *patterns, ssize_t count, int cflags);
 
+// Returns the largest shift Wu-Manber could make over the text with count
+// patterns, the shortest of which has the given length.
+ssize_t
+wm_max_shift(ssize_t count, ssize_t len_shortest);
+
+// Adds a pattern to the compiled set, with the next id. Only the shift
+// table and a list of the bucket of the pattern are updated, so this takes
+// time proportional to the length of the pattern. Returns REG_BADPAT if the
+// pattern is shorter than the shortest one of the set, or if the set was
+// loaded from a serialized blob. These need to be compiled again.
+int
+wm_add(wm_comp *comp, string pattern);
+
+// Removes the pattern with the given id from the compiled set. It is only
+// marked as removed, its shifts stay as they were.
+int
+wm_remove(wm_comp *comp, ssize_t id);
+
+// Returns whether the set was edited so much since it was compiled that
+// it should be compiled again.
+bool
+wm_needs_rebuild(const wm_comp *comp);
+
 int
 wm_execute(frec_match_t *result, const wm_comp *comp, string text, int eflags);
 
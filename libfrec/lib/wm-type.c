@@ -6,9 +6,24 @@ wm_comp_init(wm_comp *comp, ssize_t count, int cflags)
 {
     comp->count = count;
     comp->cflags = cflags;
+    comp->borrowed = false;
 
-    comp->patterns = malloc(sizeof(string) * count);
-    if (comp->patterns == NULL) {
+    string_init(&comp->arena);
+    comp->shift = NULL;
+    comp->buckets = NULL;
+    comp->bucket_ids = NULL;
+    comp->bucket_prefix = NULL;
+
+    comp->extra_head = NULL;
+    comp->extra_next = NULL;
+    comp->removed = NULL;
+    comp->base_count = count;
+    comp->capacity = count;
+    comp->arena_cap = 0;
+    comp->edits = 0;
+
+    comp->offsets = malloc(sizeof(size_t) * (count + 1));
+    if (comp->offsets == NULL) {
         return false;
     }
 
@@ -18,12 +33,28 @@ wm_comp_init(wm_comp *comp, ssize_t count, int cflags)
 void
 wm_comp_free(wm_comp *comp)
 {
-    if (comp != NULL) {
-        hashtable_free(comp->shift);
+    if (comp != NULL && comp->borrowed) {
+        string_free(&comp->arena);
+    } else if (comp != NULL) {
+        string_free(&comp->arena);
+        free(comp->offsets);
+
+        free(comp->shift);
+        free(comp->buckets);
+        free(comp->bucket_ids);
+        free(comp->bucket_prefix);
 
-        for (int i = 0; i < comp->count; i++) {
-            string_free(&comp->patterns[i]);
-        }
-        free(comp->patterns);
+        free(comp->extra_head);
+        free(comp->extra_next);
+        free(comp->removed);
     }
 }
+
+string
+wm_pattern(const wm_comp *comp, ssize_t id)
+{
+    string patt;
+    string_borrow_section(&patt, comp->arena,
+        comp->offsets[id], comp->offsets[id + 1]);
+    return patt;
+}
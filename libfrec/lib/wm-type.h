@@ -1,33 +1,41 @@
 #ifndef FREC_WM_TYPE_H
 #define FREC_WM_TYPE_H
 
+#include <stdint.h>
 #include <sys/types.h>
-#include "hashtable.h"
 #include "string-type.h"
 
-#define WM_MAXPAT 64
-
 typedef struct wm_comp {
-    string *patterns;        // Pattern array.
+    string arena;            // The concatenation of every pattern.
+    size_t *offsets;         // Start offset of each pattern in the arena,
+                             // followed by the total length.
     ssize_t count;           // Number of patterns.
 
     ssize_t len_shortest;    // Length of the shortest pattern.
+    ssize_t block_len;       // Length of the blocks (B) used for hashing.
     ssize_t shift_def;       // Default WM shift.
 
-    hashtable *shift;        // WM shift table.
-
-    int cflags;              // Compilation flags.
-} wm_comp;
+    size_t table_mask;       // Size of the shift and bucket tables minus one.
+    uint16_t *shift;         // WM shift table, indexed by block hash.
 
-typedef struct wm_entry {
-    ssize_t shift;
+    uint32_t *buckets;       // Start of each suffix bucket in the lists below,
+                             // followed by the total pattern count.
+    uint32_t *bucket_ids;    // Pattern ids of every bucket, one after the
+                             // other, grouped by their prefix hash.
+    uint32_t *bucket_prefix; // The prefix hash of each of these patterns.
 
-    unsigned char suffix_list[WM_MAXPAT];
-    ssize_t suffix_cnt;
+    uint32_t *extra_head;    // The patterns added after the compilation, in
+    uint32_t *extra_next;    // a linked list for each bucket, or NULL.
+    uint8_t *removed;        // Whether each pattern was removed, or NULL.
+    ssize_t base_count;      // Number of patterns compiled at once.
+    ssize_t capacity;        // Room for patterns in the arrays above.
+    size_t arena_cap;        // Room for characters in the arena.
+    ssize_t edits;           // Number of patterns added and removed since.
 
-    unsigned char prefix_list[WM_MAXPAT];
-    ssize_t prefix_cnt;
-} wm_entry;
+    int cflags;              // Compilation flags.
+    bool borrowed;           // The tables point into a serialized blob,
+                             // and are not freed.
+} wm_comp;
 
 bool
 wm_comp_init(wm_comp *comp, ssize_t count, int cflags);
@@ -35,4 +43,9 @@ wm_comp_init(wm_comp *comp, ssize_t count, int cflags);
 void
 wm_comp_free(wm_comp *comp);
 
+// Returns the pattern with the given id as a string borrowed from the
+// arena of the compilation struct.
+string
+wm_pattern(const wm_comp *comp, ssize_t id);
+
 #endif //FREC_WM_TYPE_H
@@ -0,0 +1,194 @@
+#include <check.h>
+#include <frec.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "ac-comp.h"
+#include "string-type.h"
+#include "wm-comp.h"
+
+/*
+ * Runs the Aho-Corasick execution phase. Asserts that the preprocessing
+ * succeeded, and returns the final execution return value as well as any
+ * potential matches in the matches input variable.
+ */
+static int
+run_execute(
+    frec_match_t *match,
+    const char **patterns, ssize_t count, const char *text, int flags
+) {
+    ac_comp comp;
+
+    string *strs = malloc(sizeof(string) * count);
+
+    for (int i = 0; i < count; i++) {
+        const char *pattern = patterns[i];
+        string_borrow(&strs[i], pattern, (ssize_t) strlen(pattern), false);
+    }
+
+    int ret = ac_compile(&comp, strs, count, flags);
+    ck_assert_msg(ret == REG_OK,
+                  "Execute failed because preprocessing failed: returned '%d'",
+                  ret
+    );
+
+    string txt;
+    string_borrow(&txt, text, (ssize_t) strlen(text), false);
+
+    ret = ac_execute(match, &comp, txt, 0);
+
+    ac_comp_free(&comp);
+    free(strs);
+    return ret;
+}
+
+typedef struct exec_tuple {
+    const char *patterns[5];
+    ssize_t count;
+    const char *text;
+    int flags;
+    int expected_ret;
+    frec_match_t expected;
+} exec_tuple;
+
+#define EXEC_LEN 14
+static exec_tuple exec_inputs[EXEC_LEN] = {
+    // Test with single patterns
+    {{"exactly the same"}, 1, "exactly the same", 0, REG_OK, {0, 16, 0}},
+    {{"alpha"}, 1, "alpha beta gamma delta", 0, REG_OK, {0, 5, 0}},
+    {{"a"}, 1, "only in the end: a", 0, REG_OK, {17, 18, 0}},
+    // The leftmost match wins, then the lowest id
+    {{"delta", "gamma"}, 2, "alpha beta gamma delta", 0, REG_OK, {11, 16, 1}},
+    {{"beta", "alpha", "delta", "gamma"}, 4, "alpha beta gamma delta", 0,
+        REG_OK, {0, 5, 1}},
+    {{"abcd", "ab"}, 2, "xxabcd", 0, REG_OK, {2, 6, 0}},
+    {{"ab", "abcd"}, 2, "xxabcd", 0, REG_OK, {2, 4, 0}},
+    {{"he", "she", "his", "hers"}, 4, "ushers", 0, REG_OK, {1, 4, 1}},
+    // Matches that are only found through failure links
+    {{"abcd", "bc"}, 2, "xabcx", 0, REG_OK, {2, 4, 1}},
+    {{"aab", "ab"}, 2, "aaab", 0, REG_OK, {1, 4, 0}},
+    // Case insensitive matching
+    {{"Alpha", "beta"}, 2, "ALPHA BETA", REG_ICASE, REG_OK, {0, 5, 0}},
+    // Failures
+    {{"alpha", "what"}, 2, "alph beta", 0, REG_NOMATCH, {0, 0, 0}},
+    {{"abc"}, 1, "ab", 0, REG_NOMATCH, {0, 0, 0}},
+    {{"Alpha"}, 1, "ALPHA", 0, REG_NOMATCH, {0, 0, 0}},
+};
+
+START_TEST(loop_test_ac__inputs__exec_ok)
+{
+    exec_tuple curr = exec_inputs[_i];
+
+    frec_match_t match;
+    int ret = run_execute(&match, curr.patterns, curr.count,
+        curr.text, curr.flags);
+
+    ck_assert_msg(ret == curr.expected_ret,
+        "Execution returned '%d' instead of '%d' for text '%s'",
+        ret, curr.expected_ret, curr.text
+    );
+
+    if (ret == REG_OK) {
+        ck_assert_msg(match.soffset == curr.expected.soffset
+            && match.eoffset == curr.expected.eoffset
+            && match.pattern_id == curr.expected.pattern_id,
+            "Execution returned match (%ld, %ld, %zu) instead of (%ld, %ld, %zu) for text '%s'",
+            match.soffset, match.eoffset, match.pattern_id,
+            curr.expected.soffset, curr.expected.eoffset,
+            curr.expected.pattern_id, curr.text
+        );
+    }
+}
+END_TEST
+
+/*
+ * Compiles the same generated pattern set with both Aho-Corasick and
+ * Wu-Manber, and checks that both find the same match in every line
+ * of a generated text.
+ */
+START_TEST(test_ac__generated__same_as_wm)
+{
+    ssize_t count = 2000;
+    unsigned int seed = 1;
+
+    char *buffer = malloc(count * 8);
+    string *strs = malloc(sizeof(string) * count);
+    for (ssize_t i = 0; i < count; i++) {
+        char *curr = &buffer[i * 8];
+        ssize_t len = 3 + i % 5;
+        for (ssize_t j = 0; j < len; j++) {
+            seed = seed * 1103515245 + 12345;
+            curr[j] = (char) ('a' + (seed >> 16) % 4);
+        }
+        string_borrow(&strs[i], curr, len, false);
+    }
+
+    ac_comp ac;
+    wm_comp wm;
+    ck_assert(ac_compile(&ac, strs, count, 0) == REG_OK);
+    ck_assert(wm_compile(&wm, strs, count, 0) == REG_OK);
+
+    char text[32];
+    for (int line = 0; line < 1000; line++) {
+        for (int j = 0; j < 31; j++) {
+            seed = seed * 1103515245 + 12345;
+            text[j] = (char) ('a' + (seed >> 16) % 5);
+        }
+        text[31] = '\0';
+
+        string txt;
+        string_borrow(&txt, text, 31, false);
+
+        frec_match_t ac_match, wm_match;
+        int ac_ret = ac_execute(&ac_match, &ac, txt, 0);
+        int wm_ret = wm_execute(&wm_match, &wm, txt, 0);
+
+        ck_assert_msg(ac_ret == wm_ret,
+            "Aho-Corasick returned '%d', Wu-Manber '%d' for text '%s'",
+            ac_ret, wm_ret, text
+        );
+        if (ac_ret == REG_OK) {
+            ck_assert_msg(ac_match.soffset == wm_match.soffset
+                && ac_match.eoffset == wm_match.eoffset
+                && ac_match.pattern_id == wm_match.pattern_id,
+                "Aho-Corasick returned (%ld, %ld, %zu), Wu-Manber (%ld, %ld, %zu) for text '%s'",
+                ac_match.soffset, ac_match.eoffset, ac_match.pattern_id,
+                wm_match.soffset, wm_match.eoffset, wm_match.pattern_id, text
+            );
+        }
+    }
+
+    ac_comp_free(&ac);
+    wm_comp_free(&wm);
+    free(strs);
+    free(buffer);
+}
+END_TEST
+
+static Suite *
+create_suite()
+{
+    Suite *suite = suite_create("Aho-Corasick");
+
+    TCase *tc_exec = tcase_create("Execution");
+
+    tcase_add_loop_test(tc_exec, loop_test_ac__inputs__exec_ok, 0, EXEC_LEN);
+    tcase_add_test(tc_exec, test_ac__generated__same_as_wm);
+
+    suite_add_tcase(suite, tc_exec);
+
+    return suite;
+}
+
+int
+main(void)
+{
+    Suite *suite = create_suite();
+    SRunner *runner = srunner_create(suite);
+
+    srunner_run_all(runner, CK_NORMAL);
+    int failed = srunner_ntests_failed(runner);
+    srunner_free(runner);
+
+    return (failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
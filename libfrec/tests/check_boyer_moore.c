@@ -2,6 +2,7 @@
 #include <check.h>
 #include <frec.h>
 #include <stdlib.h>
+#include <string.h>
 #include "bm.h"
 #include "string-type.h"
 
@@ -68,6 +69,34 @@ run_execute(
     return ret;
 }
 
+/*
+ * Runs the Boyer-Moore execution phase on standard character strings.
+ * See run_execute for more information.
+ */
+static int
+run_execute_stnd(
+    frec_match_t *match,
+    const char *pattern, const char *text, int flags
+)
+{
+    bm_comp comp;
+
+    string str;
+    string_borrow(&str, pattern, (ssize_t) strlen(pattern), false);
+    int ret = bm_compile_full(&comp, str, flags);
+    ck_assert_msg(ret == REG_OK,
+        "Execute failed because preprocessing failed: returned '%d' for '%s'",
+        ret, pattern
+    );
+
+    string txt;
+    string_borrow(&txt, text, (ssize_t) strlen(text), false);
+    ret = bm_execute(match, &comp, txt, flags);
+
+    bm_comp_free(&comp);
+    return ret;
+}
+
 
 START_TEST(test_bm__sanity__literal_prep_ok)
 {
@@ -221,6 +250,125 @@ START_TEST(loop_test_bm__successes__single_exec_succeeds)
 }
 END_TEST
 
+typedef struct exec_stnd_tuple {
+    const char *pattern;
+    const char *text;
+    int flags;
+    frec_match_t expected;
+} exec_stnd_tuple;
+
+/* Short patterns in standard character texts go through the vectorized
+ * scanner, so these texts are long enough to cover the full blocks as well
+ * as the tails. Long patterns go through Turbo-BM instead. */
+#define EXEC_STND_SUCC_LEN 11
+static exec_stnd_tuple exec_stnd_successes[EXEC_STND_SUCC_LEN] = {
+    {"exactly the same", "exactly the same", 0, {0, 16}},
+    {"x", "a single character pattern found at the very end x", 0, {49, 50}},
+    {"needle", "no needle in the first block, the needle is here", 0, {3, 9}},
+    {"haystack", "first and last chars match: hk, hayk, hxxxxxxk, then haystack", 0, {53, 61}},
+    {"end", "a long text with a pattern that only occurs in the tail end", 0, {56, 59}},
+    {"CASE", "ignoring the case of a text", REG_ICASE, {13, 17}},
+    {"^line", "not at start\nline two", REG_NEWLINE, {13, 17}},
+    {"two$", "two is not at the end, but this is two", 0, {35, 38}},
+    {"a pattern longer than the vector limit of the scanner",
+        "the text has a pattern longer than the vector limit of the scanner in it", 0, {13, 66}},
+    {"long patterns with high bytes \xe9\xe9 are found by Turbo-BM",
+        "text: long patterns with high bytes \xe9\xe9 are found by Turbo-BM", 0, {6, 60}},
+    {"A LONG PATTERN THAT IGNORES THE CASE OF THE TEXT",
+        "here is a long pattern that ignores the case of the text", REG_ICASE, {8, 56}},
+};
+
+#define EXEC_STND_FAIL_LEN 6
+static exec_stnd_tuple exec_stnd_failures[EXEC_STND_FAIL_LEN] = {
+    {"needle", "a long enough text that does not contain the pattern at all", 0, {0, 0}},
+    {"nd", "only the first char n or only the last char d is present", 0, {0, 0}},
+    {"^anchored", "the pattern is not anchored here: anchored", 0, {0, 0}},
+    {"^line", "without REG_NEWLINE\nline is not anchored", 0, {0, 0}},
+    {"Case", "the case of the text does not match", 0, {0, 0}},
+    {"a pattern longer than the vector limit of the scanner",
+        "the text has a pattern longer than the vector limit of the scammer in it", 0, {0, 0}},
+};
+
+START_TEST(loop_test_bm__successes__stnd_exec_succeeds)
+{
+    exec_stnd_tuple current = exec_stnd_successes[_i];
+
+    frec_match_t match;
+    int ret = run_execute_stnd(&match, current.pattern, current.text, current.flags);
+
+    ck_assert_msg(ret == REG_OK,
+        "Execution did not succeed: returned '%d' for pattern '%s' and text '%s' with flags '%d'",
+        ret, current.pattern, current.text, current.flags
+    );
+
+    ck_assert_msg(match.soffset == current.expected.soffset,
+        "Execution succeeded but match soffset differs: Got '%ld' instead of '%ld' for pattern '%s' and text '%s' with flags '%d'",
+        match.soffset, current.expected.soffset, current.pattern, current.text, current.flags
+    );
+
+    ck_assert_msg(match.eoffset == current.expected.eoffset,
+        "Execution succeeded but match eoffset differs: Got '%ld' instead of '%ld' for pattern '%s' and text '%s' with flags '%d'",
+        match.eoffset, current.expected.eoffset, current.pattern, current.text, current.flags
+    );
+}
+END_TEST
+
+START_TEST(loop_test_bm__failures__stnd_exec_fails)
+{
+    exec_stnd_tuple current = exec_stnd_failures[_i];
+
+    frec_match_t match;
+    int ret = run_execute_stnd(&match, current.pattern, current.text, current.flags);
+
+    ck_assert_msg(ret == REG_NOMATCH,
+        "Execution did not fail: returned '%d' for pattern '%s' and text '%s' with flags '%d'",
+        ret, current.pattern, current.text, current.flags
+    );
+}
+END_TEST
+
+START_TEST(test_bm__rare_offsets__builtin_table)
+{
+    bm_comp comp;
+
+    string str;
+    string_borrow(&str, "the error", 9, false);
+    int ret = bm_compile_literal(&comp, str, 0);
+    ck_assert_msg(ret == REG_OK, "Preprocessing failed: returned '%d'", ret);
+
+    /* The 'h' and the last 'r' are the rarest characters in typical texts. */
+    ck_assert_msg(comp.rare_offsets[0] == 1 && comp.rare_offsets[1] == 8,
+        "Incorrect rare offsets: got '%ld' and '%ld' instead of '1' and '8'",
+        comp.rare_offsets[0], comp.rare_offsets[1]
+    );
+
+    bm_comp_free(&comp);
+}
+END_TEST
+
+START_TEST(test_bm__rare_offsets__trained_table)
+{
+    const char *sample = "hhhhhhhhhhhhhhhhrrrrrrrrrrrrrrrrtttteeeeooo  ";
+    frec_train_byte_freq(sample, strlen(sample));
+
+    bm_comp comp;
+
+    string str;
+    string_borrow(&str, "the error", 9, false);
+    int ret = bm_compile_literal(&comp, str, 0);
+    ck_assert_msg(ret == REG_OK, "Preprocessing failed: returned '%d'", ret);
+
+    /* After training, the space and the 'o' are the rarest characters. */
+    ck_assert_msg(comp.rare_offsets[0] == 3 && comp.rare_offsets[1] == 7,
+        "Incorrect rare offsets: got '%ld' and '%ld' instead of '3' and '7'",
+        comp.rare_offsets[0], comp.rare_offsets[1]
+    );
+
+    bm_comp_free(&comp);
+    frec_train_byte_freq(NULL, 0);
+}
+END_TEST
+
 static Suite *
 create_suite()
 {
@@ -240,6 +388,11 @@ create_suite()
     tcase_add_test(tc_exec, test_bm__sanity__execute_on_nomatch_ok);
 
 	tcase_add_loop_test(tc_exec, loop_test_bm__successes__single_exec_succeeds, 0, EXEC_SUCC_LEN);
+	tcase_add_loop_test(tc_exec, loop_test_bm__successes__stnd_exec_succeeds, 0, EXEC_STND_SUCC_LEN);
+	tcase_add_loop_test(tc_exec, loop_test_bm__failures__stnd_exec_fails, 0, EXEC_STND_FAIL_LEN);
+
+    tcase_add_test(tc_prep, test_bm__rare_offsets__builtin_table);
+    tcase_add_test(tc_prep, test_bm__rare_offsets__trained_table);
 	
     suite_add_tcase(suite, tc_prep);
 	suite_add_tcase(suite, tc_exec);
@@ -0,0 +1,148 @@
+#include <check.h>
+#include <frec.h>
+
+typedef struct count_tuple {
+    const char *pattern;
+    const char *text;
+    int cflags;
+    size_t matches;
+    size_t lines;
+} count_tuple;
+
+#define INPUT_LEN 12
+static count_tuple inputs[INPUT_LEN] = {
+    // Literals:
+    {"ab", "ab ab\nxab\nnone\n", 0, 3, 2},
+    {"ab", "ab ab\nxab\nnone\n", REG_NOSUB, 3, 2},
+    {"aa", "aaaaa", 0, 2, 1},
+    {"none", "no match here", 0, 0, 0},
+
+    // Anchored literals match on each line:
+    {"^ab", "ab\nab\nxab", 0, 1, 2},
+    {"ab$", "ab\nab\nxab", REG_NEWLINE, 3, 3},
+
+    // Patterns with heuristics:
+    {"a[0-9]+b", "a1b a22b\nab\na3b", REG_EXTENDED, 3, 2},
+    {"a[0-9]+b", "a1b a22b\nab\na3b", REG_EXTENDED | REG_NOSUB, 1, 2},
+    {"x.*y", "xy\nx\ny\nxzzy", 0, 1, 2},
+
+    // Patterns without any literal:
+    {"[0-9]+", "1 22\n\n333", REG_EXTENDED, 3, 2},
+    {"^$", "a\n\nb\n", REG_NEWLINE, 2, 1},
+
+    // Patterns spanning lines never match a single line:
+    {"a\nb", "a\nb a\nb", 0, 2, 0}
+};
+
+START_TEST(loop_test_count__single__counts_ok)
+{
+    count_tuple curr = inputs[_i];
+
+    frec_t preg;
+    int ret = frec_regcomp(&preg, curr.pattern, curr.cflags);
+    ck_assert_msg(ret == REG_OK,
+        "regcomp failed: returned '%d' for pattern '%s'", ret, curr.pattern
+    );
+
+    size_t matches;
+    ret = frec_regcount(&preg, curr.text, 0, FREC_COUNT_MATCHES, &matches);
+    ck_assert(ret == REG_OK);
+    ck_assert_msg(matches == curr.matches,
+        "Incorrect match count: expected '%zu', got '%zu' for pattern '%s'",
+        curr.matches, matches, curr.pattern
+    );
+
+    size_t lines;
+    ret = frec_regcount(&preg, curr.text, 0, FREC_COUNT_LINES, &lines);
+    ck_assert(ret == REG_OK);
+    ck_assert_msg(lines == curr.lines,
+        "Incorrect line count: expected '%zu', got '%zu' for pattern '%s'",
+        curr.lines, lines, curr.pattern
+    );
+
+    frec_regfree(&preg);
+}
+END_TEST
+
+
+typedef struct mcount_tuple {
+    const char *patterns[3];
+    size_t pattern_count;
+    int cflags;
+    const char *text;
+    size_t matches;
+    size_t lines;
+} mcount_tuple;
+
+#define MINPUT_LEN 4
+static mcount_tuple minputs[MINPUT_LEN] = {
+    // Literal sets:
+    {{"cat", "dog"}, 2, 0, "cat dog\nbird\ndog\n", 3, 2},
+    {{"cat", "dog"}, 2, REG_NOSUB, "cat dog\nbird\ndog\n", 3, 2},
+
+    // Patterns with heuristics:
+    {{"c[a-z]t", "d.g"}, 2, 0, "cat dig\nct\ncot", 3, 2},
+
+    // Patterns without a common literal:
+    {{"[0-9]+", "x*y"}, 2, REG_EXTENDED, "12 xxy\n3\nz", 3, 2}
+};
+
+START_TEST(loop_test_count__multi__counts_ok)
+{
+    mcount_tuple curr = minputs[_i];
+
+    mfrec_t preg;
+    int ret = frec_mregcomp(&preg, curr.pattern_count, curr.patterns,
+        curr.cflags);
+    ck_assert_msg(ret == REG_OK,
+        "mregcomp failed: returned '%d' for text '%s'", ret, curr.text
+    );
+
+    size_t matches;
+    ret = frec_mregcount(&preg, curr.text, 0, FREC_COUNT_MATCHES, &matches);
+    ck_assert(ret == REG_OK);
+    ck_assert_msg(matches == curr.matches,
+        "Incorrect match count: expected '%zu', got '%zu' for text '%s'",
+        curr.matches, matches, curr.text
+    );
+
+    size_t lines;
+    ret = frec_mregcount(&preg, curr.text, 0, FREC_COUNT_LINES, &lines);
+    ck_assert(ret == REG_OK);
+    ck_assert_msg(lines == curr.lines,
+        "Incorrect line count: expected '%zu', got '%zu' for text '%s'",
+        curr.lines, lines, curr.text
+    );
+
+    frec_mregfree(&preg);
+}
+END_TEST
+
+
+Suite *create_count_suite()
+{
+    Suite *suite = suite_create("Counting");
+
+    TCase *tc_single = tcase_create("Single patterns");
+    tcase_add_loop_test(tc_single, loop_test_count__single__counts_ok, 0, INPUT_LEN);
+
+    TCase *tc_multi = tcase_create("Multiple patterns");
+    tcase_add_loop_test(tc_multi, loop_test_count__multi__counts_ok, 0, MINPUT_LEN);
+
+    suite_add_tcase(suite, tc_single);
+    suite_add_tcase(suite, tc_multi);
+
+    return suite;
+}
+
+int main(void)
+{
+    Suite *suite = create_count_suite();
+    SRunner *runner = srunner_create(suite);
+
+    srunner_run_all(runner, CK_NORMAL);
+    int failed = srunner_ntests_failed(runner);
+    srunner_free(runner);
+
+    return (failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,197 @@
+#include <check.h>
+#include <frec.h>
+#include <string.h>
+
+#include "compile.h"
+#include "dfa.h"
+#include "match.h"
+#include "string-type.h"
+
+typedef struct dfa_tuple {
+    const char *pattern;
+    int cflags;
+} dfa_tuple;
+
+#define INPUT_LEN 26
+static dfa_tuple inputs[INPUT_LEN] = {
+    // Brackets and wildcards:
+    {"[0-9]+", REG_EXTENDED},
+    {"a.c", 0},
+    {"[^a-c]x", REG_EXTENDED},
+    {"[[:alpha:]][[:digit:]]*", 0},
+    {"x.*y", 0},
+    {"x.*y", REG_NEWLINE},
+
+    // Alternation and grouping:
+    {"ab|cd", REG_EXTENDED},
+    {"(a|ab)(c|bcd)", REG_EXTENDED},
+    {"(ab)*c", REG_EXTENDED},
+    {"a\\(bc\\)*d", 0},
+    {"(a|b)+b", REG_EXTENDED},
+
+    // Intervals:
+    {"a{2,3}", REG_EXTENDED},
+    {"b{2,}c", REG_EXTENDED},
+    {"(ab){1,2}", REG_EXTENDED},
+    {"a\\{2\\}", 0},
+
+    // Anchors:
+    {"^ab", 0},
+    {"ab$", 0},
+    {"^ab", REG_NEWLINE},
+    {"ab$", REG_NEWLINE},
+    {"^$", REG_NEWLINE},
+    {"^[a-z]+$", REG_EXTENDED | REG_NEWLINE},
+    {"b*$", REG_EXTENDED},
+
+    // Case insensitivity:
+    {"AbC", REG_ICASE},
+    {"[a-c]+x", REG_EXTENDED | REG_ICASE},
+
+    // Optional parts and empty matches:
+    {"a?b?", REG_EXTENDED},
+    {"x*", 0}
+};
+
+#define TEXT_LEN 12
+static const char *texts[TEXT_LEN] = {
+    "", "abc", "xabcd abcd", "ab\nab\n", "ABC abc", "aaaa bbbc",
+    "x12y x\ny", "\n\nab\n", "ababc", "zzz", "a1b22 c333", "bbb"
+};
+
+static int eflags[3] = {0, REG_NOTBOL, REG_NOTEOL};
+
+START_TEST(loop_test_dfa__matches_like_original)
+{
+    dfa_tuple curr = inputs[_i];
+
+    frec_t preg;
+    int ret = frec_regcomp(&preg, curr.pattern, curr.cflags);
+    ck_assert(ret == REG_OK);
+
+    // Compile a DFA regardless of the other matchers of the pattern.
+    dfa_comp dfa;
+    string pattern;
+    string_borrow(&pattern, curr.pattern, strlen(curr.pattern), false);
+    ret = dfa_compile(&dfa, pattern, curr.cflags);
+    ck_assert_msg(ret == REG_OK,
+        "dfa_compile failed: returned '%d' for pattern '%s'", ret, curr.pattern
+    );
+    dfa_context *ctx = dfa_context_create(&dfa);
+    ck_assert(ctx != NULL);
+
+    // Detach the other matchers, so that only the original one is used.
+    // Its automaton is compiled first, as the copy must not compile it.
+    ck_assert(frec_compile_original(&preg) == REG_OK);
+    frec_t orig = preg;
+    orig.boyer_moore = NULL;
+    orig.heuristic = NULL;
+    orig.dfa = NULL;
+
+    for (size_t i = 0; i < TEXT_LEN; i++) {
+        for (size_t j = 0; j < 3; j++) {
+            string text;
+            string_borrow(&text, texts[i], strlen(texts[i]), false);
+
+            frec_match_t expected;
+            int exp_ret = frec_match(&expected, 1, &orig, text, eflags[j], NULL);
+
+            frec_match_t actual;
+            ret = dfa_execute(&actual, &dfa, ctx, text, eflags[j], true);
+
+            ck_assert_msg(ret == exp_ret,
+                "Incorrect return value: expected '%d', got '%d' "
+                "for pattern '%s' on text '%s'",
+                exp_ret, ret, curr.pattern, texts[i]
+            );
+            if (ret == REG_OK) {
+                ck_assert_msg(
+                    actual.soffset == expected.soffset
+                    && actual.eoffset == expected.eoffset,
+                    "Incorrect match: expected '%zd-%zd', got '%zd-%zd' "
+                    "for pattern '%s' on text '%s'",
+                    expected.soffset, expected.eoffset,
+                    actual.soffset, actual.eoffset, curr.pattern, texts[i]
+                );
+            }
+
+            // Without bounds, only the return value is computed.
+            ret = dfa_execute(NULL, &dfa, ctx, text, eflags[j], false);
+            ck_assert(ret == exp_ret);
+        }
+    }
+
+    dfa_context_free(ctx);
+    dfa_comp_free(&dfa);
+    frec_regfree(&preg);
+}
+END_TEST
+
+#define UNSUPPORTED_LEN 4
+static dfa_tuple unsupported[UNSUPPORTED_LEN] = {
+    {"\\(a\\)\\1", 0},
+    {"(a)\\1", REG_EXTENDED},
+    {"a\\w", REG_EXTENDED},
+    {"a|", REG_EXTENDED}
+};
+
+START_TEST(loop_test_dfa__unsupported_patterns_rejected)
+{
+    dfa_tuple curr = unsupported[_i];
+
+    dfa_comp dfa;
+    string pattern;
+    string_borrow(&pattern, curr.pattern, strlen(curr.pattern), false);
+
+    int ret = dfa_compile(&dfa, pattern, curr.cflags);
+    ck_assert_msg(ret == REG_BADPAT,
+        "dfa_compile accepted unsupported pattern '%s'", curr.pattern
+    );
+}
+END_TEST
+
+START_TEST(test_dfa__used_by_regexec)
+{
+    frec_t preg;
+    int ret = frec_regcomp(&preg, "[0-9]+[a-z]", REG_EXTENDED);
+    ck_assert(ret == REG_OK);
+    ck_assert(preg.dfa != NULL);
+
+    frec_match_t pmatch;
+    ret = frec_regexec(&preg, "ab 12 345x", 1, &pmatch, 0);
+    ck_assert(ret == REG_OK);
+    ck_assert(pmatch.soffset == 6 && pmatch.eoffset == 10);
+
+    frec_regfree(&preg);
+}
+END_TEST
+
+
+Suite *create_dfa_suite()
+{
+    Suite *suite = suite_create("Lazy DFA");
+
+    TCase *tc_match = tcase_create("Matching");
+    tcase_add_loop_test(tc_match, loop_test_dfa__matches_like_original, 0, INPUT_LEN);
+    tcase_add_test(tc_match, test_dfa__used_by_regexec);
+
+    TCase *tc_compile = tcase_create("Compilation");
+    tcase_add_loop_test(tc_compile, loop_test_dfa__unsupported_patterns_rejected, 0, UNSUPPORTED_LEN);
+
+    suite_add_tcase(suite, tc_match);
+    suite_add_tcase(suite, tc_compile);
+
+    return suite;
+}
+
+int main(void)
+{
+    Suite *suite = create_dfa_suite();
+    SRunner *runner = srunner_create(suite);
+
+    srunner_run_all(runner, CK_NORMAL);
+    int failed = srunner_ntests_failed(runner);
+    srunner_free(runner);
+
+    return (failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
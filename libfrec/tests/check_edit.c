@@ -0,0 +1,339 @@
+#include <check.h>
+#include <frec.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "ac-type.h"
+#include "teddy-type.h"
+#include "wm-type.h"
+
+#define SET_LEN 200
+// Large enough to be matched by Aho-Corasick.
+#define AC_SET_LEN 1500
+static char storage[SET_LEN][16];
+static const char *patterns[SET_LEN];
+
+// Fills the patterns with long literals, that are matched by Wu-Manber.
+static void
+generate_set(void)
+{
+    for (int i = 0; i < SET_LEN; i++) {
+        snprintf(storage[i], 16, "word%04d", i * 37 % SET_LEN);
+        patterns[i] = storage[i];
+    }
+}
+
+// Matches the text with the set, and checks the bounds and the id.
+static void
+assert_match(const mfrec_t *preg, const char *text,
+    int exp_ret, ssize_t so, ssize_t eo, ssize_t id)
+{
+    frec_match_t match;
+    int ret = frec_mregexec(preg, text, 1, &match, 0);
+
+    ck_assert_msg(ret == exp_ret,
+        "Incorrect return value: expected '%d', got '%d' on text '%s'",
+        exp_ret, ret, text
+    );
+    if (ret == REG_OK) {
+        ck_assert_msg(
+            match.soffset == so && match.eoffset == eo && match.pattern_id == id,
+            "Incorrect match: expected '%zd-%zd' of '%zd', got '%zd-%zd' of '%zd' "
+            "on text '%s'",
+            so, eo, id, match.soffset, match.eoffset, match.pattern_id, text
+        );
+    }
+}
+
+START_TEST(test_edit__add_to_small_set)
+{
+    const char *initial[2] = {"needle", "hay"};
+    mfrec_t preg;
+    ck_assert(frec_mregcomp(&preg, 2, initial, 0) == REG_OK);
+
+    size_t id;
+    ck_assert(frec_madd(&preg, "stack", &id) == REG_OK);
+    ck_assert(id == 2 && preg.count == 3);
+    ck_assert(preg.teddy != NULL && preg.teddy->edits == 1);
+
+    assert_match(&preg, "a stack of hay", REG_OK, 2, 7, 2);
+    assert_match(&preg, "no match", REG_NOMATCH, 0, 0, 0);
+
+    // Patterns that aren't literal change the strategy of the set.
+    ck_assert(frec_madd(&preg, "n[0-9]*x", &id) == REG_OK);
+    ck_assert(id == 3 && !preg.are_literal);
+    assert_match(&preg, "an n42x stack", REG_OK, 3, 7, 3);
+
+    // Invalid patterns leave the set as it was.
+    ck_assert(frec_madd(&preg, "[a", &id) == REG_EBRACK);
+    ck_assert(preg.count == 4);
+    assert_match(&preg, "the hay", REG_OK, 4, 7, 1);
+
+    frec_mregfree(&preg);
+}
+END_TEST
+
+START_TEST(test_edit__add_to_large_set)
+{
+    generate_set();
+
+    mfrec_t preg;
+    ck_assert(frec_mregcomp(&preg, SET_LEN - 1, patterns, 0) == REG_OK);
+    ck_assert(preg.wu_manber != NULL);
+
+    // Long enough literals are added to the Wu-Manber tables directly.
+    size_t id;
+    ck_assert(frec_madd(&preg, patterns[SET_LEN - 1], &id) == REG_OK);
+    ck_assert(id == SET_LEN - 1);
+    ck_assert(preg.wu_manber != NULL && preg.wu_manber->edits == 1);
+
+    mfrec_t fresh;
+    ck_assert(frec_mregcomp(&fresh, SET_LEN, patterns, 0) == REG_OK);
+
+    for (int i = 0; i < SET_LEN; i++) {
+        char text[32];
+        snprintf(text, sizeof(text), "a %s!", patterns[i]);
+
+        frec_match_t expected;
+        ck_assert(frec_mregexec(&fresh, text, 1, &expected, 0) == REG_OK);
+        assert_match(&preg, text, REG_OK,
+            expected.soffset, expected.eoffset, expected.pattern_id);
+    }
+
+    // A shorter pattern doesn't fit the tables, so they are compiled again.
+    ck_assert(frec_madd(&preg, "ab", &id) == REG_OK);
+    ck_assert(preg.wu_manber == NULL || preg.wu_manber->edits == 0);
+    assert_match(&preg, "word0037 ab", REG_OK, 0, 8, 1);
+    assert_match(&preg, "xx ab", REG_OK, 3, 5, SET_LEN);
+
+    frec_mregfree(&fresh);
+    frec_mregfree(&preg);
+}
+END_TEST
+
+START_TEST(test_edit__edit_aho_corasick_set)
+{
+    static char storage[AC_SET_LEN + 70][8];
+    static const char *literals[AC_SET_LEN + 70];
+    for (int i = 0; i < AC_SET_LEN + 70; i++) {
+        snprintf(storage[i], 8, (i < AC_SET_LEN) ? "k%03x" : "m%03x", i);
+        literals[i] = storage[i];
+    }
+
+    mfrec_t preg;
+    ck_assert(frec_mregcomp(&preg, AC_SET_LEN - 20, literals, 0) == REG_OK);
+    ck_assert(preg.aho_corasick != NULL);
+
+    // Added patterns are kept in a second automaton, and removed ones are
+    // only marked, so the whole set isn't compiled again.
+    size_t id;
+    for (size_t i = AC_SET_LEN - 20; i < AC_SET_LEN; i++) {
+        ck_assert(frec_madd(&preg, literals[i], &id) == REG_OK);
+        ck_assert(id == i);
+    }
+    ck_assert(frec_mremove(&preg, 7) == REG_OK);
+    ck_assert(frec_mremove(&preg, AC_SET_LEN - 3) == REG_OK);
+    ck_assert(preg.aho_corasick != NULL && preg.aho_corasick->edits == 22);
+    ck_assert(preg.aho_corasick->base_count == AC_SET_LEN - 20);
+
+    for (int i = 0; i < AC_SET_LEN; i++) {
+        char text[32];
+        snprintf(text, sizeof(text), "a %s!", literals[i]);
+        if (i == 7 || i == AC_SET_LEN - 3) {
+            assert_match(&preg, text, REG_NOMATCH, 0, 0, 0);
+        } else {
+            assert_match(&preg, text, REG_OK, 2, 6, i);
+        }
+    }
+    assert_match(&preg, "xk5d2k001", REG_OK, 1, 5, 0x5d2);
+
+    // The lowest id is reported for the same literal, even after the
+    // pattern with that id is removed.
+    ck_assert(frec_madd(&preg, "k001", &id) == REG_OK);
+    ck_assert(id == AC_SET_LEN);
+    assert_match(&preg, "k001", REG_OK, 0, 4, 1);
+    ck_assert(frec_mremove(&preg, 1) == REG_OK);
+    assert_match(&preg, "k001", REG_OK, 0, 4, AC_SET_LEN);
+
+    // Enough added patterns are compiled into the set in one batch.
+    for (size_t i = AC_SET_LEN; i < AC_SET_LEN + 70; i++) {
+        ck_assert(frec_madd(&preg, literals[i], &id) == REG_OK);
+        ck_assert(id == i + 1);
+    }
+    ck_assert(preg.aho_corasick != NULL && preg.aho_corasick->edits < 70);
+    assert_match(&preg, "a m5dc k002", REG_OK, 2, 6, AC_SET_LEN + 1);
+    assert_match(&preg, "a k5d9 k001", REG_OK, 7, 11, AC_SET_LEN);
+
+    frec_mregfree(&preg);
+}
+END_TEST
+
+START_TEST(test_edit__remove)
+{
+    const char *initial[3] = {"needle", "hay", "stack"};
+    mfrec_t preg;
+    ck_assert(frec_mregcomp(&preg, 3, initial, 0) == REG_OK);
+
+    ck_assert(frec_mremove(&preg, 1) == REG_OK);
+    assert_match(&preg, "hay and stack", REG_OK, 8, 13, 2);
+    assert_match(&preg, "only hay", REG_NOMATCH, 0, 0, 0);
+
+    // Ids are never reused.
+    size_t id;
+    ck_assert(frec_madd(&preg, "hay", &id) == REG_OK);
+    ck_assert(id == 3);
+    assert_match(&preg, "only hay", REG_OK, 5, 8, 3);
+
+    // Removing every pattern leaves a set that never matches.
+    ck_assert(frec_mremove(&preg, 0) == REG_OK);
+    ck_assert(frec_mremove(&preg, 2) == REG_OK);
+    ck_assert(frec_mremove(&preg, 3) == REG_OK);
+    assert_match(&preg, "needle hay stack", REG_NOMATCH, 0, 0, 0);
+
+    frec_mregfree(&preg);
+}
+END_TEST
+
+START_TEST(test_edit__remove_non_literal)
+{
+    const char *initial[3] = {"ne+dle", "h[a-z]y", "[0-9]+x"};
+    mfrec_t preg;
+    ck_assert(frec_mregcomp(&preg, 3, initial, REG_EXTENDED) == REG_OK);
+
+    ck_assert(frec_mremove(&preg, 0) == REG_OK);
+    assert_match(&preg, "neeedle hey", REG_OK, 8, 11, 1);
+    ck_assert(frec_mremove(&preg, 1) == REG_OK);
+    assert_match(&preg, "neeedle hey 12x", REG_OK, 12, 15, 2);
+
+    size_t count;
+    ck_assert(frec_mregcount(&preg, "1x hey 22x", 0, FREC_COUNT_MATCHES, &count) == REG_OK);
+    ck_assert(count == 2);
+
+    frec_mregfree(&preg);
+}
+END_TEST
+
+START_TEST(test_edit__remove_from_large_set)
+{
+    generate_set();
+
+    mfrec_t preg;
+    ck_assert(frec_mregcomp(&preg, SET_LEN, patterns, 0) == REG_OK);
+    ck_assert(preg.wu_manber != NULL);
+
+    // Removed patterns stay in the tables until there are enough of them,
+    // then the tables are compiled again.
+    for (size_t i = 0; i < SET_LEN; i++) {
+        if (i % 10 != 0) {
+            ck_assert(frec_mremove(&preg, i) == REG_OK);
+        }
+        if (i == SET_LEN / 2) {
+            ck_assert(preg.wu_manber != NULL && preg.wu_manber->edits == 90);
+        }
+    }
+
+    for (int i = 0; i < SET_LEN; i++) {
+        char text[32];
+        snprintf(text, sizeof(text), "a %s!", patterns[i]);
+        if (i % 10 != 0) {
+            assert_match(&preg, text, REG_NOMATCH, 0, 0, 0);
+        } else {
+            assert_match(&preg, text, REG_OK, 2, 10, i);
+        }
+    }
+
+    frec_mregfree(&preg);
+}
+END_TEST
+
+START_TEST(test_edit__invalid_removal)
+{
+    const char *initial[2] = {"needle", "hay"};
+    mfrec_t preg;
+    ck_assert(frec_mregcomp(&preg, 2, initial, 0) == REG_OK);
+
+    ck_assert(frec_mremove(&preg, 2) == REG_BADPAT);
+    ck_assert(frec_mremove(&preg, 0) == REG_OK);
+    ck_assert(frec_mremove(&preg, 0) == REG_BADPAT);
+
+    // Patterns of the other width can't be added.
+    size_t id;
+    ck_assert(frec_mwadd(&preg, L"stack", &id) == REG_BADPAT);
+
+    frec_mregfree(&preg);
+}
+END_TEST
+
+START_TEST(test_edit__serialize_edited_set)
+{
+    generate_set();
+
+    mfrec_t preg;
+    ck_assert(frec_mregcomp(&preg, SET_LEN - 1, patterns, 0) == REG_OK);
+
+    size_t id;
+    ck_assert(frec_madd(&preg, patterns[SET_LEN - 1], &id) == REG_OK);
+    ck_assert(frec_mremove(&preg, 5) == REG_OK);
+
+    void *blob;
+    size_t len;
+    ck_assert(frec_mserialize(&preg, &blob, &len) == REG_OK);
+
+    mfrec_t loaded;
+    ck_assert(frec_mdeserialize(&loaded, blob, len) == REG_OK);
+    ck_assert(loaded.count == SET_LEN);
+
+    for (int i = 0; i < SET_LEN; i++) {
+        char text[32];
+        snprintf(text, sizeof(text), "a %s!", patterns[i]);
+        if (i == 5) {
+            assert_match(&loaded, text, REG_NOMATCH, 0, 0, 0);
+        } else {
+            assert_match(&loaded, text, REG_OK, 2, 10, i);
+        }
+    }
+
+    // The loaded set can be edited too.
+    ck_assert(frec_madd(&loaded, "needle", &id) == REG_OK);
+    assert_match(&loaded, "a needle", REG_OK, 2, 8, SET_LEN);
+
+    frec_mregfree(&loaded);
+    free(blob);
+    frec_mregfree(&preg);
+}
+END_TEST
+
+
+Suite *create_edit_suite()
+{
+    Suite *suite = suite_create("Incremental edits");
+
+    TCase *tc_add = tcase_create("Adding patterns");
+    tcase_add_test(tc_add, test_edit__add_to_small_set);
+    tcase_add_test(tc_add, test_edit__add_to_large_set);
+    tcase_add_test(tc_add, test_edit__edit_aho_corasick_set);
+
+    TCase *tc_remove = tcase_create("Removing patterns");
+    tcase_add_test(tc_remove, test_edit__remove);
+    tcase_add_test(tc_remove, test_edit__remove_non_literal);
+    tcase_add_test(tc_remove, test_edit__remove_from_large_set);
+    tcase_add_test(tc_remove, test_edit__invalid_removal);
+    tcase_add_test(tc_remove, test_edit__serialize_edited_set);
+
+    suite_add_tcase(suite, tc_add);
+    suite_add_tcase(suite, tc_remove);
+
+    return suite;
+}
+
+int main(void)
+{
+    Suite *suite = create_edit_suite();
+    SRunner *runner = srunner_create(suite);
+
+    srunner_run_all(runner, CK_NORMAL);
+    int failed = srunner_ntests_failed(runner);
+    srunner_free(runner);
+
+    return (failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,218 @@
+#include <check.h>
+#include <frec.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+
+#define READER_COUNT 4
+#define PUBLISH_COUNT 200
+#define SET_LEN 100
+
+// Two versions of a pattern set. Both are large enough to use Wu-Manber,
+// and each one only matches its own word of the text.
+static char storage[2][SET_LEN][16];
+static const char *patterns[2][SET_LEN];
+static const char *text = "an alpha0042 and a beta0042";
+
+static void
+generate_sets(void)
+{
+    const char *prefixes[2] = {"alpha", "beta"};
+
+    for (int v = 0; v < 2; v++) {
+        for (int i = 0; i < SET_LEN; i++) {
+            snprintf(storage[v][i], 16, "%s%04d", prefixes[v], i);
+            patterns[v][i] = storage[v][i];
+        }
+    }
+}
+
+static void
+compile_version(mfrec_t *preg, int v)
+{
+    ck_assert(frec_mregcomp(preg, SET_LEN, patterns[v], 0) == REG_OK);
+}
+
+// Returns which version found the match, or -1 if the match is incorrect.
+static int
+match_version(const mfrec_t *preg)
+{
+    frec_match_t match;
+    if (frec_mregexec(preg, text, 1, &match, 0) != REG_OK
+        || match.pattern_id != 42) {
+        return -1;
+    }
+
+    if (match.soffset == 3 && match.eoffset == 12) {
+        return 0;
+    } else if (match.soffset == 19 && match.eoffset == 27) {
+        return 1;
+    }
+    return -1;
+}
+
+START_TEST(test_handle__publish)
+{
+    generate_sets();
+
+    mfrec_t preg;
+    compile_version(&preg, 0);
+
+    frec_handle_t handle;
+    ck_assert(frec_handle_init(&handle, &preg) == REG_OK);
+
+    frec_reader_t reader;
+    ck_assert(frec_reader_init(&reader, &handle) == REG_OK);
+
+    ck_assert(match_version(frec_reader_pin(&reader)) == 0);
+    frec_reader_unpin(&reader);
+
+    compile_version(&preg, 1);
+    ck_assert(frec_handle_publish(&handle, &preg) == REG_OK);
+
+    // Nothing was pinned, so the first version was freed right away.
+    ck_assert(frec_handle_reclaim(&handle) == 0);
+    ck_assert(match_version(frec_reader_pin(&reader)) == 1);
+    frec_reader_unpin(&reader);
+
+    frec_reader_free(&reader);
+    frec_handle_free(&handle);
+}
+END_TEST
+
+START_TEST(test_handle__pinned_version_kept)
+{
+    generate_sets();
+
+    mfrec_t preg;
+    compile_version(&preg, 0);
+
+    frec_handle_t handle;
+    ck_assert(frec_handle_init(&handle, &preg) == REG_OK);
+
+    frec_reader_t old_reader;
+    frec_reader_t new_reader;
+    ck_assert(frec_reader_init(&old_reader, &handle) == REG_OK);
+    ck_assert(frec_reader_init(&new_reader, &handle) == REG_OK);
+
+    const mfrec_t *pinned = frec_reader_pin(&old_reader);
+
+    compile_version(&preg, 1);
+    ck_assert(frec_handle_publish(&handle, &preg) == REG_OK);
+
+    // The old version stays usable while it is pinned, but new pins see
+    // the new version.
+    ck_assert(frec_handle_reclaim(&handle) == 1);
+    ck_assert(match_version(pinned) == 0);
+    ck_assert(match_version(frec_reader_pin(&new_reader)) == 1);
+
+    frec_reader_unpin(&old_reader);
+    ck_assert(frec_handle_reclaim(&handle) == 0);
+    frec_reader_unpin(&new_reader);
+
+    frec_reader_free(&old_reader);
+    frec_reader_free(&new_reader);
+    frec_handle_free(&handle);
+}
+END_TEST
+
+typedef struct reader_task {
+    frec_handle_t *handle;
+    volatile int *done;
+    int errors;
+} reader_task;
+
+static void *
+run_reader(void *arg)
+{
+    reader_task *task = arg;
+
+    frec_reader_t reader;
+    frec_reader_init(&reader, task->handle);
+
+    while (!__atomic_load_n(task->done, __ATOMIC_ACQUIRE)) {
+        if (match_version(frec_reader_pin(&reader)) == -1) {
+            task->errors++;
+        }
+        frec_reader_unpin(&reader);
+    }
+
+    frec_reader_free(&reader);
+    return NULL;
+}
+
+START_TEST(test_handle__concurrent_readers)
+{
+    generate_sets();
+
+    mfrec_t preg;
+    compile_version(&preg, 0);
+
+    frec_handle_t handle;
+    ck_assert(frec_handle_init(&handle, &preg) == REG_OK);
+
+    volatile int done = 0;
+    pthread_t threads[READER_COUNT];
+    reader_task tasks[READER_COUNT];
+    for (int t = 0; t < READER_COUNT; t++) {
+        tasks[t] = (reader_task) {&handle, &done, 0};
+        ck_assert(pthread_create(&threads[t], NULL, run_reader, &tasks[t]) == 0);
+    }
+
+    // Replace the set while the readers are matching with it.
+    for (int i = 1; i <= PUBLISH_COUNT; i++) {
+        compile_version(&preg, i % 2);
+        ck_assert(frec_handle_publish(&handle, &preg) == REG_OK);
+    }
+    __atomic_store_n(&done, 1, __ATOMIC_RELEASE);
+
+    for (int t = 0; t < READER_COUNT; t++) {
+        ck_assert(pthread_join(threads[t], NULL) == 0);
+        ck_assert_msg(tasks[t].errors == 0,
+            "Reader %d got %d incorrect results", t, tasks[t].errors
+        );
+    }
+
+    // Every reader is gone, so only the last version is left.
+    ck_assert(frec_handle_reclaim(&handle) == 0);
+
+    frec_reader_t reader;
+    ck_assert(frec_reader_init(&reader, &handle) == REG_OK);
+    ck_assert(match_version(frec_reader_pin(&reader)) == PUBLISH_COUNT % 2);
+    frec_reader_unpin(&reader);
+    frec_reader_free(&reader);
+
+    frec_handle_free(&handle);
+}
+END_TEST
+
+
+Suite *create_handle_suite()
+{
+    Suite *suite = suite_create("Hot swap");
+
+    TCase *tc_publish = tcase_create("Publishing");
+    tcase_add_test(tc_publish, test_handle__publish);
+    tcase_add_test(tc_publish, test_handle__pinned_version_kept);
+
+    TCase *tc_concurrent = tcase_create("Concurrent readers");
+    tcase_add_test(tc_concurrent, test_handle__concurrent_readers);
+    tcase_set_timeout(tc_concurrent, 60);
+
+    suite_add_tcase(suite, tc_publish);
+    suite_add_tcase(suite, tc_concurrent);
+
+    return suite;
+}
+
+int main(void)
+{
+    Suite *suite = create_handle_suite();
+    SRunner *runner = srunner_create(suite);
+
+    srunner_run_all(runner, CK_NORMAL);
+    int failed = srunner_ntests_failed(runner);
+    srunner_free(runner);
+
+    return (failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,118 @@
+#include <check.h>
+#include <frec.h>
+#include <stdlib.h>
+#include "hashtable.h"
+
+/*
+ * Fills a table with count integer keys, each mapped to its square.
+ * Starts from a small size hint, so that the table has to grow.
+ */
+static hashtable *
+create_filled(int count)
+{
+    hashtable *tbl = hashtable_init(4, sizeof(int), sizeof(long));
+    ck_assert_msg(tbl != NULL, "Initialization failed");
+
+    for (int i = 0; i < count; i++) {
+        long value = (long) i * i;
+        int ret = hashtable_put(tbl, &i, &value);
+        ck_assert_msg(ret == HASH_OK,
+            "Insertion failed: returned '%d' for key '%d'", ret, i);
+    }
+
+    return tbl;
+}
+
+START_TEST(test_hash__put_and_get__values_ok)
+{
+    hashtable *tbl = create_filled(1000);
+
+    for (int i = 0; i < 1000; i++) {
+        const long *value = hashtable_get(tbl, &i);
+        ck_assert_msg(value != NULL && *value == (long) i * i,
+            "Lookup returned incorrect value for key '%d'", i);
+    }
+
+    int missing = 1000;
+    ck_assert_msg(hashtable_get(tbl, &missing) == NULL,
+        "Lookup of a missing key did not return NULL");
+
+    hashtable_free(tbl);
+}
+END_TEST
+
+START_TEST(test_hash__put__update_ok)
+{
+    hashtable *tbl = create_filled(10);
+
+    int key = 5;
+    long value = -1;
+    int ret = hashtable_put(tbl, &key, &value);
+    ck_assert_msg(ret == HASH_UPDATED,
+        "Update of an existing key returned '%d'", ret);
+
+    const long *stored = hashtable_get(tbl, &key);
+    ck_assert_msg(stored != NULL && *stored == -1,
+        "Lookup did not return the updated value");
+
+    hashtable_free(tbl);
+}
+END_TEST
+
+START_TEST(test_hash__remove__others_remain)
+{
+    hashtable *tbl = create_filled(1000);
+
+    // Remove every third key, the rest must still be reachable.
+    for (int i = 0; i < 1000; i += 3) {
+        int ret = hashtable_remove(tbl, &i);
+        ck_assert_msg(ret == HASH_OK,
+            "Removal failed: returned '%d' for key '%d'", ret, i);
+    }
+
+    for (int i = 0; i < 1000; i++) {
+        const long *value = hashtable_get(tbl, &i);
+        if (i % 3 == 0) {
+            ck_assert_msg(value == NULL, "Removed key '%d' was found", i);
+        } else {
+            ck_assert_msg(value != NULL && *value == (long) i * i,
+                "Lookup returned incorrect value for key '%d'", i);
+        }
+    }
+
+    int key = 0;
+    ck_assert_msg(hashtable_remove(tbl, &key) == HASH_NOTFOUND,
+        "Removal of a missing key did not return HASH_NOTFOUND");
+
+    hashtable_free(tbl);
+}
+END_TEST
+
+static Suite *
+create_suite()
+{
+    Suite *suite = suite_create("Hashtable");
+
+    TCase *tc_ops = tcase_create("Operations");
+
+    tcase_add_test(tc_ops, test_hash__put_and_get__values_ok);
+    tcase_add_test(tc_ops, test_hash__put__update_ok);
+    tcase_add_test(tc_ops, test_hash__remove__others_remain);
+
+    suite_add_tcase(suite, tc_ops);
+
+    return suite;
+}
+
+int
+main(void)
+{
+    Suite *suite = create_suite();
+    SRunner *runner = srunner_create(suite);
+
+    srunner_run_all(runner, CK_NORMAL);
+    int failed = srunner_ntests_failed(runner);
+    srunner_free(runner);
+
+    return (failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -2,6 +2,7 @@
 #include <check.h>
 #include <frec.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "heuristic.h"
 
@@ -86,9 +87,9 @@ static heur_tuple prefix_successes[PREF_SUCC_LEN] = {
 
     /* Specific syntaxes which can include newlines with unknown max length */
     {L"literal[^x]x*", REG_EXTENDED, L"literal"},
-    {L"literal[\n]x*", REG_EXTENDED, L"literal"},
-    {L"literal(.)", REG_EXTENDED, L"literal"},
-    {L"literal(\n)", REG_EXTENDED, L"literal"},
+    {L"literal[\n]x*", REG_EXTENDED, L"literal\n"},
+    {L"literal(.)+", REG_EXTENDED, L"literal"},
+    {L"literal(\n)+", REG_EXTENDED, L"literal\n"},
     {L"literal.x*", REG_EXTENDED, L"literal"},
     {L"literal.+", REG_EXTENDED, L"literal"},
 };
@@ -108,10 +109,10 @@ static heur_tuple longest_successes[LONG_SUCC_LEN] = {
     {L"literal.", 0, L"literal"},
     {L"literal.", REG_EXTENDED, L"literal"},
     /* BRE and ERE inverted */
-    {L"literal\\(grp\\)", 0, L"literal"},
-    {L"literal(grp)", REG_EXTENDED, L"literal"},
-    {L"literalx\\{1,2\\}", 0, L"literal"},
-    {L"literalx{1,2}", REG_EXTENDED, L"literal"},
+    {L"literal\\(grp\\)", 0, L"literalgrp"},
+    {L"literal(grp)", REG_EXTENDED, L"literalgrp"},
+    {L"literalx\\{1,2\\}", 0, L"literalx"},
+    {L"literalx{1,2}", REG_EXTENDED, L"literalx"},
     /* Only in ERE */
     {L"literal+", REG_EXTENDED, L"literal"},
     {L"literalx?", REG_EXTENDED, L"literal"},
@@ -126,12 +127,12 @@ static heur_tuple longest_successes[LONG_SUCC_LEN] = {
     {L".literal", 0, L"literal"},
     {L".literal", REG_EXTENDED, L"literal"},
     /* BRE and ERE inverted */
-    {L"\\(grp\\)literal", 0, L"literal"},
-    {L"(grp)literal", REG_EXTENDED, L"literal"},
-    {L"x\\{1,2\\}literal", 0, L"literal"},
-    {L"x{1,2}literal", REG_EXTENDED, L"literal"},
+    {L"\\(grp\\)literal", 0, L"grpliteral"},
+    {L"(grp)literal", REG_EXTENDED, L"grpliteral"},
+    {L"x\\{1,2\\}literal", 0, L"xliteral"},
+    {L"x{1,2}literal", REG_EXTENDED, L"xliteral"},
     /* Only in ERE */
-    {L"x+literal", REG_EXTENDED, L"literal"},
+    {L"x+literal", REG_EXTENDED, L"xliteral"},
     {L"x?literal", REG_EXTENDED, L"literal"}
 };
 
@@ -180,6 +181,446 @@ START_TEST(loop_test_heur__successes__longest_succeeds)
 END_TEST
 
 
+typedef struct fragment_tuple {
+    const wchar_t *pattern;
+    int flags;
+    const wchar_t *expected_segment;
+    const wchar_t *expected_fragments[3];
+} fragment_tuple;
+
+/* Every other required fragment is kept, rarest first. */
+#define FRAG_LEN 7
+static fragment_tuple fragments[FRAG_LEN] = {
+    {L"foo[0-9]+bar.*baz", REG_EXTENDED, L"foo", {L"baz", L"bar"}},
+    {L"ab.longer.c", 0, L"longer", {L"ab", L"c"}},
+    {L"pre(grp)post_long", REG_EXTENDED, L"pregrppost_long", {NULL}},
+    {L"x*literal", 0, L"literal", {NULL}},
+    {L"a[0-9]bc\\{2\\}de", 0, L"bccde", {L"a"}},
+    {L"x*the.*qz", REG_NEWLINE, L"qz", {L"the"}},
+    {L"[0-9]eeee.*zq", REG_NEWLINE, L"zq", {L"eeee"}}
+};
+
+START_TEST(loop_test_heur__fragments__others_kept)
+{
+    fragment_tuple current = fragments[_i];
+    heur *heur = run_and_return_prep(current.pattern, current.flags);
+
+    int cmp = wcscmp(current.expected_segment, heur->literal_comp.pattern.wide);
+    ck_assert_msg(cmp == 0,
+        "Preprocessing returned incorrect heuristic segment: returned '%ls', expected '%ls' for pattern '%ls'",
+        heur->literal_comp.pattern.wide, current.expected_segment, current.pattern
+    );
+
+    ssize_t count = 0;
+    while (count < 3 && current.expected_fragments[count] != NULL) {
+        count++;
+    }
+    ck_assert_msg(heur->fragment_count == count,
+        "Preprocessing kept '%zd' fragments instead of '%zd' for pattern '%ls'",
+        heur->fragment_count, count, current.pattern
+    );
+
+    for (ssize_t i = 0; i < count; i++) {
+        cmp = wcscmp(current.expected_fragments[i], heur->fragments[i].pattern.wide);
+        ck_assert_msg(cmp == 0,
+            "Incorrect fragment: returned '%ls', expected '%ls' for pattern '%ls'",
+            heur->fragments[i].pattern.wide, current.expected_fragments[i], current.pattern
+        );
+    }
+
+    frec_free_heur(heur);
+}
+END_TEST
+
+START_TEST(test_heur__fragments__trained_pairs)
+{
+    frec_t preg;
+    unsigned int untrained;
+    ck_assert(frec_regcomp(&preg, "x*the.*qz", REG_NEWLINE) == REG_OK);
+    ck_assert(frec_literal_score(&preg, &untrained) == REG_OK);
+    frec_regfree(&preg);
+
+    // In this sample, "qz" is common, but "the" never occurs.
+    const char *sample = "qzqzqzqz qzqz qz qzqzqz tt hh ee qzqzqz qzqz";
+    frec_train_byte_freq(sample, strlen(sample));
+
+    ck_assert(frec_regcomp(&preg, "x*the.*qz", REG_NEWLINE) == REG_OK);
+    ck_assert(preg.heuristic != NULL && preg.heuristic->literal_comp.pattern.len == 3);
+
+    unsigned int trained;
+    ck_assert(frec_literal_score(&preg, &trained) == REG_OK);
+    ck_assert_msg(trained > untrained,
+        "Trained score '%u' isn't higher than '%u'", trained, untrained
+    );
+    frec_regfree(&preg);
+
+    frec_train_byte_freq(NULL, 0);
+}
+END_TEST
+
+START_TEST(test_heur__fragments__candidates_rejected)
+{
+    frec_t preg;
+    ck_assert(frec_regcomp(&preg, "foo[0-9]+bar.*baz", REG_EXTENDED) == REG_OK);
+    ck_assert(preg.heuristic != NULL && preg.heuristic->fragment_count == 2);
+
+    frec_match_t pmatch;
+    ck_assert(frec_regexec(&preg, "foo1bar and foo2 bar", 1, &pmatch, 0) == REG_NOMATCH);
+    ck_assert(frec_regexec(&preg, "foo1 bar baz\nfoo2barbaz", 1, &pmatch, 0) == REG_OK);
+    ck_assert(pmatch.soffset == 13 && pmatch.eoffset == 23);
+    ck_assert(frec_regexec(&preg, "a foo12bar, then baz", 1, &pmatch, 0) == REG_OK);
+    ck_assert(pmatch.soffset == 2 && pmatch.eoffset == 20);
+
+    frec_regfree(&preg);
+}
+END_TEST
+
+START_TEST(test_heur__fragments__tied_literals)
+{
+    // The literals of both patterns start at the same position, but only
+    // the pattern with the higher id matches there.
+    const char *patterns[2] = {"c(foo|bar)[^a]", ".c"};
+    mfrec_t mpreg;
+    frec_match_t pmatch;
+    ck_assert(frec_mregcomp(&mpreg, 2, patterns, REG_EXTENDED) == REG_OK);
+    ck_assert(frec_mregexec(&mpreg, "xxEycaof", 1, &pmatch, 0) == REG_OK);
+    ck_assert(pmatch.soffset == 3 && pmatch.eoffset == 5 && pmatch.pattern_id == 1);
+    frec_mregfree(&mpreg);
+}
+END_TEST
+
+typedef struct group_tuple {
+    const wchar_t *pattern;
+    int flags;
+    const wchar_t *expected_segment;
+    ssize_t expected_length;
+} group_tuple;
+
+/* Literals span the boundaries of groups and repetitions, whose lengths
+ * are bounded exactly. */
+#define GROUP_LEN 8
+static group_tuple groups[GROUP_LEN] = {
+    {L"(abc){2}def", REG_EXTENDED, L"abcabcdef", 9},
+    {L"\\(ab\\)\\{3\\}", 0, L"ababab", 6},
+    {L"(GET|POST) /api", REG_EXTENDED, L"T /api", 9},
+    {L"x(abc|abd)y", REG_EXTENDED, L"xab", 5},
+    {L"[0-9]{2,4}x", REG_EXTENDED, L"x", 5},
+    {L"ab(c(de)+)f", REG_EXTENDED, L"abcde", -1},
+    {L"a(b(cd)*e)?fgh", REG_EXTENDED | REG_NEWLINE, L"fgh", -1},
+    {L"k(x[0-9]){1,3}z", REG_EXTENDED, L"kx", 8}
+};
+
+START_TEST(loop_test_heur__groups__literals_joined)
+{
+    group_tuple current = groups[_i];
+    heur *heur = run_and_return_prep(current.pattern, current.flags);
+
+    int cmp = wcscmp(current.expected_segment, heur->literal_comp.pattern.wide);
+    ck_assert_msg(cmp == 0,
+        "Preprocessing returned incorrect heuristic segment: returned '%ls', expected '%ls' for pattern '%ls'",
+        heur->literal_comp.pattern.wide, current.expected_segment, current.pattern
+    );
+
+    ck_assert_msg(heur->max_length == current.expected_length,
+        "Preprocessing returned incorrect max length: returned '%zd', expected '%zd' for pattern '%ls'",
+        heur->max_length, current.expected_length, current.pattern
+    );
+
+    frec_free_heur(heur);
+}
+END_TEST
+
+START_TEST(test_heur__groups__matched)
+{
+    frec_t preg;
+    ck_assert(frec_regcomp(&preg, "(GET|POST) /api/(v[0-9]){1,2}", REG_EXTENDED) == REG_OK);
+    ck_assert(preg.heuristic != NULL && preg.heuristic->max_length == 14);
+
+    frec_match_t pmatch[3];
+    ck_assert(frec_regexec(&preg, "PUT /api/v1, GET /api/x", 1, pmatch, 0) == REG_NOMATCH);
+    ck_assert(frec_regexec(&preg, "PUT /api/v1, POST /api/v2v3", 3, pmatch, 0) == REG_OK);
+    ck_assert(pmatch[0].soffset == 13 && pmatch[0].eoffset == 27);
+    ck_assert(pmatch[1].soffset == 13 && pmatch[1].eoffset == 17);
+    ck_assert(pmatch[2].soffset == 25 && pmatch[2].eoffset == 27);
+    frec_regfree(&preg);
+
+    // The match doesn't contain the first candidate, so it reaches past the
+    // window around it.
+    ck_assert(frec_regcomp(&preg, "x[0-9].\\{1,2\\}[a-c]", 0) == REG_OK);
+    ck_assert(frec_regexec(&preg, "xx23barc", 1, pmatch, 0) == REG_OK);
+    ck_assert(pmatch[0].soffset == 1 && pmatch[0].eoffset == 6);
+
+    frec_regfree(&preg);
+
+    // Both literals of the set start at the same positions, and the
+    // pattern with the higher id matches first.
+    const char *patterns[2] = {"a{1,3}", "(a|b)a{1,3}"};
+    mfrec_t mpreg;
+    ck_assert(frec_mregcomp(&mpreg, 2, patterns, REG_EXTENDED) == REG_OK);
+    ck_assert(frec_mregexec(&mpreg, "cfb0baxzeaE0coyEx.\nyx", 1, pmatch, 0) == REG_OK);
+    ck_assert(pmatch[0].soffset == 4 && pmatch[0].eoffset == 6);
+    ck_assert(pmatch[0].pattern_id == 1);
+    frec_mregfree(&mpreg);
+}
+END_TEST
+
+typedef struct class_tuple {
+    const wchar_t *pattern;
+    int flags;
+    int expected_type;
+    ssize_t expected_count;             // 0 if a single fragment is searched.
+    const wchar_t *expected_segment;    // That fragment.
+} class_tuple;
+
+#define CLASS_LEN 8
+static class_tuple classes[CLASS_LEN] = {
+    {L"[Ee]rror", REG_EXTENDED, HEUR_LONGEST, 2, NULL},
+    {L"[Tt]imeout [0-9]", REG_EXTENDED, HEUR_LONGEST, 2, NULL},
+    {L"user[-_]id", 0, HEUR_LONGEST, 2, NULL},
+    {L"[Ee]rror.*", 0, HEUR_PREFIX, 2, NULL},
+    {L"[Ee]rror", REG_ICASE, HEUR_LONGEST, 0, L"error"},
+    {L"a[]]b", 0, HEUR_LONGEST, 0, L"a]b"},
+    {L"[a-z]bcd", 0, HEUR_LONGEST, 0, L"bcd"},
+    {L"[^E]rror.*", REG_NEWLINE, HEUR_LONGEST, 0, L"rror"}
+};
+
+START_TEST(loop_test_heur__classes__expanded)
+{
+    class_tuple current = classes[_i];
+    heur *heur = run_and_return_prep(current.pattern, current.flags);
+
+    ck_assert_msg(heur->heur_type == current.expected_type,
+        "Preprocessing returned incorrect heuristic type: returned '%d', expected '%d' for pattern '%ls'",
+        heur->heur_type, current.expected_type, current.pattern
+    );
+
+    // Wide literals are searched for with Wu-Manber.
+    if (current.expected_count > 0) {
+        ck_assert_msg(heur->wu_manber != NULL && heur->wu_manber->count == current.expected_count,
+            "Preprocessing returned incorrect variants for pattern '%ls'", current.pattern
+        );
+    } else {
+        ck_assert_msg(heur->wu_manber == NULL
+            && wcscmp(current.expected_segment, heur->literal_comp.pattern.wide) == 0,
+            "Preprocessing returned incorrect heuristic segment: returned '%ls', expected '%ls' for pattern '%ls'",
+            heur->literal_comp.pattern.wide, current.expected_segment, current.pattern
+        );
+    }
+
+    frec_free_heur(heur);
+}
+END_TEST
+
+START_TEST(test_heur__classes__matched)
+{
+    frec_t preg;
+    ck_assert(frec_regcomp(&preg, "[Ee]rror: [Tt]imeout", REG_EXTENDED) == REG_OK);
+    ck_assert(preg.heuristic != NULL && preg.heuristic->teddy != NULL);
+
+    frec_match_t pmatch;
+    ck_assert(frec_regexec(&preg, "ERROR: timeout", 1, &pmatch, 0) == REG_NOMATCH);
+    ck_assert(frec_regexec(&preg, "error: none, Error: timeout", 1, &pmatch, 0) == REG_OK);
+    ck_assert(pmatch.soffset == 13 && pmatch.eoffset == 27);
+    frec_regfree(&preg);
+
+    // Case variants are a single literal in case insensitive mode.
+    ck_assert(frec_regcomp(&preg, "[Ee]rror.", REG_ICASE) == REG_OK);
+    ck_assert(frec_regexec(&preg, "an ERROR!", 1, &pmatch, 0) == REG_OK);
+    ck_assert(pmatch.soffset == 3 && pmatch.eoffset == 9);
+    frec_regfree(&preg);
+
+    // Line feeds of the pattern can still be matched with REG_NEWLINE, and
+    // lines start after them even with REG_NOTBOL.
+    ck_assert(frec_regcomp(&preg, "[0-9]*[\n]x", REG_NEWLINE) == REG_OK);
+    ck_assert(frec_regexec(&preg, "a12\nx", 1, &pmatch, 0) == REG_OK);
+    ck_assert(pmatch.soffset == 1 && pmatch.eoffset == 5);
+    frec_regfree(&preg);
+
+    ck_assert(frec_regcomp(&preg, "^c[a-c]", REG_NEWLINE) == REG_OK);
+    ck_assert(frec_regexec(&preg, "c\nca", 1, &pmatch, REG_NOTBOL) == REG_OK);
+    ck_assert(pmatch.soffset == 2 && pmatch.eoffset == 4);
+    frec_regfree(&preg);
+
+    // Pattern sets search for the rarest fragment of the pattern instead.
+    const char *patterns[2] = {"[Ee]rror [0-9]+", "[Ww]arn"};
+    mfrec_t mpreg;
+    ck_assert(frec_mregcomp(&mpreg, 2, patterns, REG_EXTENDED | REG_NEWLINE) == REG_OK);
+    ck_assert(frec_mregexec(&mpreg, "warn: error 42", 1, &pmatch, 0) == REG_OK);
+    ck_assert(pmatch.soffset == 0 && pmatch.eoffset == 4 && pmatch.pattern_id == 1);
+    ck_assert(frec_mregexec(&mpreg, "an Error 42", 1, &pmatch, 0) == REG_OK);
+    ck_assert(pmatch.soffset == 3 && pmatch.eoffset == 11 && pmatch.pattern_id == 0);
+    frec_mregfree(&mpreg);
+}
+END_TEST
+
+typedef struct alternation_tuple {
+    const wchar_t *pattern;
+    int flags;
+    int expected_type;
+    ssize_t expected_count;
+} alternation_tuple;
+
+#define ALT_SUCC_LEN 6
+static alternation_tuple alternation_successes[ALT_SUCC_LEN] = {
+    {L"ERROR: [0-9]+|FATAL.*timeout", REG_EXTENDED, HEUR_PREFIX, 2},
+    {L"ERROR: [0-9]+|FATAL.*timeout", REG_EXTENDED | REG_NEWLINE, HEUR_LONGEST, 2},
+    {L"foo|bar|baz", REG_EXTENDED, HEUR_LONGEST, 3},
+    {L"foo.*|bar(.|\n)*", REG_EXTENDED, HEUR_PREFIX, 2},
+    {L"a(b|c)d|e", REG_EXTENDED, HEUR_LONGEST, 2},
+    {L"one\\|two", 0, HEUR_LONGEST, 2}
+};
+
+START_TEST(loop_test_heur__alternations__succeed)
+{
+    alternation_tuple current = alternation_successes[_i];
+    heur *heur = run_and_return_prep(current.pattern, current.flags);
+
+    ck_assert_msg(heur->heur_type == current.expected_type,
+        "Preprocessing returned incorrect heuristic type: returned '%d', expected '%d' for pattern '%ls'",
+        heur->heur_type, current.expected_type, current.pattern
+    );
+
+    // Wide literals are searched for with Wu-Manber.
+    ck_assert_msg(heur->wu_manber != NULL && heur->wu_manber->count == current.expected_count,
+        "Preprocessing returned incorrect alternatives for pattern '%ls'", current.pattern
+    );
+
+    frec_free_heur(heur);
+}
+END_TEST
+
+#define ALT_FAIL_LEN 4
+static alternation_tuple alternation_failures[ALT_FAIL_LEN] = {
+    {L"foo|", REG_EXTENDED, 0, 0},
+    {L"foo|x*", REG_EXTENDED, 0, 0},
+    {L"(a|b)|c", REG_EXTENDED, 0, 0},
+    {L"foo.*|.*bar", REG_EXTENDED, 0, 0}
+};
+
+START_TEST(loop_test_heur__alternations__fail)
+{
+    alternation_tuple current = alternation_failures[_i];
+
+    int ret = run_preprocess(current.pattern, current.flags);
+    ck_assert_msg(ret == REG_BADPAT,
+        "Preprocessing succeeded for pattern '%ls', where an alternative has no literal",
+        current.pattern
+    );
+}
+END_TEST
+
+START_TEST(test_heur__alternations__matched)
+{
+    frec_t preg;
+    ck_assert(frec_regcomp(&preg, "ERROR: [0-9]+|FATAL.*timeout", REG_EXTENDED | REG_NEWLINE) == REG_OK);
+    ck_assert(preg.heuristic != NULL && preg.heuristic->teddy != NULL);
+
+    frec_match_t pmatch;
+    ck_assert(frec_regexec(&preg, "ERROR: none\nFATAL: no time", 1, &pmatch, 0) == REG_NOMATCH);
+    ck_assert(frec_regexec(&preg, "FATAL: none\nFATAL: a timeout", 1, &pmatch, 0) == REG_OK);
+    ck_assert(pmatch.soffset == 12 && pmatch.eoffset == 28);
+    ck_assert(frec_regexec(&preg, "FATAL, ERROR: 42", 1, &pmatch, 0) == REG_OK);
+    ck_assert(pmatch.soffset == 7 && pmatch.eoffset == 16);
+    frec_regfree(&preg);
+
+    // Shorter alternatives may start at the same candidate.
+    ck_assert(frec_regcomp(&preg, "xx|[a-c]x", REG_EXTENDED) == REG_OK);
+    ck_assert(frec_regexec(&preg, " abxxcd", 1, &pmatch, 0) == REG_OK);
+    ck_assert(pmatch.soffset == 2 && pmatch.eoffset == 4);
+    frec_regfree(&preg);
+
+    // Anchors only match at the real line boundaries, not at the windows.
+    ck_assert(frec_regcomp(&preg, "^ab|cd$", REG_EXTENDED) == REG_OK);
+    ck_assert(frec_regexec(&preg, "xab cdx", 1, &pmatch, 0) == REG_NOMATCH);
+    ck_assert(frec_regexec(&preg, "xab cd", 1, &pmatch, 0) == REG_OK);
+    ck_assert(pmatch.soffset == 4 && pmatch.eoffset == 6);
+    frec_regfree(&preg);
+}
+END_TEST
+
+// Fills the text with copies of the filler, followed by the tail.
+static void
+fill_text(char *text, size_t copies, const char *filler, const char *tail)
+{
+    text[0] = '\0';
+    for (size_t i = 0; i < copies; i++) {
+        strcat(text, filler);
+    }
+    strcat(text, tail);
+}
+
+START_TEST(test_heur__windows__merged)
+{
+    // Every candidate has a window, and these overlap in dense text.
+    static char text[8192];
+    frec_t preg;
+    frec_match_t pmatch[2];
+
+    ck_assert(frec_regcomp(&preg, "(ab)[0-9]{2,3}x", REG_EXTENDED) == REG_OK);
+    ck_assert(preg.heuristic != NULL && preg.heuristic->max_length == 6);
+    fill_text(text, 1500, "ab1 ", "ab12 ab123x");
+    ck_assert(frec_regexec(&preg, text, 2, pmatch, 0) == REG_OK);
+    ck_assert(pmatch[0].soffset == 6005 && pmatch[0].eoffset == 6011);
+    ck_assert(pmatch[1].soffset == 6005 && pmatch[1].eoffset == 6007);
+    text[6010] = 'y';
+    ck_assert(frec_regexec(&preg, text, 2, pmatch, 0) == REG_NOMATCH);
+    frec_regfree(&preg);
+
+    // Windows of adjacent lines are merged too.
+    ck_assert(frec_regcomp(&preg, "ab[0-9]*x", REG_NEWLINE) == REG_OK);
+    ck_assert(preg.heuristic != NULL && preg.heuristic->max_length == -1);
+    fill_text(text, 1500, "ab1\n", "ab99x");
+    ck_assert(frec_regexec(&preg, text, 1, pmatch, 0) == REG_OK);
+    ck_assert(pmatch[0].soffset == 6000 && pmatch[0].eoffset == 6005);
+    frec_regfree(&preg);
+
+    // Patterns of a set only merge their own windows.
+    mfrec_t mpreg;
+    const char *patterns[2] = {"ab[0-9]{2,3}x", "cd[0-9]*y"};
+    ck_assert(frec_mregcomp(&mpreg, 2, patterns, REG_EXTENDED) == REG_OK);
+    fill_text(text, 750, "ab1 cd2\n", "cd34y ab12x");
+    ck_assert(frec_mregexec(&mpreg, text, 1, pmatch, 0) == REG_OK);
+    ck_assert(pmatch[0].soffset == 6000 && pmatch[0].eoffset == 6005);
+    ck_assert(pmatch[0].pattern_id == 1);
+    frec_mregfree(&mpreg);
+}
+END_TEST
+
+START_TEST(test_heur__windows__captures)
+{
+    // Submatches are computed only for the match that was found.
+    static char text[8192];
+    frec_t preg;
+    frec_match_t pmatch[3];
+
+    ck_assert(frec_regcomp(&preg, "(ab)([0-9]{2,3})x", REG_EXTENDED) == REG_OK);
+    ck_assert(preg.heuristic != NULL && preg.dfa != NULL);
+    fill_text(text, 1500, "ab1 ", "ab123x");
+    ck_assert(frec_regexec(&preg, text, 3, pmatch, 0) == REG_OK);
+    ck_assert(pmatch[0].soffset == 6000 && pmatch[0].eoffset == 6006);
+    ck_assert(pmatch[1].soffset == 6000 && pmatch[1].eoffset == 6002);
+    ck_assert(pmatch[2].soffset == 6002 && pmatch[2].eoffset == 6005);
+    frec_regfree(&preg);
+
+    // Wide patterns don't have a DFA, so the windows are only checked for
+    // a match at first.
+    static wchar_t wtext[10240];
+    wtext[0] = L'\0';
+    for (size_t i = 0; i < 1500; i++) {
+        wcscat(wtext, L"ab1 ");
+    }
+    wcscat(wtext, L"ab123x");
+
+    ck_assert(frec_regwcomp(&preg, L"(ab)([0-9]{2,3})x", REG_EXTENDED) == REG_OK);
+    ck_assert(preg.heuristic != NULL && preg.dfa == NULL);
+    ck_assert(frec_regwexec(&preg, wtext, 3, pmatch, 0) == REG_OK);
+    ck_assert(pmatch[0].soffset == 6000 && pmatch[0].eoffset == 6006);
+    ck_assert(pmatch[1].soffset == 6000 && pmatch[1].eoffset == 6002);
+    ck_assert(pmatch[2].soffset == 6002 && pmatch[2].eoffset == 6005);
+    frec_regfree(&preg);
+}
+END_TEST
+
 static Suite *
 create_suite()
 {
@@ -191,7 +632,35 @@ create_suite()
     tcase_add_loop_test(tc_prep, loop_test_heur__successes__prefix_succeeds, 0, PREF_SUCC_LEN);
     tcase_add_loop_test(tc_prep, loop_test_heur__successes__longest_succeeds, 0, LONG_SUCC_LEN);
 
+	TCase *tc_frag = tcase_create("Fragments");
+    tcase_add_loop_test(tc_frag, loop_test_heur__fragments__others_kept, 0, FRAG_LEN);
+    tcase_add_test(tc_frag, test_heur__fragments__trained_pairs);
+    tcase_add_test(tc_frag, test_heur__fragments__candidates_rejected);
+    tcase_add_test(tc_frag, test_heur__fragments__tied_literals);
+
+	TCase *tc_group = tcase_create("Groups");
+    tcase_add_loop_test(tc_group, loop_test_heur__groups__literals_joined, 0, GROUP_LEN);
+    tcase_add_test(tc_group, test_heur__groups__matched);
+
+	TCase *tc_class = tcase_create("Bracket expressions");
+    tcase_add_loop_test(tc_class, loop_test_heur__classes__expanded, 0, CLASS_LEN);
+    tcase_add_test(tc_class, test_heur__classes__matched);
+
+	TCase *tc_alt = tcase_create("Alternations");
+    tcase_add_loop_test(tc_alt, loop_test_heur__alternations__succeed, 0, ALT_SUCC_LEN);
+    tcase_add_loop_test(tc_alt, loop_test_heur__alternations__fail, 0, ALT_FAIL_LEN);
+    tcase_add_test(tc_alt, test_heur__alternations__matched);
+
+	TCase *tc_window = tcase_create("Windows");
+    tcase_add_test(tc_window, test_heur__windows__merged);
+    tcase_add_test(tc_window, test_heur__windows__captures);
+
 	suite_add_tcase(suite, tc_prep);
+	suite_add_tcase(suite, tc_frag);
+	suite_add_tcase(suite, tc_group);
+	suite_add_tcase(suite, tc_class);
+	suite_add_tcase(suite, tc_alt);
+	suite_add_tcase(suite, tc_window);
 
 	return suite;
 }
@@ -86,6 +86,39 @@ START_TEST(loop_test_interface__comp_and_match__offsets_ok)
 }
 END_TEST
 
+START_TEST(test_interface__literal_compiled_lazily)
+{
+    frec_t prep;
+    ck_assert(frec_regcomp(&prep, "needle", 0) == REG_OK);
+    ck_assert(!prep.has_original);
+
+    // Literal patterns are matched without the original matcher.
+    frec_match_t pmatch;
+    ck_assert(frec_regexec(&prep, "a needle", 1, &pmatch, 0) == REG_OK);
+    ck_assert(pmatch.soffset == 2 && pmatch.eoffset == 8);
+    ck_assert(!prep.has_original);
+    frec_regfree(&prep);
+
+    ck_assert(frec_regcomp(&prep, "ne+dle", REG_EXTENDED) == REG_OK);
+    ck_assert(prep.has_original);
+    frec_regfree(&prep);
+}
+END_TEST
+
+START_TEST(test_interface__invalid_patterns_still_rejected)
+{
+    const char *patterns[3] = {"ab\\", "a[b", "a\\(b"};
+
+    for (int i = 0; i < 3; i++) {
+        frec_t prep;
+        int ret = frec_regcomp(&prep, patterns[i], 0);
+        ck_assert_msg(ret != REG_OK,
+            "regcomp accepted invalid pattern '%s'", patterns[i]
+        );
+    }
+}
+END_TEST
+
 Suite *create_interface_single_suite()
 {
 	Suite *suite = suite_create("Interface / Single patterns");
@@ -94,7 +127,12 @@ Suite *create_interface_single_suite()
 
     tcase_add_loop_test(tc_offsets, loop_test_interface__comp_and_match__offsets_ok, 0, INPUT_LEN);
 
+	TCase *tc_compile = tcase_create("Compilation");
+    tcase_add_test(tc_compile, test_interface__literal_compiled_lazily);
+    tcase_add_test(tc_compile, test_interface__invalid_patterns_still_rejected);
+
 	suite_add_tcase(suite, tc_offsets);
+	suite_add_tcase(suite, tc_compile);
 
 	return suite;
 }
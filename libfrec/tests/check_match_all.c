@@ -0,0 +1,330 @@
+#include <check.h>
+#include <frec.h>
+
+#define MAX_MATCHES 8
+
+// Collects the reported matches.
+typedef struct collected {
+    frec_match_t matches[MAX_MATCHES];
+    size_t count;
+    size_t stop_after;
+} collected;
+
+static int
+collect(const frec_match_t *pmatch, size_t nmatch, void *arg)
+{
+    collected *c = arg;
+    if (c->count < MAX_MATCHES) {
+        c->matches[c->count] = pmatch[0];
+    }
+    c->count++;
+
+    return (c->stop_after != 0 && c->count >= c->stop_after);
+}
+
+static void
+assert_matches(
+    const collected *actual, size_t count, const frec_match_t *expect,
+    const char *pattern, const char *text
+) {
+    ck_assert_msg(actual->count == count,
+        "Incorrect match count: expected '%zu', got '%zu' for pattern '%s' and text '%s'",
+        count, actual->count, pattern, text
+    );
+
+    for (size_t i = 0; i < count; i++) {
+        const frec_match_t *a = &actual->matches[i];
+        ck_assert_msg(
+            a->soffset == expect[i].soffset && a->eoffset == expect[i].eoffset,
+            "Incorrect match %zu: expected '%d-%d', got '%d-%d' for pattern '%s' and text '%s'",
+            i, expect[i].soffset, expect[i].eoffset, a->soffset, a->eoffset,
+            pattern, text
+        );
+    }
+}
+
+
+typedef struct match_all_tuple {
+    const char *pattern;
+    const char *text;
+    int cflags;
+    int eflags;
+    size_t count;
+    frec_match_t matches[MAX_MATCHES];
+} match_all_tuple;
+
+#define INPUT_LEN 9
+static match_all_tuple inputs[INPUT_LEN] = {
+    // Literals:
+    {"ab", "ab ab xab", 0, 0, 3, {{0,2}, {3,5}, {7,9}}},
+    {"aa", "aaaaa", 0, 0, 2, {{0,2}, {2,4}}},
+    {"none", "no match here", 0, 0, 0, {{0,0}}},
+
+    // Regular expressions:
+    {"[0-9]+", "a1 b22 c333", REG_EXTENDED, 0, 3, {{1,2}, {4,6}, {8,11}}},
+    {"x*", "ab", REG_EXTENDED, 0, 3, {{0,0}, {1,1}, {2,2}}},
+
+    // Anchors only match at line boundaries:
+    {"^a", "aaa", 0, 0, 1, {{0,1}}},
+    {"^a", "ab\nab\nb", REG_NEWLINE, 0, 2, {{0,1}, {3,4}}},
+    {"b$", "ab\nab", REG_NEWLINE, 0, 2, {{1,2}, {4,5}}},
+
+    // Only a single match is reported without submatches:
+    {"ab", "ab ab", REG_NOSUB, 0, 1, {{0,0}}}
+};
+
+
+START_TEST(loop_test_match_all__single__all_matches_found)
+{
+    match_all_tuple curr = inputs[_i];
+
+    frec_t preg;
+    int ret = frec_regcomp(&preg, curr.pattern, curr.cflags);
+    ck_assert_msg(ret == REG_OK,
+        "regcomp failed: returned '%d' for pattern '%s'", ret, curr.pattern
+    );
+
+    collected actual = {0};
+    frec_match_t pmatch;
+    ret = frec_regexec_all(&preg, curr.text, 1, &pmatch, curr.eflags,
+        collect, &actual);
+
+    ck_assert_msg(ret == ((curr.count > 0) ? REG_OK : REG_NOMATCH),
+        "regexec_all returned '%d' for pattern '%s' and text '%s'",
+        ret, curr.pattern, curr.text
+    );
+
+    if (!(curr.cflags & REG_NOSUB)) {
+        assert_matches(&actual, curr.count, curr.matches,
+            curr.pattern, curr.text);
+    } else {
+        ck_assert(actual.count == curr.count);
+    }
+
+    frec_regfree(&preg);
+}
+END_TEST
+
+START_TEST(test_match_all__single__callback_stops)
+{
+    frec_t preg;
+    ck_assert(frec_regcomp(&preg, "a", 0) == REG_OK);
+
+    collected actual = {0};
+    actual.stop_after = 2;
+    frec_match_t pmatch;
+    int ret = frec_regexec_all(&preg, "a a a a", 1, &pmatch, 0,
+        collect, &actual);
+
+    ck_assert(ret == REG_OK);
+    ck_assert(actual.count == 2);
+
+    frec_regfree(&preg);
+}
+END_TEST
+
+START_TEST(test_match_all__single__startend_offsets)
+{
+    frec_t preg;
+    ck_assert(frec_regcomp(&preg, "ab", 0) == REG_OK);
+
+    const char *text = "ab ab ab ab";
+    collected actual = {0};
+    frec_match_t pmatch = {2, 9};
+    int ret = frec_regexec_all(&preg, text, 1, &pmatch, REG_STARTEND,
+        collect, &actual);
+
+    frec_match_t expect[] = {{3,5}, {6,8}};
+    ck_assert(ret == REG_OK);
+    assert_matches(&actual, 2, expect, "ab", text);
+
+    frec_regfree(&preg);
+}
+END_TEST
+
+
+// Collects the last submatch of the reported matches.
+static int
+collect_last(const frec_match_t *pmatch, size_t nmatch, void *arg)
+{
+    collected *c = arg;
+    if (c->count < MAX_MATCHES) {
+        c->matches[c->count] = pmatch[nmatch - 1];
+    }
+    c->count++;
+
+    return 0;
+}
+
+START_TEST(test_match_all__single__unmatched_submatches)
+{
+    // Submatches after one that didn't take part in the match are moved
+    // to the right offsets too.
+    frec_t preg;
+    ck_assert(frec_regcomp(&preg, "(a)?(b)", REG_EXTENDED) == REG_OK);
+
+    const char *text = "ab xb";
+    collected actual = {0};
+    frec_match_t pmatch[3];
+    int ret = frec_regexec_all(&preg, text, 3, pmatch, 0,
+        collect_last, &actual);
+
+    frec_match_t expect[] = {{1,2}, {4,5}};
+    ck_assert(ret == REG_OK);
+    assert_matches(&actual, 2, expect, "(a)?(b)", text);
+
+    pmatch[0].soffset = 2;
+    pmatch[0].eoffset = 5;
+    ck_assert(frec_regexec(&preg, text, 3, pmatch, REG_STARTEND) == REG_OK);
+    ck_assert(pmatch[1].soffset == -1);
+    ck_assert(pmatch[2].soffset == 4 && pmatch[2].eoffset == 5);
+
+    frec_regfree(&preg);
+}
+END_TEST
+
+typedef struct mmatch_all_tuple {
+    const char *patterns[3];
+    size_t pattern_count;
+    int cflags;
+    const char *text;
+    size_t count;
+    frec_match_t matches[MAX_MATCHES];
+    ssize_t ids[MAX_MATCHES];
+} mmatch_all_tuple;
+
+#define MINPUT_LEN 6
+static mmatch_all_tuple minputs[MINPUT_LEN] = {
+    // Literal sets:
+    {{"cat", "dog"}, 2, 0, "cat and dog and cat", 3,
+        {{0,3}, {8,11}, {16,19}}, {0, 1, 0}},
+    {{"he", "she", "hers"}, 3, 0, "ushers", 1, {{1,4}}, {1}},
+
+    // Patterns without a common literal are matched one-by-one:
+    {{"[0-9]+", "x*y"}, 2, REG_EXTENDED, "12 xxy 3 y", 4,
+        {{0,2}, {3,6}, {7,8}, {9,10}}, {0, 1, 0, 1}},
+    {{"a.c", "b"}, 2, 0, "abc b abc", 3,
+        {{0,3}, {4,5}, {6,9}}, {0, 1, 0}},
+
+    // Sets searched by their literal fragments, where the windows found
+    // after a match are kept for the next ones:
+    {{"a[0-9]+b", "ca+b"}, 2, REG_EXTENDED, "a1b caab a22b cab", 4,
+        {{0,3}, {4,8}, {9,13}, {14,17}}, {0, 1, 0, 1}},
+    {{"x[a-z]+y", "b[a-z]c"}, 2, REG_EXTENDED, "xbacy bzc xbcy", 3,
+        {{0,5}, {6,9}, {10,14}}, {0, 1, 0}}
+};
+
+START_TEST(loop_test_match_all__multi__all_matches_found)
+{
+    mmatch_all_tuple curr = minputs[_i];
+
+    mfrec_t preg;
+    int ret = frec_mregcomp(&preg, curr.pattern_count, curr.patterns,
+        curr.cflags);
+    ck_assert_msg(ret == REG_OK,
+        "mregcomp failed: returned '%d' for text '%s'", ret, curr.text
+    );
+
+    collected actual = {0};
+    frec_match_t pmatch;
+    ret = frec_mregexec_all(&preg, curr.text, 1, &pmatch, 0,
+        collect, &actual);
+
+    ck_assert(ret == REG_OK);
+    assert_matches(&actual, curr.count, curr.matches,
+        curr.patterns[0], curr.text);
+
+    for (size_t i = 0; i < curr.count; i++) {
+        ck_assert_msg(actual.matches[i].pattern_id == curr.ids[i],
+            "Incorrect pattern id for match %zu: expected '%zd', got '%zd' for text '%s'",
+            i, curr.ids[i], actual.matches[i].pattern_id, curr.text
+        );
+    }
+
+    frec_mregfree(&preg);
+}
+END_TEST
+
+// Iterates over the matches of another pattern set in each match.
+typedef struct nested {
+    const mfrec_t *inner;
+    const char *text;
+    collected outer;
+    collected inner_matches;
+} nested;
+
+static int
+collect_nested(const frec_match_t *pmatch, size_t nmatch, void *arg)
+{
+    nested *n = arg;
+    collect(pmatch, nmatch, &n->outer);
+
+    frec_match_t inner;
+    frec_mregnexec_all(n->inner, n->text + pmatch[0].soffset,
+        pmatch[0].eoffset - pmatch[0].soffset, 1, &inner, 0,
+        collect, &n->inner_matches);
+    return 0;
+}
+
+START_TEST(test_match_all__multi__nested_in_callback)
+{
+    // Both sets keep the next match of their patterns in the scratch space
+    // of the thread, which the inner iterations must leave intact.
+    const char *outer_patterns[] = {"[0-9]+", "x*y"};
+    const char *inner_patterns[] = {"[12]+", "[34]"};
+
+    mfrec_t outer, inner;
+    ck_assert(frec_mregcomp(&outer, 2, outer_patterns, REG_EXTENDED) == REG_OK);
+    ck_assert(frec_mregcomp(&inner, 2, inner_patterns, REG_EXTENDED) == REG_OK);
+
+    nested n = {0};
+    n.inner = &inner;
+    n.text = "123 xxy 113 y";
+    frec_match_t pmatch;
+    int ret = frec_mregexec_all(&outer, n.text, 1, &pmatch, 0,
+        collect_nested, &n);
+
+    frec_match_t expect_outer[] = {{0,3}, {4,7}, {8,11}, {12,13}};
+    frec_match_t expect_inner[] = {{0,2}, {2,3}, {0,2}, {2,3}};
+    ck_assert(ret == REG_OK);
+    assert_matches(&n.outer, 4, expect_outer, outer_patterns[0], n.text);
+    assert_matches(&n.inner_matches, 4, expect_inner, inner_patterns[0],
+        n.text);
+
+    frec_mregfree(&inner);
+    frec_mregfree(&outer);
+}
+END_TEST
+
+
+Suite *create_match_all_suite()
+{
+    Suite *suite = suite_create("Match iteration");
+
+    TCase *tc_single = tcase_create("Single patterns");
+    tcase_add_loop_test(tc_single, loop_test_match_all__single__all_matches_found, 0, INPUT_LEN);
+    tcase_add_test(tc_single, test_match_all__single__callback_stops);
+    tcase_add_test(tc_single, test_match_all__single__startend_offsets);
+    tcase_add_test(tc_single, test_match_all__single__unmatched_submatches);
+
+    TCase *tc_multi = tcase_create("Multiple patterns");
+    tcase_add_loop_test(tc_multi, loop_test_match_all__multi__all_matches_found, 0, MINPUT_LEN);
+    tcase_add_test(tc_multi, test_match_all__multi__nested_in_callback);
+
+    suite_add_tcase(suite, tc_single);
+    suite_add_tcase(suite, tc_multi);
+
+    return suite;
+}
+
+int main(void)
+{
+    Suite *suite = create_match_all_suite();
+    SRunner *runner = srunner_create(suite);
+
+    srunner_run_all(runner, CK_NORMAL);
+    int failed = srunner_ntests_failed(runner);
+    srunner_free(runner);
+
+    return (failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,150 @@
+#include <check.h>
+#include <frec.h>
+
+typedef struct scratch_tuple {
+    const char *patterns[3];
+    size_t count;
+    int cflags;
+    const char *text;
+    size_t nmatch;
+} scratch_tuple;
+
+#define INPUT_LEN 6
+static scratch_tuple inputs[INPUT_LEN] = {
+    // Single patterns that need the original matcher:
+    {{"a[0-9]+b"}, 1, REG_EXTENDED, "xx a12b a3b", 1},
+    {{"(a)([0-9]+)b"}, 1, REG_EXTENDED, "xx a12b a3b", 3},
+    {{"\\(x\\)\\1"}, 1, 0, "ab xx", 2},
+
+    // Pattern sets without literal fragments:
+    {{"[0-9]+", "[a-c]+", "x*y"}, 3, REG_EXTENDED, "zz 12 abc", 1},
+    {{"([0-9])+", "([a-c])+", "(x*)y"}, 3, REG_EXTENDED, "zz abc 12", 2},
+    {{"[0-9]+", "[a-c]+", "x*y"}, 3, REG_EXTENDED, "none", 1}
+};
+
+// Compiles the patterns of the tuple as a pattern set.
+static void
+compile(mfrec_t *preg, scratch_tuple curr)
+{
+    int ret = frec_mregcomp(preg, curr.count, curr.patterns, curr.cflags);
+    ck_assert_msg(ret == REG_OK,
+        "mregcomp failed: returned '%d' for pattern '%s'",
+        ret, curr.patterns[0]
+    );
+}
+
+START_TEST(loop_test_scratch__same_as_default)
+{
+    scratch_tuple curr = inputs[_i];
+
+    mfrec_t preg;
+    compile(&preg, curr);
+
+    frec_scratch_t scratch;
+    ck_assert(frec_scratch_init(&scratch) == REG_OK);
+
+    frec_match_t expected[3];
+    frec_match_t actual[3];
+    int exp_ret = frec_mregexec(&preg, curr.text, curr.nmatch, expected, 0);
+    int ret = frec_mregexec_r(&preg, curr.text, curr.nmatch, actual, 0,
+        &scratch);
+
+    ck_assert_msg(ret == exp_ret,
+        "Incorrect return value: expected '%d', got '%d' for pattern '%s'",
+        exp_ret, ret, curr.patterns[0]
+    );
+    for (size_t i = 0; ret == REG_OK && i < curr.nmatch; i++) {
+        ck_assert(actual[i].soffset == expected[i].soffset);
+        ck_assert(actual[i].eoffset == expected[i].eoffset);
+        ck_assert(actual[i].pattern_id == expected[i].pattern_id);
+    }
+
+    // The single pattern functions behave the same way.
+    if (curr.count == 1) {
+        ret = frec_regexec_r(&preg.patterns[0], curr.text, curr.nmatch,
+            actual, 0, &scratch);
+        ck_assert(ret == exp_ret);
+        for (size_t i = 0; ret == REG_OK && i < curr.nmatch; i++) {
+            ck_assert(actual[i].soffset == expected[i].soffset);
+            ck_assert(actual[i].eoffset == expected[i].eoffset);
+        }
+    }
+
+    frec_scratch_free(&scratch);
+    frec_mregfree(&preg);
+}
+END_TEST
+
+START_TEST(test_scratch__submatches_of_pattern_set)
+{
+    mfrec_t preg;
+    compile(&preg, inputs[4]);
+
+    // Submatches are relative to the text, not to the match.
+    frec_match_t pmatch[2];
+    int ret = frec_mregexec(&preg, inputs[4].text, 2, pmatch, 0);
+    ck_assert(ret == REG_OK);
+    ck_assert(pmatch[0].soffset == 3 && pmatch[0].eoffset == 6);
+    ck_assert(pmatch[1].soffset == 5 && pmatch[1].eoffset == 6);
+    ck_assert(pmatch[0].pattern_id == 1 && pmatch[1].pattern_id == 1);
+
+    frec_mregfree(&preg);
+}
+END_TEST
+
+START_TEST(test_scratch__reused_without_growing)
+{
+    mfrec_t preg;
+    compile(&preg, inputs[4]);
+
+    frec_scratch_t scratch;
+    frec_scratch_init(&scratch);
+
+    frec_match_t pmatch[2];
+    int ret = frec_mregexec_r(&preg, inputs[4].text, 2, pmatch, 0, &scratch);
+    ck_assert(ret == REG_OK);
+
+    regmatch_t *storage = scratch.pmatch;
+    frec_match_t *matches = scratch.matches;
+    ck_assert(storage != NULL && matches != NULL);
+
+    // Once large enough, the same storage is used by later calls.
+    for (int i = 0; i < 100; i++) {
+        ret = frec_mregexec_r(&preg, inputs[4].text, 2, pmatch, 0, &scratch);
+        ck_assert(ret == REG_OK);
+        ck_assert(scratch.pmatch == storage);
+        ck_assert(scratch.matches == matches);
+    }
+
+    frec_scratch_free(&scratch);
+    ck_assert(scratch.pmatch == NULL && scratch.matches == NULL);
+    frec_mregfree(&preg);
+}
+END_TEST
+
+
+Suite *create_scratch_suite()
+{
+    Suite *suite = suite_create("Scratch space");
+
+    TCase *tc_exec = tcase_create("Execution");
+    tcase_add_loop_test(tc_exec, loop_test_scratch__same_as_default, 0, INPUT_LEN);
+    tcase_add_test(tc_exec, test_scratch__submatches_of_pattern_set);
+    tcase_add_test(tc_exec, test_scratch__reused_without_growing);
+
+    suite_add_tcase(suite, tc_exec);
+
+    return suite;
+}
+
+int main(void)
+{
+    Suite *suite = create_scratch_suite();
+    SRunner *runner = srunner_create(suite);
+
+    srunner_run_all(runner, CK_NORMAL);
+    int failed = srunner_ntests_failed(runner);
+    srunner_free(runner);
+
+    return (failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,403 @@
+#include <check.h>
+#include <frec.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "ac-type.h"
+#include "teddy-type.h"
+#include "wm-type.h"
+
+typedef struct serialize_tuple {
+    const char *patterns[3];
+    size_t count;
+    int cflags;
+} serialize_tuple;
+
+#define INPUT_LEN 11
+static serialize_tuple inputs[INPUT_LEN] = {
+    // Single patterns using each matcher:
+    {{"needle"}, 1, 0},
+    {{"NeEdLe"}, 1, REG_ICASE},
+    {{"^needle"}, 1, 0},
+    {{"ne+dle[0-9]"}, 1, REG_EXTENDED},
+    {{"[0-9]+x"}, 1, REG_EXTENDED},
+    {{"\\([a-z]\\)\\1"}, 1, 0},
+    {{"ne+dle|[0-9]x|stack"}, 1, REG_EXTENDED},
+
+    // Pattern sets:
+    {{"needle", "hay", "stack"}, 3, 0},
+    {{"ne+dle[0-9]", "h[a-z]y", "st.ck"}, 3, REG_EXTENDED},
+    {{"[0-9]+x", "[a-c]{3}", "(q|z)+y"}, 3, REG_EXTENDED},
+
+    // Later inputs go here, so that the sets above keep their indices:
+    {{"[Nn]eedle in.*[Hh]ay"}, 1, REG_EXTENDED | REG_NEWLINE}
+};
+
+#define TEXT_LEN 7
+static const char *texts[TEXT_LEN] = {
+    "", "needle", "a NEEDLE in the hay", "neeedle7 12x stick",
+    "aab stack zqy", "word0042 and x17", "a Needle in the Hay"
+};
+
+// Checks that the two sets find the same matches in every text.
+static void
+assert_same_matches(const mfrec_t *expected, const mfrec_t *actual)
+{
+    for (size_t i = 0; i < TEXT_LEN; i++) {
+        frec_match_t exp_match;
+        frec_match_t act_match;
+        int exp_ret = frec_mregexec(expected, texts[i], 1, &exp_match, 0);
+        int ret = frec_mregexec(actual, texts[i], 1, &act_match, 0);
+
+        ck_assert_msg(ret == exp_ret,
+            "Incorrect return value: expected '%d', got '%d' on text '%s'",
+            exp_ret, ret, texts[i]
+        );
+        if (ret == REG_OK) {
+            ck_assert(act_match.soffset == exp_match.soffset);
+            ck_assert(act_match.eoffset == exp_match.eoffset);
+            ck_assert(act_match.pattern_id == exp_match.pattern_id);
+        }
+    }
+}
+
+START_TEST(loop_test_serialize__single_round_trip)
+{
+    serialize_tuple curr = inputs[_i];
+    if (curr.count != 1) {
+        return;
+    }
+
+    frec_t preg;
+    ck_assert(frec_regcomp(&preg, curr.patterns[0], curr.cflags) == REG_OK);
+
+    void *blob;
+    size_t len;
+    ck_assert(frec_serialize(&preg, &blob, &len) == REG_OK);
+
+    frec_t loaded;
+    int ret = frec_deserialize(&loaded, blob, len);
+    ck_assert_msg(ret == REG_OK,
+        "deserialize failed: returned '%d' for pattern '%s'",
+        ret, curr.patterns[0]
+    );
+    ck_assert((loaded.boyer_moore == NULL) == (preg.boyer_moore == NULL));
+    ck_assert((loaded.heuristic == NULL) == (preg.heuristic == NULL));
+    ck_assert((loaded.dfa == NULL) == (preg.dfa == NULL));
+
+    for (size_t i = 0; i < TEXT_LEN; i++) {
+        frec_match_t expected[2];
+        frec_match_t actual[2];
+        int exp_ret = frec_regexec(&preg, texts[i], 2, expected, 0);
+        ret = frec_regexec(&loaded, texts[i], 2, actual, 0);
+
+        ck_assert(ret == exp_ret);
+        for (size_t j = 0; ret == REG_OK && j < 2; j++) {
+            ck_assert(actual[j].soffset == expected[j].soffset);
+            ck_assert(actual[j].eoffset == expected[j].eoffset);
+        }
+    }
+
+    frec_regfree(&loaded);
+    free(blob);
+    frec_regfree(&preg);
+}
+END_TEST
+
+START_TEST(loop_test_serialize__multi_round_trip)
+{
+    serialize_tuple curr = inputs[_i];
+
+    mfrec_t preg;
+    ck_assert(frec_mregcomp(&preg, curr.count, curr.patterns, curr.cflags) == REG_OK);
+
+    void *blob;
+    size_t len;
+    ck_assert(frec_mserialize(&preg, &blob, &len) == REG_OK);
+
+    mfrec_t loaded;
+    int ret = frec_mdeserialize(&loaded, blob, len);
+    ck_assert_msg(ret == REG_OK,
+        "mdeserialize failed: returned '%d' for pattern '%s'",
+        ret, curr.patterns[0]
+    );
+    ck_assert(loaded.count == preg.count && loaded.type == preg.type);
+    ck_assert((loaded.teddy == NULL) == (preg.teddy == NULL));
+    assert_same_matches(&preg, &loaded);
+
+    frec_mregfree(&loaded);
+    free(blob);
+    frec_mregfree(&preg);
+}
+END_TEST
+
+// Large sets use Aho-Corasick for short, and Wu-Manber for long patterns.
+START_TEST(test_serialize__large_sets)
+{
+    static char storage[2][100][16];
+    const char *patterns[100];
+
+    for (int set = 0; set < 2; set++) {
+        for (int i = 0; i < 100; i++) {
+            snprintf(storage[set][i], 16, set == 0 ? "x%d" : "word%04d", i);
+            patterns[i] = storage[set][i];
+        }
+
+        mfrec_t preg;
+        ck_assert(frec_mregcomp(&preg, 100, patterns, 0) == REG_OK);
+        ck_assert(set == 0 ? preg.aho_corasick != NULL : preg.wu_manber != NULL);
+
+        void *blob;
+        size_t len;
+        ck_assert(frec_mserialize(&preg, &blob, &len) == REG_OK);
+
+        mfrec_t loaded;
+        ck_assert(frec_mdeserialize(&loaded, blob, len) == REG_OK);
+        ck_assert(set == 0 ? loaded.aho_corasick != NULL : loaded.wu_manber != NULL);
+        assert_same_matches(&preg, &loaded);
+
+        frec_mregfree(&loaded);
+        free(blob);
+        frec_mregfree(&preg);
+    }
+}
+END_TEST
+
+START_TEST(test_serialize__wide_set)
+{
+    const wchar_t *patterns[2] = {L"needle", L"h.y"};
+
+    mfrec_t preg;
+    ck_assert(frec_mregwcomp(&preg, 2, patterns, 0) == REG_OK);
+
+    void *blob;
+    size_t len;
+    ck_assert(frec_mserialize(&preg, &blob, &len) == REG_OK);
+
+    mfrec_t loaded;
+    ck_assert(frec_mdeserialize(&loaded, blob, len) == REG_OK);
+
+    frec_match_t match;
+    int ret = frec_mregwexec(&loaded, L"a hay needle", 1, &match, 0);
+    ck_assert(ret == REG_OK);
+    ck_assert(match.soffset == 2 && match.eoffset == 5 && match.pattern_id == 1);
+
+    frec_mregfree(&loaded);
+    free(blob);
+    frec_mregfree(&preg);
+}
+END_TEST
+
+START_TEST(test_serialize__read_only_mapping)
+{
+    mfrec_t preg;
+    ck_assert(frec_mregcomp(&preg, 3, inputs[8].patterns, inputs[8].cflags) == REG_OK);
+
+    void *blob;
+    size_t len;
+    ck_assert(frec_mserialize(&preg, &blob, &len) == REG_OK);
+
+    // The blob is loaded from memory that can't be written.
+    void *mapping = mmap(NULL, len, PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    ck_assert(mapping != MAP_FAILED);
+    memcpy(mapping, blob, len);
+    ck_assert(mprotect(mapping, len, PROT_READ) == 0);
+    free(blob);
+
+    mfrec_t loaded;
+    ck_assert(frec_mdeserialize(&loaded, mapping, len) == REG_OK);
+    assert_same_matches(&preg, &loaded);
+
+    frec_mregfree(&loaded);
+    munmap(mapping, len);
+    frec_mregfree(&preg);
+}
+END_TEST
+
+START_TEST(test_serialize__original_compiled_lazily)
+{
+    mfrec_t preg;
+    ck_assert(frec_mregcomp(&preg, 3, inputs[9].patterns, inputs[9].cflags) == REG_OK);
+
+    void *blob;
+    size_t len;
+    ck_assert(frec_mserialize(&preg, &blob, &len) == REG_OK);
+
+    // Loading doesn't compile the automata of the original matcher.
+    mfrec_t loaded;
+    ck_assert(frec_mdeserialize(&loaded, blob, len) == REG_OK);
+    for (ssize_t i = 0; i < loaded.count; i++) {
+        ck_assert(!loaded.patterns[i].has_original);
+    }
+
+    // Only the submatches of the match need one.
+    frec_match_t pmatch[2];
+    ck_assert(frec_mregexec(&loaded, "aab stack zqy", 2, pmatch, 0) == REG_OK);
+    ck_assert(pmatch[0].soffset == 0 && pmatch[0].eoffset == 3);
+    ck_assert(pmatch[0].pattern_id == 1);
+    ck_assert(loaded.patterns[1].has_original);
+    ck_assert(!loaded.patterns[0].has_original);
+    assert_same_matches(&preg, &loaded);
+
+    frec_mregfree(&loaded);
+    free(blob);
+    frec_mregfree(&preg);
+}
+END_TEST
+
+START_TEST(test_serialize__damaged_blobs_rejected)
+{
+    mfrec_t preg;
+    ck_assert(frec_mregcomp(&preg, 3, inputs[7].patterns, 0) == REG_OK);
+
+    void *blob;
+    size_t len;
+    ck_assert(frec_mserialize(&preg, &blob, &len) == REG_OK);
+    unsigned char *bytes = blob;
+
+    mfrec_t loaded;
+    frec_t single;
+
+    // Truncated blobs.
+    ck_assert(frec_mdeserialize(&loaded, blob, len - 8) == REG_BADPAT);
+    ck_assert(frec_mdeserialize(&loaded, blob, 16) == REG_BADPAT);
+
+    // A blob of the other kind.
+    ck_assert(frec_deserialize(&single, blob, len) == REG_BADPAT);
+
+    // Changed bytes, in the header and in the payload.
+    for (size_t at = 0; at < len; at += 7) {
+        bytes[at] ^= 0x20;
+        ck_assert_msg(frec_mdeserialize(&loaded, blob, len) == REG_BADPAT,
+            "Blob with byte '%zu' changed was accepted", at
+        );
+        bytes[at] ^= 0x20;
+    }
+
+    ck_assert(frec_mdeserialize(&loaded, blob, len) == REG_OK);
+    frec_mregfree(&loaded);
+
+    free(blob);
+    frec_mregfree(&preg);
+}
+END_TEST
+
+// Checks that the blob of the set isn't loaded. Its checksum is valid, so
+// the tables themselves have to be checked.
+static void
+assert_rejected(const mfrec_t *preg)
+{
+    void *blob;
+    size_t len;
+    ck_assert(frec_mserialize(preg, &blob, &len) == REG_OK);
+
+    mfrec_t loaded;
+    ck_assert(frec_mdeserialize(&loaded, blob, len) == REG_BADPAT);
+    free(blob);
+}
+
+START_TEST(test_serialize__indices_out_of_range_rejected)
+{
+    static char storage[2][100][16];
+    const char *patterns[100];
+    mfrec_t preg;
+
+    // Teddy buckets, and the ids in them.
+    ck_assert(frec_mregcomp(&preg, 3, inputs[7].patterns, 0) == REG_OK);
+    ck_assert(preg.teddy != NULL);
+    preg.teddy->bucket_ids[0] = 3;
+    assert_rejected(&preg);
+    preg.teddy->bucket_ids[0] = 0;
+    preg.teddy->bucket_start[TEDDY_BUCKETS] = 4;
+    assert_rejected(&preg);
+    frec_mregfree(&preg);
+
+    // Aho-Corasick transitions and links.
+    for (int i = 0; i < 100; i++) {
+        snprintf(storage[0][i], 16, "x%d", i);
+        patterns[i] = storage[0][i];
+    }
+    ck_assert(frec_mregcomp(&preg, 100, patterns, 0) == REG_OK);
+    ac_comp *ac = preg.aho_corasick;
+    ck_assert(ac != NULL);
+    uint32_t last = ac->state_count - 1;
+
+    uint32_t saved = ac->edges[0].target;
+    ac->edges[0].target = ac->state_count;
+    assert_rejected(&preg);
+    ac->edges[0].target = saved;
+
+    saved = ac->fail[last];
+    ac->fail[last] = last;
+    assert_rejected(&preg);
+    ac->fail[last] = saved;
+
+    saved = ac->output[last];
+    ac->output[last] = 100;
+    assert_rejected(&preg);
+    ac->output[last] = saved;
+    frec_mregfree(&preg);
+
+    // Wu-Manber buckets, ids and pattern offsets.
+    for (int i = 0; i < 100; i++) {
+        snprintf(storage[1][i], 16, "word%04d", i);
+        patterns[i] = storage[1][i];
+    }
+    ck_assert(frec_mregcomp(&preg, 100, patterns, 0) == REG_OK);
+    wm_comp *wm = preg.wu_manber;
+    ck_assert(wm != NULL);
+
+    saved = wm->bucket_ids[0];
+    wm->bucket_ids[0] = 100;
+    assert_rejected(&preg);
+    wm->bucket_ids[0] = saved;
+
+    size_t offset = wm->offsets[1];
+    wm->offsets[1] = wm->offsets[2] + 1;
+    assert_rejected(&preg);
+    wm->offsets[1] = offset;
+
+    saved = wm->buckets[1];
+    wm->buckets[1] = 101;
+    assert_rejected(&preg);
+    wm->buckets[1] = saved;
+    frec_mregfree(&preg);
+}
+END_TEST
+
+
+Suite *create_serialize_suite()
+{
+    Suite *suite = suite_create("Serialization");
+
+    TCase *tc_round_trip = tcase_create("Round trip");
+    tcase_add_loop_test(tc_round_trip, loop_test_serialize__single_round_trip, 0, INPUT_LEN);
+    tcase_add_loop_test(tc_round_trip, loop_test_serialize__multi_round_trip, 0, INPUT_LEN);
+    tcase_add_test(tc_round_trip, test_serialize__large_sets);
+    tcase_add_test(tc_round_trip, test_serialize__wide_set);
+    tcase_add_test(tc_round_trip, test_serialize__read_only_mapping);
+    tcase_add_test(tc_round_trip, test_serialize__original_compiled_lazily);
+
+    TCase *tc_invalid = tcase_create("Invalid blobs");
+    tcase_add_test(tc_invalid, test_serialize__damaged_blobs_rejected);
+    tcase_add_test(tc_invalid, test_serialize__indices_out_of_range_rejected);
+
+    suite_add_tcase(suite, tc_round_trip);
+    suite_add_tcase(suite, tc_invalid);
+
+    return suite;
+}
+
+int main(void)
+{
+    Suite *suite = create_serialize_suite();
+    SRunner *runner = srunner_create(suite);
+
+    srunner_run_all(runner, CK_NORMAL);
+    int failed = srunner_ntests_failed(runner);
+    srunner_free(runner);
+
+    return (failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,187 @@
+#include <check.h>
+#include <string.h>
+#include <frec.h>
+
+#define MAX_MATCHES 32
+
+// Collects the reported matches.
+typedef struct collected {
+    frec_match_t matches[MAX_MATCHES];
+    size_t count;
+} collected;
+
+static int
+collect(const frec_match_t *pmatch, size_t nmatch, void *arg)
+{
+    collected *c = arg;
+    if (c->count < MAX_MATCHES) {
+        c->matches[c->count] = pmatch[0];
+    }
+    c->count++;
+    return 0;
+}
+
+// Feeds the text to the stream in chunks of the given size.
+static int
+feed_chunks(frec_stream_t *stream, const char *text, size_t chunk)
+{
+    size_t len = strlen(text);
+    for (size_t pos = 0; pos < len; pos += chunk) {
+        size_t curr = (len - pos < chunk) ? (len - pos) : chunk;
+        int ret = frec_stream_feed(stream, text + pos, curr);
+        ck_assert_msg(ret == REG_OK, "stream_feed returned '%d'", ret);
+    }
+    return frec_stream_close(stream);
+}
+
+static void
+assert_same(
+    const collected *expect, const collected *actual,
+    const char *text, size_t chunk
+) {
+    ck_assert_msg(expect->count == actual->count,
+        "Incorrect match count: expected '%zu', got '%zu' for text '%s' in chunks of %zu",
+        expect->count, actual->count, text, chunk
+    );
+
+    for (size_t i = 0; i < expect->count && i < MAX_MATCHES; i++) {
+        const frec_match_t *e = &expect->matches[i];
+        const frec_match_t *a = &actual->matches[i];
+        ck_assert_msg(
+            e->soffset == a->soffset && e->eoffset == a->eoffset
+                && e->pattern_id == a->pattern_id,
+            "Incorrect match %zu: expected '%zd-%zd' (%zu), got '%zd-%zd' (%zu) for text '%s' in chunks of %zu",
+            i, e->soffset, e->eoffset, e->pattern_id,
+            a->soffset, a->eoffset, a->pattern_id, text, chunk
+        );
+    }
+}
+
+
+typedef struct stream_tuple {
+    const char *patterns[3];
+    size_t pattern_count;
+    int cflags;
+    const char *text;
+} stream_tuple;
+
+#define INPUT_LEN 11
+static stream_tuple inputs[INPUT_LEN] = {
+    // Literals, where the longest match is known:
+    {{"abc"}, 1, 0, "abc xabcx abcabc\nab\nc abc"},
+    {{"^abc"}, 1, REG_NEWLINE, "abc\nabc abc\nxabc\nabc"},
+    {{"abc$"}, 1, REG_NEWLINE, "abc\nabc abc\nabcx\nabc"},
+
+    // Patterns with a bounded length:
+    {{"a[0-9]b"}, 1, 0, "a1b a22b a3b\na4b"},
+
+    // Patterns that can't contain line feeds:
+    {{"a[0-9]+b"}, 1, REG_EXTENDED, "a1b a2222222b\na\n3b a44b"},
+    {{"x.*y"}, 1, REG_NEWLINE, "xy xzzy\nx\ny xaaaaaaaay"},
+
+    // Patterns that need the whole stream:
+    {{"x.*y"}, 1, 0, "xy xzzy\nx\ny xaaaaaaaay"},
+
+    // Literal sets and other pattern sets:
+    {{"cat", "dog", "bird"}, 3, 0, "cat dog\nbirdcat\ncadog"},
+    {{"c[a-z]t", "d.g"}, 2, 0, "cat dig\nct\ncot dxg"},
+    {{"[0-9]+", "x*y"}, 2, REG_EXTENDED | REG_NEWLINE, "12 xxy\n3\nzy 45"},
+    {{"[^a]b", "ca+b"}, 2, REG_EXTENDED, "x\nb caab"}
+};
+
+START_TEST(loop_test_stream__chunks__same_as_whole_text)
+{
+    stream_tuple curr = inputs[_i];
+
+    mfrec_t preg;
+    int ret = frec_mregcomp(&preg, curr.pattern_count, curr.patterns,
+        curr.cflags);
+    ck_assert_msg(ret == REG_OK,
+        "mregcomp failed: returned '%d' for pattern '%s'",
+        ret, curr.patterns[0]
+    );
+
+    collected expect = {0};
+    frec_match_t pmatch;
+    int expect_ret = frec_mregexec_all(&preg, curr.text, 1, &pmatch, 0,
+        collect, &expect);
+    ck_assert(expect.count > 0);
+
+    for (size_t chunk = 1; chunk <= strlen(curr.text); chunk++) {
+        frec_stream_t stream;
+        collected actual = {0};
+
+        frec_mstream_open(&stream, &preg, 0, collect, &actual);
+        ret = feed_chunks(&stream, curr.text, chunk);
+
+        ck_assert(ret == expect_ret);
+        assert_same(&expect, &actual, curr.text, chunk);
+    }
+
+    frec_mregfree(&preg);
+}
+END_TEST
+
+START_TEST(test_stream__single__no_match)
+{
+    frec_t preg;
+    ck_assert(frec_regcomp(&preg, "needle", 0) == REG_OK);
+
+    frec_stream_t stream;
+    collected actual = {0};
+    frec_stream_open(&stream, &preg, 0, collect, &actual);
+
+    int ret = feed_chunks(&stream, "need le\nneedl e", 3);
+    ck_assert(ret == REG_NOMATCH);
+    ck_assert(actual.count == 0);
+
+    frec_regfree(&preg);
+}
+END_TEST
+
+START_TEST(test_stream__single__absolute_offsets)
+{
+    frec_t preg;
+    ck_assert(frec_regcomp(&preg, "needle", 0) == REG_OK);
+
+    frec_stream_t stream;
+    collected actual = {0};
+    frec_stream_open(&stream, &preg, 0, collect, &actual);
+
+    const char *text = "hay needle hay hay needle";
+    int ret = feed_chunks(&stream, text, 4);
+
+    collected expect = { {{4, 10}, {19, 25}}, 2 };
+    ck_assert(ret == REG_OK);
+    assert_same(&expect, &actual, text, 4);
+
+    frec_regfree(&preg);
+}
+END_TEST
+
+
+Suite *create_stream_suite()
+{
+    Suite *suite = suite_create("Streaming");
+
+    TCase *tc_chunks = tcase_create("Chunked input");
+    tcase_add_loop_test(tc_chunks, loop_test_stream__chunks__same_as_whole_text, 0, INPUT_LEN);
+    tcase_add_test(tc_chunks, test_stream__single__no_match);
+    tcase_add_test(tc_chunks, test_stream__single__absolute_offsets);
+
+    suite_add_tcase(suite, tc_chunks);
+
+    return suite;
+}
+
+int main(void)
+{
+    Suite *suite = create_stream_suite();
+    SRunner *runner = srunner_create(suite);
+
+    srunner_run_all(runner, CK_NORMAL);
+    int failed = srunner_ntests_failed(runner);
+    srunner_free(runner);
+
+    return (failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
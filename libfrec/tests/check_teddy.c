@@ -0,0 +1,210 @@
+#include <check.h>
+#include <frec.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "string-type.h"
+#include "teddy-comp.h"
+#include "wm-comp.h"
+
+/*
+ * Runs the Teddy execution phase. Asserts that the preprocessing
+ * succeeded, and returns the final execution return value as well as any
+ * potential matches in the matches input variable.
+ */
+static int
+run_execute(
+    frec_match_t *match,
+    const char **patterns, ssize_t count, const char *text, int flags
+) {
+    teddy_comp comp;
+
+    string *strs = malloc(sizeof(string) * count);
+
+    for (int i = 0; i < count; i++) {
+        const char *pattern = patterns[i];
+        string_borrow(&strs[i], pattern, (ssize_t) strlen(pattern), false);
+    }
+
+    int ret = teddy_compile(&comp, strs, count, flags);
+    ck_assert_msg(ret == REG_OK,
+                  "Execute failed because preprocessing failed: returned '%d'",
+                  ret
+    );
+
+    string txt;
+    string_borrow(&txt, text, (ssize_t) strlen(text), false);
+
+    ret = teddy_execute(match, &comp, txt, 0);
+
+    teddy_comp_free(&comp);
+    free(strs);
+    return ret;
+}
+
+typedef struct exec_tuple {
+    const char *patterns[5];
+    ssize_t count;
+    const char *text;
+    int flags;
+    int expected_ret;
+    frec_match_t expected;
+} exec_tuple;
+
+#define EXEC_LEN 13
+static exec_tuple exec_inputs[EXEC_LEN] = {
+    // Short texts
+    {{"alpha", "beta"}, 2, "alpha beta", 0, REG_OK, {0, 5, 0}},
+    {{"beta", "delta"}, 2, "alpha beta", 0, REG_OK, {6, 10, 0}},
+    {{"a", "bc"}, 2, "xxbca", 0, REG_OK, {2, 4, 1}},
+    {{"abcd", "ab"}, 2, "xxabcd", 0, REG_OK, {2, 6, 0}},
+    {{"ab", "abcd"}, 2, "xxabcd", 0, REG_OK, {2, 4, 0}},
+    // Longer texts, matches in the vectorized part and at the end
+    {{"needle", "pin"}, 2,
+        "a long haystack with lots of hay in it, but only one needle here",
+        0, REG_OK, {53, 59, 0}},
+    {{"needle", "pin"}, 2,
+        "a long haystack with lots of hay in it, and a pin at the end: pin",
+        0, REG_OK, {46, 49, 1}},
+    {{"end", "xyz"}, 2,
+        "the match is not in the vectorized part of the text, only at the end",
+        0, REG_OK, {65, 68, 0}},
+    // Case insensitive matching
+    {{"Needle", "pin"}, 2,
+        "a long haystack with lots of hay in it, and one NEEDLE in the middle",
+        REG_ICASE, REG_OK, {48, 54, 0}},
+    {{"x[y]", "PIN"}, 2, "the Pin and x[Y]", REG_ICASE, REG_OK, {4, 7, 1}},
+    // Failures
+    {{"needle", "pin"}, 2,
+        "a long haystack with lots of hay in it, but no needl or pi at all",
+        0, REG_NOMATCH, {0, 0, 0}},
+    {{"abc", "abd"}, 2, "ab", 0, REG_NOMATCH, {0, 0, 0}},
+    {{"Needle"}, 1,
+        "a long haystack with lots of hay in it, and one NEEDLE in the middle",
+        0, REG_NOMATCH, {0, 0, 0}},
+};
+
+START_TEST(loop_test_teddy__inputs__exec_ok)
+{
+    exec_tuple curr = exec_inputs[_i];
+
+    frec_match_t match;
+    int ret = run_execute(&match, curr.patterns, curr.count,
+        curr.text, curr.flags);
+
+    ck_assert_msg(ret == curr.expected_ret,
+        "Execution returned '%d' instead of '%d' for text '%s'",
+        ret, curr.expected_ret, curr.text
+    );
+
+    if (ret == REG_OK) {
+        ck_assert_msg(match.soffset == curr.expected.soffset
+            && match.eoffset == curr.expected.eoffset
+            && match.pattern_id == curr.expected.pattern_id,
+            "Execution returned match (%ld, %ld, %zu) instead of (%ld, %ld, %zu) for text '%s'",
+            match.soffset, match.eoffset, match.pattern_id,
+            curr.expected.soffset, curr.expected.eoffset,
+            curr.expected.pattern_id, curr.text
+        );
+    }
+}
+END_TEST
+
+/*
+ * Compiles the same generated pattern set with both Teddy and Wu-Manber,
+ * and checks that both find the same matches in a generated text. The
+ * loop index selects the number of patterns, which also decides whether
+ * eight or sixteen buckets are used.
+ */
+#define GEN_LEN 4
+static ssize_t gen_counts[GEN_LEN] = {2, 9, 33, 64};
+
+START_TEST(loop_test_teddy__generated__same_as_wm)
+{
+    ssize_t count = gen_counts[_i];
+    unsigned int seed = 1;
+
+    char *buffer = malloc(count * 8);
+    string *strs = malloc(sizeof(string) * count);
+    for (ssize_t i = 0; i < count; i++) {
+        char *curr = &buffer[i * 8];
+        ssize_t len = 2 + i % 4;
+        for (ssize_t j = 0; j < len; j++) {
+            seed = seed * 1103515245 + 12345;
+            curr[j] = (char) ('a' + (seed >> 16) % 6);
+        }
+        string_borrow(&strs[i], curr, len, false);
+    }
+
+    teddy_comp teddy;
+    wm_comp wm;
+    ck_assert(teddy_compile(&teddy, strs, count, 0) == REG_OK);
+    ck_assert(wm_compile(&wm, strs, count, 0) == REG_OK);
+
+    char text[4097];
+    for (int j = 0; j < 4096; j++) {
+        seed = seed * 1103515245 + 12345;
+        text[j] = (char) ('a' + (seed >> 16) % 8);
+    }
+    text[4096] = '\0';
+
+    string txt;
+    string_borrow(&txt, text, 4096, false);
+
+    // Find every match one after the other.
+    while (txt.len > 0) {
+        frec_match_t teddy_match, wm_match;
+        int teddy_ret = teddy_execute(&teddy_match, &teddy, txt, 0);
+        int wm_ret = wm_execute(&wm_match, &wm, txt, 0);
+
+        ck_assert_msg(teddy_ret == wm_ret,
+            "Teddy returned '%d', Wu-Manber '%d'", teddy_ret, wm_ret
+        );
+        if (teddy_ret != REG_OK) {
+            break;
+        }
+
+        ck_assert_msg(teddy_match.soffset == wm_match.soffset
+            && teddy_match.eoffset == wm_match.eoffset
+            && teddy_match.pattern_id == wm_match.pattern_id,
+            "Teddy returned (%ld, %ld, %zu), Wu-Manber (%ld, %ld, %zu)",
+            teddy_match.soffset, teddy_match.eoffset, teddy_match.pattern_id,
+            wm_match.soffset, wm_match.eoffset, wm_match.pattern_id
+        );
+        string_offset(&txt, teddy_match.soffset + 1);
+    }
+
+    teddy_comp_free(&teddy);
+    wm_comp_free(&wm);
+    free(strs);
+    free(buffer);
+}
+END_TEST
+
+static Suite *
+create_suite()
+{
+    Suite *suite = suite_create("Teddy");
+
+    TCase *tc_exec = tcase_create("Execution");
+
+    tcase_add_loop_test(tc_exec, loop_test_teddy__inputs__exec_ok, 0, EXEC_LEN);
+    tcase_add_loop_test(tc_exec, loop_test_teddy__generated__same_as_wm, 0, GEN_LEN);
+
+    suite_add_tcase(suite, tc_exec);
+
+    return suite;
+}
+
+int
+main(void)
+{
+    Suite *suite = create_suite();
+    SRunner *runner = srunner_create(suite);
+
+    srunner_run_all(runner, CK_NORMAL);
+    int failed = srunner_ntests_failed(runner);
+    srunner_free(runner);
+
+    return (failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,452 @@
+#include <check.h>
+#include <frec.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "bm-type.h"
+#include "compile.h"
+#include "wm-type.h"
+
+#define THREAD_COUNT 8
+#define ROUNDS 20
+#define LINE_COUNT 64
+#define LINE_LEN 80
+
+typedef struct thread_tuple {
+    const char *patterns[4];
+    size_t count;
+    int cflags;
+} thread_tuple;
+
+// Pattern sets exercising each matcher: literals, heuristics, the lazy DFA,
+// the original matcher, and the multi-pattern engines.
+#define INPUT_LEN 8
+static thread_tuple inputs[INPUT_LEN] = {
+    {{"needle"}, 1, 0},
+    {{"ne+dle[0-9]"}, 1, REG_EXTENDED},
+    {{"[0-9]+x"}, 1, REG_EXTENDED},
+    {{"\\([a-z]\\)\\1"}, 1, 0},
+    {{"needle", "hay", "stack"}, 3, 0},
+    {{"ne+dle[0-9]", "h[a-z]y", "st.ck"}, 3, REG_EXTENDED},
+    {{"[0-9]+x", "[a-c]{3}", "(q|z)+y"}, 3, REG_EXTENDED},
+    {{"[0-9]+x", "needle"}, 2, REG_EXTENDED | REG_NOSUB}
+};
+
+static char lines[LINE_COUNT][LINE_LEN + 1];
+
+typedef struct expected_match {
+    int ret;
+    frec_match_t match;
+} expected_match;
+
+typedef struct worker {
+    const mfrec_t *preg;
+    const expected_match *expected;
+    bool nosub;
+    bool use_scratch;
+    int errors;
+} worker;
+
+// Fills the lines with pseudo-random text, deterministically.
+static void
+generate_lines(void)
+{
+    const char *words[] = {"needle", "neeedle7", "hay", "hey", "stack",
+        "stick", "12x", "aab", "abc", "zqy", "xx", "  ", "9"};
+    unsigned int seed = 12345;
+
+    for (int i = 0; i < LINE_COUNT; i++) {
+        size_t len = 0;
+        while (true) {
+            seed = seed * 1103515245 + 12345;
+            const char *word = words[(seed >> 16) % 13];
+            if (len + strlen(word) > LINE_LEN) {
+                break;
+            }
+            memcpy(lines[i] + len, word, strlen(word));
+            len += strlen(word);
+        }
+        lines[i][len] = '\0';
+    }
+}
+
+static int
+match_line(const mfrec_t *preg, const char *line, frec_match_t *match,
+    frec_scratch_t *scratch)
+{
+    return (scratch == NULL)
+        ? frec_mregexec(preg, line, 1, match, 0)
+        : frec_mregexec_r(preg, line, 1, match, 0, scratch);
+}
+
+static void *
+run_worker(void *arg)
+{
+    worker *w = arg;
+
+    frec_scratch_t storage;
+    frec_scratch_t *scratch = NULL;
+    if (w->use_scratch) {
+        frec_scratch_init(&storage);
+        scratch = &storage;
+    }
+
+    for (int round = 0; round < ROUNDS; round++) {
+        for (int i = 0; i < LINE_COUNT; i++) {
+            frec_match_t match;
+            int ret = match_line(w->preg, lines[i], &match, scratch);
+
+            const expected_match *exp = &w->expected[i];
+            if (ret != exp->ret || (ret == REG_OK && !w->nosub
+                && (match.soffset != exp->match.soffset
+                    || match.eoffset != exp->match.eoffset
+                    || match.pattern_id != exp->match.pattern_id))) {
+                w->errors++;
+            }
+        }
+    }
+
+    if (scratch != NULL) {
+        frec_scratch_free(scratch);
+    }
+    return NULL;
+}
+
+START_TEST(loop_test_threads__shared_pattern_set)
+{
+    thread_tuple curr = inputs[_i];
+    generate_lines();
+
+    mfrec_t preg;
+    int ret = frec_mregcomp(&preg, curr.count, curr.patterns, curr.cflags);
+    ck_assert_msg(ret == REG_OK,
+        "mregcomp failed: returned '%d' for pattern '%s'",
+        ret, curr.patterns[0]
+    );
+
+    // Compute the expected results on a single thread first.
+    expected_match expected[LINE_COUNT];
+    for (int i = 0; i < LINE_COUNT; i++) {
+        expected[i].ret = match_line(&preg, lines[i], &expected[i].match, NULL);
+        ck_assert(expected[i].ret == REG_OK || expected[i].ret == REG_NOMATCH);
+    }
+
+    // Then match the same lines with every thread at the same time.
+    pthread_t threads[THREAD_COUNT];
+    worker workers[THREAD_COUNT];
+    for (int t = 0; t < THREAD_COUNT; t++) {
+        workers[t].preg = &preg;
+        workers[t].expected = expected;
+        workers[t].nosub = curr.cflags & REG_NOSUB;
+        workers[t].use_scratch = (t % 2 == 0);
+        workers[t].errors = 0;
+        ck_assert(pthread_create(&threads[t], NULL, run_worker, &workers[t]) == 0);
+    }
+
+    for (int t = 0; t < THREAD_COUNT; t++) {
+        ck_assert(pthread_join(threads[t], NULL) == 0);
+        ck_assert_msg(workers[t].errors == 0,
+            "Thread %d got %d incorrect results for pattern '%s'",
+            t, workers[t].errors, curr.patterns[0]
+        );
+    }
+
+    frec_mregfree(&preg);
+}
+END_TEST
+
+static void *
+run_lazy_worker(void *arg)
+{
+    worker *w = arg;
+
+    // Threads that need the original matcher of a literal pattern at the
+    // same time compile it only once.
+    if (frec_compile_original(&w->preg->patterns[0]) != REG_OK) {
+        w->errors++;
+    }
+
+    frec_match_t match;
+    if (frec_mregexec(w->preg, "a needle", 1, &match, 0) != REG_OK
+        || match.soffset != 2 || match.eoffset != 8) {
+        w->errors++;
+    }
+    return NULL;
+}
+
+START_TEST(test_threads__deferred_compilation)
+{
+    const char *patterns[1] = {"needle"};
+    mfrec_t preg;
+    ck_assert(frec_mregcomp(&preg, 1, patterns, 0) == REG_OK);
+    ck_assert(!preg.patterns[0].has_original);
+
+    pthread_t threads[THREAD_COUNT];
+    worker workers[THREAD_COUNT];
+    for (int t = 0; t < THREAD_COUNT; t++) {
+        workers[t].preg = &preg;
+        workers[t].errors = 0;
+        ck_assert(pthread_create(&threads[t], NULL, run_lazy_worker, &workers[t]) == 0);
+    }
+
+    for (int t = 0; t < THREAD_COUNT; t++) {
+        ck_assert(pthread_join(threads[t], NULL) == 0);
+        ck_assert(workers[t].errors == 0);
+    }
+    ck_assert(preg.patterns[0].has_original);
+
+    frec_mregfree(&preg);
+}
+END_TEST
+
+#define SET_LEN 20000
+static char set_storage[SET_LEN][16];
+static const char *set_patterns[SET_LEN];
+
+// Fills the large pattern set, with invalid patterns at the given indices.
+static void
+generate_set(ssize_t bad_a, ssize_t bad_b)
+{
+    for (ssize_t i = 0; i < SET_LEN; i++) {
+        if (i == bad_a || i == bad_b) {
+            snprintf(set_storage[i], 16, "w[%zd", i);
+        } else {
+            snprintf(set_storage[i], 16, "w%05zd-%05zd", i * 7919 % SET_LEN, i);
+        }
+        set_patterns[i] = set_storage[i];
+    }
+}
+
+START_TEST(test_threads__parallel_compilation_same_tables)
+{
+    generate_set(-1, -1);
+
+    mfrec_t sequential;
+    frec_set_compile_threads(1);
+    ck_assert(frec_mregcomp(&sequential, SET_LEN, set_patterns, 0) == REG_OK);
+
+    mfrec_t parallel;
+    frec_set_compile_threads(4);
+    ck_assert(frec_mregcomp(&parallel, SET_LEN, set_patterns, 0) == REG_OK);
+    frec_set_compile_threads(1);
+
+    const wm_comp *a = sequential.wu_manber;
+    const wm_comp *b = parallel.wu_manber;
+    ck_assert(a != NULL && b != NULL);
+    ck_assert(a->table_mask == b->table_mask && a->shift_def == b->shift_def);
+
+    size_t table_size = a->table_mask + 1;
+    ck_assert(memcmp(a->shift, b->shift, sizeof(uint16_t) * table_size) == 0);
+    ck_assert(memcmp(a->buckets, b->buckets, sizeof(uint32_t) * (table_size + 1)) == 0);
+    ck_assert(memcmp(a->bucket_ids, b->bucket_ids, sizeof(uint32_t) * SET_LEN) == 0);
+    ck_assert(memcmp(a->bucket_prefix, b->bucket_prefix, sizeof(uint32_t) * SET_LEN) == 0);
+
+    for (ssize_t i = 0; i < SET_LEN; i += 997) {
+        frec_match_t expected;
+        frec_match_t actual;
+        ck_assert(frec_mregexec(&sequential, set_patterns[i], 1, &expected, 0) == REG_OK);
+        ck_assert(frec_mregexec(&parallel, set_patterns[i], 1, &actual, 0) == REG_OK);
+        ck_assert(actual.pattern_id == expected.pattern_id);
+    }
+
+    frec_mregfree(&parallel);
+    frec_mregfree(&sequential);
+}
+END_TEST
+
+START_TEST(test_threads__parallel_compilation_first_error)
+{
+    // The first invalid pattern is reported, wherever the threads are.
+    generate_set(SET_LEN / 3, SET_LEN / 5);
+
+    for (int threads = 1; threads <= 8; threads *= 2) {
+        frec_set_compile_threads(threads);
+
+        mfrec_t preg;
+        int ret = frec_mregcomp(&preg, SET_LEN, set_patterns, 0);
+        ck_assert(ret == REG_EBRACK);
+
+        int errpatn;
+        char buf[64];
+        frec_mregerror(ret, &preg, &errpatn, buf, sizeof(buf));
+        ck_assert_msg(errpatn == SET_LEN / 5,
+            "Expected the error at '%d', got '%d' with %d threads",
+            SET_LEN / 5, errpatn, threads
+        );
+    }
+    frec_set_compile_threads(1);
+}
+END_TEST
+
+// Two samples in which different characters of the pattern below are the
+// rarest ones.
+static const char *freq_samples[2] = {
+    "qzth qzth qzthqzth qz th qzth",
+    "zthe zthe zthezthe zt he zthe"
+};
+
+typedef struct freq_worker {
+    ssize_t expected[2][2]; // The rare offsets with each sample.
+    unsigned int expected_score[2]; // The score of the fragment.
+    int errors;
+} freq_worker;
+
+// The fragment of this pattern is also scored by its byte pairs.
+#define FREQ_PATTERN "x*zthe"
+
+// Sets of this many copies of the pattern are compiled on several threads.
+#define FREQ_SET_LEN 256
+
+// Asserts that the rare offsets are the ones expected with a sample.
+static bool
+expected_offsets(const freq_worker *w, const ssize_t *offsets)
+{
+    bool found = false;
+    for (int k = 0; k < 2; k++) {
+        found |= offsets[0] == w->expected[k][0]
+            && offsets[1] == w->expected[k][1];
+    }
+    return found;
+}
+
+// Asserts that every pattern of the set was compiled with the same model.
+static bool
+compile_freq_set(const freq_worker *w)
+{
+    const char *patterns[FREQ_SET_LEN];
+    for (int i = 0; i < FREQ_SET_LEN; i++) {
+        patterns[i] = "qzthe";
+    }
+
+    mfrec_t preg;
+    if (frec_mregcomp(&preg, FREQ_SET_LEN, patterns, 0) != REG_OK) {
+        return false;
+    }
+
+    const ssize_t *first = preg.patterns[0].boyer_moore->rare_offsets;
+    bool same = expected_offsets(w, first);
+    for (int i = 1; i < FREQ_SET_LEN; i++) {
+        const ssize_t *offsets = preg.patterns[i].boyer_moore->rare_offsets;
+        same &= offsets[0] == first[0] && offsets[1] == first[1];
+    }
+
+    frec_mregfree(&preg);
+    return same;
+}
+
+
+static void *
+run_freq_worker(void *arg)
+{
+    freq_worker *w = arg;
+
+    for (int i = 0; i < ROUNDS * 10; i++) {
+        frec_t preg;
+        if (frec_regcomp(&preg, "qzthe", 0) != REG_OK) {
+            w->errors++;
+            continue;
+        }
+
+        if (!expected_offsets(w, preg.boyer_moore->rare_offsets)) {
+            w->errors++;
+        }
+        frec_regfree(&preg);
+
+        if (i % 20 == 0 && !compile_freq_set(w)) {
+            w->errors++;
+        }
+
+        unsigned int score;
+        if (frec_regcomp(&preg, FREQ_PATTERN, REG_NEWLINE) != REG_OK) {
+            w->errors++;
+            continue;
+        }
+        if (frec_literal_score(&preg, &score) != REG_OK
+            || (score != w->expected_score[0] && score != w->expected_score[1])) {
+            w->errors++;
+        }
+        frec_regfree(&preg);
+    }
+    return NULL;
+}
+
+START_TEST(test_threads__training_during_compilation)
+{
+    freq_worker workers[THREAD_COUNT];
+    for (int k = 0; k < 2; k++) {
+        frec_train_byte_freq(freq_samples[k], strlen(freq_samples[k]));
+        frec_t preg;
+        ck_assert(frec_regcomp(&preg, "qzthe", 0) == REG_OK);
+        for (int t = 0; t < THREAD_COUNT; t++) {
+            workers[t].expected[k][0] = preg.boyer_moore->rare_offsets[0];
+            workers[t].expected[k][1] = preg.boyer_moore->rare_offsets[1];
+        }
+        frec_regfree(&preg);
+
+        unsigned int score;
+        ck_assert(frec_regcomp(&preg, FREQ_PATTERN, REG_NEWLINE) == REG_OK);
+        ck_assert(frec_literal_score(&preg, &score) == REG_OK);
+        for (int t = 0; t < THREAD_COUNT; t++) {
+            workers[t].expected_score[k] = score;
+        }
+        frec_regfree(&preg);
+    }
+    ck_assert(workers[0].expected[0][0] != workers[0].expected[1][0]);
+    ck_assert(workers[0].expected_score[0] != workers[0].expected_score[1]);
+
+    // Every compilation sees one of the two models as a whole, even the
+    // ones of sets compiled on several threads.
+    frec_set_compile_threads(4);
+    pthread_t threads[THREAD_COUNT];
+    for (int t = 0; t < THREAD_COUNT; t++) {
+        workers[t].errors = 0;
+        ck_assert(pthread_create(&threads[t], NULL, run_freq_worker, &workers[t]) == 0);
+    }
+    for (int i = 0; i < ROUNDS * 10; i++) {
+        const char *sample = freq_samples[i % 2];
+        frec_train_byte_freq(sample, strlen(sample));
+    }
+
+    for (int t = 0; t < THREAD_COUNT; t++) {
+        ck_assert(pthread_join(threads[t], NULL) == 0);
+        ck_assert(workers[t].errors == 0);
+    }
+    frec_set_compile_threads(1);
+    frec_train_byte_freq(NULL, 0);
+}
+END_TEST
+
+
+Suite *create_threads_suite()
+{
+    Suite *suite = suite_create("Concurrent matching");
+
+    TCase *tc_shared = tcase_create("Shared patterns");
+    tcase_add_loop_test(tc_shared, loop_test_threads__shared_pattern_set, 0, INPUT_LEN);
+    tcase_add_test(tc_shared, test_threads__deferred_compilation);
+    tcase_set_timeout(tc_shared, 60);
+
+    TCase *tc_compile = tcase_create("Parallel compilation");
+    tcase_add_test(tc_compile, test_threads__parallel_compilation_same_tables);
+    tcase_add_test(tc_compile, test_threads__parallel_compilation_first_error);
+    tcase_add_test(tc_compile, test_threads__training_during_compilation);
+    tcase_set_timeout(tc_compile, 60);
+
+    suite_add_tcase(suite, tc_shared);
+    suite_add_tcase(suite, tc_compile);
+
+    return suite;
+}
+
+int main(void)
+{
+    Suite *suite = create_threads_suite();
+    SRunner *runner = srunner_create(suite);
+
+    srunner_run_all(runner, CK_NORMAL);
+    int failed = srunner_ntests_failed(runner);
+    srunner_free(runner);
+
+    return (failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
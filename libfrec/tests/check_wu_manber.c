@@ -1,6 +1,8 @@
 #include <check.h>
 #include <frec.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include "wm-comp.h"
 #include "string-type.h"
 
@@ -94,6 +96,82 @@ START_TEST(loop_test_wm__successes__single_exec_succeeds)
     }
 END_TEST
 
+/*
+ * Generates count patterns from the given format and an index, and runs
+ * the execution phase with them. The patterns are freed afterwards.
+ */
+static int
+run_execute_generated(
+    frec_match_t *match, const char *format, ssize_t count, const char *text
+) {
+    char **patterns = malloc(sizeof(char *) * count);
+    for (ssize_t i = 0; i < count; i++) {
+        patterns[i] = malloc(32);
+        snprintf(patterns[i], 32, format, (int) i);
+    }
+
+    int ret = run_execute(match, (const char **) patterns, count, text);
+
+    for (ssize_t i = 0; i < count; i++) {
+        free(patterns[i]);
+    }
+    free(patterns);
+    return ret;
+}
+
+typedef struct gen_tuple {
+    const char *format;
+    ssize_t count;
+    const char *text;
+    int expected_ret;
+    frec_match_t expected;
+} gen_tuple;
+
+#define GEN_LEN 10
+static gen_tuple gen_inputs[GEN_LEN] = {
+    // Hundreds of patterns sharing the same blocks.
+    {"pat%03d", 300, "text with a pat271 in it", REG_OK, {12, 18, 271}},
+    {"pat%03d", 300, "text with a pat27 only", REG_NOMATCH, {0, 0, 0}},
+    // Enough patterns to use three character blocks.
+    {"key%05d", 3000, "the key02999 and key00001", REG_OK, {4, 12, 2999}},
+    {"key%05d", 3000, "the key0299 and key0001", REG_NOMATCH, {0, 0, 0}},
+    // Single character blocks.
+    {"%d", 10, "only letters and then 7", REG_OK, {22, 23, 7}},
+    {"%d", 10, "only letters", REG_NOMATCH, {0, 0, 0}},
+    // Far more than 64 patterns in the same bucket, and ids over 65535.
+    {"%06dx", 100000, "id 099999x and 000001x", REG_OK, {3, 10, 99999}},
+    {"%06dx", 100000, "id 99999x and 0001x", REG_NOMATCH, {0, 0, 0}},
+    {"host-%06d.example", 300000, "see host-271828.example",
+        REG_OK, {4, 23, 271828}},
+    {"host-%06d.example", 300000, "see host-271828.exampl",
+        REG_NOMATCH, {0, 0, 0}},
+};
+
+START_TEST(loop_test_wm__generated__exec_ok)
+{
+    gen_tuple curr = gen_inputs[_i];
+
+    frec_match_t match;
+    int ret = run_execute_generated(&match, curr.format, curr.count, curr.text);
+
+    ck_assert_msg(ret == curr.expected_ret,
+        "Execution returned '%d' instead of '%d' for text '%s'",
+        ret, curr.expected_ret, curr.text
+    );
+
+    if (ret == REG_OK) {
+        ck_assert_msg(match.soffset == curr.expected.soffset
+            && match.eoffset == curr.expected.eoffset
+            && match.pattern_id == curr.expected.pattern_id,
+            "Execution returned match (%ld, %ld, %zu) instead of (%ld, %ld, %zu) for text '%s'",
+            match.soffset, match.eoffset, match.pattern_id,
+            curr.expected.soffset, curr.expected.eoffset,
+            curr.expected.pattern_id, curr.text
+        );
+    }
+}
+END_TEST
+
 static Suite *
 create_suite()
 {
@@ -102,6 +180,7 @@ create_suite()
     TCase *tc_exec = tcase_create("Execution");
 
     tcase_add_loop_test(tc_exec, loop_test_wm__successes__single_exec_succeeds, 0, EXEC_SUCC_LEN);
+    tcase_add_loop_test(tc_exec, loop_test_wm__generated__exec_ok, 0, GEN_LEN);
 
     suite_add_tcase(suite, tc_exec);
 